@@ -4,24 +4,91 @@
 // Date: 01/30/2015
 
 #include "viterbi.h"
+#include "viterbi_acs.h"
+#include "viterbi_acs_simd.h"
+#include "viterbi_bits.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 namespace {
 
-int HammingDistance(const std::string& x, const std::string& y) {
-  assert(x.size() == y.size());
-  int distance = 0;
-  for (int i = 0; i < x.size(); i++) {
-    distance += x[i] != y[i];
+// Cost of receiving soft symbol x when the transmitted bit is "0" and "1".
+// Agreeing with the sign of x is free; disagreeing costs its magnitude. For
+// hard symbols (+1 or -1) this is the Hamming distance.
+inline int SymbolCost0(int x) { return x < 0 ? -x : 0; }
+inline int SymbolCost1(int x) { return x > 0 ? x : 0; }
+
+// Received hard bits, packed by PackBits(). Missing trailing bits are "0".
+class PackedSymbols {
+ public:
+  PackedSymbols(const uint64_t* words, size_t size)
+      : words_(words), size_(size) {}
+
+  void GetCosts(size_t i, int* cost0, int* cost1) const {
+    const int bit = i < size_ ? GetBit(words_, i) : 0;
+    *cost0 = bit;
+    *cost1 = 1 - bit;
+  }
+
+ private:
+  const uint64_t* words_;
+  const size_t size_;
+};
+
+// Received hard bits, '0' or '1', unpacked. Missing trailing bits are "0".
+class HardBits {
+ public:
+  HardBits(const char* bits, size_t size) : bits_(bits), size_(size) {}
+
+  void GetCosts(size_t i, int* cost0, int* cost1) const {
+    assert(i >= size_ || bits_[i] == '0' || bits_[i] == '1');
+    const int bit = i < size_ && bits_[i] == '1';
+    *cost0 = bit;
+    *cost1 = 1 - bit;
   }
-  return distance;
+
+ private:
+  const char* bits_;
+  const size_t size_;
+};
+
+// Received soft symbols. Missing trailing symbols are erasures.
+template <typename T>
+class SoftSymbols {
+ public:
+  SoftSymbols(const T* symbols, size_t size) : symbols_(symbols), size_(size) {}
+
+  void GetCosts(size_t i, int* cost0, int* cost1) const {
+    const int x = i < size_ ? symbols_[i] : 0;
+    *cost0 = SymbolCost0(x);
+    *cost1 = SymbolCost1(x);
+  }
+
+ private:
+  const T* symbols_;
+  const size_t size_;
+};
+
+// Hard decision on received symbol i: 1 if "1" is likelier, 0 if "0" is, or
+// -1 for an erasure.
+template <typename Symbols>
+int HardDecision(const Symbols& symbols, size_t i) {
+  int cost0;
+  int cost1;
+  symbols.GetCosts(i, &cost0, &cost1);
+  return cost0 == cost1 ? -1 : cost0 > cost1;
 }
 
 }  // namespace
@@ -47,146 +114,876 @@ int ReverseBits(int num_bits, int input) {
   return output;
 }
 
-ViterbiCodec::ViterbiCodec(int constraint, const std::vector<int>& polynomials)
-    : constraint_(constraint), polynomials_(polynomials) {
-  assert(!polynomials_.empty());
-  for (int i = 0; i < polynomials_.size(); i++) {
-    assert(polynomials_[i] > 0);
-    assert(polynomials_[i] < (1 << constraint_));
-  }
-  InitializeOutputs();
+const int ViterbiCodec::kUnreachableMetric;
+const int ViterbiCodec::kRenormalizeThreshold;
+
+ViterbiCodec::ViterbiCodec(int constraint,
+                           const std::vector<int>& polynomials,
+                           const ViterbiOptions& options)
+    : ViterbiCodec(ConvolutionalCode::Get(constraint, polynomials), options) {}
+
+ViterbiCodec::ViterbiCodec(std::shared_ptr<const ConvolutionalCode> code,
+                           const ViterbiOptions& options)
+    : constraint_(code->constraint()),
+      polynomials_(code->polynomials()),
+      options_(options),
+      memory_resource_(options.memory_resource != NULL
+                           ? options.memory_resource
+                           : std::pmr::get_default_resource()),
+      code_(code),
+      outputs_(code->outputs_),
+      output_words_(code->output_words_),
+      branch_outputs_(code->branch_outputs_),
+      num_branch_outputs_(code->num_branch_outputs_),
+      branch0_(code->branch0_),
+      branch1_(code->branch1_),
+      simd_masks16_(code->simd_masks16_),
+      simd_masks32_(code->simd_masks32_),
+      num_simd_mask_sets_(code->num_simd_mask_sets_) {
+  assert(constraint_ >= 2);
+  LoadTuning();
 }
 
 int ViterbiCodec::num_parity_bits() const {
   return polynomials_.size();
 }
 
-int ViterbiCodec::NextState(int current_state, int input) const {
-  return (current_state >> 1) | (input << (constraint_ - 2));
+bool ViterbiCodec::transparent() const {
+  for (int i = 0; i < polynomials_.size(); i++) {
+    if (__builtin_popcount(polynomials_[i]) % 2 == 0) {
+      return false;
+    }
+  }
+  return true;
 }
 
-std::string ViterbiCodec::Output(int current_state, int input) const {
-  return outputs_.at(current_state | (input << (constraint_ - 1)));
+int ViterbiCodec::NextState(int current_state, int input) const {
+  return (current_state >> 1) | (input << (constraint_ - 2));
 }
 
 std::string ViterbiCodec::Encode(const std::string& bits) const {
+  std::vector<uint64_t> words(NumBitWords(bits.size()));
+  const bool valid = PackBits(bits.data(), bits.size(), words.data());
+  assert(valid);
+
+  const int n = num_parity_bits();
   std::string encoded;
+  encoded.reserve((bits.size() + constraint_ - 1) * n);
   int state = 0;
 
   // Encode the message bits.
   for (int i = 0; i < bits.size(); i++) {
-    char c = bits[i];
-    assert(c == '0' || c == '1');
-    int input = c - '0';
-    encoded += Output(state, input);
+    int input = GetBit(words.data(), i);
+    encoded.append(
+        &outputs_[(size_t) (state | (input << (constraint_ - 1))) * n], n);
     state = NextState(state, input);
   }
 
   // Encode (constaint_ - 1) flushing bits.
   for (int i = 0; i < constraint_ - 1; i++) {
-    encoded += Output(state, 0);
+    encoded.append(&outputs_[(size_t) state * n], n);
     state = NextState(state, 0);
   }
 
   return encoded;
 }
 
-void ViterbiCodec::InitializeOutputs() {
-  outputs_.resize(1 << constraint_);
-  for (int i = 0; i < outputs_.size(); i++) {
-    for (int j = 0; j < num_parity_bits(); j++) {
-      // Reverse polynomial bits to make the convolution code simpler.
-      int polynomial = ReverseBits(constraint_, polynomials_[j]);
-      int input = i;
-      int output = 0;
-      for (int k = 0; k < constraint_; k++) {
-        output ^= (input & 1) & (polynomial & 1);
-        polynomial >>= 1;
-        input >>= 1;
+void ViterbiCodec::LoadTuning() {
+  const std::string path =
+      options_.tuning_file.empty() ? DefaultTuningFile() : options_.tuning_file;
+  if (path.empty()) {
+    return;
+  }
+  // Tuning is advisory: without a usable file, the built-in rules apply.
+  const std::shared_ptr<const std::vector<ViterbiTuning> > entries =
+      LoadTuningFile(path);
+  if (!entries) {
+    return;
+  }
+  static const std::string cpu = TuningCpuName();
+  for (int i = 0; i < entries->size(); i++) {
+    const ViterbiTuning& entry = (*entries)[i];
+    if (entry.cpu == cpu && entry.constraint == constraint_ &&
+        entry.polynomials == polynomials_) {
+      tuning_.push_back(entry);
+    }
+  }
+}
+
+bool ViterbiCodec::SupportsEngine(const AcsConfig& config) const {
+  if (config.metric_bits != 16 && config.metric_bits != 32) {
+    return false;
+  }
+  if (config.engine == kScalarEngine) {
+    return config.metric_bits == 32;
+  }
+  if (config.engine == kAutoEngine || num_simd_mask_sets_ == 0) {
+    return false;
+  }
+  const int lanes = EngineLanes(config.engine, config.metric_bits);
+  return lanes > 0 && num_states() >= 2 * lanes;
+}
+
+AcsConfig ViterbiCodec::ChooseEngine(SymbolType type,
+                                     size_t num_symbols) const {
+  if (options_.engine == kAutoEngine && options_.metric_bits == 0) {
+    const ViterbiTuning* tuning = FindTuning(tuning_, type, num_symbols);
+    if (tuning != NULL && SupportsEngine(tuning->acs)) {
+      return tuning->acs;
+    }
+  }
+
+  static const ViterbiEngine kEngines[] = {kAvx2Engine, kSse2Engine,
+                                           kScalarEngine};
+  static const int kMetricBits[] = {16, 32};
+  const bool exact16 =
+      MaxSymbolCost(type) <= Max16BitCost(constraint_, num_parity_bits());
+  for (int i = 0; i < 3; i++) {
+    if (options_.engine != kAutoEngine && options_.engine != kEngines[i]) {
+      continue;
+    }
+    for (int j = 0; j < 2; j++) {
+      if (options_.metric_bits != 0 ? options_.metric_bits != kMetricBits[j]
+                                    : kMetricBits[j] == 16 && !exact16) {
+        continue;
+      }
+      AcsConfig config = {kEngines[i], kMetricBits[j]};
+      if (SupportsEngine(config)) {
+        return config;
       }
-      outputs_[i] += output ? "1" : "0";
     }
   }
+  AcsConfig config = {kScalarEngine, 32};
+  return config;
 }
 
-int ViterbiCodec::BranchMetric(const std::string& bits,
-                               int source_state,
-                               int target_state) const {
-  assert(bits.size() == num_parity_bits());
-  assert((target_state & ((1 << (constraint_ - 2)) - 1)) == source_state >> 1);
-  const std::string output =
-      Output(source_state, target_state >> (constraint_ - 2));
+int ViterbiCodec::traceback_depth() const {
+  if (options_.traceback_depth > 0) {
+    return options_.traceback_depth;
+  }
+  // Decoders fed any symbol type follow the entry for the largest frames,
+  // which viterbi_tune tuned streams like.
+  const ViterbiTuning* stream = NULL;
+  for (int i = 0; i < tuning_.size(); i++) {
+    if (stream == NULL ||
+        tuning_[i].max_frame_bits > stream->max_frame_bits) {
+      stream = &tuning_[i];
+    }
+  }
+  return stream != NULL ? traceback_depth(stream->symbol_type)
+                        : 5 * constraint_;
+}
+
+int ViterbiCodec::traceback_depth(SymbolType type) const {
+  if (options_.traceback_depth > 0) {
+    return options_.traceback_depth;
+  }
+  const ViterbiTuning* tuning = FindTuning(tuning_, type, SIZE_MAX);
+  return tuning != NULL ? tuning->traceback_depth : 5 * constraint_;
+}
 
-  return HammingDistance(bits, output);
+int ViterbiCodec::traceback_overlap() const {
+  return options_.traceback_overlap > 0 ? options_.traceback_overlap
+                                        : 16 * constraint_;
 }
 
-std::pair<int, int> ViterbiCodec::PathMetric(
-    const std::string& bits,
-    const std::vector<int>& prev_path_metrics,
+int ViterbiCodec::num_threads() const {
+  if (options_.num_threads > 0) {
+    return options_.num_threads;
+  }
+  int threads = 0;
+  for (int i = 0; i < tuning_.size(); i++) {
+    threads = std::max(threads, tuning_[i].num_threads);
+  }
+  return threads > 0 ? threads
+                     : std::max(1, (int) std::thread::hardware_concurrency());
+}
+
+int ViterbiCodec::PreviousState(int state, const uint64_t* decisions) const {
+  const int odd = (decisions[state >> 6] >> (state & 63)) & 1;
+  return ((state & ((1 << (constraint_ - 2)) - 1)) << 1) | odd;
+}
+
+std::string ViterbiCodec::Traceback(
+    const std::pmr::vector<uint64_t>& decisions,
+    int num_steps,
     int state) const {
-  int s = (state & ((1 << (constraint_ - 2)) - 1)) << 1;
-  int source_state1 = s | 0;
-  int source_state2 = s | 1;
+  std::vector<uint64_t> words(NumBitWords(num_steps));
+  const int shift = constraint_ - 2;
+  if (num_steps < kMinSegmentedSteps || !options_.segmented_traceback) {
+    for (int i = num_steps - 1; i >= 0; i--) {
+      words[i >> 6] |= (uint64_t) (state >> shift) << (i & 63);
+      state = PreviousState(state, &decisions[(size_t) i * decision_words()]);
+    }
+    return UnpackDecoded(words, num_steps);
+  }
+
+  // Segments write whole words, as kTracebackSegmentSteps is a multiple of
+  // 64. Each lane traces one segment back from its start to its begin, and
+  // outputs the steps before its end.
+  const int overlap = traceback_overlap();
+  const int num_segments =
+      (num_steps + kTracebackSegmentSteps - 1) / kTracebackSegmentSteps;
+  const int words_per_step = decision_words();
+  for (int first = 0; first < num_segments; first += kTracebackLanes) {
+    const int num_lanes = std::min(kTracebackLanes, num_segments - first);
+    int states[kTracebackLanes];
+    int steps[kTracebackLanes];
+    int begins[kTracebackLanes];
+    int ends[kTracebackLanes];
+    int common = std::numeric_limits<int>::max();
+    for (int lane = 0; lane < num_lanes; lane++) {
+      const int segment = first + lane;
+      begins[lane] = segment * kTracebackSegmentSteps;
+      ends[lane] = std::min(begins[lane] + kTracebackSegmentSteps, num_steps);
+      const bool last = segment == num_segments - 1;
+      steps[lane] =
+          last ? num_steps : std::min(ends[lane] + overlap, num_steps);
+      states[lane] = last ? state : 0;
+      common = std::min(common, steps[lane] - begins[lane]);
+    }
+
+    // The lanes step together while they all have steps left, then finish
+    // one by one. Each gathers its bits in a word of its own until it
+    // reaches a word boundary.
+    uint64_t bits[kTracebackLanes] = {0};
+    for (int k = 0; k < common; k++) {
+      for (int lane = 0; lane < num_lanes; lane++) {
+        const int i = steps[lane] - 1 - k;
+        bits[lane] |= (uint64_t) ((states[lane] >> shift) & (i < ends[lane]))
+                      << (i & 63);
+        if ((i & 63) == 0) {
+          words[i >> 6] |= bits[lane];
+          bits[lane] = 0;
+        }
+        states[lane] = PreviousState(
+            states[lane], &decisions[(size_t) i * words_per_step]);
+      }
+    }
+    for (int lane = 0; lane < num_lanes; lane++) {
+      for (int i = steps[lane] - 1 - common; i >= begins[lane]; i--) {
+        bits[lane] |= (uint64_t) ((states[lane] >> shift) & (i < ends[lane]))
+                      << (i & 63);
+        if ((i & 63) == 0) {
+          words[i >> 6] |= bits[lane];
+          bits[lane] = 0;
+        }
+        states[lane] = PreviousState(
+            states[lane], &decisions[(size_t) i * words_per_step]);
+      }
+    }
+  }
+  return UnpackDecoded(words, num_steps);
+}
+
+std::string ViterbiCodec::UnpackDecoded(const std::vector<uint64_t>& words,
+                                        int num_steps) const {
+  // Remove (constraint_ - 1) flushing bits.
+  const int num_bits =
+      num_steps >= constraint_ - 1 ? num_steps - constraint_ + 1 : num_steps;
+  std::string decoded(num_bits, '0');
+  UnpackBits(words.data(), num_bits, &decoded[0]);
+  return decoded;
+}
+
+template <typename Symbols>
+std::string ViterbiCodec::DecodeFrame(const Symbols& symbols,
+                                      size_t num_symbols,
+                                      SymbolType type) const {
+  const int n = num_parity_bits();
+  const int num_steps = (num_symbols + n - 1) / n;
+  const AcsConfig config = ChooseEngine(type, num_symbols);
+  std::string decoded;
+  if (DecodeShortcut(symbols, num_symbols, type, config, &decoded)) {
+    return decoded;
+  }
+
+  std::pmr::vector<uint64_t> decisions((size_t) num_steps * decision_words(),
+                                       memory_resource_);
+  AcsState acs(*this, config, type);
+  std::vector<int> cost0(n);
+  std::vector<int> cost1(n);
+
+  for (int i = 0; i < num_steps; i++) {
+    for (int j = 0; j < n; j++) {
+      symbols.GetCosts((size_t) i * n + j, &cost0[j], &cost1[j]);
+    }
+    acs.Step(cost0.data(), cost1.data(),
+             &decisions[(size_t) i * decision_words()]);
+  }
+
+  return Traceback(decisions, num_steps, acs.BestState());
+}
+
+template <typename Symbols>
+bool ViterbiCodec::DecodeShortcut(const Symbols& symbols,
+                                  size_t num_symbols,
+                                  SymbolType type,
+                                  const AcsConfig& config,
+                                  std::string* decoded) const {
+  // A codeword is the only path of cost 0, unless 16-bit metrics scale small
+  // costs down to 0 too.
+  if (options_.codeword_fast_path &&
+      (config.metric_bits == 32 ||
+       MaxSymbolCost(type) <= Max16BitCost(constraint_, num_parity_bits())) &&
+      DecodeCodeword(symbols, num_symbols, decoded)) {
+    return true;
+  }
+  if (options_.reduced_states > 0 &&
+      options_.reduced_states < num_states() &&
+      SyndromeErrorRate(symbols, num_symbols) <=
+          options_.max_reduced_error_rate) {
+    *decoded = DecodeReduced(symbols, num_symbols);
+    return true;
+  }
+  return false;
+}
+
+bool ViterbiCodec::DecodeShortcut(SymbolType type,
+                                  const void* symbols,
+                                  size_t num_symbols,
+                                  std::string* decoded) const {
+  const AcsConfig config = ChooseEngine(type, num_symbols);
+  switch (type) {
+    case kHardSymbols:
+      return DecodeShortcut(
+          HardBits(static_cast<const char*>(symbols), num_symbols),
+          num_symbols, type, config, decoded);
+    case kInt8Symbols:
+      return DecodeShortcut(
+          SoftSymbols<int8_t>(static_cast<const int8_t*>(symbols),
+                              num_symbols),
+          num_symbols, type, config, decoded);
+    case kInt16Symbols:
+      return DecodeShortcut(
+          SoftSymbols<int16_t>(static_cast<const int16_t*>(symbols),
+                               num_symbols),
+          num_symbols, type, config, decoded);
+  }
+  return false;
+}
+
+template <typename Symbols>
+std::string ViterbiCodec::DecodePriors(const Symbols& symbols,
+                                       size_t num_symbols,
+                                       SymbolType type,
+                                       const ViterbiPriors& priors) const {
+  const int n = num_parity_bits();
+  const int num_steps = (num_symbols + n - 1) / n;
+  const int num_message_bits = num_steps - (constraint_ - 1);
+  const int words = decision_words();
+  std::pmr::vector<uint64_t> decisions((size_t) num_steps * words,
+                                       memory_resource_);
+  AcsConfig config = ChooseEngine(type, num_symbols);
+  if (config.metric_bits == 16) {
+    config.metric_bits = 32;
+    if (!SupportsEngine(config)) {
+      config.engine = kScalarEngine;
+    }
+  }
+  AcsState acs(*this, config, type);
+  std::vector<int> cost0(n);
+  std::vector<int> cost1(n);
+
+  // A path which contradicts a known bit costs more than any path through
+  // the next (constraint - 1) steps can differ by, so none survives them.
+  int max_llr = 0;
+  for (int i = 0; i < priors.llrs.size(); i++) {
+    max_llr = std::max(max_llr, std::abs(priors.llrs[i]));
+  }
+  const int contradiction =
+      2 * constraint_ * (n * MaxSymbolCost(type) + max_llr) + 1;
+
+  // The state the known bits of the last known_steps steps lead to, which
+  // is the only one left once they span (constraint - 1) steps. The frame
+  // starts in state 0. While following it, its path metric is kept in
+  // path_metric rather than in acs.
+  int known_state = 0;
+  int known_steps = constraint_ - 1;
+  bool following = false;
+  int64_t path_metric = 0;
+
+  for (int i = 0; i < num_steps; i++) {
+    for (int j = 0; j < n; j++) {
+      symbols.GetCosts((size_t) i * n + j, &cost0[j], &cost1[j]);
+    }
+    int input = -1;
+    if (i >= num_message_bits) {
+      input = 0;
+    } else if (i < priors.known.size() &&
+               (priors.known[i] == '0' || priors.known[i] == '1')) {
+      input = priors.known[i] - '0';
+    }
+    const int llr = i < priors.llrs.size() ? priors.llrs[i] : 0;
+    int input_cost0 = llr < 0 ? -llr : 0;
+    int input_cost1 = llr > 0 ? llr : 0;
+    uint64_t* step_decisions = &decisions[(size_t) i * words];
+
+    if (input >= 0 && known_steps >= constraint_ - 1) {
+      if (!following) {
+        path_metric = acs.Metric(known_state);
+        following = true;
+      }
+      const char* output =
+          &outputs_[(size_t) (known_state | input << (constraint_ - 1)) * n];
+      for (int j = 0; j < n; j++) {
+        path_metric += output[j] == '1' ? cost1[j] : cost0[j];
+      }
+      path_metric += input ? input_cost1 : input_cost0;
+      const int next_state = NextState(known_state, input);
+      std::fill(step_decisions, step_decisions + words, 0);
+      step_decisions[next_state >> 6] |= (uint64_t) (known_state & 1)
+                                         << (next_state & 63);
+    } else {
+      if (following) {
+        acs.ResetToState(known_state, path_metric);
+        following = false;
+      }
+      acs.Step(cost0.data(), cost1.data(), step_decisions);
+      if (input == 0) {
+        input_cost1 += contradiction;
+      } else if (input == 1) {
+        input_cost0 += contradiction;
+      }
+      if (input_cost0 != 0 || input_cost1 != 0) {
+        acs.AddInputCosts(input_cost0, input_cost1);
+      }
+    }
+
+    if (input >= 0) {
+      known_state = NextState(known_state, input);
+      known_steps++;
+    } else {
+      known_steps = 0;
+    }
+  }
+  if (following) {
+    acs.ResetToState(known_state, path_metric);
+  }
+
+  return Traceback(decisions, num_steps, acs.BestState());
+}
 
-  int pm1 = prev_path_metrics[source_state1];
-  if (pm1 < std::numeric_limits<int>::max()) {
-    pm1 += BranchMetric(bits, source_state1, state);
+template <typename Symbols>
+std::string ViterbiCodec::DecodeBothPolarities(const Symbols& symbols,
+                                               size_t num_symbols,
+                                               SymbolType type,
+                                               bool* inverted) const {
+  *inverted = false;
+  if (!transparent()) {
+    return std::string();
   }
-  int pm2 = prev_path_metrics[source_state2];
-  if (pm2 < std::numeric_limits<int>::max()) {
-    pm2 += BranchMetric(bits, source_state2, state);
+  const int n = num_parity_bits();
+  const int num_steps = (num_symbols + n - 1) / n;
+  std::pmr::vector<uint64_t> decisions((size_t) num_steps * decision_words(),
+                                       memory_resource_);
+  AcsState acs(*this, ChooseEngine(type, num_symbols), type);
+  acs.ResetBothPolarities();
+  std::vector<int> cost0(n);
+  std::vector<int> cost1(n);
+
+  for (int i = 0; i < num_steps; i++) {
+    for (int j = 0; j < n; j++) {
+      symbols.GetCosts((size_t) i * n + j, &cost0[j], &cost1[j]);
+    }
+    acs.Step(cost0.data(), cost1.data(),
+             &decisions[(size_t) i * decision_words()]);
   }
 
-  if (pm1 <= pm2) {
-    return std::make_pair(pm1, source_state1);
-  } else {
-    return std::make_pair(pm2, source_state2);
+  // The flushing bits end the frame in state 0 of its polarity.
+  const int complement = num_states() - 1;
+  *inverted = acs.Metric(complement) < acs.Metric(0);
+  std::string decoded =
+      Traceback(decisions, num_steps, *inverted ? complement : 0);
+  if (*inverted) {
+    for (int i = 0; i < decoded.size(); i++) {
+      decoded[i] = decoded[i] == '0' ? '1' : '0';
+    }
   }
+  return decoded;
 }
 
-void ViterbiCodec::UpdatePathMetrics(const std::string& bits,
-                                     std::vector<int>* path_metrics,
-                                     Trellis* trellis) const {
-  std::vector<int> new_path_metrics(path_metrics->size());
-  std::vector<int> new_trellis_column(1 << (constraint_ - 1));
-  for (int i = 0; i < path_metrics->size(); i++) {
-    std::pair<int, int> p = PathMetric(bits, *path_metrics, i);
-    new_path_metrics[i] = p.first;
-    new_trellis_column[i] = p.second;
+template <typename Symbols>
+bool ViterbiCodec::DecodeCodeword(const Symbols& symbols,
+                                  size_t num_symbols,
+                                  std::string* decoded) const {
+  if (constraint_ < 2) {
+    return false;
+  }
+  const int n = num_parity_bits();
+  const int num_steps = (num_symbols + n - 1) / n;
+  const int num_decoded =
+      num_steps >= constraint_ - 1 ? num_steps - constraint_ + 1 : num_steps;
+  decoded->assign(num_decoded, '0');
+  int state = 0;
+  for (int i = 0; i < num_steps; i++) {
+    int word = 0;
+    for (int j = 0; j < n; j++) {
+      const int bit = HardDecision(symbols, (size_t) i * n + j);
+      if (bit < 0) {
+        return false;
+      }
+      word |= bit << j;
+    }
+    // The input must follow from the state and the output for the path to
+    // be the only one.
+    const int output0 = output_words_[state];
+    const int output1 = output_words_[state | (1 << (constraint_ - 1))];
+    if (output0 == output1 || (word != output0 && word != output1)) {
+      return false;
+    }
+    const int input = word == output1;
+    if (i < num_decoded) {
+      (*decoded)[i] = '0' + input;
+    }
+    state = NextState(state, input);
   }
+  return true;
+}
+
+template <typename Symbols>
+double ViterbiCodec::SyndromeErrorRate(const Symbols& symbols,
+                                       size_t num_symbols) const {
+  const int n = num_parity_bits();
+  const int num_steps = (num_symbols + n - 1) / n;
+  if (n < 2 || num_steps == 0) {
+    return 0;
+  }
+  // Parity streams 0 and 1 are the input convolved with h0 and h1, so
+  // stream 0 convolved with h1 equals stream 1 convolved with h0. The
+  // histories hold the newest bit of each stream in bit (constraint - 1),
+  // as the encoder's register does.
+  const int h0 = ReverseBits(constraint_, polynomials_[0]);
+  const int h1 = ReverseBits(constraint_, polynomials_[1]);
+  int history0 = 0;
+  int history1 = 0;
+  size_t weight = 0;
+  for (int i = 0; i < num_steps; i++) {
+    const int bit0 = HardDecision(symbols, (size_t) i * n) == 1;
+    const int bit1 = HardDecision(symbols, (size_t) i * n + 1) == 1;
+    history0 = (history0 >> 1) | (bit0 << (constraint_ - 1));
+    history1 = (history1 >> 1) | (bit1 << (constraint_ - 1));
+    weight += __builtin_parity(history0 & h1) ^ __builtin_parity(history1 & h0);
+  }
+  return (double) weight /
+         ((double) num_steps *
+          (__builtin_popcount(h0) + __builtin_popcount(h1)));
+}
+
+template <typename Symbols>
+std::string ViterbiCodec::DecodeReduced(const Symbols& symbols,
+                                        size_t num_symbols) const {
+  const int n = num_parity_bits();
+  const int num_steps = (num_symbols + n - 1) / n;
+  const int max_states = options_.reduced_states;
+
+  // The states kept after each step, and the index of the predecessor of
+  // each among those kept after the previous step. Step i's start at
+  // offsets[i].
+  std::pmr::vector<int> kept_states(memory_resource_);
+  std::pmr::vector<int> kept_predecessors(memory_resource_);
+  std::vector<size_t> offsets(1, 0);
+  kept_states.reserve((size_t) num_steps * max_states);
+  kept_predecessors.reserve((size_t) num_steps * max_states);
+
+  // The states kept after the last step and their path metrics, and the
+  // candidates for the next, with their index by state.
+  std::vector<int> states(1, 0);
+  std::vector<int> metrics(1, 0);
+  std::vector<int> next_states;
+  std::vector<int> next_metrics;
+  std::vector<int> predecessors;
+  std::vector<int> slots(num_states(), -1);
+  std::vector<int> order;
+  std::vector<int> branch_metrics(1 << n);
+  std::vector<int> cost0(n);
+  std::vector<int> cost1(n);
+
+  for (int i = 0; i < num_steps; i++) {
+    for (int j = 0; j < n; j++) {
+      symbols.GetCosts((size_t) i * n + j, &cost0[j], &cost1[j]);
+    }
+    for (int word = 0; word < branch_metrics.size(); word++) {
+      int metric = 0;
+      for (int j = 0; j < n; j++) {
+        metric += (word >> j) & 1 ? cost1[j] : cost0[j];
+      }
+      branch_metrics[word] = metric;
+    }
+
+    next_states.clear();
+    next_metrics.clear();
+    predecessors.clear();
+    for (int k = 0; k < states.size(); k++) {
+      for (int input = 0; input < 2; input++) {
+        const int index = states[k] | (input << (constraint_ - 1));
+        const int next = NextState(states[k], input);
+        const int metric =
+            metrics[k] + branch_metrics[output_words_[index]];
+        if (slots[next] < 0) {
+          slots[next] = next_states.size();
+          next_states.push_back(next);
+          next_metrics.push_back(metric);
+          predecessors.push_back(k);
+        } else if (metric < next_metrics[slots[next]]) {
+          next_metrics[slots[next]] = metric;
+          predecessors[slots[next]] = k;
+        }
+      }
+    }
+
+    // Keep the best, ties going to the smaller state.
+    order.resize(next_states.size());
+    for (int k = 0; k < order.size(); k++) {
+      order[k] = k;
+      slots[next_states[k]] = -1;
+    }
+    if (order.size() > max_states) {
+      std::nth_element(order.begin(), order.begin() + max_states, order.end(),
+                       [&](int a, int b) {
+                         return next_metrics[a] != next_metrics[b]
+                                    ? next_metrics[a] < next_metrics[b]
+                                    : next_states[a] < next_states[b];
+                       });
+      order.resize(max_states);
+    }
+    int best = next_metrics[order[0]];
+    for (int k = 1; k < order.size(); k++) {
+      best = std::min(best, next_metrics[order[k]]);
+    }
+    states.resize(order.size());
+    metrics.resize(order.size());
+    for (int k = 0; k < order.size(); k++) {
+      states[k] = next_states[order[k]];
+      metrics[k] = next_metrics[order[k]] - best;
+      kept_states.push_back(states[k]);
+      kept_predecessors.push_back(predecessors[order[k]]);
+    }
+    offsets.push_back(kept_states.size());
+  }
+
+  const int num_decoded =
+      num_steps >= constraint_ - 1 ? num_steps - constraint_ + 1 : num_steps;
+  std::string decoded(num_decoded, '0');
+  int k = std::min_element(metrics.begin(), metrics.end()) - metrics.begin();
+  for (int i = num_steps - 1; i >= 0; i--) {
+    if (i < num_decoded) {
+      decoded[i] = kept_states[offsets[i] + k] >> (constraint_ - 2) ? '1' : '0';
+    }
+    k = kept_predecessors[offsets[i] + k];
+  }
+  return decoded;
+}
 
-  *path_metrics = new_path_metrics;
-  trellis->push_back(new_trellis_column);
+double ViterbiCodec::EstimateErrorRate(const std::string& bits) const {
+  std::vector<uint64_t> words(NumBitWords(bits.size()));
+  const bool valid = PackBits(bits.data(), bits.size(), words.data());
+  assert(valid);
+  return SyndromeErrorRate(PackedSymbols(words.data(), bits.size()),
+                           bits.size());
+}
+
+double ViterbiCodec::EstimateErrorRate(const int8_t* symbols,
+                                       size_t num_symbols) const {
+  return SyndromeErrorRate(SoftSymbols<int8_t>(symbols, num_symbols),
+                           num_symbols);
+}
+
+double ViterbiCodec::EstimateErrorRate(const int16_t* symbols,
+                                       size_t num_symbols) const {
+  return SyndromeErrorRate(SoftSymbols<int16_t>(symbols, num_symbols),
+                           num_symbols);
 }
 
 std::string ViterbiCodec::Decode(const std::string& bits) const {
-  // Compute path metrics and generate trellis.
-  Trellis trellis;
-  std::vector<int> path_metrics(1 << (constraint_ - 1),
-                                std::numeric_limits<int>::max());
-  path_metrics.front() = 0;
-  for (int i = 0; i < bits.size(); i += num_parity_bits()) {
-    std::string current_bits(bits, i, num_parity_bits());
-    // If some bits are missing, fill with trailing zeros.
-    // This is not ideal but it is the best we can do.
-    if (current_bits.size() < num_parity_bits()) {
-      current_bits.append(
-          std::string(num_parity_bits() - current_bits.size(), '0'));
-    }
-    UpdatePathMetrics(current_bits, &path_metrics, &trellis);
-  }
-
-  // Traceback.
-  std::string decoded;
-  int state = std::min_element(path_metrics.begin(), path_metrics.end()) -
-              path_metrics.begin();
-  for (int i = trellis.size() - 1; i >= 0; i--) {
-    decoded += state >> (constraint_ - 2) ? "1" : "0";
-    state = trellis[i][state];
+  std::vector<uint64_t> words(NumBitWords(bits.size()));
+  const bool valid = PackBits(bits.data(), bits.size(), words.data());
+  assert(valid);
+  return DecodeFrame(PackedSymbols(words.data(), bits.size()), bits.size(),
+                     kHardSymbols);
+}
+
+std::string ViterbiCodec::Decode(const int8_t* symbols,
+                                 size_t num_symbols) const {
+  return DecodeFrame(SoftSymbols<int8_t>(symbols, num_symbols), num_symbols,
+                     kInt8Symbols);
+}
+
+std::string ViterbiCodec::Decode(const int16_t* symbols,
+                                 size_t num_symbols) const {
+  return DecodeFrame(SoftSymbols<int16_t>(symbols, num_symbols), num_symbols,
+                     kInt16Symbols);
+}
+
+std::string ViterbiCodec::DecodeWithPriors(const std::string& bits,
+                                           const ViterbiPriors& priors) const {
+  std::vector<uint64_t> words(NumBitWords(bits.size()));
+  const bool valid = PackBits(bits.data(), bits.size(), words.data());
+  assert(valid);
+  return DecodePriors(PackedSymbols(words.data(), bits.size()), bits.size(),
+                      kHardSymbols, priors);
+}
+
+std::string ViterbiCodec::DecodeWithPriors(const int8_t* symbols,
+                                           size_t num_symbols,
+                                           const ViterbiPriors& priors) const {
+  return DecodePriors(SoftSymbols<int8_t>(symbols, num_symbols), num_symbols,
+                      kInt8Symbols, priors);
+}
+
+std::string ViterbiCodec::DecodeWithPriors(const int16_t* symbols,
+                                           size_t num_symbols,
+                                           const ViterbiPriors& priors) const {
+  return DecodePriors(SoftSymbols<int16_t>(symbols, num_symbols), num_symbols,
+                      kInt16Symbols, priors);
+}
+
+std::string ViterbiCodec::DecodeEitherPolarity(const std::string& bits,
+                                               bool* inverted) const {
+  std::vector<uint64_t> words(NumBitWords(bits.size()));
+  const bool valid = PackBits(bits.data(), bits.size(), words.data());
+  assert(valid);
+  return DecodeBothPolarities(PackedSymbols(words.data(), bits.size()),
+                              bits.size(), kHardSymbols, inverted);
+}
+
+std::string ViterbiCodec::DecodeEitherPolarity(const int8_t* symbols,
+                                               size_t num_symbols,
+                                               bool* inverted) const {
+  return DecodeBothPolarities(SoftSymbols<int8_t>(symbols, num_symbols),
+                              num_symbols, kInt8Symbols, inverted);
+}
+
+std::string ViterbiCodec::DecodeEitherPolarity(const int16_t* symbols,
+                                               size_t num_symbols,
+                                               bool* inverted) const {
+  return DecodeBothPolarities(SoftSymbols<int16_t>(symbols, num_symbols),
+                              num_symbols, kInt16Symbols, inverted);
+}
+
+template <typename Symbols>
+void ViterbiCodec::DecodeInterleaved(const std::vector<Symbols>& frames,
+                                     const std::vector<size_t>& num_symbols,
+                                     SymbolType type,
+                                     std::vector<std::string>* decoded) const {
+  decoded->resize(frames.size());
+  if (frames.empty()) {
+    return;
   }
-  std::reverse(decoded.begin(), decoded.end());
+  const int n = num_parity_bits();
+  const int words = decision_words();
+  const int shift = constraint_ - 2;
+  AcsState acs(*this, ChooseEngine(type, num_symbols[0]), type);
+  std::vector<int> cost0(n);
+  std::vector<int> cost1(n);
 
-  // Remove (constraint_ - 1) flushing bits.
-  return decoded.substr(0, decoded.size() - constraint_ + 1);
+  // The decisions of the frame being searched, and of the previous frame,
+  // which is being traced back from traced_state before its step
+  // traced_steps, into traced_words.
+  std::pmr::vector<uint64_t> decisions(memory_resource_);
+  std::pmr::vector<uint64_t> traced(memory_resource_);
+  std::vector<uint64_t> traced_words;
+  int traced_frame = -1;
+  int traced_steps = 0;
+  int traced_state = 0;
+  const auto trace_step = [&]() {
+    const int step = --traced_steps;
+    traced_words[step >> 6] |= (uint64_t) (traced_state >> shift)
+                               << (step & 63);
+    traced_state = PreviousState(traced_state, &traced[(size_t) step * words]);
+  };
+
+  for (int frame = 0; frame <= frames.size(); frame++) {
+    // Whether the frame needs the search, which Decode() skips by the same
+    // shortcuts.
+    bool searched = false;
+    int num_steps = 0;
+    if (frame < frames.size()) {
+      const AcsConfig config = ChooseEngine(type, num_symbols[frame]);
+      if (!DecodeShortcut(frames[frame], num_symbols[frame], type, config,
+                          &(*decoded)[frame])) {
+        searched = true;
+        num_steps = (num_symbols[frame] + n - 1) / n;
+        acs.Reset(config, type);
+        decisions.resize((size_t) num_steps * words);
+      }
+    }
+
+    // Traceback steps per search step, to finish both about together.
+    const int ratio =
+        num_steps > 0 ? (traced_steps + num_steps - 1) / num_steps : 0;
+    for (int i = 0; i < num_steps; i++) {
+      for (int j = 0; j < n; j++) {
+        frames[frame].GetCosts((size_t) i * n + j, &cost0[j], &cost1[j]);
+      }
+      acs.Step(cost0.data(), cost1.data(), &decisions[(size_t) i * words]);
+
+      for (int j = 0; j < ratio && traced_steps > 0; j++) {
+        trace_step();
+      }
+    }
+
+    while (traced_steps > 0) {
+      trace_step();
+    }
+    if (traced_frame >= 0) {
+      (*decoded)[traced_frame] = UnpackDecoded(
+          traced_words, (num_symbols[traced_frame] + n - 1) / n);
+      traced_frame = -1;
+    }
+
+    // Long frames are traced back in segments, as by Decode(), rather than
+    // during the next frame's search.
+    if (searched && num_steps >= kMinSegmentedSteps &&
+        options_.segmented_traceback) {
+      (*decoded)[frame] = Traceback(decisions, num_steps, acs.BestState());
+    } else if (searched) {
+      decisions.swap(traced);
+      traced_words.assign(NumBitWords(num_steps), 0);
+      traced_frame = frame;
+      traced_steps = num_steps;
+      traced_state = acs.BestState();
+    }
+  }
+}
+
+void ViterbiCodec::DecodeBatch(const std::vector<std::string>& frames,
+                               std::vector<std::string>* decoded) const {
+  std::vector<std::vector<uint64_t> > words(frames.size());
+  std::vector<PackedSymbols> symbols;
+  std::vector<size_t> num_symbols;
+  for (int i = 0; i < frames.size(); i++) {
+    words[i].resize(NumBitWords(frames[i].size()));
+    const bool valid =
+        PackBits(frames[i].data(), frames[i].size(), words[i].data());
+    assert(valid);
+    symbols.push_back(PackedSymbols(words[i].data(), frames[i].size()));
+    num_symbols.push_back(frames[i].size());
+  }
+  DecodeInterleaved(symbols, num_symbols, kHardSymbols, decoded);
 }
 
+void ViterbiCodec::DecodeBatch(const std::vector<std::vector<int8_t> >& frames,
+                               std::vector<std::string>* decoded) const {
+  std::vector<SoftSymbols<int8_t> > symbols;
+  std::vector<size_t> num_symbols;
+  for (int i = 0; i < frames.size(); i++) {
+    symbols.push_back(
+        SoftSymbols<int8_t>(frames[i].data(), frames[i].size()));
+    num_symbols.push_back(frames[i].size());
+  }
+  DecodeInterleaved(symbols, num_symbols, kInt8Symbols, decoded);
+}
+
+void ViterbiCodec::DecodeBatch(
+    const std::vector<std::vector<int16_t> >& frames,
+    std::vector<std::string>* decoded) const {
+  std::vector<SoftSymbols<int16_t> > symbols;
+  std::vector<size_t> num_symbols;
+  for (int i = 0; i < frames.size(); i++) {
+    symbols.push_back(
+        SoftSymbols<int16_t>(frames[i].data(), frames[i].size()));
+    num_symbols.push_back(frames[i].size());
+  }
+  DecodeInterleaved(symbols, num_symbols, kInt16Symbols, decoded);
+}
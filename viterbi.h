@@ -6,12 +6,80 @@
 #ifndef VITERBI_H_
 #define VITERBI_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <memory_resource>
 #include <ostream>
+#include <span>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "viterbi_code.h"
+#include "viterbi_tuning.h"
+
+// How a ViterbiCodec decodes. Fields left at their defaults are taken from the
+// tuning file, or else from built-in rules.
+struct ViterbiOptions {
+  ViterbiOptions()
+      : engine(kAutoEngine),
+        metric_bits(0),
+        traceback_depth(0),
+        traceback_overlap(0),
+        segmented_traceback(true),
+        num_threads(0),
+        codeword_fast_path(true),
+        reduced_states(0),
+        max_reduced_error_rate(0.01),
+        memory_resource(NULL) {}
+
+  ViterbiEngine engine;
+  // 16 or 32.
+  int metric_bits;
+  // Default traceback depth of ViterbiStreamDecoder.
+  int traceback_depth;
+  // Steps within which survivor paths are taken to merge when a long frame
+  // is traced back in segments. 0 for 16 times the constraint.
+  int traceback_overlap;
+  // Whether Decode() traces long frames back in segments, several at once,
+  // rather than in one pass over the whole frame.
+  bool segmented_traceback;
+  // Number of threads worth decoding frames of this code with.
+  int num_threads;
+  // Tuning file to load. Empty for DefaultTuningFile().
+  std::string tuning_file;
+  // Whether Decode() takes the hard decisions of a frame as they are when
+  // they form a codeword without erasures, which is then the most likely one.
+  bool codeword_fast_path;
+  // If positive, Decode() searches frames whose EstimateErrorRate() is at
+  // most max_reduced_error_rate keeping only the reduced_states likeliest
+  // states of each step. That is faster for large codes on clean channels,
+  // but the most likely path may be lost.
+  int reduced_states;
+  double max_reduced_error_rate;
+  // Where decoding buffers are allocated from, such as the huge-page
+  // resources of viterbi_memory.h. NULL for std::pmr::get_default_resource()
+  // at construction. It must outlive the codec.
+  std::pmr::memory_resource* memory_resource;
+};
+
+// What is known of the bits of a frame before it is received, for
+// ViterbiCodec::DecodeWithPriors(). Either field may be shorter than the
+// frame, or empty.
+struct ViterbiPriors {
+  // known[i] is '0' or '1' if bit i of the frame is known to be that, as in
+  // header fields and pilots, and any other character, say '?', if not.
+  std::string known;
+  // llrs[i] is the a-priori log-likelihood ratio of bit i, in the units of
+  // the symbols: positive if "0" is more likely, 0 if neither is.
+  std::vector<int> llrs;
+};
+
 // This class implements both a Viterbi Decoder and a Convolutional Encoder.
+// It is immutable after construction, so one codec may serve any number of
+// threads at once.
 class ViterbiCodec {
  public:
   // Note about Polynomial Descriptor of a Convolutional Encoder / Decoder.
@@ -32,60 +100,278 @@ class ViterbiCodec {
   //    This representation is used by the Spiral Viterbi Decoder Software
   //    Generator. See http://www.spiral.net/software/viterbi.html
   // We use 2.
-  ViterbiCodec(int constraint, const std::vector<int>& polynomials);
+  // The constraint must be at least 2: a code of constraint 1 has a single
+  // state, whose survivor records no input bit to trace back.
+  ViterbiCodec(int constraint,
+               const std::vector<int>& polynomials,
+               const ViterbiOptions& options = ViterbiOptions());
+
+  // A codec of the given code, sharing its tables.
+  explicit ViterbiCodec(std::shared_ptr<const ConvolutionalCode> code,
+                        const ViterbiOptions& options = ViterbiOptions());
 
   std::string Encode(const std::string& bits) const;
 
   std::string Decode(const std::string& bits) const;
 
+  // Soft-decision decoding. Each received bit is given as a log-likelihood
+  // ratio: a positive value means "0" is more likely, a negative value means
+  // "1" is more likely, and the magnitude is the confidence. 0 is an erasure.
+  // A hard "0" or "1" is equivalent to +1 or -1, so Decode(bits) is a special
+  // case of these.
+  std::string Decode(const int8_t* symbols, size_t num_symbols) const;
+  std::string Decode(const int16_t* symbols, size_t num_symbols) const;
+
+  // Decodes a frame given what is known of its bits before it is received.
+  // Paths which contradict a known bit are pruned, and once the bits of the
+  // last (constraint - 1) steps are known, leaving a single state, known bits
+  // are followed without add-compare-select. Path metrics are 32-bit.
+  std::string DecodeWithPriors(const std::string& bits,
+                               const ViterbiPriors& priors) const;
+  std::string DecodeWithPriors(const int8_t* symbols,
+                               size_t num_symbols,
+                               const ViterbiPriors& priors) const;
+  std::string DecodeWithPriors(const int16_t* symbols,
+                               size_t num_symbols,
+                               const ViterbiPriors& priors) const;
+
+  // Decodes a frame of a transparent() code which may have been received
+  // inverted, as after the phase ambiguity of BPSK or QPSK carrier recovery,
+  // and sets *inverted to whether it was. Both polarities are searched in one
+  // pass: the inverted one over the complemented states, which share every
+  // branch metric. Only the start and the flushing bits of the frame tell
+  // them apart, so it must end with them. The bits sent are returned either
+  // way. Other codes decode inverted symbols to bits no less likely, so for
+  // them it returns an empty string, with *inverted false.
+  std::string DecodeEitherPolarity(const std::string& bits,
+                                   bool* inverted) const;
+  std::string DecodeEitherPolarity(const int8_t* symbols,
+                                   size_t num_symbols,
+                                   bool* inverted) const;
+  std::string DecodeEitherPolarity(const int16_t* symbols,
+                                   size_t num_symbols,
+                                   bool* inverted) const;
+
+  // Decodes back-to-back frames, each exactly as Decode(), into
+  // (*decoded)[i]. The traceback of each frame, which waits on memory, is
+  // interleaved with the add-compare-select steps of the next, which wait on
+  // arithmetic, so that one core runs both at once. Frames which Decode()
+  // takes a shortcut for (see ViterbiOptions) or traces back in segments are
+  // decoded that way instead, without the interleaving.
+  void DecodeBatch(const std::vector<std::string>& frames,
+                   std::vector<std::string>* decoded) const;
+  void DecodeBatch(const std::vector<std::vector<int8_t> >& frames,
+                   std::vector<std::string>* decoded) const;
+  void DecodeBatch(const std::vector<std::vector<int16_t> >& frames,
+                   std::vector<std::string>* decoded) const;
+
+  // Estimates the bit error rate of the channel a frame was received over,
+  // from the syndrome of the hard decisions of its first two parity bits:
+  // each error there sets as many syndrome bits as the other polynomial has
+  // taps. Returns 0 for codes of one polynomial.
+  double EstimateErrorRate(const std::string& bits) const;
+  double EstimateErrorRate(const int8_t* symbols, size_t num_symbols) const;
+  double EstimateErrorRate(const int16_t* symbols, size_t num_symbols) const;
+
   int constraint() const { return constraint_; }
 
   const std::vector<int>& polynomials() const { return polynomials_; }
 
+  int num_parity_bits() const;
+
+  // Whether every polynomial has an odd number of taps, so that complementing
+  // the input complements every parity bit: inverted symbols then decode to
+  // the complemented bits, as well as the others decode.
+  bool transparent() const;
+
+  int num_states() const { return 1 << (constraint_ - 1); }
+
+  const ViterbiOptions& options() const { return options_; }
+
+  const std::shared_ptr<const ConvolutionalCode>& code() const {
+    return code_;
+  }
+
+  // Resource the decisions of frames are allocated from.
+  std::pmr::memory_resource* memory_resource() const {
+    return memory_resource_;
+  }
+
+  // Tuning file entries for this code on this CPU.
+  const std::vector<ViterbiTuning>& tuning() const { return tuning_; }
+
+  // Returns the engine to decode a frame of num_symbols symbols of the given
+  // type with: as forced by options(), else as tuned, else the fastest one
+  // this CPU supports, with 16-bit metrics if they hold the symbol costs
+  // exactly.
+  AcsConfig ChooseEngine(SymbolType type, size_t num_symbols) const;
+
+  // Whether this code can be decoded with config on this CPU. The SIMD
+  // engines need at least twice as many states as lanes, and at most
+  // kMaxSimdParityBits parity bits.
+  bool SupportsEngine(const AcsConfig& config) const;
+
+  // Default traceback depth of ViterbiStreamDecoder for streams of the given
+  // symbol type: as given by options(), else that of the tuning entry
+  // FindTuning() picks for an endless stream, else 5 times the constraint.
+  // Without a type, that of the type tuned for the largest frames.
+  int traceback_depth() const;
+  int traceback_depth(SymbolType type) const;
+
+  // See ViterbiOptions::traceback_overlap.
+  int traceback_overlap() const;
+
+  // Number of threads to decode frames of this code with: as given by
+  // options(), else the most tuned, else all hardware threads.
+  int num_threads() const;
+
  private:
-  // Suppose
-  //
-  //     Trellis trellis;
-  //
-  // Then trellis[i][s] is the state in the (i - 1)th iteration which leads to
-  // the current state s in the ith iteration.
-  // It is used for traceback.
-  typedef std::vector<std::vector<int> > Trellis;
+  friend class AcsState;
+  friend class ViterbiBatchDecoder;
+  friend class ViterbiHarqBuffer;
+  friend class ViterbiPipelineDecoder;
+  friend class ViterbiSessionManager;
+  template <typename Input>
+  friend class ViterbiSlicedDecoder;
+  friend class ViterbiStreamDecoder;
+  friend class ViterbiStreamEncoder;
 
-  int num_parity_bits() const;
+  // Path metric of a state that cannot be reached from the initial state. It
+  // is far above any reachable metric but leaves room for additions without
+  // overflowing.
+  static const int kUnreachableMetric = 1 << 28;
 
-  void InitializeOutputs();
+  // Path metrics are renormalized once the best one exceeds this.
+  static const int kRenormalizeThreshold = 1 << 29;
 
   int NextState(int current_state, int input) const;
 
-  std::string Output(int current_state, int input) const;
+  // Loads the entries of the tuning file for this code and CPU.
+  void LoadTuning();
+
+  // Returns the predecessor of state on its survivor path.
+  int PreviousState(int state, const uint64_t* decisions) const;
+
+  // Number of 64-bit words holding one decision bit per state.
+  int decision_words() const { return (num_states() + 63) / 64; }
+
+  // Shared implementation of all Decode() overloads. Symbols provides the
+  // costs of each received bit, see viterbi.cpp.
+  template <typename Symbols>
+  std::string DecodeFrame(const Symbols& symbols,
+                          size_t num_symbols,
+                          SymbolType type) const;
+
+  // Decodes a frame into *decoded as Decode() does without searching all
+  // states: by the codeword fast path, or by DecodeReduced() when the
+  // options ask for it and the frame is clean enough. Returns false if
+  // Decode() would run the full search, given config, the engine it picks.
+  template <typename Symbols>
+  bool DecodeShortcut(const Symbols& symbols,
+                      size_t num_symbols,
+                      SymbolType type,
+                      const AcsConfig& config,
+                      std::string* decoded) const;
+
+  // As above, for the decoders built on the codec, given num_symbols
+  // symbols of the type: '0' or '1' chars if hard, else int8_t or int16_t.
+  bool DecodeShortcut(SymbolType type,
+                      const void* symbols,
+                      size_t num_symbols,
+                      std::string* decoded) const;
+
+  // Shared implementation of all DecodeWithPriors() overloads.
+  template <typename Symbols>
+  std::string DecodePriors(const Symbols& symbols,
+                           size_t num_symbols,
+                           SymbolType type,
+                           const ViterbiPriors& priors) const;
 
-  int BranchMetric(const std::string& bits,
-                   int source_state,
-                   int target_state) const;
+  // Shared implementation of all DecodeEitherPolarity() overloads.
+  template <typename Symbols>
+  std::string DecodeBothPolarities(const Symbols& symbols,
+                                   size_t num_symbols,
+                                   SymbolType type,
+                                   bool* inverted) const;
 
-  // Given num_parity_bits() received bits, compute and returns path
-  // metric and its corresponding previous state.
-  std::pair<int, int> PathMetric(const std::string& bits,
-                                 const std::vector<int>& prev_path_metrics,
-                                 int state) const;
+  // Decodes a frame into *decoded if the hard decisions of its symbols form
+  // a codeword. Returns false if they do not.
+  template <typename Symbols>
+  bool DecodeCodeword(const Symbols& symbols,
+                      size_t num_symbols,
+                      std::string* decoded) const;
 
-  // Given num_parity_bits() received bits, update path metrics of all states
-  // in the current iteration, and append new traceback vector to trellis.
-  void UpdatePathMetrics(const std::string& bits,
-                         std::vector<int>* path_metrics,
-                         Trellis* trellis) const;
+  // Shared implementation of all EstimateErrorRate() overloads.
+  template <typename Symbols>
+  double SyndromeErrorRate(const Symbols& symbols, size_t num_symbols) const;
+
+  // Searches a frame keeping only the options().reduced_states states with
+  // the smallest path metrics after each step.
+  template <typename Symbols>
+  std::string DecodeReduced(const Symbols& symbols, size_t num_symbols) const;
+
+  // Shared implementation of all DecodeBatch() overloads.
+  template <typename Symbols>
+  void DecodeInterleaved(const std::vector<Symbols>& frames,
+                         const std::vector<size_t>& num_symbols,
+                         SymbolType type,
+                         std::vector<std::string>* decoded) const;
+
+  // Frames of at least kMinSegmentedSteps steps are traced back in segments
+  // of kTracebackSegmentSteps, up to kTracebackLanes at a time, unless
+  // options().segmented_traceback is off.
+  static const int kTracebackSegmentSteps = 1 << 13;
+  static const int kMinSegmentedSteps = 4 * kTracebackSegmentSteps;
+  static const int kTracebackLanes = 8;
+
+  // Traceback over a whole frame, given the final best state. Removes the
+  // (constraint_ - 1) flushing bits. Long frames are traced back in
+  // segments, each from state 0 traceback_overlap() steps after its end, and
+  // several at once, so that their memory accesses overlap.
+  std::string Traceback(const std::pmr::vector<uint64_t>& decisions,
+                        int num_steps,
+                        int state) const;
+
+  // The decoded bits of a frame of num_steps steps, given the bits of all
+  // steps packed as by PackBits(), without the flushing bits.
+  std::string UnpackDecoded(const std::vector<uint64_t>& words,
+                            int num_steps) const;
 
   const int constraint_;
   const std::vector<int> polynomials_;
+  const ViterbiOptions options_;
+  std::pmr::memory_resource* const memory_resource_;
+  std::vector<ViterbiTuning> tuning_;
+
+  // The tables below are code_'s.
+  const std::shared_ptr<const ConvolutionalCode> code_;
 
   // The output table.
   // The index is current input bit combined with previous inputs in the shift
-  // register. The value is the output parity bits in string format for
-  // convenience, e.g. "10". For example, suppose the shift register contains
-  // 0b10 (= 2), and the current input is 0b1 (= 1), then the index is 0b110 (=
-  // 6).
-  std::vector<std::string> outputs_;
+  // register. The value is the output parity bits as characters, for
+  // convenience, num_parity_bits() of them from index * num_parity_bits(),
+  // e.g. "10". For example, suppose the shift register contains 0b10 (= 2),
+  // and the current input is 0b1 (= 1), then the index is 0b110 (= 6).
+  const std::span<const char> outputs_;
+
+  // outputs_ packed, parity bit j in bit j.
+  const std::span<const int> output_words_;
+
+  // The distinct values of outputs_, flattened, num_parity_bits() bits each.
+  const std::span<const int> branch_outputs_;
+  const int num_branch_outputs_;
+
+  // For target state s, branch0_[s] and branch1_[s] index the distinct
+  // outputs of the branches from the even and the odd predecessor.
+  const std::span<const int> branch0_;
+  const std::span<const int> branch1_;
+
+  // For the SIMD engines, whether each parity bit of each branch is "1", as
+  // lanes of all ones or zeros. See SimdAcsStep for the layout.
+  // num_simd_mask_sets_ is 0 if they cannot decode this code.
+  const std::span<const int16_t> simd_masks16_;
+  const std::span<const int32_t> simd_masks32_;
+  const int num_simd_mask_sets_;
 };
 
 std::ostream& operator <<(std::ostream& os, const ViterbiCodec& codec);
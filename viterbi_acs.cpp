@@ -0,0 +1,355 @@
+// Implementation of AcsState.
+
+#include "viterbi_acs.h"
+#include "viterbi_acs_simd.h"
+#include "viterbi_snapshot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VITERBI_ACS_X86
+#endif
+
+namespace {
+
+// 16-bit path metrics. Reachable metrics stay below kUnreachableMetric16 over
+// the first (constraint - 1) steps, and differ by less than that afterwards,
+// given symbol costs up to Max16BitCost(). Renormalizing at
+// kRenormalizeThreshold16 then keeps every metric below 32767.
+const int kUnreachableMetric16 = 1 << 13;
+const int kRenormalizeThreshold16 = 1 << 13;
+
+}  // namespace
+
+int Max16BitCost(int constraint, int num_parity_bits) {
+  return (kUnreachableMetric16 - 1) / (constraint * num_parity_bits);
+}
+
+int EngineLanes(ViterbiEngine engine, int metric_bits) {
+  switch (engine) {
+    case kScalarEngine:
+      return 1;
+#ifdef VITERBI_ACS_X86
+    case kSse2Engine:
+      return __builtin_cpu_supports("sse2") ? 128 / metric_bits : 0;
+    case kAvx2Engine:
+      return __builtin_cpu_supports("avx2") ? 256 / metric_bits : 0;
+#endif
+    default:
+      return 0;
+  }
+}
+
+AcsState::AcsState(const ViterbiCodec& codec,
+                   const AcsConfig& config,
+                   SymbolType symbol_type)
+    : codec_(codec),
+      scaled_cost0_(codec.num_parity_bits()),
+      scaled_cost1_(codec.num_parity_bits()),
+      branch_metrics_(codec.num_branch_outputs_) {
+  Reset(config, symbol_type);
+}
+
+void AcsState::Reset(const AcsConfig& config, SymbolType symbol_type) {
+  assert(codec_.SupportsEngine(config));
+  config_ = config;
+  symbol_type_ = symbol_type;
+  SetCostScale();
+  Reset();
+}
+
+void AcsState::Reset() {
+  const int num_states = codec_.num_states();
+  if (config_.metric_bits == 16) {
+    metrics16_.assign(num_states, kUnreachableMetric16);
+    metrics16_.front() = 0;
+    new_metrics16_.resize(num_states);
+  } else {
+    metrics32_.assign(num_states, ViterbiCodec::kUnreachableMetric);
+    metrics32_.front() = 0;
+    new_metrics32_.resize(num_states);
+  }
+  bias_ = 0;
+  renormalized_ = 0;
+  num_steps_ = 0;
+}
+
+void AcsState::ResetMidFrame() {
+  const int num_states = codec_.num_states();
+  if (config_.metric_bits == 16) {
+    metrics16_.assign(num_states, 0);
+    new_metrics16_.resize(num_states);
+  } else {
+    metrics32_.assign(num_states, 0);
+    new_metrics32_.resize(num_states);
+  }
+  bias_ = 0;
+  renormalized_ = 0;
+  num_steps_ = codec_.constraint() - 1;
+}
+
+void AcsState::ResetBothPolarities() {
+  Reset();
+  if (config_.metric_bits == 16) {
+    metrics16_.back() = 0;
+  } else {
+    metrics32_.back() = 0;
+  }
+}
+
+void AcsState::ResetToState(int state, int64_t metric) {
+  Reset();
+  if (config_.metric_bits == 16) {
+    metrics16_.front() = kUnreachableMetric16;
+    metrics16_[state] = 0;
+  } else {
+    metrics32_.front() = ViterbiCodec::kUnreachableMetric;
+    metrics32_[state] = 0;
+  }
+  renormalized_ = metric >> cost_shift_;
+}
+
+void AcsState::SetCostScale() {
+  cost_shift_ = 0;
+  max_cost_ = MaxSymbolCost(symbol_type_);
+  if (config_.metric_bits == 16) {
+    const int max_cost =
+        Max16BitCost(codec_.constraint(), codec_.num_parity_bits());
+    while ((max_cost_ >> cost_shift_) > max_cost) {
+      cost_shift_++;
+    }
+    max_cost_ = max_cost;
+  }
+}
+
+void AcsState::Widen(SymbolType symbol_type) {
+  symbol_type_ = symbol_type;
+  if (config_.metric_bits == 16) {
+    const int num_states = codec_.num_states();
+    const bool all_reachable = num_steps_ == codec_.constraint() - 1;
+    metrics32_.resize(num_states);
+    new_metrics32_.resize(num_states);
+    // Undo the scaling of the costs so far.
+    for (int state = 0; state < num_states; state++) {
+      const int metric = metrics16_[state];
+      const bool reachable = all_reachable || metric < kUnreachableMetric16;
+      metrics32_[state] = reachable ? metric << cost_shift_
+                                    : metric - kUnreachableMetric16 +
+                                          ViterbiCodec::kUnreachableMetric;
+    }
+    bias_ <<= cost_shift_;
+    renormalized_ <<= cost_shift_;
+    metrics16_.clear();
+    new_metrics16_.clear();
+    config_.metric_bits = 32;
+  }
+  SetCostScale();
+}
+
+void AcsState::Step(const int* cost0, const int* cost1, uint64_t* decisions) {
+  int threshold = ViterbiCodec::kRenormalizeThreshold;
+  if (config_.metric_bits == 16) {
+    for (int i = 0; i < codec_.num_parity_bits(); i++) {
+      scaled_cost0_[i] = std::min(cost0[i] >> cost_shift_, max_cost_);
+      scaled_cost1_[i] = std::min(cost1[i] >> cost_shift_, max_cost_);
+    }
+    cost0 = scaled_cost0_.data();
+    cost1 = scaled_cost1_.data();
+    threshold = kRenormalizeThreshold16;
+  }
+  renormalized_ -= bias_;
+
+  const int best = config_.engine == kScalarEngine
+                       ? ScalarStep(cost0, cost1, decisions)
+                       : SimdStep(cost0, cost1, decisions);
+  metrics32_.swap(new_metrics32_);
+  metrics16_.swap(new_metrics16_);
+
+  bias_ = best >= threshold ? -best : 0;
+  if (num_steps_ < codec_.constraint() - 1) {
+    num_steps_++;
+  }
+}
+
+void AcsState::AddInputCosts(int cost0, int cost1) {
+  assert(config_.metric_bits == 32);
+  // The input bit of a step is the top bit of the state it leads to.
+  const int half = codec_.num_states() >> 1;
+  int32_t* metrics = metrics32_.data();
+  for (int state = 0; state < half; state++) {
+    metrics[state] += cost0;
+  }
+  for (int state = half; state < 2 * half; state++) {
+    metrics[state] += cost1;
+  }
+}
+
+int AcsState::ScalarStep(const int* cost0,
+                         const int* cost1,
+                         uint64_t* decisions) {
+  const int n = codec_.num_parity_bits();
+  const int* output = codec_.branch_outputs_.data();
+  for (int i = 0; i < codec_.num_branch_outputs_; i++) {
+    int metric = bias_;
+    for (int j = 0; j < n; j++) {
+      metric += output[j] ? cost1[j] : cost0[j];
+    }
+    branch_metrics_[i] = metric;
+    output += n;
+  }
+
+  // Target states s and s + half share the predecessors 2s and 2s + 1.
+  const int num_states = codec_.num_states();
+  const int half = num_states >> 1;
+  const int* branch0 = codec_.branch0_.data();
+  const int* branch1 = codec_.branch1_.data();
+  const int* branch_metrics = branch_metrics_.data();
+  const int32_t* path_metrics = metrics32_.data();
+  int32_t* new_path_metrics = new_metrics32_.data();
+  int best = std::numeric_limits<int>::max();
+  for (int word = 0; word < codec_.decision_words(); word++) {
+    const int begin = word * 64;
+    const int end = std::min(begin + 64, num_states);
+    uint64_t bits = 0;
+    for (int state = begin; state < end; state++) {
+      const int s = (state & (half - 1)) << 1;
+      const int pm0 = path_metrics[s] + branch_metrics[branch0[state]];
+      const int pm1 = path_metrics[s | 1] + branch_metrics[branch1[state]];
+      // Ties go to the even predecessor.
+      const bool odd = pm1 < pm0;
+      new_path_metrics[state] = odd ? pm1 : pm0;
+      bits |= (uint64_t) odd << (state - begin);
+      best = std::min(best, new_path_metrics[state]);
+    }
+    decisions[word] = bits;
+  }
+  return best;
+}
+
+int AcsState::SimdStep(const int* cost0,
+                       const int* cost1,
+                       uint64_t* decisions) {
+  const int n = codec_.num_parity_bits();
+  SimdAcsStep step;
+  step.half = codec_.num_states() >> 1;
+  step.num_parity_bits = n;
+  step.num_mask_sets = codec_.num_simd_mask_sets_;
+  step.base = bias_;
+  step.total = 2 * bias_;
+  for (int i = 0; i < n; i++) {
+    step.base += cost0[i];
+    step.total += cost0[i] + cost1[i];
+    step.diffs[i] = cost1[i] - cost0[i];
+  }
+
+#ifdef VITERBI_ACS_X86
+  if (config_.metric_bits == 16) {
+    step.masks = codec_.simd_masks16_.data();
+    return config_.engine == kAvx2Engine
+               ? Avx2AddCompareSelect16(step, metrics16_.data(),
+                                        new_metrics16_.data(), decisions)
+               : Sse2AddCompareSelect16(step, metrics16_.data(),
+                                        new_metrics16_.data(), decisions);
+  }
+  step.masks = codec_.simd_masks32_.data();
+  return config_.engine == kAvx2Engine
+             ? Avx2AddCompareSelect32(step, metrics32_.data(),
+                                      new_metrics32_.data(), decisions)
+             : Sse2AddCompareSelect32(step, metrics32_.data(),
+                                      new_metrics32_.data(), decisions);
+#else
+  assert(false);
+  return 0;
+#endif
+}
+
+int AcsState::BestState() const {
+  if (config_.metric_bits == 16) {
+    return std::min_element(metrics16_.begin(), metrics16_.end()) -
+           metrics16_.begin();
+  }
+  return std::min_element(metrics32_.begin(), metrics32_.end()) -
+         metrics32_.begin();
+}
+
+int64_t AcsState::BestMetric() const {
+  return Metric(BestState());
+}
+
+int64_t AcsState::Metric(int state) const {
+  if (config_.metric_bits == 16) {
+    return (metrics16_[state] + renormalized_) << cost_shift_;
+  }
+  return metrics32_[state] + renormalized_;
+}
+
+void AcsState::Snapshot(std::string* out) const {
+  AppendSnapshot<uint8_t>(config_.engine, out);
+  AppendSnapshot<uint8_t>(config_.metric_bits, out);
+  AppendSnapshot<uint8_t>(symbol_type_, out);
+  AppendSnapshot<uint8_t>(0, out);
+  AppendSnapshot<int32_t>(bias_, out);
+  AppendSnapshot<int32_t>(num_steps_, out);
+  if (config_.metric_bits == 16) {
+    AppendSnapshot(metrics16_.data(), metrics16_.size(), out);
+  } else {
+    AppendSnapshot(metrics32_.data(), metrics32_.size(), out);
+  }
+}
+
+bool AcsState::Restore(SnapshotReader* reader) {
+  uint8_t engine;
+  uint8_t metric_bits;
+  uint8_t symbol_type;
+  uint8_t reserved;
+  int32_t bias;
+  int32_t num_steps;
+  if (!reader->Read(&engine) || !reader->Read(&metric_bits) ||
+      !reader->Read(&symbol_type) || !reader->Read(&reserved) ||
+      !reader->Read(&bias) || !reader->Read(&num_steps)) {
+    return false;
+  }
+  if (engine > kAvx2Engine || (metric_bits != 16 && metric_bits != 32) ||
+      symbol_type > kInt16Symbols || num_steps < 0 ||
+      num_steps > codec_.constraint() - 1) {
+    return false;
+  }
+
+  AcsConfig config = {(ViterbiEngine) engine, metric_bits};
+  static const ViterbiEngine kEngines[] = {kAvx2Engine, kSse2Engine,
+                                           kScalarEngine};
+  for (int i = 0; i < 3 && !codec_.SupportsEngine(config); i++) {
+    config.engine = kEngines[i];
+  }
+  // Only the scalar engine is left, which needs 32-bit metrics: load the
+  // 16-bit ones as they are and widen them below.
+  const bool widen = !codec_.SupportsEngine(config);
+  config_ = config;
+  symbol_type_ = (SymbolType) symbol_type;
+  SetCostScale();
+  const int num_states = codec_.num_states();
+  if (metric_bits == 16) {
+    metrics16_.resize(num_states);
+    new_metrics16_.resize(num_states);
+    if (!reader->Read(metrics16_.data(), num_states)) {
+      return false;
+    }
+  } else {
+    metrics32_.resize(num_states);
+    new_metrics32_.resize(num_states);
+    if (!reader->Read(metrics32_.data(), num_states)) {
+      return false;
+    }
+  }
+  bias_ = bias;
+  renormalized_ = 0;
+  num_steps_ = num_steps;
+  if (widen) {
+    Widen(symbol_type_);
+  }
+  return true;
+}
@@ -0,0 +1,133 @@
+// Path metrics of a decode in progress, and the engines which update them.
+
+#ifndef VITERBI_ACS_H_
+#define VITERBI_ACS_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "viterbi.h"
+#include "viterbi_tuning.h"
+
+// Number of states an engine processes per instruction with the given metric
+// width, 1 for kScalarEngine, or 0 if this CPU cannot run it.
+int EngineLanes(ViterbiEngine engine, int metric_bits);
+
+// Largest symbol cost 16-bit path metrics hold exactly for the given code
+// dimensions. Larger costs are scaled down.
+int Max16BitCost(int constraint, int num_parity_bits);
+
+class SnapshotReader;
+
+// The trellis search of one frame or stream: the path metrics of all states,
+// in the representation of the engine chosen by an AcsConfig. Each decode
+// needs its own.
+class AcsState {
+ public:
+  // The codec must outlive the state and support config. Symbols of the given
+  // type are scaled down if needed to fit 16-bit metrics.
+  AcsState(const ViterbiCodec& codec,
+           const AcsConfig& config,
+           SymbolType symbol_type);
+
+  // Starts a new frame in state 0.
+  void Reset();
+
+  // Starts a new frame in state 0 with another configuration.
+  void Reset(const AcsConfig& config, SymbolType symbol_type);
+
+  // Starts in the middle of a frame, with every state equally likely.
+  void ResetMidFrame();
+
+  // Starts a new frame in state 0 or in its complement, equally likely. With
+  // a transparent code, the path from the complement over the complemented
+  // states is that of the inverted symbols, so one search covers both
+  // polarities over the same branch metrics.
+  void ResetBothPolarities();
+
+  // Starts over in a single state, with the given path metric, as after the
+  // known input bits of a run of steps, which leave no other state.
+  void ResetToState(int state, int64_t metric);
+
+  // Runs one trellis step, given the costs of receiving each parity bit as
+  // "0" (cost0) and as "1" (cost1). Writes one decision bit per state, set if
+  // the survivor comes from the odd predecessor.
+  void Step(const int* cost0, const int* cost1, uint64_t* decisions);
+
+  // Adds the a-priori costs of the input bit of the last step being "0"
+  // (cost0) and "1" (cost1) to the states it led to. Needs 32-bit metrics.
+  void AddInputCosts(int cost0, int cost1);
+
+  // Returns the first state with the smallest path metric.
+  int BestState() const;
+
+  // Returns the smallest path metric, the cost of the likeliest path since
+  // the last reset or Restore(), counting what renormalization took off.
+  // With 16-bit metrics it is approximate, from costs scaled down and back
+  // up.
+  int64_t BestMetric() const;
+
+  // Returns the path metric of a state, as BestMetric().
+  int64_t Metric(int state) const;
+
+  // Switches to 32-bit path metrics, so that symbols of a type with larger
+  // costs can follow without being scaled down.
+  void Widen(SymbolType symbol_type);
+
+  const AcsConfig& config() const { return config_; }
+
+  SymbolType symbol_type() const { return symbol_type_; }
+
+  // Appends the configuration and path metrics to a snapshot, see
+  // viterbi_snapshot.h.
+  void Snapshot(std::string* out) const;
+
+  // Reads back what Snapshot() wrote. The engine is swapped for another of
+  // the same metric width if this CPU cannot run it, and 16-bit metrics are
+  // widened if none can. Returns false if the snapshot is malformed, leaving
+  // the state to be reset.
+  bool Restore(SnapshotReader* reader);
+
+ private:
+  // Returns the smallest new path metric.
+  int ScalarStep(const int* cost0, const int* cost1, uint64_t* decisions);
+  int SimdStep(const int* cost0, const int* cost1, uint64_t* decisions);
+
+  // Sets cost_shift_ and max_cost_ for symbol_type_ and the metric width.
+  void SetCostScale();
+
+  const ViterbiCodec& codec_;
+  AcsConfig config_;
+  SymbolType symbol_type_;
+
+  // With 16-bit metrics, symbol costs are shifted right by cost_shift_ and
+  // then clamped to max_cost_.
+  int cost_shift_;
+  int max_cost_;
+  std::vector<int> scaled_cost0_;
+  std::vector<int> scaled_cost1_;
+
+  // Path metrics in the configured width, and their next values.
+  std::vector<int32_t> metrics32_;
+  std::vector<int32_t> new_metrics32_;
+  std::vector<int16_t> metrics16_;
+  std::vector<int16_t> new_metrics16_;
+
+  // Added to every branch metric of the next step, to renormalize the path
+  // metrics as part of it.
+  int bias_;
+
+  // Sum of what renormalization took off every path metric since the last
+  // reset, in the costs of the metric width.
+  int64_t renormalized_;
+
+  // Steps since Reset(), up to constraint - 1, after which every state is
+  // reachable.
+  int num_steps_;
+
+  std::vector<int> branch_metrics_;
+};
+
+#endif  // VITERBI_ACS_H_
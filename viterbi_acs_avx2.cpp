@@ -0,0 +1,98 @@
+// AVX2 add-compare-select engine. Compiled with -mavx2; only called when the
+// CPU supports it.
+
+#include "viterbi_acs_simd.h"
+
+#ifdef __AVX2__
+
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2Int16 {
+  typedef int16_t Metric;
+  typedef __m256i Vec;
+  static const int kLanes = 16;
+  static const int kMaxMetric = 32767;
+
+  static Vec Load(const Metric* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+  static void Store(Metric* p, Vec v) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+  }
+  static Vec Set1(int x) { return _mm256_set1_epi16(x); }
+  static Vec Add(Vec a, Vec b) { return _mm256_add_epi16(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm256_sub_epi16(a, b); }
+  static Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+  static Vec Less(Vec a, Vec b) { return _mm256_cmpgt_epi16(b, a); }
+  static Vec Min(Vec a, Vec b) { return _mm256_min_epi16(a, b); }
+  static int MoveMask(Vec mask) {
+    // Packing works within 128-bit halves: lanes 0-7 land in bytes 0-7 and
+    // lanes 8-15 in bytes 16-23.
+    const unsigned int bits = _mm256_movemask_epi8(
+        _mm256_packs_epi16(mask, _mm256_setzero_si256()));
+    return (bits & 0xff) | ((bits >> 8) & 0xff00);
+  }
+  static void Deinterleave(Vec a, Vec b, Vec* even, Vec* odd) {
+    // As for SSE2, then undo the interleaving of the 128-bit halves.
+    const Vec e = _mm256_packs_epi32(
+        _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16),
+        _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16));
+    const Vec o =
+        _mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16));
+    *even = _mm256_permute4x64_epi64(e, _MM_SHUFFLE(3, 1, 2, 0));
+    *odd = _mm256_permute4x64_epi64(o, _MM_SHUFFLE(3, 1, 2, 0));
+  }
+};
+
+struct Avx2Int32 {
+  typedef int32_t Metric;
+  typedef __m256i Vec;
+  static const int kLanes = 8;
+  static const int kMaxMetric = 0x7fffffff;
+
+  static Vec Load(const Metric* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+  static void Store(Metric* p, Vec v) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+  }
+  static Vec Set1(int x) { return _mm256_set1_epi32(x); }
+  static Vec Add(Vec a, Vec b) { return _mm256_add_epi32(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm256_sub_epi32(a, b); }
+  static Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+  static Vec Less(Vec a, Vec b) { return _mm256_cmpgt_epi32(b, a); }
+  static Vec Min(Vec a, Vec b) { return _mm256_min_epi32(a, b); }
+  static int MoveMask(Vec mask) {
+    return _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+  }
+  static void Deinterleave(Vec a, Vec b, Vec* even, Vec* odd) {
+    const __m256 fa = _mm256_castsi256_ps(a);
+    const __m256 fb = _mm256_castsi256_ps(b);
+    const Vec e = _mm256_castps_si256(
+        _mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+    const Vec o = _mm256_castps_si256(
+        _mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+    *even = _mm256_permute4x64_epi64(e, _MM_SHUFFLE(3, 1, 2, 0));
+    *odd = _mm256_permute4x64_epi64(o, _MM_SHUFFLE(3, 1, 2, 0));
+  }
+};
+
+}  // namespace
+
+int Avx2AddCompareSelect16(const SimdAcsStep& step,
+                           const int16_t* pm,
+                           int16_t* new_pm,
+                           uint64_t* decisions) {
+  return SimdAddCompareSelect<Avx2Int16>(step, pm, new_pm, decisions);
+}
+
+int Avx2AddCompareSelect32(const SimdAcsStep& step,
+                           const int32_t* pm,
+                           int32_t* new_pm,
+                           uint64_t* decisions) {
+  return SimdAddCompareSelect<Avx2Int32>(step, pm, new_pm, decisions);
+}
+
+#endif  // __AVX2__
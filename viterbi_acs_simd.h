@@ -0,0 +1,134 @@
+// Vectorized add-compare-select step, shared by the SSE2 and AVX2 engines.
+//
+// Each engine's translation unit is compiled for its instruction set, defines
+// a traits class for its vector type and instantiates SimdAddCompareSelect()
+// with it. Keep this header free of anything else that such a translation
+// unit could instantiate: the linker may pick any copy of an inline function.
+
+#ifndef VITERBI_ACS_SIMD_H_
+#define VITERBI_ACS_SIMD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest number of parity bits the SIMD engines support.
+const int kMaxSimdParityBits = 16;
+
+// Inputs of one trellis step. Butterfly j connects the predecessors 2j and
+// 2j + 1 to the targets j and j + half. Its four branches are numbered by
+// 2 * input + (predecessor is odd), and the cost of branch b is
+//   base + sum over parity bits k of (masks[b][k][j] & diffs[k])
+// where masks hold all ones for each parity bit which is "1". When
+// num_mask_sets is 1 the code is symmetric: branches 1 and 2 output the
+// complement of branch 0 and cost total minus its cost, and branch 3 outputs
+// the same as branch 0.
+struct SimdAcsStep {
+  int half;
+  int num_parity_bits;
+  int num_mask_sets;
+  const void* masks;  // Lanes of the metric width.
+  int base;
+  int total;
+  int diffs[kMaxSimdParityBits];
+};
+
+// Runs one step with the metric width of the function name: reads the path
+// metrics pm, writes new_pm and one decision bit per state, and returns the
+// smallest new path metric. Require half to be a multiple of the number of
+// lanes: 8 or 4 for SSE2, 16 or 8 for AVX2.
+int Sse2AddCompareSelect16(const SimdAcsStep& step,
+                           const int16_t* pm,
+                           int16_t* new_pm,
+                           uint64_t* decisions);
+int Sse2AddCompareSelect32(const SimdAcsStep& step,
+                           const int32_t* pm,
+                           int32_t* new_pm,
+                           uint64_t* decisions);
+int Avx2AddCompareSelect16(const SimdAcsStep& step,
+                           const int16_t* pm,
+                           int16_t* new_pm,
+                           uint64_t* decisions);
+int Avx2AddCompareSelect32(const SimdAcsStep& step,
+                           const int32_t* pm,
+                           int32_t* new_pm,
+                           uint64_t* decisions);
+
+// V provides the vector type Vec of kLanes lanes of type Metric, the largest
+// metric kMaxMetric, and Load, Store, Set1, Add, Sub, And, Less, Min, MoveMask
+// (one bit per lane of a comparison result) and Deinterleave (even and odd
+// lanes of two vectors).
+template <typename V>
+inline int SimdAddCompareSelect(const SimdAcsStep& step,
+                                const typename V::Metric* pm,
+                                typename V::Metric* new_pm,
+                                uint64_t* decisions) {
+  typedef typename V::Metric Metric;
+  typedef typename V::Vec Vec;
+  const int half = step.half;
+  const int n = step.num_parity_bits;
+  const Metric* masks = static_cast<const Metric*>(step.masks);
+
+  for (int word = 0; word < (2 * half + 63) / 64; word++) {
+    decisions[word] = 0;
+  }
+
+  Vec diffs[kMaxSimdParityBits];
+  for (int k = 0; k < n; k++) {
+    diffs[k] = V::Set1(step.diffs[k]);
+  }
+  const Vec base = V::Set1(step.base);
+  const Vec total = V::Set1(step.total);
+
+  Vec best = V::Set1(V::kMaxMetric);
+  for (int j = 0; j < half; j += V::kLanes) {
+    const auto branch_metric = [&](int b) {
+      const Metric* mask = masks + (size_t) b * n * half + j;
+      Vec metric = base;
+      for (int k = 0; k < n; k++) {
+        metric = V::Add(metric, V::And(V::Load(mask + (size_t) k * half),
+                                       diffs[k]));
+      }
+      return metric;
+    };
+    Vec bm[4];
+    if (step.num_mask_sets == 1) {
+      bm[0] = bm[3] = branch_metric(0);
+      bm[1] = bm[2] = V::Sub(total, bm[0]);
+    } else {
+      for (int b = 0; b < 4; b++) {
+        bm[b] = branch_metric(b);
+      }
+    }
+
+    Vec even;
+    Vec odd;
+    V::Deinterleave(V::Load(pm + 2 * j), V::Load(pm + 2 * j + V::kLanes),
+                    &even, &odd);
+
+    // Ties go to the even predecessor.
+    const Vec pm0 = V::Add(even, bm[0]);
+    const Vec pm1 = V::Add(odd, bm[1]);
+    const Vec new0 = V::Min(pm0, pm1);
+    V::Store(new_pm + j, new0);
+    decisions[j >> 6] |= (uint64_t) V::MoveMask(V::Less(pm1, pm0)) << (j & 63);
+
+    const Vec pm2 = V::Add(even, bm[2]);
+    const Vec pm3 = V::Add(odd, bm[3]);
+    const Vec new1 = V::Min(pm2, pm3);
+    V::Store(new_pm + j + half, new1);
+    decisions[(j + half) >> 6] |=
+        (uint64_t) V::MoveMask(V::Less(pm3, pm2)) << ((j + half) & 63);
+
+    best = V::Min(best, V::Min(new0, new1));
+  }
+
+  Metric lanes[V::kLanes];
+  V::Store(lanes, best);
+  int smallest = lanes[0];
+  for (int i = 1; i < V::kLanes; i++) {
+    smallest = lanes[i] < smallest ? lanes[i] : smallest;
+  }
+  return smallest;
+}
+
+#endif  // VITERBI_ACS_SIMD_H_
@@ -0,0 +1,90 @@
+// SSE2 add-compare-select engine. Compiled with -msse2; only called when the
+// CPU supports it.
+
+#include "viterbi_acs_simd.h"
+
+#ifdef __SSE2__
+
+#include <emmintrin.h>
+
+namespace {
+
+struct Sse2Int16 {
+  typedef int16_t Metric;
+  typedef __m128i Vec;
+  static const int kLanes = 8;
+  static const int kMaxMetric = 32767;
+
+  static Vec Load(const Metric* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+  static void Store(Metric* p, Vec v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+  }
+  static Vec Set1(int x) { return _mm_set1_epi16(x); }
+  static Vec Add(Vec a, Vec b) { return _mm_add_epi16(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm_sub_epi16(a, b); }
+  static Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+  static Vec Less(Vec a, Vec b) { return _mm_cmplt_epi16(a, b); }
+  static Vec Min(Vec a, Vec b) { return _mm_min_epi16(a, b); }
+  static int MoveMask(Vec mask) {
+    return _mm_movemask_epi8(_mm_packs_epi16(mask, _mm_setzero_si128()));
+  }
+  static void Deinterleave(Vec a, Vec b, Vec* even, Vec* odd) {
+    // Sign-extend each 16-bit lane pair into 32 bits, then pack back.
+    *even = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                            _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+    *odd = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+  }
+};
+
+struct Sse2Int32 {
+  typedef int32_t Metric;
+  typedef __m128i Vec;
+  static const int kLanes = 4;
+  static const int kMaxMetric = 0x7fffffff;
+
+  static Vec Load(const Metric* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+  static void Store(Metric* p, Vec v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+  }
+  static Vec Set1(int x) { return _mm_set1_epi32(x); }
+  static Vec Add(Vec a, Vec b) { return _mm_add_epi32(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm_sub_epi32(a, b); }
+  static Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+  static Vec Less(Vec a, Vec b) { return _mm_cmplt_epi32(a, b); }
+  static Vec Min(Vec a, Vec b) {
+    // SSE2 has no 32-bit minimum.
+    const Vec less = _mm_cmplt_epi32(b, a);
+    return _mm_or_si128(_mm_and_si128(less, b), _mm_andnot_si128(less, a));
+  }
+  static int MoveMask(Vec mask) {
+    return _mm_movemask_ps(_mm_castsi128_ps(mask));
+  }
+  static void Deinterleave(Vec a, Vec b, Vec* even, Vec* odd) {
+    const __m128 fa = _mm_castsi128_ps(a);
+    const __m128 fb = _mm_castsi128_ps(b);
+    *even = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+    *odd = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+  }
+};
+
+}  // namespace
+
+int Sse2AddCompareSelect16(const SimdAcsStep& step,
+                           const int16_t* pm,
+                           int16_t* new_pm,
+                           uint64_t* decisions) {
+  return SimdAddCompareSelect<Sse2Int16>(step, pm, new_pm, decisions);
+}
+
+int Sse2AddCompareSelect32(const SimdAcsStep& step,
+                           const int32_t* pm,
+                           int32_t* new_pm,
+                           uint64_t* decisions) {
+  return SimdAddCompareSelect<Sse2Int32>(step, pm, new_pm, decisions);
+}
+
+#endif  // __SSE2__
@@ -0,0 +1,367 @@
+// Implementation of ViterbiExecutor and the asynchronous entry points.
+
+#include "viterbi_async.h"
+#include "viterbi_acs.h"
+#include "viterbi_stream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Symbol costs as in ViterbiCodec::Decode(): missing trailing hard bits are
+// "0", missing trailing soft symbols are erasures.
+void GetCosts(const std::string& bits, size_t i, int* cost0, int* cost1) {
+  assert(i >= bits.size() || bits[i] == '0' || bits[i] == '1');
+  const int bit = i < bits.size() && bits[i] == '1';
+  *cost0 = bit;
+  *cost1 = 1 - bit;
+}
+
+template <typename T>
+void GetCosts(const std::vector<T>& symbols,
+              size_t i,
+              int* cost0,
+              int* cost1) {
+  const int x = i < symbols.size() ? symbols[i] : 0;
+  *cost0 = x < 0 ? -x : 0;
+  *cost1 = x > 0 ? x : 0;
+}
+
+template <typename Input>
+std::future<std::string> Async(void (*start)(const ViterbiCodec&,
+                                             Input,
+                                             ViterbiCallback,
+                                             ViterbiExecutor*,
+                                             const ViterbiSchedule&),
+                               const ViterbiCodec& codec,
+                               Input input,
+                               ViterbiExecutor* executor,
+                               const ViterbiSchedule& schedule) {
+  std::shared_ptr<std::promise<std::string> > promise(
+      new std::promise<std::string>);
+  std::future<std::string> result = promise->get_future();
+  start(codec, std::move(input),
+        [promise](std::string output) {
+          promise->set_value(std::move(output));
+        },
+        executor, schedule);
+  return result;
+}
+
+template <typename Input>
+std::future<std::vector<std::string> > DecodeBatch(
+    const ViterbiCodec& codec,
+    std::vector<Input> frames,
+    ViterbiExecutor* executor,
+    const ViterbiSchedule& schedule) {
+  struct Batch {
+    std::promise<std::vector<std::string> > promise;
+    std::vector<std::string> decoded;
+    std::atomic<size_t> num_remaining;
+  };
+  std::shared_ptr<Batch> batch(new Batch);
+  batch->decoded.resize(frames.size());
+  batch->num_remaining = frames.size();
+  std::future<std::vector<std::string> > result = batch->promise.get_future();
+  if (frames.empty()) {
+    batch->promise.set_value(std::vector<std::string>());
+  }
+  for (size_t i = 0; i < frames.size(); i++) {
+    StartDecode(codec, std::move(frames[i]),
+                [batch, i](std::string decoded) {
+                  batch->decoded[i] = std::move(decoded);
+                  if (--batch->num_remaining == 0) {
+                    batch->promise.set_value(std::move(batch->decoded));
+                  }
+                },
+                executor, schedule);
+  }
+  return result;
+}
+
+}  // namespace
+
+// Decodes a frame as ViterbiCodec::Decode(), kDecodeSliceStates path metric
+// updates at a time. A frame whose full search fits one slice is decoded by
+// Decode()'s shortcut, if it takes one, in that slice. The shortcuts run in
+// one go, so larger frames are searched in full, see StartDecode().
+template <typename Input>
+class ViterbiSlicedDecoder {
+ public:
+  ViterbiSlicedDecoder(const ViterbiCodec& codec,
+                       Input input,
+                       SymbolType type,
+                       ViterbiCallback done)
+      : codec_(codec),
+        input_(std::move(input)),
+        type_(type),
+        done_(std::move(done)),
+        num_steps_((input_.size() + codec.num_parity_bits() - 1) /
+                   codec.num_parity_bits()),
+        next_step_(0),
+        decisions_(codec.memory_resource()) {}
+
+  // Runs one slice. Returns whether the frame is done.
+  bool RunSlice() {
+    const int n = codec_.num_parity_bits();
+    const int words = codec_.decision_words();
+    if (!acs_) {
+      std::string decoded;
+      if ((int64_t) num_steps_ * codec_.num_states() <= kDecodeSliceStates &&
+          codec_.DecodeShortcut(type_, input_.data(), input_.size(),
+                                &decoded)) {
+        done_(std::move(decoded));
+        return true;
+      }
+      acs_.reset(new AcsState(codec_, codec_.ChooseEngine(type_, input_.size()),
+                              type_));
+      decisions_.resize((size_t) num_steps_ * words);
+      cost0_.resize(n);
+      cost1_.resize(n);
+    }
+
+    const int slice_steps =
+        std::max(1, kDecodeSliceStates / codec_.num_states());
+    const int end = std::min(num_steps_, next_step_ + slice_steps);
+    for (; next_step_ < end; next_step_++) {
+      for (int j = 0; j < n; j++) {
+        GetCosts(input_, (size_t) next_step_ * n + j, &cost0_[j], &cost1_[j]);
+      }
+      acs_->Step(cost0_.data(), cost1_.data(),
+                 &decisions_[(size_t) next_step_ * words]);
+    }
+    if (next_step_ < num_steps_) {
+      return false;
+    }
+    done_(codec_.Traceback(decisions_, num_steps_, acs_->BestState()));
+    return true;
+  }
+
+ private:
+  const ViterbiCodec& codec_;
+  const Input input_;
+  const SymbolType type_;
+  const ViterbiCallback done_;
+  const int num_steps_;
+  int next_step_;
+  std::unique_ptr<AcsState> acs_;
+  std::pmr::vector<uint64_t> decisions_;
+  std::vector<int> cost0_;
+  std::vector<int> cost1_;
+};
+
+ViterbiExecutor::ViterbiExecutor(int num_threads)
+    : next_sequence_(0), stopping_(false) {
+  if (num_threads <= 0) {
+    num_threads = std::max(1, (int) std::thread::hardware_concurrency());
+  }
+  for (int i = 0; i < num_threads; i++) {
+    threads_.push_back(std::thread([this]() { Run(); }));
+  }
+}
+
+ViterbiExecutor::~ViterbiExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+  for (int i = 0; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+}
+
+ViterbiExecutor* ViterbiExecutor::Default() {
+  static ViterbiExecutor executor;
+  return &executor;
+}
+
+void ViterbiExecutor::Submit(Job job, const ViterbiSchedule& schedule) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Key key = {schedule, next_sequence_++};
+    jobs_.emplace(key, std::move(job));
+  }
+  ready_.notify_one();
+}
+
+ViterbiExecutorStats ViterbiExecutor::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void ViterbiExecutor::Run() {
+  while (true) {
+    Job job;
+    ViterbiSchedule schedule;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      schedule = jobs_.begin()->first.schedule;
+      job = std::move(jobs_.begin()->second);
+      jobs_.erase(jobs_.begin());
+    }
+    const bool done = job();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.num_slices++;
+    if (!done) {
+      // Behind the jobs which tie with it and were queued meanwhile.
+      const Key key = {schedule, next_sequence_++};
+      jobs_.emplace(key, std::move(job));
+      continue;
+    }
+    stats_.num_jobs++;
+    if (schedule.has_deadline()) {
+      stats_.num_deadline_jobs++;
+      const ViterbiSchedule::Clock::duration lateness =
+          ViterbiSchedule::Clock::now() - schedule.deadline;
+      if (lateness.count() > 0) {
+        stats_.num_deadline_misses++;
+        stats_.max_lateness = std::max(stats_.max_lateness, lateness);
+      }
+    }
+  }
+}
+
+template <typename Input>
+void StartSlicedDecode(const ViterbiCodec& codec,
+                       Input input,
+                       SymbolType type,
+                       ViterbiCallback done,
+                       ViterbiExecutor* executor,
+                       const ViterbiSchedule& schedule) {
+  std::shared_ptr<ViterbiSlicedDecoder<Input> > decoder(
+      new ViterbiSlicedDecoder<Input>(codec, std::move(input), type,
+                                      std::move(done)));
+  (executor ? executor : ViterbiExecutor::Default())
+      ->Submit([decoder]() { return decoder->RunSlice(); }, schedule);
+}
+
+void StartDecode(const ViterbiCodec& codec,
+                 std::string bits,
+                 ViterbiCallback done,
+                 ViterbiExecutor* executor,
+                 const ViterbiSchedule& schedule) {
+  StartSlicedDecode(codec, std::move(bits), kHardSymbols, std::move(done),
+                    executor, schedule);
+}
+
+void StartDecode(const ViterbiCodec& codec,
+                 std::vector<int8_t> symbols,
+                 ViterbiCallback done,
+                 ViterbiExecutor* executor,
+                 const ViterbiSchedule& schedule) {
+  StartSlicedDecode(codec, std::move(symbols), kInt8Symbols, std::move(done),
+                    executor, schedule);
+}
+
+void StartDecode(const ViterbiCodec& codec,
+                 std::vector<int16_t> symbols,
+                 ViterbiCallback done,
+                 ViterbiExecutor* executor,
+                 const ViterbiSchedule& schedule) {
+  StartSlicedDecode(codec, std::move(symbols), kInt16Symbols,
+                    std::move(done), executor, schedule);
+}
+
+void StartEncode(const ViterbiCodec& codec,
+                 std::string bits,
+                 ViterbiCallback done,
+                 ViterbiExecutor* executor,
+                 const ViterbiSchedule& schedule) {
+  struct Encoding {
+    Encoding(const ViterbiCodec& codec, std::string bits, ViterbiCallback done)
+        : encoder(codec), bits(std::move(bits)), done(std::move(done)),
+          next(0) {}
+
+    ViterbiStreamEncoder encoder;
+    const std::string bits;
+    const ViterbiCallback done;
+    size_t next;
+    std::string encoded;
+  };
+  std::shared_ptr<Encoding> encoding(
+      new Encoding(codec, std::move(bits), std::move(done)));
+  ViterbiExecutor::Job job = [encoding]() {
+    const size_t size = std::min<size_t>(
+        kEncodeSliceBits, encoding->bits.size() - encoding->next);
+    encoding->encoder.Feed(encoding->bits.substr(encoding->next, size),
+                           &encoding->encoded);
+    encoding->next += size;
+    if (encoding->next < encoding->bits.size()) {
+      return false;
+    }
+    encoding->encoder.Finish(&encoding->encoded);
+    encoding->done(std::move(encoding->encoded));
+    return true;
+  };
+  (executor ? executor : ViterbiExecutor::Default())
+      ->Submit(std::move(job), schedule);
+}
+
+std::future<std::string> DecodeAsync(const ViterbiCodec& codec,
+                                     std::string bits,
+                                     ViterbiExecutor* executor,
+                                     const ViterbiSchedule& schedule) {
+  return Async<std::string>(StartDecode, codec, std::move(bits), executor,
+                            schedule);
+}
+
+std::future<std::string> DecodeAsync(const ViterbiCodec& codec,
+                                     std::vector<int8_t> symbols,
+                                     ViterbiExecutor* executor,
+                                     const ViterbiSchedule& schedule) {
+  return Async<std::vector<int8_t> >(StartDecode, codec, std::move(symbols),
+                                     executor, schedule);
+}
+
+std::future<std::string> DecodeAsync(const ViterbiCodec& codec,
+                                     std::vector<int16_t> symbols,
+                                     ViterbiExecutor* executor,
+                                     const ViterbiSchedule& schedule) {
+  return Async<std::vector<int16_t> >(StartDecode, codec, std::move(symbols),
+                                      executor, schedule);
+}
+
+std::future<std::string> EncodeAsync(const ViterbiCodec& codec,
+                                     std::string bits,
+                                     ViterbiExecutor* executor,
+                                     const ViterbiSchedule& schedule) {
+  return Async<std::string>(StartEncode, codec, std::move(bits), executor,
+                            schedule);
+}
+
+std::future<std::vector<std::string> > DecodeBatchAsync(
+    const ViterbiCodec& codec,
+    std::vector<std::string> frames,
+    ViterbiExecutor* executor,
+    const ViterbiSchedule& schedule) {
+  return DecodeBatch(codec, std::move(frames), executor, schedule);
+}
+
+std::future<std::vector<std::string> > DecodeBatchAsync(
+    const ViterbiCodec& codec,
+    std::vector<std::vector<int8_t> > frames,
+    ViterbiExecutor* executor,
+    const ViterbiSchedule& schedule) {
+  return DecodeBatch(codec, std::move(frames), executor, schedule);
+}
+
+std::future<std::vector<std::string> > DecodeBatchAsync(
+    const ViterbiCodec& codec,
+    std::vector<std::vector<int16_t> > frames,
+    ViterbiExecutor* executor,
+    const ViterbiSchedule& schedule) {
+  return DecodeBatch(codec, std::move(frames), executor, schedule);
+}
@@ -0,0 +1,264 @@
+// Asynchronous encoding and decoding, for callers which must not block, such
+// as the reactor threads of event-driven servers.
+
+#ifndef VITERBI_ASYNC_H_
+#define VITERBI_ASYNC_H_
+
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+#include "viterbi.h"
+
+// When a job is due, and how it ranks against jobs due at the same time.
+struct ViterbiSchedule {
+  typedef std::chrono::steady_clock Clock;
+
+  ViterbiSchedule() : priority(0), deadline(Clock::time_point::max()) {}
+
+  // Due within timeout from now.
+  static ViterbiSchedule Within(Clock::duration timeout, int priority = 0) {
+    ViterbiSchedule schedule;
+    schedule.priority = priority;
+    schedule.deadline = Clock::now() + timeout;
+    return schedule;
+  }
+
+  bool has_deadline() const { return deadline != Clock::time_point::max(); }
+
+  // Higher runs first.
+  int priority;
+  // Clock::time_point::max() if none.
+  Clock::time_point deadline;
+};
+
+// Counters of a ViterbiExecutor since it started.
+struct ViterbiExecutorStats {
+  ViterbiExecutorStats()
+      : num_jobs(0),
+        num_slices(0),
+        num_deadline_jobs(0),
+        num_deadline_misses(0),
+        max_lateness(0) {}
+
+  // Jobs done, and slices run.
+  uint64_t num_jobs;
+  uint64_t num_slices;
+  // Jobs done which had a deadline, and those done after it.
+  uint64_t num_deadline_jobs;
+  uint64_t num_deadline_misses;
+  // How late the latest of them was done.
+  ViterbiSchedule::Clock::duration max_lateness;
+};
+
+// A pool of threads which run jobs in cooperative slices. A job does a
+// bounded amount of work per call, and is rescheduled until it is done. The
+// next slice is always of the job with the earliest deadline, then the
+// highest priority; jobs which tie take turns. So an urgent job waits for at
+// most a slice per thread, however much bulk work is queued.
+class ViterbiExecutor {
+ public:
+  // Runs one slice of a job, and returns whether the job is done.
+  typedef std::function<bool()> Job;
+
+  // A num_threads of 0 means one per hardware thread.
+  explicit ViterbiExecutor(int num_threads = 0);
+
+  // Runs the jobs already submitted to completion, then stops.
+  ~ViterbiExecutor();
+
+  void Submit(Job job, const ViterbiSchedule& schedule = ViterbiSchedule());
+
+  int num_threads() const { return threads_.size(); }
+
+  ViterbiExecutorStats stats() const;
+
+  // The executor used when none is given, with one thread per hardware
+  // thread. It is created on first use.
+  static ViterbiExecutor* Default();
+
+ private:
+  // Orders the queue: earliest deadline, highest priority, then first
+  // queued.
+  struct Key {
+    bool operator<(const Key& other) const {
+      if (schedule.deadline != other.schedule.deadline) {
+        return schedule.deadline < other.schedule.deadline;
+      }
+      if (schedule.priority != other.schedule.priority) {
+        return schedule.priority > other.schedule.priority;
+      }
+      return sequence < other.sequence;
+    }
+
+    ViterbiSchedule schedule;
+    uint64_t sequence;
+  };
+
+  void Run();
+
+  mutable std::mutex mutex_;
+  std::condition_variable ready_;
+  std::map<Key, Job> jobs_;
+  uint64_t next_sequence_;
+  ViterbiExecutorStats stats_;
+  bool stopping_;
+  std::vector<std::thread> threads_;
+};
+
+// Path metric updates per decode slice, that is trellis steps times states:
+// 16384 steps of a 64-state code. Slices of every code take about as long.
+const int kDecodeSliceStates = 1 << 20;
+
+// Bits encoded per slice.
+const int kEncodeSliceBits = 1 << 18;
+
+// Receives the result of an asynchronous job, on an executor thread.
+typedef std::function<void(std::string)> ViterbiCallback;
+
+// Start decoding or encoding on the executor, or the default one if it is
+// NULL, as scheduled, and call done with the same result as
+// ViterbiCodec::Decode() or Encode(). The codec must outlive the job.
+//
+// Decode()'s shortcuts, the codeword fast path and the reduced-state search
+// of ViterbiOptions, cannot be cut into slices, so only frames whose full
+// search fits one slice take them. Larger frames are searched in full, slice
+// by slice: the result is the same as Decode()'s unless the codec has
+// reduced_states, when it is the most likely path, which the reduced search
+// may have lost.
+void StartDecode(const ViterbiCodec& codec,
+                 std::string bits,
+                 ViterbiCallback done,
+                 ViterbiExecutor* executor = NULL,
+                 const ViterbiSchedule& schedule = ViterbiSchedule());
+void StartDecode(const ViterbiCodec& codec,
+                 std::vector<int8_t> symbols,
+                 ViterbiCallback done,
+                 ViterbiExecutor* executor = NULL,
+                 const ViterbiSchedule& schedule = ViterbiSchedule());
+void StartDecode(const ViterbiCodec& codec,
+                 std::vector<int16_t> symbols,
+                 ViterbiCallback done,
+                 ViterbiExecutor* executor = NULL,
+                 const ViterbiSchedule& schedule = ViterbiSchedule());
+void StartEncode(const ViterbiCodec& codec,
+                 std::string bits,
+                 ViterbiCallback done,
+                 ViterbiExecutor* executor = NULL,
+                 const ViterbiSchedule& schedule = ViterbiSchedule());
+
+// As StartDecode() and StartEncode(), with the result in a future.
+std::future<std::string> DecodeAsync(const ViterbiCodec& codec,
+                                     std::string bits,
+                                     ViterbiExecutor* executor = NULL,
+                                     const ViterbiSchedule& schedule =
+                                         ViterbiSchedule());
+std::future<std::string> DecodeAsync(const ViterbiCodec& codec,
+                                     std::vector<int8_t> symbols,
+                                     ViterbiExecutor* executor = NULL,
+                                     const ViterbiSchedule& schedule =
+                                         ViterbiSchedule());
+std::future<std::string> DecodeAsync(const ViterbiCodec& codec,
+                                     std::vector<int16_t> symbols,
+                                     ViterbiExecutor* executor = NULL,
+                                     const ViterbiSchedule& schedule =
+                                         ViterbiSchedule());
+std::future<std::string> EncodeAsync(const ViterbiCodec& codec,
+                                     std::string bits,
+                                     ViterbiExecutor* executor = NULL,
+                                     const ViterbiSchedule& schedule =
+                                         ViterbiSchedule());
+
+// Decodes a batch of frames, each as DecodeAsync() with the same schedule,
+// into a vector of results in order.
+std::future<std::vector<std::string> > DecodeBatchAsync(
+    const ViterbiCodec& codec,
+    std::vector<std::string> frames,
+    ViterbiExecutor* executor = NULL,
+    const ViterbiSchedule& schedule = ViterbiSchedule());
+std::future<std::vector<std::string> > DecodeBatchAsync(
+    const ViterbiCodec& codec,
+    std::vector<std::vector<int8_t> > frames,
+    ViterbiExecutor* executor = NULL,
+    const ViterbiSchedule& schedule = ViterbiSchedule());
+std::future<std::vector<std::string> > DecodeBatchAsync(
+    const ViterbiCodec& codec,
+    std::vector<std::vector<int16_t> > frames,
+    ViterbiExecutor* executor = NULL,
+    const ViterbiSchedule& schedule = ViterbiSchedule());
+
+#if defined(__cpp_impl_coroutine)
+
+// Awaiting it starts a job and suspends the coroutine, which resumes on an
+// executor thread with the job's result.
+class ViterbiAwaitable {
+ public:
+  // Starts the job, given what to call with its result.
+  typedef std::function<void(ViterbiCallback)> Start;
+
+  explicit ViterbiAwaitable(Start start) : start_(std::move(start)) {}
+
+  bool await_ready() const { return false; }
+
+  void await_suspend(std::coroutine_handle<> coroutine) {
+    // The coroutine may resume, and destroy this, before start returns.
+    Start start = std::move(start_);
+    start([this, coroutine](std::string result) {
+      result_ = std::move(result);
+      coroutine.resume();
+    });
+  }
+
+  std::string await_resume() { return std::move(result_); }
+
+ private:
+  Start start_;
+  std::string result_;
+};
+
+// co_await AwaitDecode(codec, input) decodes like DecodeAsync(). Input is a
+// std::string of bits, or a std::vector of int8_t or int16_t symbols.
+template <typename Input>
+ViterbiAwaitable AwaitDecode(const ViterbiCodec& codec,
+                             Input input,
+                             ViterbiExecutor* executor = NULL,
+                             const ViterbiSchedule& schedule =
+                                 ViterbiSchedule()) {
+  return ViterbiAwaitable(
+      [&codec, input = std::move(input), executor, schedule](
+          ViterbiCallback done) mutable {
+        StartDecode(codec, std::move(input), std::move(done), executor,
+                    schedule);
+      });
+}
+
+inline ViterbiAwaitable AwaitEncode(const ViterbiCodec& codec,
+                                    std::string bits,
+                                    ViterbiExecutor* executor = NULL,
+                                    const ViterbiSchedule& schedule =
+                                        ViterbiSchedule()) {
+  return ViterbiAwaitable(
+      [&codec, bits = std::move(bits), executor, schedule](
+          ViterbiCallback done) mutable {
+        StartEncode(codec, std::move(bits), std::move(done), executor,
+                    schedule);
+      });
+}
+
+#endif  // defined(__cpp_impl_coroutine)
+
+#endif  // VITERBI_ASYNC_H_
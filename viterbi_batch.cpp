@@ -0,0 +1,308 @@
+// Implementation of ViterbiBatchDecoder.
+
+#include "viterbi_batch.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Received hard bits, '0' or '1'. Missing trailing bits are "0".
+class HardBits {
+ public:
+  HardBits(const char* bits, size_t size) : bits_(bits), size_(size) {}
+
+  void GetCosts(size_t i, int* cost0, int* cost1) const {
+    assert(i >= size_ || bits_[i] == '0' || bits_[i] == '1');
+    const int bit = i < size_ && bits_[i] == '1';
+    *cost0 = bit;
+    *cost1 = 1 - bit;
+  }
+
+ private:
+  const char* bits_;
+  const size_t size_;
+};
+
+// Received soft symbols. Missing trailing symbols are erasures.
+template <typename T>
+class SoftSymbols {
+ public:
+  SoftSymbols(const T* symbols, size_t size) : symbols_(symbols), size_(size) {}
+
+  void GetCosts(size_t i, int* cost0, int* cost1) const {
+    const int x = i < size_ ? symbols_[i] : 0;
+    *cost0 = x < 0 ? -x : 0;
+    *cost1 = x > 0 ? x : 0;
+  }
+
+ private:
+  const T* symbols_;
+  const size_t size_;
+};
+
+}  // namespace
+
+ViterbiBatchDecoder::Worker::Worker(
+    const ViterbiCodec& codec,
+    std::pmr::memory_resource* memory_resource)
+    : acs(codec, codec.ChooseEngine(kHardSymbols, SIZE_MAX), kHardSymbols),
+      decisions(memory_resource),
+      cost0(codec.num_parity_bits()),
+      cost1(codec.num_parity_bits()) {}
+
+ViterbiBatchDecoder::ViterbiBatchDecoder(const ViterbiCodec& codec,
+                                         int num_threads,
+                                         int overlap,
+                                         std::pmr::memory_resource*
+                                             memory_resource)
+    : codec_(codec),
+      overlap_(overlap > 0 ? overlap : codec.traceback_overlap()),
+      num_queued_(0),
+      num_remaining_(0),
+      stopping_(false) {
+  if (num_threads <= 0) {
+    num_threads = codec_.num_threads();
+  }
+  // The longest search is a split segment with both overlaps, or a whole
+  // frame with its flushing steps.
+  const size_t max_steps =
+      kSegmentSteps + std::max(2 * overlap_, codec_.constraint() - 1);
+  if (memory_resource == NULL) {
+    memory_resource = codec_.memory_resource();
+  }
+  for (int i = 0; i < num_threads; i++) {
+    workers_.push_back(
+        std::unique_ptr<Worker>(new Worker(codec_, memory_resource)));
+    workers_.back()->decisions.resize(max_steps * codec_.decision_words());
+  }
+  for (int i = 0; i < num_threads; i++) {
+    threads_.push_back(std::thread([this, i]() { RunWorker(i); }));
+  }
+}
+
+ViterbiBatchDecoder::~ViterbiBatchDecoder() {
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for (int i = 0; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+}
+
+void ViterbiBatchDecoder::Decode(const std::vector<std::string>& frames,
+                                 std::vector<std::string>* decoded) {
+  std::lock_guard<std::mutex> lock(batch_mutex_);
+  frames_.resize(frames.size());
+  for (int i = 0; i < frames.size(); i++) {
+    frames_[i].type = kHardSymbols;
+    frames_[i].symbols = frames[i].data();
+    frames_[i].num_symbols = frames[i].size();
+  }
+  Run(decoded);
+}
+
+void ViterbiBatchDecoder::Decode(
+    const std::vector<std::vector<int8_t> >& frames,
+    std::vector<std::string>* decoded) {
+  std::lock_guard<std::mutex> lock(batch_mutex_);
+  frames_.resize(frames.size());
+  for (int i = 0; i < frames.size(); i++) {
+    frames_[i].type = kInt8Symbols;
+    frames_[i].symbols = frames[i].data();
+    frames_[i].num_symbols = frames[i].size();
+  }
+  Run(decoded);
+}
+
+void ViterbiBatchDecoder::Decode(
+    const std::vector<std::vector<int16_t> >& frames,
+    std::vector<std::string>* decoded) {
+  std::lock_guard<std::mutex> lock(batch_mutex_);
+  frames_.resize(frames.size());
+  for (int i = 0; i < frames.size(); i++) {
+    frames_[i].type = kInt16Symbols;
+    frames_[i].symbols = frames[i].data();
+    frames_[i].num_symbols = frames[i].size();
+  }
+  Run(decoded);
+}
+
+void ViterbiBatchDecoder::Run(std::vector<std::string>* decoded) {
+  const int n = codec_.num_parity_bits();
+  const int num_flushing_bits = codec_.constraint() - 1;
+  decoded->resize(frames_.size());
+  int num_segments = 0;
+  for (int i = 0; i < frames_.size(); i++) {
+    Frame& frame = frames_[i];
+    frame.num_steps = (frame.num_symbols + n - 1) / n;
+    // As ViterbiCodec::Traceback(), without the flushing bits.
+    frame.num_decoded = frame.num_steps >= num_flushing_bits
+                            ? frame.num_steps - num_flushing_bits
+                            : frame.num_steps;
+    frame.num_segments = std::max(
+        1, (frame.num_decoded + kSegmentSteps - 1) / kSegmentSteps);
+    (*decoded)[i].assign(frame.num_decoded, '0');
+    frame.decoded = frame.num_decoded > 0 ? &(*decoded)[i][0] : NULL;
+    num_segments += frame.num_segments;
+  }
+  if (frames_.empty()) {
+    return;
+  }
+
+  num_remaining_ = num_segments;
+  for (int i = 0; i < frames_.size(); i++) {
+    const Task task = {i, -1};
+    PushTask(workers_[i % workers_.size()].get(), task);
+  }
+  std::unique_lock<std::mutex> lock(idle_mutex_);
+  work_ready_.notify_all();
+  batch_done_.wait(lock, [this]() { return num_remaining_ == 0; });
+}
+
+void ViterbiBatchDecoder::RunWorker(int index) {
+  Worker* worker = workers_[index].get();
+  while (true) {
+    Task task;
+    if (TakeTask(index, &task)) {
+      RunTask(worker, task);
+      if (--num_remaining_ == 0) {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        batch_done_.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    work_ready_.wait(lock, [this]() { return stopping_ || num_queued_ > 0; });
+    if (stopping_ && num_queued_ == 0) {
+      return;
+    }
+  }
+}
+
+bool ViterbiBatchDecoder::TakeTask(int index, Task* task) {
+  {
+    Worker* worker = workers_[index].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->tasks.empty()) {
+      *task = worker->tasks.back();
+      worker->tasks.pop_back();
+      num_queued_--;
+      return true;
+    }
+  }
+  for (int i = 1; i < workers_.size(); i++) {
+    Worker* victim = workers_[(index + i) % workers_.size()].get();
+    std::lock_guard<std::mutex> lock(victim->mutex);
+    if (!victim->tasks.empty()) {
+      *task = victim->tasks.front();
+      victim->tasks.pop_front();
+      num_queued_--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ViterbiBatchDecoder::PushTask(Worker* worker, const Task& task) {
+  std::lock_guard<std::mutex> lock(worker->mutex);
+  worker->tasks.push_back(task);
+  num_queued_++;
+}
+
+void ViterbiBatchDecoder::RunTask(Worker* worker, Task task) {
+  const Frame& frame = frames_[task.frame];
+  if (task.segment < 0) {
+    // Frames which ViterbiCodec::Decode() needs no search for are decoded
+    // whole, as by it.
+    std::string decoded;
+    if (codec_.DecodeShortcut(frame.type, frame.symbols, frame.num_symbols,
+                              &decoded)) {
+      assert(decoded.size() == (size_t) frame.num_decoded);
+      std::copy(decoded.begin(), decoded.end(), frame.decoded);
+      num_remaining_ -= frame.num_segments - 1;
+      return;
+    }
+    // Leave all but the first segment to whoever is idle.
+    for (int segment = 1; segment < frame.num_segments; segment++) {
+      const Task split = {task.frame, segment};
+      PushTask(worker, split);
+    }
+    if (frame.num_segments > 1) {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      work_ready_.notify_all();
+    }
+    task.segment = 0;
+  }
+
+  switch (frame.type) {
+    case kHardSymbols:
+      DecodeSegment(worker, frame,
+                    HardBits(static_cast<const char*>(frame.symbols),
+                             frame.num_symbols),
+                    task.segment);
+      break;
+    case kInt8Symbols:
+      DecodeSegment(worker, frame,
+                    SoftSymbols<int8_t>(
+                        static_cast<const int8_t*>(frame.symbols),
+                        frame.num_symbols),
+                    task.segment);
+      break;
+    case kInt16Symbols:
+      DecodeSegment(worker, frame,
+                    SoftSymbols<int16_t>(
+                        static_cast<const int16_t*>(frame.symbols),
+                        frame.num_symbols),
+                    task.segment);
+      break;
+  }
+}
+
+template <typename Symbols>
+void ViterbiBatchDecoder::DecodeSegment(Worker* worker,
+                                        const Frame& frame,
+                                        const Symbols& symbols,
+                                        int segment) {
+  const int n = codec_.num_parity_bits();
+  const int words = codec_.decision_words();
+  const int shift = codec_.constraint() - 2;
+  // Decoded bits [begin, end) come from searching steps [start, stop). The
+  // last segment runs to the end of the frame, as ViterbiCodec::Decode().
+  const int begin = segment * kSegmentSteps;
+  const int end = std::min(frame.num_decoded, begin + kSegmentSteps);
+  const int start = std::max(0, begin - overlap_);
+  const int stop = segment == frame.num_segments - 1
+                       ? frame.num_steps
+                       : std::min(frame.num_steps, end + overlap_);
+
+  AcsState& acs = worker->acs;
+  acs.Reset(codec_.ChooseEngine(frame.type, frame.num_symbols), frame.type);
+  if (start > 0) {
+    acs.ResetMidFrame();
+  }
+  uint64_t* decisions = worker->decisions.data();
+  for (int i = start; i < stop; i++) {
+    for (int j = 0; j < n; j++) {
+      symbols.GetCosts((size_t) i * n + j, &worker->cost0[j],
+                       &worker->cost1[j]);
+    }
+    acs.Step(worker->cost0.data(), worker->cost1.data(),
+             &decisions[(size_t) (i - start) * words]);
+  }
+
+  int state = acs.BestState();
+  for (int i = stop - 1; i >= begin; i--) {
+    if (i < end) {
+      frame.decoded[i] = state >> shift ? '1' : '0';
+    }
+    state = codec_.PreviousState(state,
+                                 &decisions[(size_t) (i - start) * words]);
+  }
+}
@@ -0,0 +1,147 @@
+// Decoding of batches of frames of one code on a work-stealing thread pool.
+
+#ifndef VITERBI_BATCH_H_
+#define VITERBI_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "viterbi.h"
+#include "viterbi_acs.h"
+
+// Decodes batches of frames of mixed sizes on threads of its own. Each worker
+// has a deque of tasks: it takes its own from the back, and when it runs out
+// it steals from the front of the others'. A frame of more than
+// kSegmentSteps decoded bits is split, by the worker which takes it, into
+// segments of kSegmentSteps bits which the idle workers steal, so a few huge
+// frames keep every thread busy.
+//
+// A segment is decoded with overlap() extra trellis steps on each side: the
+// search starts that far before it with every state equally likely, and
+// traces back from the best state that far after it. Once the overlap exceeds
+// the depth within which survivor paths merge, a split frame decodes as by
+// ViterbiCodec::Decode(). Frames which Decode() takes a shortcut for (see
+// ViterbiOptions) are decoded whole by that shortcut, and are never split.
+// Other frames that are not split are searched exactly alike, but traced back
+// in one pass, where Decode() traces frames of ViterbiCodec's
+// kMinSegmentedSteps steps or more back in segments unless
+// ViterbiOptions::segmented_traceback is off.
+//
+// Each worker keeps its path metrics, decisions and symbol costs between
+// tasks, so searching allocates nothing but the decoded strings. Decode() may
+// be called from several threads; batches run one at a time.
+class ViterbiBatchDecoder {
+ public:
+  // Decoded bits per segment of a split frame.
+  static const int kSegmentSteps = 1 << 15;
+
+  // The codec must outlive the decoder. A num_threads of 0 takes the codec's,
+  // and an overlap of 0 its traceback_overlap(). The workers' decisions are
+  // allocated from memory_resource, by default the codec's; it must outlive
+  // the decoder.
+  explicit ViterbiBatchDecoder(
+      const ViterbiCodec& codec,
+      int num_threads = 0,
+      int overlap = 0,
+      std::pmr::memory_resource* memory_resource = NULL);
+  ~ViterbiBatchDecoder();
+
+  // Decodes each frame as ViterbiCodec::Decode() into (*decoded)[i].
+  void Decode(const std::vector<std::string>& frames,
+              std::vector<std::string>* decoded);
+  void Decode(const std::vector<std::vector<int8_t> >& frames,
+              std::vector<std::string>* decoded);
+  void Decode(const std::vector<std::vector<int16_t> >& frames,
+              std::vector<std::string>* decoded);
+
+  const ViterbiCodec& codec() const { return codec_; }
+
+  int num_threads() const { return workers_.size(); }
+
+  int overlap() const { return overlap_; }
+
+ private:
+  struct Frame {
+    SymbolType type;
+    const void* symbols;
+    size_t num_symbols;
+    int num_steps;
+    int num_segments;
+    char* decoded;
+    int num_decoded;
+  };
+
+  // A segment of a frame, or a whole frame which is yet to be split if
+  // segment is -1.
+  struct Task {
+    int frame;
+    int segment;
+  };
+
+  struct Worker {
+    Worker(const ViterbiCodec& codec,
+           std::pmr::memory_resource* memory_resource);
+
+    // Guards tasks, which other workers steal from.
+    std::mutex mutex;
+    std::deque<Task> tasks;
+
+    // Workspace of the worker's decodes.
+    AcsState acs;
+    std::pmr::vector<uint64_t> decisions;
+    std::vector<int> cost0;
+    std::vector<int> cost1;
+  };
+
+  // Queues a batch of frames and waits for it.
+  void Run(std::vector<std::string>* decoded);
+
+  // Worker threads.
+  void RunWorker(int index);
+
+  // Takes a task of a worker's own, or else steals one.
+  bool TakeTask(int index, Task* task);
+
+  void PushTask(Worker* worker, const Task& task);
+
+  // Runs a task, splitting its frame if it is whole and needs to be.
+  void RunTask(Worker* worker, Task task);
+
+  template <typename Symbols>
+  void DecodeSegment(Worker* worker,
+                     const Frame& frame,
+                     const Symbols& symbols,
+                     int segment);
+
+  const ViterbiCodec& codec_;
+  const int overlap_;
+
+  // Serializes batches.
+  std::mutex batch_mutex_;
+  std::vector<Frame> frames_;
+
+  std::vector<std::unique_ptr<Worker> > workers_;
+  std::vector<std::thread> threads_;
+
+  // Tasks queued in all deques, and segments of the batch left to decode.
+  std::atomic<int> num_queued_;
+  std::atomic<int> num_remaining_;
+
+  // Guard the sleeping of idle workers, and of the caller of Run().
+  std::mutex idle_mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable batch_done_;
+  bool stopping_;
+};
+
+#endif  // VITERBI_BATCH_H_
@@ -0,0 +1,258 @@
+// Implementation of bit string conversion.
+
+#include "viterbi_bits.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VITERBI_BITS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Scalar versions, also used for the tails of the vector versions. They
+// expect words to be aligned to a multiple of 64 characters.
+
+size_t FindNonBitScalar(const char* text, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (text[i] != '0' && text[i] != '1') {
+      return i;
+    }
+  }
+  return size;
+}
+
+bool PackBitsScalar(const char* text, size_t size, uint64_t* words) {
+  for (size_t i = 0; i < size; i += 64) {
+    const size_t end = size - i < 64 ? size - i : 64;
+    uint64_t word = 0;
+    for (size_t j = 0; j < end; j++) {
+      const unsigned bit = text[i + j] - '0';
+      if (bit > 1) {
+        return false;
+      }
+      word |= (uint64_t) bit << j;
+    }
+    words[i / 64] = word;
+  }
+  return true;
+}
+
+void UnpackBitsScalar(const uint64_t* words, size_t num_bits, char* text) {
+  for (size_t i = 0; i < num_bits; i++) {
+    text[i] = '0' + GetBit(words, i);
+  }
+}
+
+#ifdef VITERBI_BITS_X86
+
+__attribute__((target("sse2")))
+size_t FindNonBitSse2(const char* text, size_t size) {
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i one = _mm_set1_epi8('1');
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i x = _mm_loadu_si128((const __m128i*) (text + i));
+    const int valid = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(x, zero), _mm_cmpeq_epi8(x, one)));
+    if (valid != 0xFFFF) {
+      return i + __builtin_ctz(~valid);
+    }
+  }
+  return i + FindNonBitScalar(text + i, size - i);
+}
+
+__attribute__((target("sse2")))
+bool PackBitsSse2(const char* text, size_t size, uint64_t* words) {
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i one = _mm_set1_epi8('1');
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    uint64_t word = 0;
+    for (int j = 0; j < 64; j += 16) {
+      const __m128i x = _mm_loadu_si128((const __m128i*) (text + i + j));
+      const __m128i ones = _mm_cmpeq_epi8(x, one);
+      const __m128i valid = _mm_or_si128(ones, _mm_cmpeq_epi8(x, zero));
+      if (_mm_movemask_epi8(valid) != 0xFFFF) {
+        return false;
+      }
+      word |= (uint64_t) _mm_movemask_epi8(ones) << j;
+    }
+    words[i / 64] = word;
+  }
+  return PackBitsScalar(text + i, size - i, words + i / 64);
+}
+
+__attribute__((target("sse2")))
+void UnpackBitsSse2(const uint64_t* words, size_t num_bits, char* text) {
+  // Byte k of the selector picks bit (k % 8) of its byte of the mask.
+  const __m128i selector =
+      _mm_set1_epi64x((long long) 0x8040201008040201ULL);
+  const __m128i zero = _mm_set1_epi8('0');
+  size_t i = 0;
+  for (; i + 16 <= num_bits; i += 16) {
+    const int mask = (words[i >> 6] >> (i & 63)) & 0xFFFF;
+    // Spread the two mask bytes over the low and high 8 bytes.
+    __m128i x = _mm_cvtsi32_si128(mask);
+    x = _mm_unpacklo_epi8(x, x);
+    x = _mm_unpacklo_epi16(x, x);
+    x = _mm_unpacklo_epi32(x, x);
+    const __m128i bits =
+        _mm_cmpeq_epi8(_mm_and_si128(x, selector), selector);
+    _mm_storeu_si128((__m128i*) (text + i), _mm_sub_epi8(zero, bits));
+  }
+  for (; i < num_bits; i++) {
+    text[i] = '0' + GetBit(words, i);
+  }
+}
+
+__attribute__((target("avx2")))
+size_t FindNonBitAvx2(const char* text, size_t size) {
+  const __m256i zero = _mm256_set1_epi8('0');
+  const __m256i one = _mm256_set1_epi8('1');
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const __m256i x = _mm256_loadu_si256((const __m256i*) (text + i));
+    const unsigned valid = _mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(x, zero), _mm256_cmpeq_epi8(x, one)));
+    if (valid != 0xFFFFFFFFu) {
+      return i + __builtin_ctz(~valid);
+    }
+  }
+  return i + FindNonBitScalar(text + i, size - i);
+}
+
+__attribute__((target("avx2")))
+bool PackBitsAvx2(const char* text, size_t size, uint64_t* words) {
+  const __m256i zero = _mm256_set1_epi8('0');
+  const __m256i one = _mm256_set1_epi8('1');
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    const __m256i lo = _mm256_loadu_si256((const __m256i*) (text + i));
+    const __m256i hi = _mm256_loadu_si256((const __m256i*) (text + i + 32));
+    const __m256i lo_ones = _mm256_cmpeq_epi8(lo, one);
+    const __m256i hi_ones = _mm256_cmpeq_epi8(hi, one);
+    const __m256i valid = _mm256_and_si256(
+        _mm256_or_si256(lo_ones, _mm256_cmpeq_epi8(lo, zero)),
+        _mm256_or_si256(hi_ones, _mm256_cmpeq_epi8(hi, zero)));
+    if ((unsigned) _mm256_movemask_epi8(valid) != 0xFFFFFFFFu) {
+      return false;
+    }
+    words[i / 64] = (uint64_t) (unsigned) _mm256_movemask_epi8(lo_ones) |
+                    (uint64_t) (unsigned) _mm256_movemask_epi8(hi_ones) << 32;
+  }
+  return PackBitsScalar(text + i, size - i, words + i / 64);
+}
+
+__attribute__((target("avx2")))
+void UnpackBitsAvx2(const uint64_t* words, size_t num_bits, char* text) {
+  // Byte k of the shuffle picks byte k / 8 of the mask, and byte k of the
+  // selector picks bit (k % 8) of it.
+  const __m256i shuffle = _mm256_setr_epi8(
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+      2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+  const __m256i selector =
+      _mm256_set1_epi64x((long long) 0x8040201008040201ULL);
+  const __m256i zero = _mm256_set1_epi8('0');
+  size_t i = 0;
+  for (; i + 32 <= num_bits; i += 32) {
+    const int mask = (int) (words[i >> 6] >> (i & 63));
+    const __m256i x = _mm256_shuffle_epi8(_mm256_set1_epi32(mask), shuffle);
+    const __m256i bits =
+        _mm256_cmpeq_epi8(_mm256_and_si256(x, selector), selector);
+    _mm256_storeu_si256((__m256i*) (text + i), _mm256_sub_epi8(zero, bits));
+  }
+  for (; i < num_bits; i++) {
+    text[i] = '0' + GetBit(words, i);
+  }
+}
+
+#endif  // VITERBI_BITS_X86
+
+// The implementations chosen for this CPU.
+struct BitsDispatch {
+  const char* name;
+  size_t (*find_non_bit)(const char*, size_t);
+  bool (*pack_bits)(const char*, size_t, uint64_t*);
+  void (*unpack_bits)(const uint64_t*, size_t, char*);
+};
+
+BitsDispatch SelectBitsDispatch() {
+#ifdef VITERBI_BITS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    BitsDispatch dispatch = {
+        "avx2", FindNonBitAvx2, PackBitsAvx2, UnpackBitsAvx2};
+    return dispatch;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    BitsDispatch dispatch = {
+        "sse2", FindNonBitSse2, PackBitsSse2, UnpackBitsSse2};
+    return dispatch;
+  }
+#endif
+  BitsDispatch dispatch = {
+      "scalar", FindNonBitScalar, PackBitsScalar, UnpackBitsScalar};
+  return dispatch;
+}
+
+const BitsDispatch& GetBitsDispatch() {
+  static const BitsDispatch dispatch = SelectBitsDispatch();
+  return dispatch;
+}
+
+// Reverses the bits of a byte.
+unsigned char ReverseByte(unsigned char b) {
+  b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+  b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+  b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+  return b;
+}
+
+}  // namespace
+
+size_t FindNonBit(const char* text, size_t size) {
+  return GetBitsDispatch().find_non_bit(text, size);
+}
+
+bool PackBits(const char* text, size_t size, uint64_t* words) {
+  return GetBitsDispatch().pack_bits(text, size, words);
+}
+
+void UnpackBits(const uint64_t* words, size_t num_bits, char* text) {
+  GetBitsDispatch().unpack_bits(words, num_bits, text);
+}
+
+bool PackBytes(const char* text, size_t size, unsigned char* bytes) {
+  // Pack 64 characters at a time into a little-endian word, then reverse the
+  // bits of each of its bytes.
+  uint64_t word;
+  for (size_t i = 0; i < size; i += 64) {
+    const size_t end = size - i < 64 ? size - i : 64;
+    if (!PackBits(text + i, end, &word)) {
+      return false;
+    }
+    for (size_t j = 0; j < end; j += 8) {
+      bytes[(i + j) / 8] = ReverseByte((unsigned char) (word >> j));
+    }
+  }
+  return true;
+}
+
+void UnpackBytes(const unsigned char* bytes, size_t num_bits, char* text) {
+  // Gather 8 bytes at a time into a little-endian word with the bits of each
+  // byte reversed, then unpack the word.
+  for (size_t i = 0; i < num_bits; i += 64) {
+    const size_t end = num_bits - i < 64 ? num_bits - i : 64;
+    uint64_t word = 0;
+    for (size_t j = 0; j < end; j += 8) {
+      word |= (uint64_t) ReverseByte(bytes[(i + j) / 8]) << j;
+    }
+    UnpackBits(&word, end, text + i);
+  }
+}
+
+const char* BitsInstructionSet() {
+  return GetBitsDispatch().name;
+}
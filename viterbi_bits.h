@@ -0,0 +1,43 @@
+// Conversion between bit strings of '0' and '1' characters and packed bits.
+//
+// These are on the path of every text input and output, so they process 16 or
+// 32 characters per instruction where the CPU allows, chosen at run time.
+
+#ifndef VITERBI_BITS_H_
+#define VITERBI_BITS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of 64-bit words holding num_bits bits.
+inline size_t NumBitWords(size_t num_bits) { return (num_bits + 63) / 64; }
+
+// Returns bit i of words packed by PackBits().
+inline int GetBit(const uint64_t* words, size_t i) {
+  return (words[i >> 6] >> (i & 63)) & 1;
+}
+
+// Returns the index of the first character of text which is neither '0' nor
+// '1', or size if there is none.
+size_t FindNonBit(const char* text, size_t size);
+
+// Packs text into NumBitWords(size) words: bit j of words[i] is text[64 * i +
+// j]. Unused high bits of the last word are zero. Returns false if text has a
+// character other than '0' and '1', in which case words are unspecified.
+bool PackBits(const char* text, size_t size, uint64_t* words);
+
+// Inverse of PackBits(). Writes num_bits characters to text.
+void UnpackBits(const uint64_t* words, size_t num_bits, char* text);
+
+// Packs text into (size + 7) / 8 bytes, most significant bit of each byte
+// first, padding the last byte with "0" bits. Returns false if text has a
+// character other than '0' and '1'.
+bool PackBytes(const char* text, size_t size, unsigned char* bytes);
+
+// Inverse of PackBytes(). Writes num_bits characters to text.
+void UnpackBytes(const unsigned char* bytes, size_t num_bits, char* text);
+
+// Name of the instruction set used by the functions above, e.g. "avx2".
+const char* BitsInstructionSet();
+
+#endif  // VITERBI_BITS_H_
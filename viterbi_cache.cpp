@@ -0,0 +1,26 @@
+// Implementation of ViterbiCodecCache.
+
+#include "viterbi_cache.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+const ViterbiCodec& ViterbiCodecCache::Get(
+    int constraint,
+    const std::vector<int>& polynomials) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<ViterbiCodec>& codec =
+      codecs_[std::make_pair(constraint, polynomials)];
+  if (!codec) {
+    codec.reset(new ViterbiCodec(constraint, polynomials));
+  }
+  return *codec;
+}
+
+size_t ViterbiCodecCache::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return codecs_.size();
+}
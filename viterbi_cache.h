@@ -0,0 +1,32 @@
+// Cache of ViterbiCodec objects shared between threads.
+
+#ifndef VITERBI_CACHE_H_
+#define VITERBI_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "viterbi.h"
+
+// Thread-safe cache of codecs keyed by (constraint, polynomials), so that jobs
+// sharing a code share its tables. ViterbiCodec is immutable after
+// construction, so a cached codec may be used by any number of threads at
+// once. Codecs live as long as the cache.
+class ViterbiCodecCache {
+ public:
+  const ViterbiCodec& Get(int constraint, const std::vector<int>& polynomials);
+
+  // Number of distinct codecs built so far.
+  size_t size();
+
+ private:
+  typedef std::pair<int, std::vector<int> > Key;
+
+  std::mutex mutex_;
+  std::map<Key, std::unique_ptr<ViterbiCodec> > codecs_;
+};
+
+#endif  // VITERBI_CACHE_H_
@@ -0,0 +1,107 @@
+// Command line client of viterbi_server.
+
+#include "viterbi.h"
+#include "viterbi_bits.h"
+#include "viterbi_protocol.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Path of the server's Unix domain socket.
+static std::string FLAGS_socket = kDefaultSocketPath;
+
+// Whether to reverse polynomials, as in viterbi_main.
+static bool FLAGS_reverse_polynomials = false;
+
+// Whether to perform encoding instead of decoding.
+static bool FLAGS_encode = false;
+
+void Usage(const std::string& exec) {
+  std::cout
+      << "Usage:\n"
+      << "    " << exec << " [--socket=<path>] [--reverse_polynomials]"
+      << " [--encode] <constraint> <polynomial>... <bits>\n\n"
+      << "Sends one request to viterbi_server and prints the result.\n\n"
+      << "Example:\n"
+      << "    " << exec << " 3 7 5 0011100001100111111000101100111011\n";
+}
+
+std::vector<std::string> ParseFlags(int argc, char** argv) {
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--help") == 0) {
+      Usage(argv[0]);
+      exit(1);
+    } else if (std::strncmp(argv[i], "--socket=", 9) == 0) {
+      FLAGS_socket = argv[i] + 9;
+    } else if (std::strcmp(argv[i], "--reverse_polynomials") == 0) {
+      FLAGS_reverse_polynomials = true;
+    } else if (std::strcmp(argv[i], "--encode") == 0) {
+      FLAGS_encode = true;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  return args;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> args = ParseFlags(argc, argv);
+  if (args.size() < 3) {
+    std::cout << "Insufficient number of arguments." << std::endl;
+    exit(1);
+  }
+
+  // The server validates the request, so only the syntax is checked here.
+  Request request;
+  request.id = 0;
+  request.type = FLAGS_encode ? kEncode : kDecodeBits;
+  request.constraint = std::atoi(args[0].c_str());
+  for (int i = 1; i < args.size() - 1; i++) {
+    int polynomial = std::atoi(args[i].c_str());
+    if (FLAGS_reverse_polynomials && polynomial > 0 &&
+        polynomial < (1 << request.constraint)) {
+      polynomial = ReverseBits(request.constraint, polynomial);
+    }
+    request.polynomials.push_back(polynomial);
+  }
+  const std::string& bits = args.back();
+  request.num_symbols = bits.size();
+  request.payload.resize(PayloadSize(kDecodeBits, bits.size()));
+  if (!PackBytes(bits.data(), bits.size(),
+                 reinterpret_cast<unsigned char*>(&request.payload[0]))) {
+    std::cout << "Expected a binary sequence, found " << bits << std::endl;
+    exit(1);
+  }
+
+  const int fd = ConnectToServer(FLAGS_socket);
+  if (fd < 0) {
+    std::cout << "Failed to connect to " << FLAGS_socket << ": "
+              << std::strerror(errno) << std::endl;
+    exit(1);
+  }
+  std::string data;
+  SerializeRequest(request, &data);
+  Response response;
+  if (!WriteFully(fd, data.data(), data.size()) || !ReadMessage(fd, &data) ||
+      !ParseResponse(data, &response)) {
+    std::cout << "Lost connection to " << FLAGS_socket << std::endl;
+    exit(1);
+  }
+  close(fd);
+
+  if (response.status != kOk) {
+    std::cout << response.payload << std::endl;
+    exit(1);
+  }
+  std::string result(response.num_bits, '0');
+  UnpackBytes(reinterpret_cast<const unsigned char*>(response.payload.data()),
+              response.num_bits, &result[0]);
+  std::cout << result << std::endl;
+}
@@ -0,0 +1,469 @@
+// Implementation of ConvolutionalCode.
+
+#include "viterbi_code.h"
+#include "viterbi.h"
+#include "viterbi_acs.h"
+#include "viterbi_acs_simd.h"
+#include "viterbi_tuning.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const int kDispatchBytes = 16;
+
+// Bytes of a table file header up to the polynomials.
+const size_t kFixedHeaderBytes = 56;
+
+inline size_t Pad8(size_t bytes) { return (bytes + 7) & ~(size_t) 7; }
+
+// Byte offsets of the tables in their block, and its size.
+struct TableLayout {
+  size_t outputs;
+  size_t output_words;
+  size_t branch_outputs;
+  size_t branch0;
+  size_t branch1;
+  size_t simd_masks16;
+  size_t simd_masks32;
+  size_t bytes;
+};
+
+TableLayout GetTableLayout(int constraint,
+                           int num_parity_bits,
+                           int num_branch_outputs,
+                           int num_simd_mask_sets) {
+  const size_t num_indices = (size_t) 1 << constraint;
+  const size_t num_branch_states = num_indices >> 1;
+  const size_t num_masks =
+      (size_t) num_simd_mask_sets * num_parity_bits * (num_indices >> 2);
+  TableLayout layout;
+  size_t offset = 0;
+  layout.outputs = offset;
+  offset += Pad8(num_indices * num_parity_bits);
+  layout.output_words = offset;
+  offset += Pad8(num_indices * sizeof(int));
+  layout.branch_outputs = offset;
+  offset += Pad8((size_t) num_branch_outputs * num_parity_bits * sizeof(int));
+  layout.branch0 = offset;
+  offset += Pad8(num_branch_states * sizeof(int));
+  layout.branch1 = offset;
+  offset += Pad8(num_branch_states * sizeof(int));
+  layout.simd_masks16 = offset;
+  offset += Pad8(num_masks * sizeof(int16_t));
+  layout.simd_masks32 = offset;
+  offset += Pad8(num_masks * sizeof(int32_t));
+  layout.bytes = offset;
+  return layout;
+}
+
+// Checksum of a table block, in four independent lanes so that it runs
+// about as fast as the block is read.
+uint64_t TableChecksum(const char* tables, size_t bytes) {
+  const uint64_t kMultiplier = 0x9e3779b97f4a7c15ULL;
+  uint64_t lanes[4] = {1, 2, 3, 4};
+  const size_t num_words = bytes / 8;
+  size_t i = 0;
+  for (; i + 4 <= num_words; i += 4) {
+    for (int lane = 0; lane < 4; lane++) {
+      uint64_t word;
+      std::memcpy(&word, tables + (i + lane) * 8, 8);
+      lanes[lane] = (lanes[lane] ^ word) * kMultiplier;
+      lanes[lane] ^= lanes[lane] >> 29;
+    }
+  }
+  for (; i < num_words; i++) {
+    uint64_t word;
+    std::memcpy(&word, tables + i * 8, 8);
+    lanes[0] = (lanes[0] ^ word) * kMultiplier;
+    lanes[0] ^= lanes[0] >> 29;
+  }
+  uint64_t checksum = bytes;
+  for (int lane = 0; lane < 4; lane++) {
+    checksum = (checksum ^ lanes[lane]) * kMultiplier;
+    checksum ^= checksum >> 29;
+  }
+  return checksum;
+}
+
+// The header of a table file, up to the polynomials.
+struct TableFileHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_bytes;
+  uint32_t constraint;
+  uint32_t num_polynomials;
+  char dispatch[kDispatchBytes];
+  uint32_t num_branch_outputs;
+  uint32_t num_simd_mask_sets;
+  uint64_t table_bytes;
+  uint64_t checksum;
+};
+
+static_assert(sizeof(TableFileHeader) == kFixedHeaderBytes,
+              "table file header must not be padded");
+
+template <typename T>
+std::span<const T> TableSpan(const char* tables, size_t offset, size_t size) {
+  return std::span<const T>(reinterpret_cast<const T*>(tables + offset),
+                            size);
+}
+
+}  // namespace
+
+std::shared_ptr<const ConvolutionalCode> ConvolutionalCode::Get(
+    int constraint,
+    const std::vector<int>& polynomials) {
+  typedef std::pair<int, std::vector<int> > Key;
+  static std::mutex mutex;
+  static std::map<Key, std::weak_ptr<const ConvolutionalCode> > codes;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::weak_ptr<const ConvolutionalCode>& entry =
+      codes[std::make_pair(constraint, polynomials)];
+  std::shared_ptr<const ConvolutionalCode> code = entry.lock();
+  if (code) {
+    return code;
+  }
+
+  const std::string dir = DefaultTableCacheDir();
+  const std::string path =
+      dir.empty() ? "" : dir + "/" + TableFileName(constraint, polynomials);
+  if (!path.empty()) {
+    code = Load(path, constraint, polynomials);
+  }
+  if (!code) {
+    std::shared_ptr<ConvolutionalCode> built(
+        new ConvolutionalCode(constraint, polynomials));
+    // The cache is advisory: without it, every process builds the tables.
+    if (!path.empty()) {
+      built->Save(path);
+    }
+    code = built;
+  }
+  entry = code;
+
+  // Forget the codes nobody uses any more.
+  for (std::map<Key, std::weak_ptr<const ConvolutionalCode> >::iterator it =
+           codes.begin();
+       it != codes.end();) {
+    if (it->second.expired()) {
+      it = codes.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return code;
+}
+
+std::string ConvolutionalCode::TableFileName(
+    int constraint,
+    const std::vector<int>& polynomials) {
+  std::string name = "viterbi_" + std::to_string(constraint);
+  for (int i = 0; i < polynomials.size(); i++) {
+    name += "_" + std::to_string(polynomials[i]);
+  }
+  return name + "_" + TableDispatchLevel() + ".tables";
+}
+
+ConvolutionalCode::ConvolutionalCode(int constraint,
+                                     const std::vector<int>& polynomials)
+    : constraint_(constraint),
+      polynomials_(polynomials),
+      num_branch_outputs_(0),
+      num_simd_mask_sets_(0),
+      mapping_(NULL),
+      mapping_bytes_(0),
+      table_bytes_(0) {
+  assert(constraint_ >= 2);
+  assert(!polynomials_.empty());
+  for (int i = 0; i < polynomials_.size(); i++) {
+    assert(polynomials_[i] > 0);
+    assert(polynomials_[i] < (1 << constraint_));
+  }
+  const int n = num_parity_bits();
+  const int num_indices = 1 << constraint_;
+
+  // The output table. The index is current input bit combined with previous
+  // inputs in the shift register. Polynomial bits are reversed to make the
+  // convolution code simpler.
+  std::vector<int> reversed(n);
+  for (int j = 0; j < n; j++) {
+    reversed[j] = ReverseBits(constraint_, polynomials_[j]);
+  }
+  std::vector<char> outputs((size_t) num_indices * n);
+  std::vector<int> output_words(num_indices);
+  for (int i = 0; i < num_indices; i++) {
+    for (int j = 0; j < n; j++) {
+      const int output = __builtin_parity(i & reversed[j]);
+      outputs[(size_t) i * n + j] = output ? '1' : '0';
+      output_words[i] |= output << j;
+    }
+  }
+
+  // Number the distinct outputs, so that per-step branch metrics need only be
+  // computed once for each of them. For target state s, branch0 and branch1
+  // index the outputs of the branches from the even and the odd predecessor.
+  std::vector<int> branch_outputs;
+  std::vector<int> branch0;
+  std::vector<int> branch1;
+  if (constraint_ >= 2) {
+    std::map<int, int> index;
+    std::vector<int> output_index(num_indices);
+    for (int i = 0; i < num_indices; i++) {
+      std::map<int, int>::iterator it = index.find(output_words[i]);
+      if (it == index.end()) {
+        it = index.insert(std::make_pair(output_words[i], (int) index.size()))
+                 .first;
+        for (int j = 0; j < n; j++) {
+          branch_outputs.push_back((output_words[i] >> j) & 1);
+        }
+      }
+      output_index[i] = it->second;
+    }
+    num_branch_outputs_ = index.size();
+
+    branch0.resize(num_states());
+    branch1.resize(num_states());
+    for (int state = 0; state < num_states(); state++) {
+      int input = state >> (constraint_ - 2);
+      int s = (state & ((1 << (constraint_ - 2)) - 1)) << 1;
+      branch0[state] = output_index[(s | 0) | (input << (constraint_ - 1))];
+      branch1[state] = output_index[(s | 1) | (input << (constraint_ - 1))];
+    }
+  }
+
+  // For the SIMD engines, whether each parity bit of each branch is "1". Branch
+  // b of butterfly j leaves predecessor 2j + (b & 1) with input b >> 1.
+  std::vector<int16_t> simd_masks16;
+  std::vector<int32_t> simd_masks32;
+  if (constraint_ >= 3 && n <= kMaxSimdParityBits) {
+    const int half = num_states() >> 1;
+    const int all = (1 << n) - 1;
+    std::vector<int> words(4 * half);
+    bool symmetric = true;
+    for (int j = 0; j < half; j++) {
+      for (int b = 0; b < 4; b++) {
+        words[4 * j + b] = output_words[(2 * j + (b & 1)) |
+                                        ((b >> 1) << (constraint_ - 1))];
+      }
+      symmetric = symmetric && words[4 * j + 1] == (words[4 * j] ^ all) &&
+                  words[4 * j + 2] == (words[4 * j] ^ all) &&
+                  words[4 * j + 3] == words[4 * j];
+    }
+
+    num_simd_mask_sets_ = symmetric ? 1 : 4;
+    simd_masks16.resize((size_t) num_simd_mask_sets_ * n * half);
+    simd_masks32.resize(simd_masks16.size());
+    for (int b = 0; b < num_simd_mask_sets_; b++) {
+      for (int k = 0; k < n; k++) {
+        for (int j = 0; j < half; j++) {
+          const size_t i = ((size_t) b * n + k) * half + j;
+          const bool one = (words[4 * j + b] >> k) & 1;
+          simd_masks16[i] = one ? -1 : 0;
+          simd_masks32[i] = one ? -1 : 0;
+        }
+      }
+    }
+  }
+
+  // Lay them out in one block, as in a table file.
+  const TableLayout layout =
+      GetTableLayout(constraint_, n, num_branch_outputs_, num_simd_mask_sets_);
+  storage_.resize(layout.bytes / 8);
+  char* tables = reinterpret_cast<char*>(storage_.data());
+  std::memcpy(tables + layout.outputs, outputs.data(), outputs.size());
+  std::memcpy(tables + layout.output_words, output_words.data(),
+              output_words.size() * sizeof(int));
+  std::memcpy(tables + layout.branch_outputs, branch_outputs.data(),
+              branch_outputs.size() * sizeof(int));
+  std::memcpy(tables + layout.branch0, branch0.data(),
+              branch0.size() * sizeof(int));
+  std::memcpy(tables + layout.branch1, branch1.data(),
+              branch1.size() * sizeof(int));
+  std::memcpy(tables + layout.simd_masks16, simd_masks16.data(),
+              simd_masks16.size() * sizeof(int16_t));
+  std::memcpy(tables + layout.simd_masks32, simd_masks32.data(),
+              simd_masks32.size() * sizeof(int32_t));
+  SetTables(tables);
+}
+
+ConvolutionalCode::ConvolutionalCode(int constraint,
+                                     const std::vector<int>& polynomials,
+                                     int num_branch_outputs,
+                                     int num_simd_mask_sets,
+                                     void* mapping,
+                                     size_t mapping_bytes,
+                                     const char* tables)
+    : constraint_(constraint),
+      polynomials_(polynomials),
+      num_branch_outputs_(num_branch_outputs),
+      num_simd_mask_sets_(num_simd_mask_sets),
+      mapping_(mapping),
+      mapping_bytes_(mapping_bytes),
+      table_bytes_(0) {
+  SetTables(tables);
+}
+
+ConvolutionalCode::~ConvolutionalCode() {
+  if (mapping_ != NULL) {
+    munmap(mapping_, mapping_bytes_);
+  }
+}
+
+void ConvolutionalCode::SetTables(const char* tables) {
+  const int n = num_parity_bits();
+  const size_t num_indices = (size_t) 1 << constraint_;
+  const size_t num_branch_states = num_states();
+  const size_t num_masks =
+      (size_t) num_simd_mask_sets_ * n * (num_indices >> 2);
+  const TableLayout layout =
+      GetTableLayout(constraint_, n, num_branch_outputs_, num_simd_mask_sets_);
+  outputs_ = TableSpan<char>(tables, layout.outputs, num_indices * n);
+  output_words_ = TableSpan<int>(tables, layout.output_words, num_indices);
+  branch_outputs_ = TableSpan<int>(tables, layout.branch_outputs,
+                                   (size_t) num_branch_outputs_ * n);
+  branch0_ = TableSpan<int>(tables, layout.branch0, num_branch_states);
+  branch1_ = TableSpan<int>(tables, layout.branch1, num_branch_states);
+  simd_masks16_ =
+      TableSpan<int16_t>(tables, layout.simd_masks16, num_masks);
+  simd_masks32_ =
+      TableSpan<int32_t>(tables, layout.simd_masks32, num_masks);
+  table_bytes_ = layout.bytes;
+}
+
+bool ConvolutionalCode::Save(const std::string& path) const {
+  const int n = num_parity_bits();
+  const char* tables = outputs_.data();
+
+  TableFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kTableFileMagic;
+  header.version = kTableFileVersion;
+  header.header_bytes = kFixedHeaderBytes + Pad8(n * sizeof(uint32_t));
+  header.constraint = constraint_;
+  header.num_polynomials = n;
+  const std::string dispatch = TableDispatchLevel();
+  std::memcpy(header.dispatch, dispatch.data(),
+              std::min<size_t>(dispatch.size(), kDispatchBytes));
+  header.num_branch_outputs = num_branch_outputs_;
+  header.num_simd_mask_sets = num_simd_mask_sets_;
+  header.table_bytes = table_bytes_;
+  header.checksum = TableChecksum(tables, table_bytes_);
+  std::vector<uint32_t> polynomials(Pad8(n * sizeof(uint32_t)) / 4);
+  for (int i = 0; i < n; i++) {
+    polynomials[i] = polynomials_[i];
+  }
+
+  // Readers see either the old file or the whole new one.
+  const std::string temporary = path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(temporary.c_str(), std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(polynomials.data()),
+              polynomials.size() * sizeof(uint32_t));
+    out.write(tables, table_bytes_);
+    out.close();
+    if (!out) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::shared_ptr<const ConvolutionalCode> ConvolutionalCode::Load(
+    const std::string& path,
+    int constraint,
+    const std::vector<int>& polynomials) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) kFixedHeaderBytes) {
+    close(fd);
+    return NULL;
+  }
+  const size_t size = st.st_size;
+  void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+  const char* data = static_cast<const char*>(mapping);
+
+  TableFileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  const int n = polynomials.size();
+  const size_t header_bytes = kFixedHeaderBytes + Pad8(n * sizeof(uint32_t));
+  char dispatch[kDispatchBytes] = {0};
+  const std::string level = TableDispatchLevel();
+  std::memcpy(dispatch, level.data(),
+              std::min<size_t>(level.size(), kDispatchBytes));
+  bool valid =
+      header.magic == kTableFileMagic &&
+      header.version == kTableFileVersion &&
+      header.header_bytes == header_bytes &&
+      header.constraint == constraint && header.num_polynomials == n &&
+      std::memcmp(header.dispatch, dispatch, kDispatchBytes) == 0 &&
+      (header.num_simd_mask_sets == 0 || header.num_simd_mask_sets == 1 ||
+       header.num_simd_mask_sets == 4) &&
+      header.num_branch_outputs <= ((uint32_t) 1 << constraint) &&
+      header.table_bytes ==
+          GetTableLayout(constraint, n, header.num_branch_outputs,
+                         header.num_simd_mask_sets)
+              .bytes &&
+      size == header_bytes + header.table_bytes;
+  for (int i = 0; valid && i < n; i++) {
+    uint32_t polynomial;
+    std::memcpy(&polynomial, data + kFixedHeaderBytes + i * sizeof(uint32_t),
+                sizeof(polynomial));
+    valid = polynomial == polynomials[i];
+  }
+  valid = valid && TableChecksum(data + header_bytes, header.table_bytes) ==
+                       header.checksum;
+  if (!valid) {
+    munmap(mapping, size);
+    return NULL;
+  }
+  return std::shared_ptr<const ConvolutionalCode>(new ConvolutionalCode(
+      constraint, polynomials, header.num_branch_outputs,
+      header.num_simd_mask_sets, mapping, size, data + header_bytes));
+}
+
+std::string TableDispatchLevel() {
+  static const ViterbiEngine kEngines[] = {kAvx2Engine, kSse2Engine};
+  for (int i = 0; i < 2; i++) {
+    if (EngineLanes(kEngines[i], 16) > 0) {
+      return EngineName(kEngines[i]);
+    }
+  }
+  return EngineName(kScalarEngine);
+}
+
+std::string DefaultTableCacheDir() {
+  const char* dir = std::getenv("VITERBI_TABLE_CACHE");
+  return dir ? dir : "";
+}
@@ -0,0 +1,133 @@
+// Tables of a convolutional code, shared by all codecs of the code and
+// optionally persisted in a cache directory.
+
+#ifndef VITERBI_CODE_H_
+#define VITERBI_CODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// The tables of a convolutional code, which every ViterbiCodec of the code
+// shares whatever its options: those of a 16384-state code take up to 1 MB.
+// Immutable, so any number of threads may use them at once. The mutable state
+// of decoding lives in the decoders, such as ViterbiStreamDecoder, and in the
+// workspaces of the ViterbiCodec methods.
+//
+// The tables are laid out in one block, which is either built in memory or
+// mapped read-only from a table file written by Save(), so processes which
+// map the same file share its pages. A table file is:
+//     uint32 magic            kTableFileMagic
+//     uint16 version          kTableFileVersion
+//     uint16 header_bytes     up to the tables, a multiple of 8
+//     uint32 constraint
+//     uint32 num_polynomials
+//     char   dispatch[16]     TableDispatchLevel(), NUL padded
+//     uint32 num_branch_outputs
+//     uint32 num_simd_mask_sets
+//     uint64 table_bytes
+//     uint64 checksum         of the tables, see viterbi_code.cpp
+//     uint32 polynomials[num_polynomials], padded to a multiple of 8 bytes
+//     the tables, in the order of the members of this class, each padded to a
+//     multiple of 8 bytes
+// in host byte order.
+class ConvolutionalCode {
+ public:
+  static const uint32_t kTableFileMagic = 0x54425456;  // "VTBT"
+  static const int kTableFileVersion = 1;
+
+  // Returns the tables of a code, shared with every codec of the code which
+  // is alive. Otherwise they are mapped from the table file of the code in
+  // DefaultTableCacheDir() if it is set, else built, and then saved there.
+  // Thread-safe.
+  static std::shared_ptr<const ConvolutionalCode> Get(
+      int constraint,
+      const std::vector<int>& polynomials);
+
+  // Maps the table file at path. Returns NULL unless it is a valid table file
+  // of this code, dispatch level and version.
+  static std::shared_ptr<const ConvolutionalCode> Load(
+      const std::string& path,
+      int constraint,
+      const std::vector<int>& polynomials);
+
+  // Name of the table file of a code in a cache directory, which identifies
+  // the code and the dispatch level.
+  static std::string TableFileName(int constraint,
+                                   const std::vector<int>& polynomials);
+
+  // Builds the tables. See ViterbiCodec::ViterbiCodec() for the notation of
+  // polynomials.
+  ConvolutionalCode(int constraint, const std::vector<int>& polynomials);
+  ~ConvolutionalCode();
+
+  ConvolutionalCode(const ConvolutionalCode&) = delete;
+  ConvolutionalCode& operator=(const ConvolutionalCode&) = delete;
+
+  // Writes the table file, replacing any file at path at once. Returns false
+  // if it cannot be written.
+  bool Save(const std::string& path) const;
+
+  int constraint() const { return constraint_; }
+
+  const std::vector<int>& polynomials() const { return polynomials_; }
+
+  int num_parity_bits() const { return polynomials_.size(); }
+
+  int num_states() const { return 1 << (constraint_ - 1); }
+
+  // Bytes taken by the tables.
+  size_t table_bytes() const { return table_bytes_; }
+
+  // Whether the tables are mapped from a table file.
+  bool mapped() const { return mapping_ != NULL; }
+
+ private:
+  friend class ViterbiCodec;
+
+  // A code mapped from a table file.
+  ConvolutionalCode(int constraint,
+                    const std::vector<int>& polynomials,
+                    int num_branch_outputs,
+                    int num_simd_mask_sets,
+                    void* mapping,
+                    size_t mapping_bytes,
+                    const char* tables);
+
+  // Points the tables into the block at tables, and sets table_bytes_.
+  void SetTables(const char* tables);
+
+  const int constraint_;
+  const std::vector<int> polynomials_;
+  int num_branch_outputs_;
+  int num_simd_mask_sets_;
+
+  // The block of the tables, if built.
+  std::vector<uint64_t> storage_;
+  // The table file, if mapped.
+  void* mapping_;
+  size_t mapping_bytes_;
+  size_t table_bytes_;
+
+  // See the members of ViterbiCodec which refer to these.
+  std::span<const char> outputs_;
+  std::span<const int> output_words_;
+  std::span<const int> branch_outputs_;
+  std::span<const int> branch0_;
+  std::span<const int> branch1_;
+  std::span<const int16_t> simd_masks16_;
+  std::span<const int32_t> simd_masks32_;
+};
+
+// Name of the widest SIMD instruction set this CPU supports, which table
+// files are specific to.
+std::string TableDispatchLevel();
+
+// $VITERBI_TABLE_CACHE, a directory of table files, or empty if unset.
+std::string DefaultTableCacheDir();
+
+#endif  // VITERBI_CODE_H_
@@ -0,0 +1,125 @@
+// Implementation of ViterbiHarqBuffer.
+
+#include "viterbi_harq.h"
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "viterbi.h"
+#include "viterbi_acs.h"
+#include "viterbi_snapshot.h"
+
+ViterbiHarqBuffer::ViterbiHarqBuffer(const ViterbiCodec& codec,
+                                     size_t num_symbols,
+                                     int checkpoint_interval)
+    : codec_(codec),
+      checkpoint_interval_(checkpoint_interval > 0 ? checkpoint_interval : 64),
+      num_steps_((num_symbols + codec.num_parity_bits() - 1) /
+                 codec.num_parity_bits()),
+      symbols_(num_symbols),
+      acs_(codec,
+           codec.ChooseEngine(kInt16Symbols, num_symbols),
+           kInt16Symbols),
+      decisions_((size_t) num_steps_ * codec.decision_words(),
+                 codec.memory_resource()),
+      checkpoints_((num_steps_ + checkpoint_interval_ - 1) /
+                   checkpoint_interval_) {
+  Reset();
+}
+
+void ViterbiHarqBuffer::Reset() {
+  std::fill(symbols_.begin(), symbols_.end(), 0);
+  num_checkpoints_ = 0;
+  changed_step_ = 0;
+  decoded_.clear();
+  searched_steps_ = 0;
+}
+
+void ViterbiHarqBuffer::Combine(const int8_t* symbols,
+                                size_t num_symbols,
+                                size_t first,
+                                const std::string& pattern) {
+  CombineSymbols(symbols, num_symbols, first, pattern);
+}
+
+void ViterbiHarqBuffer::Combine(const int16_t* symbols,
+                                size_t num_symbols,
+                                size_t first,
+                                const std::string& pattern) {
+  CombineSymbols(symbols, num_symbols, first, pattern);
+}
+
+template <typename T>
+void ViterbiHarqBuffer::CombineSymbols(const T* symbols,
+                                       size_t num_symbols,
+                                       size_t first,
+                                       const std::string& pattern) {
+  const int n = codec_.num_parity_bits();
+  size_t position = first;
+  for (size_t i = 0; i < num_symbols; i++, position++) {
+    if (!pattern.empty()) {
+      while (position < symbols_.size() &&
+             pattern[position % pattern.size()] != '1') {
+        position++;
+      }
+    }
+    if (position >= symbols_.size()) {
+      break;
+    }
+    const int sum =
+        std::max(-32767, std::min(symbols_[position] + symbols[i], 32767));
+    if (sum != symbols_[position]) {
+      symbols_[position] = sum;
+      changed_step_ = std::min(changed_step_, (int) (position / n));
+    }
+  }
+}
+
+std::string ViterbiHarqBuffer::Decode() {
+  if (changed_step_ >= num_steps_) {
+    searched_steps_ = 0;
+    return decoded_;
+  }
+
+  // Resume from the last valid checkpoint before the first changed step.
+  const int checkpoint =
+      std::min(changed_step_ / checkpoint_interval_, num_checkpoints_ - 1);
+  int step = 0;
+  if (checkpoint < 0) {
+    acs_.Reset();
+  } else {
+    const std::string& snapshot = checkpoints_[checkpoint];
+    SnapshotReader reader(snapshot.data(), snapshot.size());
+    const bool valid = acs_.Restore(&reader);
+    assert(valid);
+    step = checkpoint * checkpoint_interval_;
+  }
+  num_checkpoints_ = checkpoint + 1;
+  searched_steps_ = num_steps_ - step;
+
+  const int n = codec_.num_parity_bits();
+  std::vector<int> cost0(n);
+  std::vector<int> cost1(n);
+  for (; step < num_steps_; step++) {
+    if (step % checkpoint_interval_ == 0 &&
+        step / checkpoint_interval_ == num_checkpoints_) {
+      std::string* snapshot = &checkpoints_[num_checkpoints_++];
+      snapshot->clear();
+      acs_.Snapshot(snapshot);
+    }
+    for (int j = 0; j < n; j++) {
+      const size_t position = (size_t) step * n + j;
+      const int x = position < symbols_.size() ? symbols_[position] : 0;
+      cost0[j] = x < 0 ? -x : 0;
+      cost1[j] = x > 0 ? x : 0;
+    }
+    acs_.Step(cost0.data(), cost1.data(),
+              &decisions_[(size_t) step * codec_.decision_words()]);
+  }
+
+  changed_step_ = num_steps_;
+  decoded_ = codec_.Traceback(decisions_, num_steps_, acs_.BestState());
+  return decoded_;
+}
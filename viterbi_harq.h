@@ -0,0 +1,94 @@
+// Soft combining of retransmitted frames, for hybrid ARQ.
+
+#ifndef VITERBI_HARQ_H_
+#define VITERBI_HARQ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "viterbi.h"
+#include "viterbi_acs.h"
+
+// Accumulates the soft symbols of every transmission of a frame and decodes
+// their sum. Each transmission may repeat the whole frame (chase combining)
+// or carry other symbols of the mother code under a puncturing pattern
+// (incremental redundancy).
+//
+// The path metrics are checkpointed every checkpoint_interval() trellis
+// steps and the decisions of the whole frame kept, so Decode() resumes the
+// search from the last checkpoint before the first step whose symbols
+// changed since the previous Decode(). A retransmission of the end of a
+// frame is searched only there.
+class ViterbiHarqBuffer {
+ public:
+  // The codec must outlive the buffer. num_symbols is the length of the
+  // frame in the mother code, flushing bits included, as ViterbiCodec::
+  // Encode() outputs it. A checkpoint_interval of 0 takes 64 steps.
+  ViterbiHarqBuffer(const ViterbiCodec& codec,
+                    size_t num_symbols,
+                    int checkpoint_interval = 0);
+
+  // Adds the soft symbols of a transmission, see ViterbiCodec::Decode() for
+  // their meaning, to those of the frame from position first on. Sums
+  // saturate at +-32767. If pattern is not empty, it marks the positions of
+  // the frame which are transmitted by '1' and the punctured ones by '0', and
+  // repeats from position 0: each symbol goes to the next transmitted
+  // position. Symbols past the end of the frame are ignored.
+  void Combine(const int8_t* symbols,
+               size_t num_symbols,
+               size_t first = 0,
+               const std::string& pattern = std::string());
+  void Combine(const int16_t* symbols,
+               size_t num_symbols,
+               size_t first = 0,
+               const std::string& pattern = std::string());
+
+  // Decodes the sum of the transmissions so far, as ViterbiCodec::Decode()
+  // would.
+  std::string Decode();
+
+  // Discards the transmissions, for a new frame of the same length.
+  void Reset();
+
+  const ViterbiCodec& codec() const { return codec_; }
+
+  int checkpoint_interval() const { return checkpoint_interval_; }
+
+  // The soft symbols of the frame, summed over its transmissions.
+  const std::vector<int16_t>& symbols() const { return symbols_; }
+
+  // Trellis steps the last Decode() searched.
+  int searched_steps() const { return searched_steps_; }
+
+ private:
+  template <typename T>
+  void CombineSymbols(const T* symbols,
+                      size_t num_symbols,
+                      size_t first,
+                      const std::string& pattern);
+
+  const ViterbiCodec& codec_;
+  const int checkpoint_interval_;
+  const int num_steps_;
+
+  std::vector<int16_t> symbols_;
+
+  AcsState acs_;
+  std::pmr::vector<uint64_t> decisions_;
+  // checkpoints_[i] holds the path metrics before step
+  // i * checkpoint_interval_, as AcsState::Snapshot() writes them. The first
+  // num_checkpoints_ are valid.
+  std::vector<std::string> checkpoints_;
+  int num_checkpoints_;
+
+  // First step whose symbols changed since the last Decode().
+  int changed_step_;
+  std::string decoded_;
+  int searched_steps_;
+};
+
+#endif  // VITERBI_HARQ_H_
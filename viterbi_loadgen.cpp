@@ -0,0 +1,237 @@
+// Load generator for viterbi_server. Runs a number of connections, each with
+// a number of requests in flight, and reports throughput and latency.
+
+#include "viterbi.h"
+#include "viterbi_bits.h"
+#include "viterbi_protocol.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Path of the server's Unix domain socket.
+static std::string FLAGS_socket = kDefaultSocketPath;
+
+// Number of concurrent connections.
+static int FLAGS_connections = 4;
+
+// Number of requests in flight per connection.
+static int FLAGS_depth = 8;
+
+// Total number of requests.
+static int FLAGS_requests = 10000;
+
+// Number of message bits per request.
+static int FLAGS_bits = 1000;
+
+// Request type: encode, bits, int8 or int16.
+static std::string FLAGS_type = "bits";
+
+typedef std::chrono::steady_clock Clock;
+
+void Usage(const std::string& exec) {
+  std::cout
+      << "Usage:\n"
+      << "    " << exec << " [--socket=<path>] [--connections=<n>]"
+      << " [--depth=<n>] [--requests=<n>] [--bits=<n>]"
+      << " [--type=<encode|bits|int8|int16>] [<constraint> <polynomial>...]\n\n"
+      << "Sends random frames to viterbi_server and reports throughput and\n"
+      << "latency percentiles. The code defaults to 7 91 117 121.\n";
+}
+
+std::vector<std::string> ParseFlags(int argc, char** argv) {
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--help") == 0) {
+      Usage(argv[0]);
+      exit(1);
+    } else if (std::strncmp(argv[i], "--socket=", 9) == 0) {
+      FLAGS_socket = argv[i] + 9;
+    } else if (std::strncmp(argv[i], "--connections=", 14) == 0) {
+      FLAGS_connections = std::max(1, std::atoi(argv[i] + 14));
+    } else if (std::strncmp(argv[i], "--depth=", 8) == 0) {
+      FLAGS_depth = std::max(1, std::atoi(argv[i] + 8));
+    } else if (std::strncmp(argv[i], "--requests=", 11) == 0) {
+      FLAGS_requests = std::max(1, std::atoi(argv[i] + 11));
+    } else if (std::strncmp(argv[i], "--bits=", 7) == 0) {
+      FLAGS_bits = std::max(1, std::atoi(argv[i] + 7));
+    } else if (std::strncmp(argv[i], "--type=", 7) == 0) {
+      FLAGS_type = argv[i] + 7;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  return args;
+}
+
+// Builds a request for a random message, and the expected result.
+void MakeRequest(const ViterbiCodec& codec,
+                 Request* request,
+                 std::string* expected) {
+  std::string message;
+  for (int i = 0; i < FLAGS_bits; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const std::string encoded = codec.Encode(message);
+
+  request->constraint = codec.constraint();
+  request->polynomials = codec.polynomials();
+  std::string input;
+  if (FLAGS_type == "encode") {
+    request->type = kEncode;
+    input = message;
+    *expected = encoded;
+  } else {
+    input = encoded;
+    *expected = message;
+  }
+  request->num_symbols = input.size();
+
+  if (FLAGS_type == "encode" || FLAGS_type == "bits") {
+    request->type = FLAGS_type == "encode" ? kEncode : kDecodeBits;
+    request->payload.resize(PayloadSize(request->type, input.size()));
+    PackBytes(input.data(), input.size(),
+              reinterpret_cast<unsigned char*>(&request->payload[0]));
+  } else if (FLAGS_type == "int8") {
+    request->type = kDecodeInt8;
+    request->payload.resize(input.size());
+    for (int i = 0; i < input.size(); i++) {
+      request->payload[i] = input[i] == '0' ? 100 : -100;
+    }
+  } else {
+    request->type = kDecodeInt16;
+    std::vector<int16_t> symbols(input.size());
+    for (int i = 0; i < input.size(); i++) {
+      symbols[i] = input[i] == '0' ? 1000 : -1000;
+    }
+    request->payload.assign(reinterpret_cast<const char*>(symbols.data()),
+                            symbols.size() * sizeof(int16_t));
+  }
+}
+
+struct ConnectionResult {
+  std::vector<double> latencies_us;
+  int errors;
+};
+
+// Runs num_requests requests over one connection, keeping FLAGS_depth of them
+// in flight.
+void RunConnection(const ViterbiCodec& codec,
+                   int num_requests,
+                   ConnectionResult* result) {
+  const int fd = ConnectToServer(FLAGS_socket);
+  if (fd < 0) {
+    std::cout << "Failed to connect to " << FLAGS_socket << ": "
+              << std::strerror(errno) << std::endl;
+    exit(1);
+  }
+
+  Request request;
+  std::string expected;
+  MakeRequest(codec, &request, &expected);
+
+  std::vector<Clock::time_point> sent(num_requests);
+  result->errors = 0;
+  std::string data;
+  std::string decoded;
+  Response response;
+  int num_sent = 0;
+  for (int received = 0; received < num_requests; received++) {
+    // Top up the requests in flight with one write.
+    data.clear();
+    const Clock::time_point now = Clock::now();
+    while (num_sent < num_requests && num_sent - received < FLAGS_depth) {
+      request.id = num_sent;
+      SerializeRequest(request, &data);
+      sent[num_sent++] = now;
+    }
+    if (!WriteFully(fd, data.data(), data.size()) ||
+        !ReadMessage(fd, &data) || !ParseResponse(data, &response)) {
+      std::cout << "Lost connection to " << FLAGS_socket << std::endl;
+      exit(1);
+    }
+    result->latencies_us.push_back(
+        std::chrono::duration<double, std::micro>(Clock::now() -
+                                                  sent[response.id])
+            .count());
+
+    decoded.assign(response.num_bits, '0');
+    UnpackBytes(reinterpret_cast<const unsigned char*>(response.payload.data()),
+                response.num_bits, &decoded[0]);
+    if (response.status != kOk || decoded != expected) {
+      result->errors++;
+    }
+  }
+  close(fd);
+}
+
+double Percentile(const std::vector<double>& sorted, double p) {
+  return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> args = ParseFlags(argc, argv);
+  int constraint = 7;
+  std::vector<int> polynomials;
+  if (args.empty()) {
+    polynomials.push_back(91);
+    polynomials.push_back(117);
+    polynomials.push_back(121);
+  } else if (args.size() < 3) {
+    std::cout << "Insufficient number of arguments." << std::endl;
+    exit(1);
+  } else {
+    constraint = std::atoi(args[0].c_str());
+    for (int i = 1; i < args.size(); i++) {
+      polynomials.push_back(std::atoi(args[i].c_str()));
+    }
+  }
+  ViterbiCodec codec(constraint, polynomials);
+
+  std::vector<ConnectionResult> results(FLAGS_connections);
+  std::vector<std::thread> threads;
+  const Clock::time_point start = Clock::now();
+  for (int i = 0; i < FLAGS_connections; i++) {
+    const int num_requests = FLAGS_requests / FLAGS_connections +
+                             (i < FLAGS_requests % FLAGS_connections);
+    threads.push_back(
+        std::thread(RunConnection, std::cref(codec), num_requests,
+                    &results[i]));
+  }
+  for (int i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::vector<double> latencies;
+  int errors = 0;
+  for (int i = 0; i < results.size(); i++) {
+    latencies.insert(latencies.end(), results[i].latencies_us.begin(),
+                     results[i].latencies_us.end());
+    errors += results[i].errors;
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  std::cout << codec << ", " << FLAGS_type << ", " << FLAGS_bits
+            << " bits per request\n"
+            << "requests:   " << latencies.size() << " in " << seconds
+            << " s, " << errors << " errors\n"
+            << "throughput: " << latencies.size() / seconds << " requests/s, "
+            << latencies.size() * (double) FLAGS_bits / seconds / 1e6
+            << " Mbit/s\n"
+            << "latency:    p50 " << Percentile(latencies, 0.5) << " us, p99 "
+            << Percentile(latencies, 0.99) << " us, p99.9 "
+            << Percentile(latencies, 0.999) << " us, max "
+            << latencies.back() << " us" << std::endl;
+  return errors == 0 ? 0 : 1;
+}
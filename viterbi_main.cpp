@@ -4,13 +4,30 @@
 // Date: 01/30/2015
 
 #include "viterbi.h"
+#include "viterbi_bits.h"
+#include "viterbi_cache.h"
+#include "viterbi_pipeline.h"
+#include "viterbi_stream.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 // Whether to reverse polynomials. This is to support a different notation of
@@ -22,6 +39,41 @@ static bool FLAGS_reverse_polynomials = false;
 // Whether to perform encoding instead of decoding.
 static bool FLAGS_encode = false;
 
+// Whether to treat every stdin line as an independent job.
+static bool FLAGS_batch = false;
+
+// Number of worker threads in batch mode. 0 means one per hardware thread.
+static int FLAGS_threads = 0;
+
+// Raw binary capture to decode instead of text input. Empty means none.
+static std::string FLAGS_input_file;
+
+// Format of --input_file or --stream input: "text" ('0' and '1'
+// characters), "bits" (packed hard bits), "int8" or "int16" (soft symbols, see
+// ViterbiCodec::Decode()). Empty means "bits" for --input_file and "text" for
+// --stream.
+static std::string FLAGS_input_format;
+
+// Whether to encode or decode stdin to stdout as a continuous stream, writing
+// bits as soon as they are final.
+static bool FLAGS_stream = false;
+
+// Maximum number of trellis steps a decoded bit may wait before output in
+// stream mode. 0 means the decoder's default.
+static int FLAGS_flush_latency = 0;
+
+// Traceback depth of the streaming decoder. 0 means 5 times the constraint.
+static int FLAGS_traceback_depth = 0;
+
+// Whether the streaming decoder outputs bits as soon as all survivor paths
+// have merged, and reports the depths of the merges on stderr.
+static bool FLAGS_commit_on_merge = false;
+
+// Whether to decode a stream on a pipeline of threads, and the CPUs to pin
+// them to, comma separated. Empty leaves them unpinned.
+static bool FLAGS_pipeline = false;
+static std::string FLAGS_pipeline_cpus;
+
 void Usage(const std::string& exec) {
   std::cout
       << "Usage:\n"
@@ -33,6 +85,18 @@ void Usage(const std::string& exec) {
       << "        <constraint> <polynomial>... <bits>\n\n"
       << "    Example input:\n"
       << "        3 7 5 0011100001100111111000101100111011\n\n"
+      << "Read independent jobs from stdin, one per line:\n"
+      << "    " << exec << " --batch [--threads=<n>] [--reverse_polynomials]"
+      << " [--encode]\n\n"
+      << "Decode a raw binary capture, writing packed bits to stdout:\n"
+      << "    " << exec << " --input_file=<path> [--input_format=<format>]"
+      << " [--traceback_depth=<n>] [--reverse_polynomials]"
+      << " <constraint> <polynomial>...\n\n"
+      << "Encode or decode stdin to stdout as a continuous stream:\n"
+      << "    " << exec << " --stream [--input_format=<format>]"
+      << " [--traceback_depth=<n>] [--flush_latency=<n>] [--commit_on_merge]"
+      << " [--pipeline] [--pipeline_cpus=<cpu>,<cpu>,<cpu>]"
+      << " [--reverse_polynomials] [--encode] <constraint> <polynomial>...\n\n"
       << "Read input from commandline arguments:\n"
       << "    " << exec << " [--reverse_polynomials] [--encode]"
       << " <constraint> <polynomial>... <bits>\n\n"
@@ -41,6 +105,46 @@ void Usage(const std::string& exec) {
       << "        Reverse polynomials. E.g. 6 (=0b110) becomes 3 (=0b011).\n\n"
       << "    --encode\n"
       << "        Do encoding instead of decoding.\n\n"
+      << "    --batch\n"
+      << "        Treat every stdin line as its own job. Results are written\n"
+      << "        one per line, in input order.\n\n"
+      << "    --threads=<n>\n"
+      << "        Number of worker threads in batch mode. Defaults to the\n"
+      << "        number of hardware threads.\n\n"
+      << "    --input_file=<path>\n"
+      << "        Decode a raw binary capture with the streaming decoder.\n"
+      << "        Decoded bits are written to stdout packed into bytes, most\n"
+      << "        significant bit first.\n\n"
+      << "    --input_format=<text|bits|int8|int16>\n"
+      << "        Format of --input_file or --stream input: '0' and '1'\n"
+      << "        characters (default for --stream), packed hard bits\n"
+      << "        (default for --input_file), or 8-bit or 16-bit soft\n"
+      << "        symbols where positive means 0. Binary input is decoded to\n"
+      << "        packed bits, text input to text.\n\n"
+      << "    --stream\n"
+      << "        Encode or decode stdin to stdout in chunks, writing bits as\n"
+      << "        soon as they are final.\n\n"
+      << "    --flush_latency=<n>\n"
+      << "        In stream mode, output every decoded bit at most n trellis\n"
+      << "        steps after it is received. Must exceed the traceback\n"
+      << "        depth.\n\n"
+      << "    --traceback_depth=<n>\n"
+      << "        Traceback depth of the streaming decoder. Defaults to the\n"
+      << "        tuned depth (see viterbi_tune), else 5 times the\n"
+      << "        constraint.\n\n"
+      << "    --commit_on_merge\n"
+      << "        In stream mode, output decoded bits as soon as all survivor\n"
+      << "        paths have merged, usually well within the traceback depth,\n"
+      << "        and report the depths of the merges on stderr.\n\n"
+      << "    --pipeline\n"
+      << "        In stream mode, decode on three threads: symbol costs,\n"
+      << "        add-compare-select and traceback. Faster for one fast\n"
+      << "        stream on an otherwise idle machine, with the same output.\n"
+      << "        Bits are output later than without it, so it excludes\n"
+      << "        --flush_latency.\n\n"
+      << "    --pipeline_cpus=<cpu>,<cpu>,<cpu>\n"
+      << "        Pin the threads of --pipeline, which it implies, to these\n"
+      << "        CPUs.\n\n"
       << "Examples:\n"
       << exec << " 3 7 5 0011100001100111111000101100111011\n"
       << exec << " 3 6 5 111011011100101011\n"
@@ -64,6 +168,38 @@ std::vector<std::string> ParseFlags(int argc, char** argv) {
       FLAGS_reverse_polynomials = true;
     } else if (std::strcmp(argv[i], "--encode") == 0) {
       FLAGS_encode = true;
+    } else if (std::strcmp(argv[i], "--batch") == 0) {
+      FLAGS_batch = true;
+    } else if (std::strncmp(argv[i], "--input_file=", 13) == 0) {
+      FLAGS_input_file = argv[i] + 13;
+    } else if (std::strncmp(argv[i], "--input_format=", 15) == 0) {
+      FLAGS_input_format = argv[i] + 15;
+      if (FLAGS_input_format != "text" && FLAGS_input_format != "bits" &&
+          FLAGS_input_format != "int8" && FLAGS_input_format != "int16") {
+        std::cout << "Expected text, bits, int8 or int16, found "
+                  << FLAGS_input_format << std::endl;
+        exit(1);
+      }
+    } else if (std::strcmp(argv[i], "--stream") == 0) {
+      FLAGS_stream = true;
+    } else if (std::strncmp(argv[i], "--flush_latency=", 16) == 0) {
+      FLAGS_flush_latency = std::atoi(argv[i] + 16);
+    } else if (std::strcmp(argv[i], "--commit_on_merge") == 0) {
+      FLAGS_commit_on_merge = true;
+    } else if (std::strcmp(argv[i], "--pipeline") == 0) {
+      FLAGS_pipeline = true;
+    } else if (std::strncmp(argv[i], "--pipeline_cpus=", 16) == 0) {
+      FLAGS_pipeline = true;
+      FLAGS_pipeline_cpus = argv[i] + 16;
+    } else if (std::strncmp(argv[i], "--traceback_depth=", 18) == 0) {
+      FLAGS_traceback_depth = std::atoi(argv[i] + 18);
+    } else if (std::strncmp(argv[i], "--threads=", 10) == 0) {
+      FLAGS_threads = std::atoi(argv[i] + 10);
+      if (FLAGS_threads < 0) {
+        std::cout << "Expected a non-negative thread count, found "
+                  << argv[i] + 10 << std::endl;
+        exit(1);
+      }
     } else {
       args.push_back(argv[i]);
     }
@@ -71,73 +207,642 @@ std::vector<std::string> ParseFlags(int argc, char** argv) {
   return args;
 }
 
-int ParseInt(const std::string& s) {
+// Parses a decimal integer. Returns false if s is not a number.
+bool ParseInt(const std::string& s, int* i) {
   char* end;
-  const int i = (int) std::strtol(s.c_str(), &end, 10);
-  if (end - s.c_str() != s.size()) {
-    std::cout << "Expected a number, found " << s << std::endl;
-    exit(1);
+  *i = (int) std::strtol(s.c_str(), &end, 10);
+  return !s.empty() && end - s.c_str() == s.size();
+}
+
+// Largest constraint accepted, as by viterbi_server, which bounds the table
+// sizes. One bad line of a batch must not exhaust memory for the others.
+const int kMaxConstraint = 16;
+
+// Parses and validates "<constraint> <polynomial>...", the first num_args of
+// args. Returns false and sets *error if the arguments are invalid.
+bool ParseCode(const std::vector<std::string>& args,
+               int num_args,
+               int* constraint,
+               std::vector<int>* polynomials,
+               std::string* error) {
+  std::ostringstream os;
+
+  // Parse and validate constraint.
+  if (!ParseInt(args[0], constraint)) {
+    os << "Expected a number, found " << args[0];
+    *error = os.str();
+    return false;
+  }
+  if (*constraint < 2 || *constraint > kMaxConstraint) {
+    os << "Constraint should be between 2 and " << kMaxConstraint
+       << ", found " << *constraint;
+    *error = os.str();
+    return false;
+  }
+
+  // Parse and validate generator polynomials.
+  polynomials->clear();
+  for (int i = 1; i < num_args; i++) {
+    int polynomial;
+    if (!ParseInt(args[i], &polynomial)) {
+      os << "Expected a number, found " << args[i];
+      *error = os.str();
+      return false;
+    }
+    if (polynomial <= 0) {
+      os << "Polynomial should be greater than 0, found " << polynomial;
+      *error = os.str();
+      return false;
+    }
+    if (polynomial >= (1 << *constraint)) {
+      os << "Polynomial should be less than " << (1 << *constraint)
+         << ", found " << polynomial;
+      *error = os.str();
+      return false;
+    }
+    polynomials->push_back(polynomial);
+  }
+  if (FLAGS_reverse_polynomials) {
+    for (int i = 0; i < polynomials->size(); i++) {
+      (*polynomials)[i] = ReverseBits(*constraint, (*polynomials)[i]);
+    }
   }
-  return i;
+  return true;
 }
 
-void ViterbiMain(const std::vector<std::string>& args) {
+// Parses and validates "<constraint> <polynomial>... <bits>".
+// Returns false and sets *error if the arguments are invalid.
+bool ParseJob(const std::vector<std::string>& args,
+              int* constraint,
+              std::vector<int>* polynomials,
+              std::string* bits,
+              std::string* error) {
   if (args.size() < 4) {
-    std::cout << "Insufficient number of arguments." << std::endl;
-    exit(1);
+    *error = "Insufficient number of arguments.";
+    return false;
+  }
+  if (!ParseCode(args, args.size() - 1, constraint, polynomials, error)) {
+    return false;
   }
 
-  // Parse and validate constraint.
-  const int constraint = ParseInt(args[0]);
-  if (constraint <= 0) {
-    std::cout << "Constraint should be greater than 0, found " << constraint
-              << std::endl;
+  // Parse and validate bit sequence.
+  *bits = args.back();
+  if (FindNonBit(bits->data(), bits->size()) != bits->size()) {
+    *error = "Expected a binary sequence, found " + *bits;
+    return false;
+  }
+  return true;
+}
+
+void ViterbiMain(const std::vector<std::string>& args) {
+  int constraint;
+  std::vector<int> polynomials;
+  std::string bits;
+  std::string error;
+  if (!ParseJob(args, &constraint, &polynomials, &bits, &error)) {
+    std::cout << error << std::endl;
     exit(1);
   }
 
-  // Parse and validate generator polynomials.
+  ViterbiCodec codec(constraint, polynomials);
+
+  if (FLAGS_encode) {
+    std::cout << codec.Encode(bits) << std::endl;
+  } else {
+    std::cout << codec.Decode(bits) << std::endl;
+  }
+}
+
+// Bounded window of results indexed by job sequence number. Workers may
+// complete jobs in any order; the writer takes them back in input order. At
+// most window() jobs are in flight at any time, which bounds memory use no
+// matter how long the input is.
+class ReorderBuffer {
+ public:
+  explicit ReorderBuffer(size_t window)
+      : slots_(window), ready_(window, false), next_(0), closed_(false) {}
+
+  size_t window() const { return slots_.size(); }
+
+  // Blocks until job `sequence` fits into the window.
+  void Reserve(size_t sequence) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    reserved_.wait(lock, [&] { return sequence < next_ + window(); });
+  }
+
+  void Put(size_t sequence, std::string* result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t slot = sequence % window();
+    slots_[slot].swap(*result);
+    ready_[slot] = true;
+    if (sequence == next_) {
+      available_.notify_one();
+    }
+  }
+
+  // No more jobs will be reserved after `num_jobs` jobs.
+  void Close(size_t num_jobs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    num_jobs_ = num_jobs;
+    available_.notify_one();
+  }
+
+  // Takes the next result in input order. Returns false once all results have
+  // been taken.
+  bool Take(std::string* result) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const size_t slot = next_ % window();
+    available_.wait(lock, [&] {
+      return ready_[slot] || (closed_ && next_ == num_jobs_);
+    });
+    if (!ready_[slot]) {
+      return false;
+    }
+    result->swap(slots_[slot]);
+    ready_[slot] = false;
+    next_++;
+    reserved_.notify_all();
+    return true;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable reserved_;
+  std::condition_variable available_;
+  std::vector<std::string> slots_;
+  std::vector<bool> ready_;
+  size_t next_;
+  bool closed_;
+  size_t num_jobs_;
+};
+
+// FIFO of input lines waiting for a worker.
+class JobQueue {
+ public:
+  JobQueue() : closed_(false) {}
+
+  void Push(size_t sequence, std::string* line) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::make_pair(sequence, std::string()));
+    jobs_.back().second.swap(*line);
+    not_empty_.notify_one();
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+  // Returns false once the queue is closed and drained.
+  bool Pop(size_t* sequence, std::string* line) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [&] { return !jobs_.empty() || closed_; });
+    if (jobs_.empty()) {
+      return false;
+    }
+    *sequence = jobs_.front().first;
+    line->swap(jobs_.front().second);
+    jobs_.pop_front();
+    return true;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::deque<std::pair<size_t, std::string> > jobs_;
+  bool closed_;
+};
+
+// Runs one batch job. Invalid jobs produce their error message instead of a
+// result so that output lines stay aligned with input lines.
+std::string RunBatchJob(const std::string& line, ViterbiCodecCache* cache) {
+  std::vector<std::string> args;
+  std::istringstream is(line);
+  std::string arg;
+  while (is >> arg) {
+    args.push_back(arg);
+  }
+
+  int constraint;
   std::vector<int> polynomials;
-  for (int i = 1; i < args.size() - 1; i++) {
-    const int polynomial = ParseInt(args[i]);
-    if (polynomial <= 0) {
-      std::cout << "Polynomial should be greater than 0, found " << polynomial
+  std::string bits;
+  std::string error;
+  if (!ParseJob(args, &constraint, &polynomials, &bits, &error)) {
+    return error;
+  }
+
+  const ViterbiCodec& codec = cache->Get(constraint, polynomials);
+  return FLAGS_encode ? codec.Encode(bits) : codec.Decode(bits);
+}
+
+// Reads jobs from stdin, one per line, runs them on a pool of worker threads
+// and writes results to stdout in input order.
+void BatchMain() {
+  int num_threads = FLAGS_threads;
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  ViterbiCodecCache cache;
+  JobQueue queue;
+  ReorderBuffer results(64 * num_threads);
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < num_threads; i++) {
+    workers.push_back(std::thread([&] {
+      size_t sequence;
+      std::string line;
+      while (queue.Pop(&sequence, &line)) {
+        std::string result = RunBatchJob(line, &cache);
+        results.Put(sequence, &result);
+      }
+    }));
+  }
+
+  std::thread writer([&] {
+    std::string result;
+    while (results.Take(&result)) {
+      std::cout << result << '\n';
+    }
+    std::cout.flush();
+  });
+
+  size_t num_jobs = 0;
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    // Skip blank line and comment line (start with '#')
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    results.Reserve(num_jobs);
+    queue.Push(num_jobs++, &line);
+  }
+  queue.Close();
+  results.Close(num_jobs);
+
+  for (int i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  writer.join();
+}
+
+// Writes all of data to fd, or exits on failure.
+void WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Failed to write output: " << std::strerror(errno)
                 << std::endl;
       exit(1);
     }
-    if (polynomial >= (1 << constraint)) {
-      std::cout << "Polynomial should be less than " << (1 << constraint)
-                << ", found " << polynomial << std::endl;
-      exit(1);
+    data += written;
+    size -= written;
+  }
+}
+
+// Buffers bits and writes them packed into bytes, most significant bit first,
+// in large writes.
+class PackedWriter {
+ public:
+  explicit PackedWriter(int fd) : fd_(fd), byte_(0), num_bits_(0) {
+    buffer_.reserve(kBufferSize);
+  }
+
+  void Append(const std::string& bits) {
+    size_t i = 0;
+    // Complete a partial byte left over from the last call.
+    for (; i < bits.size() && num_bits_ > 0; i++) {
+      AppendBit(bits[i] - '0');
+    }
+    // Pack whole bytes at once.
+    const size_t num_bytes = (bits.size() - i) / 8;
+    const size_t size = buffer_.size();
+    buffer_.resize(size + num_bytes);
+    PackBytes(bits.data() + i, num_bytes * 8, &buffer_[size]);
+    for (i += num_bytes * 8; i < bits.size(); i++) {
+      AppendBit(bits[i] - '0');
+    }
+    if (buffer_.size() >= kBufferSize) {
+      Flush();
     }
-    polynomials.push_back(polynomial);
   }
-  if (FLAGS_reverse_polynomials) {
-    for (int i = 0; i < polynomials.size(); i++) {
-      polynomials[i] = ReverseBits(constraint, polynomials[i]);
+
+  // Writes out all complete bytes.
+  void Flush() {
+    WriteAll(fd_, reinterpret_cast<const char*>(buffer_.data()),
+             buffer_.size());
+    buffer_.clear();
+  }
+
+  // Pads the last byte with "0" bits and writes everything out.
+  void Finish() {
+    if (num_bits_ > 0) {
+      buffer_.push_back(byte_ << (8 - num_bits_));
+      byte_ = 0;
+      num_bits_ = 0;
     }
+    Flush();
   }
 
-  // Parse and validate bit sequence.
-  const std::string& bits = args.back();
-  for (int i = 0; i < bits.size(); i++) {
-    if (bits[i] != '0' && bits[i] != '1') {
-      std::cout << "Expected a binary sequence, found " << bits << std::endl;
+ private:
+  static const size_t kBufferSize = 1 << 20;
+
+  void AppendBit(int bit) {
+    byte_ = (byte_ << 1) | bit;
+    if (++num_bits_ == 8) {
+      buffer_.push_back(byte_);
+      byte_ = 0;
+      num_bits_ = 0;
+    }
+  }
+
+  const int fd_;
+  std::vector<unsigned char> buffer_;
+  unsigned char byte_;
+  int num_bits_;
+};
+
+// Parses "<constraint> <polynomial>..." for the file and stream modes, and
+// validates the traceback depth.
+void ParseCodeOrDie(const std::vector<std::string>& args,
+                    int* constraint,
+                    std::vector<int>* polynomials) {
+  if (args.size() < 3) {
+    std::cout << "Insufficient number of arguments." << std::endl;
+    exit(1);
+  }
+
+  std::string error;
+  if (!ParseCode(args, args.size(), constraint, polynomials, &error)) {
+    std::cout << error << std::endl;
+    exit(1);
+  }
+  if (FLAGS_traceback_depth != 0 && FLAGS_traceback_depth < *constraint - 1) {
+    std::cout << "Traceback depth should be at least " << *constraint - 1
+              << ", found " << FLAGS_traceback_depth << std::endl;
+    exit(1);
+  }
+}
+
+// Decodes --input_file with the streaming decoder. The file is memory mapped
+// and read in place.
+void InputFileMain(const std::vector<std::string>& args) {
+  if (FLAGS_encode) {
+    std::cout << "--input_file only supports decoding." << std::endl;
+    exit(1);
+  }
+  if (FLAGS_input_format.empty()) {
+    FLAGS_input_format = "bits";
+  }
+  if (FLAGS_input_format == "text") {
+    std::cout << "--input_file only supports binary formats." << std::endl;
+    exit(1);
+  }
+
+  int constraint;
+  std::vector<int> polynomials;
+  ParseCodeOrDie(args, &constraint, &polynomials);
+
+  const int fd = open(FLAGS_input_file.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    std::cout << "Failed to open " << FLAGS_input_file << ": "
+              << std::strerror(errno) << std::endl;
+    exit(1);
+  }
+  const size_t size = st.st_size;
+  if (FLAGS_input_format == "int16" && size % 2 != 0) {
+    std::cout << "Expected an even file size for int16 input, found " << size
+              << std::endl;
+    exit(1);
+  }
+
+  const unsigned char* data = NULL;
+  if (size > 0) {
+    void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      std::cout << "Failed to map " << FLAGS_input_file << ": "
+                << std::strerror(errno) << std::endl;
       exit(1);
     }
+    madvise(p, size, MADV_SEQUENTIAL);
+    data = static_cast<const unsigned char*>(p);
   }
+  close(fd);
 
   ViterbiCodec codec(constraint, polynomials);
+  ViterbiStreamDecoder decoder(codec, FLAGS_traceback_depth);
+  PackedWriter writer(STDOUT_FILENO);
+  std::string decoded;
+
+  // Feed the mapping in chunks, so that output is written while decoding.
+  const size_t kChunkSize = 1 << 20;
+  for (size_t offset = 0; offset < size; offset += kChunkSize) {
+    const size_t chunk = std::min(kChunkSize, size - offset);
+    if (FLAGS_input_format == "bits") {
+      decoder.FeedPacked(data + offset, chunk * 8, &decoded);
+    } else if (FLAGS_input_format == "int8") {
+      decoder.Feed(reinterpret_cast<const int8_t*>(data + offset), chunk,
+                   &decoded);
+    } else {
+      decoder.Feed(reinterpret_cast<const int16_t*>(data + offset), chunk / 2,
+                   &decoded);
+    }
+    writer.Append(decoded);
+    decoded.clear();
+  }
+  decoder.Finish(&decoded);
+  writer.Append(decoded);
+  writer.Finish();
+
+  if (data != NULL) {
+    munmap(const_cast<unsigned char*>(data), size);
+  }
+}
+
+// Encodes or decodes stdin to stdout with decoder, a ViterbiStreamDecoder or
+// a ViterbiPipelineDecoder.
+template <typename Decoder>
+void RunStream(const ViterbiCodec& codec, Decoder* decoder) {
+  const size_t kChunkSize = 1 << 16;
+  const bool text = FLAGS_input_format == "text";
+  ViterbiStreamEncoder encoder(codec);
+  PackedWriter writer(STDOUT_FILENO);
+  std::vector<char> buffer(kChunkSize);
+  std::string bits;
+  std::string output;
+  bits.reserve(kChunkSize);
+  // Encoding outputs n bits per input bit, and decoding at most 8 bits per
+  // input byte, packed ones.
+  output.reserve(std::max(codec.num_parity_bits(), 8) * kChunkSize +
+                 decoder->max_latency());
+
+  size_t leftover = 0;
+  while (true) {
+    const ssize_t size =
+        read(STDIN_FILENO, buffer.data() + leftover, kChunkSize - leftover);
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cout << "Failed to read input: " << std::strerror(errno)
+                << std::endl;
+      exit(1);
+    }
+    if (size == 0) {
+      break;
+    }
+    const char* data = buffer.data();
+    const size_t available = leftover + size;
+    leftover = 0;
+
+    if (text) {
+      // Collect runs of bits, skipping whitespace between them.
+      for (size_t i = 0; i < available; i++) {
+        const size_t run = FindNonBit(data + i, available - i);
+        bits.append(data + i, run);
+        i += run;
+        if (i < available && !std::isspace(data[i])) {
+          std::cout << "Expected a binary sequence, found " << data[i]
+                    << std::endl;
+          exit(1);
+        }
+      }
+      if (FLAGS_encode) {
+        encoder.Feed(bits, &output);
+      } else {
+        decoder->Feed(bits, &output);
+      }
+      bits.clear();
+      WriteAll(STDOUT_FILENO, output.data(), output.size());
+    } else {
+      const unsigned char* bytes =
+          reinterpret_cast<const unsigned char*>(data);
+      if (FLAGS_input_format == "bits") {
+        decoder->FeedPacked(bytes, available * 8, &output);
+      } else if (FLAGS_input_format == "int8") {
+        decoder->Feed(reinterpret_cast<const int8_t*>(bytes), available,
+                     &output);
+      } else {
+        // Keep an odd trailing byte for the next chunk.
+        decoder->Feed(reinterpret_cast<const int16_t*>(bytes), available / 2,
+                     &output);
+        if (available % 2 != 0) {
+          buffer[0] = data[available - 1];
+          leftover = 1;
+        }
+      }
+      writer.Append(output);
+      writer.Flush();
+    }
+    output.clear();
+  }
 
   if (FLAGS_encode) {
-    std::cout << codec.Encode(bits) << std::endl;
+    encoder.Finish(&output);
   } else {
-    std::cout << codec.Decode(bits) << std::endl;
+    decoder->Finish(&output);
+  }
+  if (text) {
+    output += '\n';
+    WriteAll(STDOUT_FILENO, output.data(), output.size());
+  } else {
+    writer.Append(output);
+    writer.Finish();
   }
 }
 
+// Encodes or decodes stdin to stdout as a continuous stream. Input is read in
+// chunks as it arrives, and output is written as soon as it is final. All
+// buffers are allocated up front.
+void StreamMain(const std::vector<std::string>& args) {
+  if (FLAGS_input_format.empty()) {
+    FLAGS_input_format = "text";
+  }
+  if (FLAGS_encode && FLAGS_input_format != "text") {
+    std::cout << "--stream only supports encoding text." << std::endl;
+    exit(1);
+  }
+
+  int constraint;
+  std::vector<int> polynomials;
+  ParseCodeOrDie(args, &constraint, &polynomials);
+  ViterbiCodec codec(constraint, polynomials);
+  const int traceback_depth = FLAGS_traceback_depth != 0
+                                  ? FLAGS_traceback_depth
+                                  : codec.traceback_depth();
+  if (FLAGS_flush_latency != 0 && FLAGS_flush_latency <= traceback_depth) {
+    std::cout << "Flush latency should be greater than " << traceback_depth
+              << ", found " << FLAGS_flush_latency << std::endl;
+    exit(1);
+  }
+
+  if (FLAGS_pipeline && FLAGS_flush_latency != 0) {
+    std::cout << "--pipeline does not support --flush_latency" << std::endl;
+    exit(1);
+  }
+  if (FLAGS_pipeline && FLAGS_commit_on_merge) {
+    std::cout << "--pipeline does not support --commit_on_merge" << std::endl;
+    exit(1);
+  }
+  if (!FLAGS_pipeline || FLAGS_encode) {
+    ViterbiStreamDecoder decoder(codec, traceback_depth, FLAGS_flush_latency);
+    decoder.set_commit_on_merge(FLAGS_commit_on_merge);
+    RunStream(codec, &decoder);
+    if (FLAGS_commit_on_merge && !FLAGS_encode) {
+      const ViterbiMergeStats& stats = decoder.merge_stats();
+      std::cerr << "Merges: " << stats.num_merges
+                << ", mean depth: " << stats.mean_depth()
+                << ", 99.9th percentile: " << stats.Percentile(0.999)
+                << ", max depth: " << stats.max_depth << std::endl;
+    }
+    return;
+  }
+
+  std::vector<int> cpus;
+  std::istringstream cpu_list(FLAGS_pipeline_cpus);
+  std::string cpu;
+  while (std::getline(cpu_list, cpu, ',')) {
+    if (cpu.empty() || cpu.find_first_not_of("0123456789") != cpu.npos) {
+      std::cout << "Expected CPU numbers, found " << FLAGS_pipeline_cpus
+                << std::endl;
+      exit(1);
+    }
+    cpus.push_back(std::atoi(cpu.c_str()));
+  }
+  ViterbiPipelineDecoder decoder(codec, traceback_depth, 0, cpus);
+  RunStream(codec, &decoder);
+}
+
 int main(int argc, char** argv) {
   std::vector<std::string> args = ParseFlags(argc, argv);
 
+  if (FLAGS_batch) {
+    if (!args.empty()) {
+      std::cout << "--batch reads jobs from stdin, found argument " << args[0]
+                << std::endl;
+      exit(1);
+    }
+    std::ios::sync_with_stdio(false);
+    BatchMain();
+    return 0;
+  }
+
+  if (!FLAGS_input_file.empty()) {
+    InputFileMain(args);
+    return 0;
+  }
+
+  if (FLAGS_stream) {
+    StreamMain(args);
+    return 0;
+  }
+
   if (args.empty()) {
     // No non-flag arguments are provided in commandline, Read input from stdin.
     std::string line;
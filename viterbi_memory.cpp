@@ -0,0 +1,266 @@
+// Implementation of the memory resources.
+
+#include "viterbi_memory.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Maps bytes, a multiple of the huge page size, aligned to a huge page. Sets
+// *reserved if the mapping is in reserved huge pages. Returns NULL on failure.
+void* MapHugePages(size_t bytes, bool* reserved) {
+  const size_t page = HugePageResource::kHugePageBytes;
+  void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED) {
+    *reserved = true;
+    return p;
+  }
+
+  // Over-map to align the mapping, then trim it.
+  *reserved = false;
+  p = mmap(NULL, bytes + page, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+  const uintptr_t begin = (uintptr_t) p;
+  const uintptr_t aligned = (begin + page - 1) & ~(uintptr_t) (page - 1);
+  if (aligned > begin) {
+    munmap(p, aligned - begin);
+  }
+  if (begin + page > aligned) {
+    munmap((void*) (aligned + bytes), begin + page - aligned);
+  }
+  madvise((void*) aligned, bytes, MADV_HUGEPAGE);
+  return (void*) aligned;
+}
+
+}  // namespace
+
+HugePageResource::HugePageResource(size_t max_cached_bytes,
+                                   std::pmr::memory_resource* upstream)
+    : max_cached_bytes_(max_cached_bytes),
+      upstream_(upstream),
+      cached_bytes_(0),
+      num_mappings_(0),
+      num_reserved_mappings_(0) {}
+
+HugePageResource::~HugePageResource() {
+  Release();
+  assert(mapped_.empty());
+}
+
+void HugePageResource::Release() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::multimap<size_t, void*>::iterator it = cache_.begin();
+       it != cache_.end(); ++it) {
+    munmap(it->second, it->first);
+  }
+  cache_.clear();
+  cached_bytes_ = 0;
+}
+
+int HugePageResource::num_mappings() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_mappings_;
+}
+
+int HugePageResource::num_reserved_mappings() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_reserved_mappings_;
+}
+
+void* HugePageResource::do_allocate(size_t bytes, size_t alignment) {
+  if (bytes < kMinHugeBytes || alignment > kHugePageBytes) {
+    return upstream_->allocate(bytes, alignment);
+  }
+  const size_t size = (bytes + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Reuse a cached mapping unless it would waste more than half of itself.
+  std::multimap<size_t, void*>::iterator it = cache_.lower_bound(size);
+  if (it != cache_.end() && it->first <= 2 * size) {
+    void* p = it->second;
+    mapped_[p] = it->first;
+    cached_bytes_ -= it->first;
+    cache_.erase(it);
+    return p;
+  }
+
+  bool reserved;
+  void* p = MapHugePages(size, &reserved);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  mapped_[p] = size;
+  num_mappings_++;
+  num_reserved_mappings_ += reserved;
+  return p;
+}
+
+void HugePageResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+  if (bytes < kMinHugeBytes || alignment > kHugePageBytes) {
+    upstream_->deallocate(p, bytes, alignment);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<void*, size_t>::iterator it = mapped_.find(p);
+  assert(it != mapped_.end());
+  const size_t size = it->second;
+  mapped_.erase(it);
+  // Make room for it by evicting the largest cached mappings.
+  while (!cache_.empty() && cached_bytes_ + size > max_cached_bytes_) {
+    std::multimap<size_t, void*>::iterator largest = --cache_.end();
+    munmap(largest->second, largest->first);
+    cached_bytes_ -= largest->first;
+    cache_.erase(largest);
+  }
+  if (cached_bytes_ + size <= max_cached_bytes_) {
+    cache_.insert(std::make_pair(size, p));
+    cached_bytes_ += size;
+  } else {
+    munmap(p, size);
+  }
+}
+
+bool HugePageResource::do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept {
+  return this == &other;
+}
+
+HugePageResource* HugePageMemory() {
+  // Never destroyed, so that buffers may outlive static destruction.
+  static HugePageResource* const resource = new HugePageResource();
+  return resource;
+}
+
+BumpArena::BumpArena(std::pmr::memory_resource* upstream, size_t block_bytes)
+    : upstream_(upstream),
+      block_bytes_(block_bytes),
+      current_(0),
+      offset_(0),
+      num_live_(0) {}
+
+BumpArena::~BumpArena() {
+  assert(num_live_ == 0);
+  FreeBlocks();
+}
+
+size_t BumpArena::capacity() const {
+  size_t capacity = 0;
+  for (int i = 0; i < blocks_.size(); i++) {
+    capacity += blocks_[i].second;
+  }
+  return capacity;
+}
+
+bool BumpArena::Contains(const void* p) const {
+  const char* c = static_cast<const char*>(p);
+  for (int i = 0; i < blocks_.size(); i++) {
+    if (c >= blocks_[i].first && c < blocks_[i].first + blocks_[i].second) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void BumpArena::FreeBlocks() {
+  for (int i = 0; i < blocks_.size(); i++) {
+    upstream_->deallocate(blocks_[i].first, blocks_[i].second,
+                          alignof(std::max_align_t));
+  }
+  blocks_.clear();
+  current_ = 0;
+  offset_ = 0;
+}
+
+void* BumpArena::do_allocate(size_t bytes, size_t alignment) {
+  while (current_ < blocks_.size()) {
+    const std::pair<char*, size_t>& block = blocks_[current_];
+    const uintptr_t base = (uintptr_t) block.first;
+    const uintptr_t p = (base + offset_ + alignment - 1) & ~(alignment - 1);
+    if (p + bytes <= base + block.second) {
+      offset_ = p + bytes - base;
+      num_live_++;
+      return (void*) p;
+    }
+    current_++;
+    offset_ = 0;
+  }
+
+  const size_t size = std::max(block_bytes_, bytes + alignment);
+  char* block = static_cast<char*>(
+      upstream_->allocate(size, alignof(std::max_align_t)));
+  blocks_.push_back(std::make_pair(block, size));
+  current_ = blocks_.size() - 1;
+  offset_ = 0;
+  return do_allocate(bytes, alignment);
+}
+
+void BumpArena::do_deallocate(void* p, size_t bytes, size_t alignment) {
+  assert(num_live_ > 0 && Contains(p));
+  num_live_--;
+  if (num_live_ == 0) {
+    // Start over, in a single block if it took several.
+    if (blocks_.size() > 1) {
+      const size_t size = capacity();
+      FreeBlocks();
+      blocks_.push_back(std::make_pair(
+          static_cast<char*>(
+              upstream_->allocate(size, alignof(std::max_align_t))),
+          size));
+    }
+    current_ = 0;
+    offset_ = 0;
+    return;
+  }
+  char* const end = static_cast<char*>(p) + bytes;
+  if (current_ < blocks_.size() && end == blocks_[current_].first + offset_) {
+    offset_ = static_cast<char*>(p) - blocks_[current_].first;
+  }
+}
+
+bool BumpArena::do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept {
+  return this == &other;
+}
+
+namespace {
+
+class ThreadArenaResource : public std::pmr::memory_resource {
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    return ThreadArena()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    ThreadArena()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+}  // namespace
+
+BumpArena* ThreadArena() {
+  static thread_local BumpArena arena;
+  return &arena;
+}
+
+std::pmr::memory_resource* ThreadArenaMemory() {
+  static ThreadArenaResource resource;
+  return &resource;
+}
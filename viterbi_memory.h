@@ -0,0 +1,108 @@
+// Memory resources for decoder buffers.
+//
+// The decisions of a long frame of a large code span many megabytes, and
+// walking them in 4 KiB pages misses the TLB on almost every traceback step.
+// A codec, a ViterbiBatchDecoder or a decoding job allocates them from the
+// std::pmr::memory_resource of its ViterbiOptions, which may be one of these.
+
+#ifndef VITERBI_MEMORY_H_
+#define VITERBI_MEMORY_H_
+
+#include <stddef.h>
+
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Maps buffers of at least kMinHugeBytes in whole 2 MiB huge pages: reserved
+// ones (MAP_HUGETLB) if the system has any, else transparent ones
+// (MADV_HUGEPAGE). Smaller buffers come from the upstream resource. Freed
+// mappings are kept, up to max_cached_bytes, for the next buffers to reuse
+// without faulting their pages in again. Thread-safe.
+class HugePageResource : public std::pmr::memory_resource {
+ public:
+  static const size_t kHugePageBytes = 2 << 20;
+  static const size_t kMinHugeBytes = kHugePageBytes / 4;
+
+  explicit HugePageResource(
+      size_t max_cached_bytes = 64 * kHugePageBytes,
+      std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+  ~HugePageResource();
+
+  // Unmaps the cached mappings.
+  void Release();
+
+  // Mappings made so far, and how many of them in reserved huge pages.
+  int num_mappings() const;
+  int num_reserved_mappings() const;
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override;
+
+  const size_t max_cached_bytes_;
+  std::pmr::memory_resource* const upstream_;
+
+  mutable std::mutex mutex_;
+  // Sizes of the mappings in use, by address.
+  std::unordered_map<void*, size_t> mapped_;
+  // Free mappings by size.
+  std::multimap<size_t, void*> cache_;
+  size_t cached_bytes_;
+  int num_mappings_;
+  int num_reserved_mappings_;
+};
+
+// A process-wide HugePageResource.
+HugePageResource* HugePageMemory();
+
+// Hands out buffers by bumping a pointer through blocks of the upstream
+// resource. Deallocating the newest buffer takes its space back, and once
+// every buffer is deallocated the arena starts over, in one block as large as
+// all it used, so a thread decoding frame after frame reuses the same memory
+// without a call to the upstream resource. Not thread-safe.
+class BumpArena : public std::pmr::memory_resource {
+ public:
+  explicit BumpArena(std::pmr::memory_resource* upstream = HugePageMemory(),
+                     size_t block_bytes = HugePageResource::kHugePageBytes);
+  ~BumpArena();
+
+  // Bytes of the blocks held.
+  size_t capacity() const;
+
+  // Whether p is in one of the blocks.
+  bool Contains(const void* p) const;
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override;
+
+  // Returns the blocks to the upstream resource.
+  void FreeBlocks();
+
+  std::pmr::memory_resource* const upstream_;
+  const size_t block_bytes_;
+  // Blocks and their sizes. Buffers are bumped through the current block.
+  std::vector<std::pair<char*, size_t> > blocks_;
+  int current_;
+  size_t offset_;
+  int num_live_;
+};
+
+// The BumpArena of the calling thread, over HugePageMemory().
+BumpArena* ThreadArena();
+
+// Allocates from ThreadArena() of whichever thread calls it. Every buffer
+// must be deallocated by the thread which allocated it, so it suits codecs
+// decoded with Decode() and DecodeBatch(), but not DecodeAsync() or
+// ViterbiBatchDecoder, whose buffers change threads.
+std::pmr::memory_resource* ThreadArenaMemory();
+
+#endif  // VITERBI_MEMORY_H_
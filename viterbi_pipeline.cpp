@@ -0,0 +1,334 @@
+// Implementation of ViterbiPipelineDecoder.
+
+#include "viterbi_pipeline.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Blocks in flight between two stages.
+const int kRingBlocks = 4;
+
+void PinThread(std::thread* thread, int cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  // Not pinning only costs speed.
+  pthread_setaffinity_np(thread->native_handle(), sizeof(cpus), &cpus);
+}
+
+}  // namespace
+
+ViterbiPipelineDecoder::ViterbiPipelineDecoder(const ViterbiCodec& codec,
+                                               int traceback_depth,
+                                               int max_latency,
+                                               const std::vector<int>& cpus)
+    : codec_(codec),
+      traceback_depth_(traceback_depth > 0 ? traceback_depth
+                                           : codec.traceback_depth()),
+      window_(max_latency > 0
+                  ? max_latency
+                  : traceback_depth_ + std::max(traceback_depth_, 64)),
+      fresh_(true),
+      symbols_(kRingBlocks),
+      costs_(kRingBlocks),
+      decisions_(kRingBlocks),
+      outputs_(kRingBlocks) {
+  assert(traceback_depth_ >= codec_.constraint() - 1);
+  assert(window_ > traceback_depth_);
+  threads_.push_back(std::thread([this]() { RunBranchMetrics(); }));
+  threads_.push_back(std::thread([this]() { RunAddCompareSelect(); }));
+  threads_.push_back(std::thread([this]() { RunTraceback(); }));
+  for (int i = 0; i < threads_.size() && i < cpus.size(); i++) {
+    PinThread(&threads_[i], cpus[i]);
+  }
+}
+
+ViterbiPipelineDecoder::~ViterbiPipelineDecoder() {
+  std::string discarded;
+  SymbolBlock* block = BeginPush(&discarded);
+  block->marker = kStopMarker;
+  block->type = kHardSymbols;
+  block->fresh = false;
+  block->symbols.clear();
+  symbols_.EndPush();
+
+  // Discard the output of an unfinished stream until the stop marker is
+  // through every stage, or the traceback stage waits for room forever.
+  SpinWait wait;
+  bool stopped = false;
+  while (!stopped) {
+    const OutputBlock* out = outputs_.TryFront();
+    if (out == NULL) {
+      wait.Wait();
+      continue;
+    }
+    stopped = out->marker == kStopMarker;
+    outputs_.Pop();
+  }
+  for (int i = 0; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+}
+
+void ViterbiPipelineDecoder::RunBranchMetrics() {
+  const int n = codec_.num_parity_bits();
+  // Symbols of an incomplete trellis step, carried to the next block.
+  std::vector<int16_t> partial;
+  while (true) {
+    const SymbolBlock* in = symbols_.Front();
+    CostBlock* out = costs_.BeginPush();
+    out->marker = in->marker;
+    out->type = in->type;
+    out->fresh = in->fresh;
+
+    const std::vector<int16_t>& symbols = in->symbols;
+    size_t total = partial.size() + symbols.size();
+    if (in->marker == kFinishMarker) {
+      // Complete a partial trellis step with erasures.
+      total = (total + n - 1) / n * n;
+    }
+    out->num_steps = total / n;
+    out->cost0.resize(out->num_steps * n);
+    out->cost1.resize(out->num_steps * n);
+    size_t next = 0;
+    for (size_t i = 0; i < out->cost0.size(); i++) {
+      int x = 0;
+      if (i < partial.size()) {
+        x = partial[i];
+      } else if (next < symbols.size()) {
+        x = symbols[next++];
+      }
+      out->cost0[i] = x < 0 ? -x : 0;
+      out->cost1[i] = x > 0 ? x : 0;
+    }
+    if (partial.size() > out->cost0.size()) {
+      partial.erase(partial.begin(), partial.begin() + out->cost0.size());
+    } else {
+      partial.clear();
+    }
+    partial.insert(partial.end(), symbols.begin() + next, symbols.end());
+
+    const Marker marker = in->marker;
+    costs_.EndPush();
+    symbols_.Pop();
+    if (marker == kStopMarker) {
+      return;
+    }
+  }
+}
+
+void ViterbiPipelineDecoder::RunAddCompareSelect() {
+  const int n = codec_.num_parity_bits();
+  const int words = codec_.decision_words();
+  AcsState acs(codec_, codec_.ChooseEngine(kHardSymbols, SIZE_MAX),
+               kHardSymbols);
+  // Steps whose bits the traceback stage has not output, as it will count
+  // them.
+  int num_pending_steps = 0;
+  while (true) {
+    const CostBlock* in = costs_.Front();
+    DecisionBlock* out = decisions_.BeginPush();
+    out->marker = in->marker;
+    out->num_steps = in->num_steps;
+    out->decisions.resize((size_t) in->num_steps * words);
+    out->tracebacks.clear();
+
+    // As ViterbiStreamDecoder::Prepare().
+    if (in->fresh) {
+      acs.Reset(codec_.ChooseEngine(in->type, SIZE_MAX), in->type);
+    } else if (MaxSymbolCost(in->type) > MaxSymbolCost(acs.symbol_type())) {
+      acs.Widen(in->type);
+    }
+
+    for (int step = 0; step < in->num_steps; step++) {
+      if (num_pending_steps == window_) {
+        const TracebackPoint traceback = {step, acs.BestState(),
+                                          window_ - traceback_depth_};
+        out->tracebacks.push_back(traceback);
+        num_pending_steps -= traceback.num_output;
+      }
+      acs.Step(&in->cost0[step * n], &in->cost1[step * n],
+               &out->decisions[(size_t) step * words]);
+      num_pending_steps++;
+    }
+
+    if (in->marker == kFinishMarker) {
+      // Output all but the flushing bits.
+      const int num_flushing_bits = codec_.constraint() - 1;
+      const TracebackPoint traceback = {
+          in->num_steps, acs.BestState(),
+          num_pending_steps >= num_flushing_bits
+              ? num_pending_steps - num_flushing_bits
+              : num_pending_steps};
+      out->tracebacks.push_back(traceback);
+      acs.Reset();
+      num_pending_steps = 0;
+    }
+
+    const Marker marker = in->marker;
+    decisions_.EndPush();
+    costs_.Pop();
+    if (marker == kStopMarker) {
+      return;
+    }
+  }
+}
+
+void ViterbiPipelineDecoder::RunTraceback() {
+  const int words = codec_.decision_words();
+  const int shift = codec_.constraint() - 2;
+  // The decisions of the pending steps, as in ViterbiStreamDecoder.
+  std::vector<uint64_t> ring((size_t) window_ * words);
+  int first = 0;
+  int num_pending_steps = 0;
+  while (true) {
+    const DecisionBlock* in = decisions_.Front();
+    OutputBlock* out = outputs_.BeginPush();
+    out->marker = in->marker;
+    out->bits.clear();
+
+    int next = 0;
+    for (int step = 0; step <= in->num_steps; step++) {
+      for (; next < in->tracebacks.size() &&
+             in->tracebacks[next].step == step;
+           next++) {
+        const TracebackPoint& traceback = in->tracebacks[next];
+        const size_t begin = out->bits.size();
+        out->bits.resize(begin + traceback.num_output, '0');
+        int state = traceback.state;
+        for (int i = num_pending_steps - 1; i >= 0; i--) {
+          if (i < traceback.num_output) {
+            out->bits[begin + i] = state >> shift ? '1' : '0';
+          }
+          state = codec_.PreviousState(
+              state, &ring[(size_t) ((first + i) % window_) * words]);
+        }
+        first = (first + traceback.num_output) % window_;
+        num_pending_steps -= traceback.num_output;
+      }
+      if (step < in->num_steps) {
+        std::copy(&in->decisions[(size_t) step * words],
+                  &in->decisions[(size_t) (step + 1) * words],
+                  &ring[(size_t) ((first + num_pending_steps) % window_) *
+                        words]);
+        num_pending_steps++;
+      }
+    }
+    if (in->marker == kFinishMarker) {
+      first = 0;
+      num_pending_steps = 0;
+    }
+
+    const Marker marker = in->marker;
+    outputs_.EndPush();
+    decisions_.Pop();
+    if (marker == kStopMarker) {
+      return;
+    }
+  }
+}
+
+ViterbiPipelineDecoder::SymbolBlock* ViterbiPipelineDecoder::BeginPush(
+    std::string* decoded) {
+  // The stages may be waiting for room for output, so drain it.
+  SpinWait wait;
+  SymbolBlock* block;
+  while ((block = symbols_.TryBeginPush()) == NULL) {
+    Drain(decoded);
+    wait.Wait();
+  }
+  return block;
+}
+
+bool ViterbiPipelineDecoder::Drain(std::string* decoded) {
+  bool finished = false;
+  OutputBlock* block;
+  while ((block = outputs_.TryFront()) != NULL) {
+    decoded->append(block->bits);
+    finished = finished || block->marker == kFinishMarker;
+    outputs_.Pop();
+  }
+  return finished;
+}
+
+template <typename T>
+void ViterbiPipelineDecoder::FeedSymbols(SymbolType type,
+                                         const T* symbols,
+                                         size_t num_symbols,
+                                         std::string* decoded) {
+  const size_t block_symbols = (size_t) kBlockSteps * codec_.num_parity_bits();
+  size_t i = 0;
+  // Every feed sends a block, even an empty one, as every feed of a
+  // ViterbiStreamDecoder may change its engine.
+  do {
+    const size_t size = std::min(num_symbols - i, block_symbols);
+    SymbolBlock* block = BeginPush(decoded);
+    block->marker = kNoMarker;
+    block->type = type;
+    block->fresh = fresh_;
+    block->symbols.assign(symbols + i, symbols + i + size);
+    symbols_.EndPush();
+    fresh_ = fresh_ && size == 0;
+    i += size;
+  } while (i < num_symbols);
+  Drain(decoded);
+}
+
+void ViterbiPipelineDecoder::Feed(const std::string& bits,
+                                  std::string* decoded) {
+  hard_symbols_.resize(bits.size());
+  for (int i = 0; i < bits.size(); i++) {
+    assert(bits[i] == '0' || bits[i] == '1');
+    hard_symbols_[i] = bits[i] == '0' ? 1 : -1;
+  }
+  FeedSymbols(kHardSymbols, hard_symbols_.data(), hard_symbols_.size(),
+              decoded);
+}
+
+void ViterbiPipelineDecoder::Feed(const int8_t* symbols,
+                                  size_t num_symbols,
+                                  std::string* decoded) {
+  FeedSymbols(kInt8Symbols, symbols, num_symbols, decoded);
+}
+
+void ViterbiPipelineDecoder::Feed(const int16_t* symbols,
+                                  size_t num_symbols,
+                                  std::string* decoded) {
+  FeedSymbols(kInt16Symbols, symbols, num_symbols, decoded);
+}
+
+void ViterbiPipelineDecoder::FeedPacked(const unsigned char* data,
+                                        size_t num_bits,
+                                        std::string* decoded) {
+  hard_symbols_.resize(num_bits);
+  for (size_t i = 0; i < num_bits; i++) {
+    hard_symbols_[i] = (data[i >> 3] >> (7 - (i & 7))) & 1 ? -1 : 1;
+  }
+  FeedSymbols(kHardSymbols, hard_symbols_.data(), hard_symbols_.size(),
+              decoded);
+}
+
+void ViterbiPipelineDecoder::Finish(std::string* decoded) {
+  SymbolBlock* block = BeginPush(decoded);
+  block->marker = kFinishMarker;
+  block->fresh = false;
+  block->symbols.clear();
+  // The type of an empty block only matters on a fresh stream, which then
+  // stays fresh.
+  block->type = kHardSymbols;
+  symbols_.EndPush();
+
+  SpinWait wait;
+  while (!Drain(decoded)) {
+    wait.Wait();
+  }
+  fresh_ = true;
+}
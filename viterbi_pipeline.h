@@ -0,0 +1,143 @@
+// Streaming Viterbi decoder pipelined over several threads.
+
+#ifndef VITERBI_PIPELINE_H_
+#define VITERBI_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "viterbi.h"
+#include "viterbi_acs.h"
+#include "viterbi_spsc.h"
+
+// Decodes one stream like ViterbiStreamDecoder, with identical output, but
+// runs its stages on threads of their own: one turns symbols into symbol
+// costs, one runs the add-compare-select steps, and one traces back. The
+// stages pass blocks of trellis steps through lock-free rings, so a stream
+// is decoded as fast as the slowest stage, usually add-compare-select, rather
+// than the sum of all three.
+//
+// Decoded bits leave the pipeline some blocks after their symbols enter it:
+// Feed() appends the bits which are ready, and Finish() waits for the rest.
+// Not thread-safe: one thread feeds the decoder.
+class ViterbiPipelineDecoder {
+ public:
+  // Trellis steps per block passed between stages.
+  static const int kBlockSteps = 2048;
+
+  // traceback_depth and max_latency are as for ViterbiStreamDecoder. If cpus
+  // is not empty, the three stage threads are pinned to its first three CPUs,
+  // in order.
+  ViterbiPipelineDecoder(const ViterbiCodec& codec,
+                         int traceback_depth,
+                         int max_latency = 0,
+                         const std::vector<int>& cpus = std::vector<int>());
+
+  // Stops the stage threads, discarding the bits of an unfinished stream.
+  ~ViterbiPipelineDecoder();
+
+  // Feed symbols, as in ViterbiStreamDecoder.
+  void Feed(const std::string& bits, std::string* decoded);
+  void Feed(const int8_t* symbols, size_t num_symbols, std::string* decoded);
+  void Feed(const int16_t* symbols, size_t num_symbols, std::string* decoded);
+  void FeedPacked(const unsigned char* data,
+                  size_t num_bits,
+                  std::string* decoded);
+
+  // Ends the stream as ViterbiStreamDecoder::Finish(), and waits for all its
+  // remaining bits.
+  void Finish(std::string* decoded);
+
+  const ViterbiCodec& codec() const { return codec_; }
+
+  int traceback_depth() const { return traceback_depth_; }
+
+  int max_latency() const { return window_; }
+
+ private:
+  enum Marker {
+    kNoMarker,
+    // The stream ends after this block.
+    kFinishMarker,
+    // The stage threads exit.
+    kStopMarker,
+  };
+
+  // Received symbols, hard bits as -1 for "1" and 1 for "0".
+  struct SymbolBlock {
+    Marker marker;
+    SymbolType type;
+    // Whether nothing was fed since the stream started.
+    bool fresh;
+    std::vector<int16_t> symbols;
+  };
+
+  // Symbol costs of whole trellis steps, num_parity_bits() per step.
+  struct CostBlock {
+    Marker marker;
+    SymbolType type;
+    bool fresh;
+    int num_steps;
+    std::vector<int> cost0;
+    std::vector<int> cost1;
+  };
+
+  // A traceback, before the given step of a block, from the best state then.
+  struct TracebackPoint {
+    int step;
+    int state;
+    int num_output;
+  };
+
+  struct DecisionBlock {
+    Marker marker;
+    int num_steps;
+    std::vector<uint64_t> decisions;
+    std::vector<TracebackPoint> tracebacks;
+  };
+
+  struct OutputBlock {
+    Marker marker;
+    std::string bits;
+  };
+
+  // Stage threads.
+  void RunBranchMetrics();
+  void RunAddCompareSelect();
+  void RunTraceback();
+
+  // Feeds symbols in blocks, hard bits as for SymbolBlock.
+  template <typename T>
+  void FeedSymbols(SymbolType type,
+                   const T* symbols,
+                   size_t num_symbols,
+                   std::string* decoded);
+
+  // Waits for a free symbol block, collecting decoded bits meanwhile.
+  SymbolBlock* BeginPush(std::string* decoded);
+
+  // Appends the decoded bits which are ready. Returns whether they included
+  // the end of a stream.
+  bool Drain(std::string* decoded);
+
+  const ViterbiCodec& codec_;
+  const int traceback_depth_;
+  const int window_;
+
+  // Whether nothing was fed since the stream started.
+  bool fresh_;
+  std::vector<int16_t> hard_symbols_;
+
+  SpscRing<SymbolBlock> symbols_;
+  SpscRing<CostBlock> costs_;
+  SpscRing<DecisionBlock> decisions_;
+  SpscRing<OutputBlock> outputs_;
+
+  std::vector<std::thread> threads_;
+};
+
+#endif  // VITERBI_PIPELINE_H_
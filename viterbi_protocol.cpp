@@ -0,0 +1,244 @@
+// Implementation of the viterbi_server wire protocol.
+
+#include "viterbi_protocol.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+const char kDefaultSocketPath[] = "/tmp/viterbi.sock";
+
+namespace {
+
+// Fixed-size parts of the message bodies.
+const size_t kRequestHeaderSize = 12;
+const size_t kResponseHeaderSize = 12;
+
+void AppendU32(uint32_t value, std::string* out) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendU8(int value, std::string* out) {
+  out->push_back((char) value);
+}
+
+uint32_t GetU32(const std::string& body, size_t offset) {
+  uint32_t value;
+  memcpy(&value, body.data() + offset, sizeof(value));
+  return value;
+}
+
+int GetU8(const std::string& body, size_t offset) {
+  return (unsigned char) body[offset];
+}
+
+// Reads exactly size bytes. Returns false on end of stream or error.
+bool ReadFully(int fd, char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = read(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Working memory of a request for a valid code, see kMaxRequestMemory.
+uint64_t RequestMemory(int type,
+                       int constraint,
+                       int num_polynomials,
+                       uint32_t num_symbols) {
+  const uint64_t unpacked =
+      type == kEncode || type == kDecodeBits ? num_symbols : 0;
+  if (type == kEncode) {
+    return unpacked + (unpacked + constraint - 1) * num_polynomials;
+  }
+  const uint64_t num_steps =
+      ((uint64_t) num_symbols + num_polynomials - 1) / num_polynomials;
+  const uint64_t decision_words = ((1ull << (constraint - 1)) + 63) / 64;
+  return unpacked + num_steps * decision_words * sizeof(uint64_t);
+}
+
+// Overwrites the length prefix at offset with the size of what follows it.
+void FinishMessage(size_t offset, std::string* out) {
+  const uint32_t length = out->size() - offset - sizeof(uint32_t);
+  memcpy(&(*out)[offset], &length, sizeof(length));
+}
+
+}  // namespace
+
+size_t PayloadSize(int type, uint32_t num_symbols) {
+  switch (type) {
+    case kEncode:
+    case kDecodeBits:
+      return ((size_t) num_symbols + 7) / 8;
+    case kDecodeInt8:
+      return num_symbols;
+    case kDecodeInt16:
+      return (size_t) num_symbols * 2;
+    default:
+      return 0;
+  }
+}
+
+void SerializeRequest(const Request& request, std::string* out) {
+  const size_t offset = out->size();
+  AppendU32(0, out);
+  AppendU32(request.id, out);
+  AppendU8(request.type, out);
+  AppendU8(request.constraint, out);
+  AppendU8(request.polynomials.size(), out);
+  AppendU8(0, out);
+  AppendU32(request.num_symbols, out);
+  for (int i = 0; i < request.polynomials.size(); i++) {
+    AppendU32(request.polynomials[i], out);
+  }
+  out->append(request.payload);
+  FinishMessage(offset, out);
+}
+
+void SerializeResponse(const Response& response, std::string* out) {
+  const size_t offset = out->size();
+  AppendU32(0, out);
+  AppendU32(response.id, out);
+  AppendU8(response.status, out);
+  AppendU8(0, out);
+  AppendU8(0, out);
+  AppendU8(0, out);
+  AppendU32(response.num_bits, out);
+  out->append(response.payload);
+  FinishMessage(offset, out);
+}
+
+bool ParseRequest(const std::string& body, Request* request) {
+  request->id = body.size() >= sizeof(uint32_t) ? GetU32(body, 0) : 0;
+  if (body.size() < kRequestHeaderSize) {
+    return false;
+  }
+  request->type = GetU8(body, 4);
+  request->constraint = GetU8(body, 5);
+  const int num_polynomials = GetU8(body, 6);
+  request->num_symbols = GetU32(body, 8);
+
+  size_t offset = kRequestHeaderSize;
+  if (body.size() < offset + num_polynomials * sizeof(uint32_t)) {
+    return false;
+  }
+  request->polynomials.resize(num_polynomials);
+  for (int i = 0; i < num_polynomials; i++) {
+    request->polynomials[i] = GetU32(body, offset);
+    offset += sizeof(uint32_t);
+  }
+  request->payload.assign(body, offset, std::string::npos);
+  return true;
+}
+
+bool ParseResponse(const std::string& body, Response* response) {
+  if (body.size() < kResponseHeaderSize) {
+    return false;
+  }
+  response->id = GetU32(body, 0);
+  response->status = GetU8(body, 4);
+  response->num_bits = GetU32(body, 8);
+  response->payload.assign(body, kResponseHeaderSize, std::string::npos);
+  return true;
+}
+
+bool ValidateRequest(const Request& request, std::string* error) {
+  return ValidateRequest(request.type, request.constraint, request.polynomials,
+                         request.num_symbols, request.payload.size(), error);
+}
+
+bool ValidateRequest(int type,
+                     int constraint,
+                     const std::vector<int>& polynomials,
+                     uint32_t num_symbols,
+                     size_t payload_size,
+                     std::string* error) {
+  std::ostringstream os;
+  if (type < kEncode || type > kDecodeInt16) {
+    os << "Unknown request type " << type;
+  } else if (constraint < 2 || constraint > kMaxServerConstraint) {
+    os << "Constraint should be between 2 and " << kMaxServerConstraint
+       << ", found " << constraint;
+  } else if (polynomials.empty()) {
+    os << "Expected at least one polynomial";
+  } else if (payload_size != PayloadSize(type, num_symbols)) {
+    os << "Expected a payload of " << PayloadSize(type, num_symbols)
+       << " bytes, found " << payload_size;
+  } else if (RequestMemory(type, constraint, polynomials.size(),
+                           num_symbols) > kMaxRequestMemory) {
+    os << "Request needs more than " << kMaxRequestMemory
+       << " bytes of memory, send fewer symbols";
+  } else {
+    for (int i = 0; i < polynomials.size(); i++) {
+      if (polynomials[i] <= 0 || polynomials[i] >= (1 << constraint)) {
+        os << "Polynomial should be greater than 0 and less than "
+           << (1 << constraint) << ", found " << polynomials[i];
+        break;
+      }
+    }
+  }
+  *error = os.str();
+  return error->empty();
+}
+
+bool ReadMessage(int fd, std::string* body) {
+  uint32_t length;
+  if (!ReadFully(fd, reinterpret_cast<char*>(&length), sizeof(length)) ||
+      length > kMaxMessageSize) {
+    return false;
+  }
+  body->resize(length);
+  return ReadFully(fd, &(*body)[0], length);
+}
+
+bool WriteFully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+int ConnectToServer(const std::string& path) {
+  sockaddr_un address;
+  if (path.size() >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) <
+      0) {
+    const int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+}
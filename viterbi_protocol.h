@@ -0,0 +1,116 @@
+// Wire protocol of viterbi_server, and a blocking client for it.
+//
+// The server listens on a Unix domain socket. Every message is a 32-bit
+// length followed by that many bytes. All integers are in host byte order,
+// since both ends run on the same machine.
+//
+// Request:
+//     uint32 length
+//     uint32 id               echoed in the response
+//     uint8  type             a RequestType
+//     uint8  constraint
+//     uint8  num_polynomials
+//     uint8  reserved         0
+//     uint32 num_symbols      bits for kEncode and kDecodeBits, else symbols
+//     uint32 polynomials[num_polynomials]
+//     payload                 packed bits (most significant bit first),
+//                             int8 or int16 soft symbols
+//
+// Response:
+//     uint32 length
+//     uint32 id
+//     uint8  status           a ResponseStatus
+//     uint8  reserved[3]      0
+//     uint32 num_bits
+//     payload                 packed bits, or an error message
+//
+// Requests on one connection may be answered out of order, as requests for
+// the same code are batched together.
+
+#ifndef VITERBI_PROTOCOL_H_
+#define VITERBI_PROTOCOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+enum RequestType {
+  kEncode = 0,
+  kDecodeBits = 1,
+  kDecodeInt8 = 2,
+  kDecodeInt16 = 3,
+};
+
+enum ResponseStatus {
+  kOk = 0,
+  kInvalidRequest = 1,
+};
+
+// Largest constraint the server accepts, which bounds its table sizes.
+const int kMaxServerConstraint = 16;
+
+// Largest message the server accepts.
+const uint32_t kMaxMessageSize = 1u << 30;
+
+// Largest working memory, in bytes, the server spends on one request: the
+// decisions of a decode, or the unpacked bits and codeword of an encode.
+const uint64_t kMaxRequestMemory = 1ull << 30;
+
+// Default socket path of the server.
+extern const char kDefaultSocketPath[];
+
+struct Request {
+  uint32_t id;
+  int type;
+  int constraint;
+  std::vector<int> polynomials;
+  uint32_t num_symbols;
+  std::string payload;
+};
+
+struct Response {
+  uint32_t id;
+  int status;
+  uint32_t num_bits;
+  std::string payload;
+};
+
+// Size in bytes of the payload of a request.
+size_t PayloadSize(int type, uint32_t num_symbols);
+
+// Serializes a message, including its length prefix, appending to *out.
+void SerializeRequest(const Request& request, std::string* out);
+void SerializeResponse(const Response& response, std::string* out);
+
+// Parses a message body, i.e. without its length prefix. Returns false if
+// the body is malformed, in which case the id is still set if the body holds
+// one, else 0.
+bool ParseRequest(const std::string& body, Request* request);
+bool ParseResponse(const std::string& body, Response* response);
+
+// Validates the code, payload size and working memory of a parsed request.
+// Returns false and sets *error if the request is invalid.
+bool ValidateRequest(const Request& request, std::string* error);
+
+// Same as ValidateRequest(), for a request whose payload is elsewhere.
+bool ValidateRequest(int type,
+                     int constraint,
+                     const std::vector<int>& polynomials,
+                     uint32_t num_symbols,
+                     size_t payload_size,
+                     std::string* error);
+
+// Reads one length-prefixed message body from fd. Returns false on end of
+// stream, error, or a message larger than kMaxMessageSize.
+bool ReadMessage(int fd, std::string* body);
+
+// Writes all of data to fd. Returns false on error.
+bool WriteFully(int fd, const char* data, size_t size);
+
+// Connects to the server listening at path. Returns the socket, or -1 on
+// failure with errno set.
+int ConnectToServer(const std::string& path);
+
+#endif  // VITERBI_PROTOCOL_H_
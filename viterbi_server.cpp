@@ -0,0 +1,428 @@
+// Decoding daemon. Serves encode and decode requests over a Unix domain
+// socket, see viterbi_protocol.h, keeping codecs warm between requests.
+//
+// Every connection has a reader thread which parses requests and queues them
+// by code. A pool of worker threads takes batches of queued requests for the
+// same code and answers them.
+//
+// Optionally, it also serves a shared-memory segment, see viterbi_shm.h, with
+// a thread per channel that decodes requests in place.
+
+#include "viterbi.h"
+#include "viterbi_bits.h"
+#include "viterbi_cache.h"
+#include "viterbi_protocol.h"
+#include "viterbi_shm.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Path of the Unix domain socket to listen on.
+static std::string FLAGS_socket = kDefaultSocketPath;
+
+// Number of worker threads. 0 means one per hardware thread.
+static int FLAGS_threads = 0;
+
+// Largest number of requests for one code answered as a batch.
+static int FLAGS_max_batch = 64;
+
+// Name of a shared-memory segment to serve as well, e.g. "/viterbi". Empty
+// means none.
+static std::string FLAGS_shm;
+
+// Number of channels, i.e. concurrent producers, of the segment.
+static int FLAGS_shm_channels = 4;
+
+// Size in bytes of each ring of the segment. Must be a power of two.
+static int FLAGS_shm_ring_size = 1 << 24;
+
+void Usage(const std::string& exec) {
+  std::cout
+      << "Usage:\n"
+      << "    " << exec << " [--socket=<path>] [--threads=<n>]"
+      << " [--max_batch=<n>] [--shm=<name>] [--shm_channels=<n>]"
+      << " [--shm_ring_size=<bytes>]\n\n"
+      << "Flags:\n"
+      << "    --socket=<path>\n"
+      << "        Unix domain socket to listen on. Defaults to "
+      << kDefaultSocketPath << ".\n\n"
+      << "    --threads=<n>\n"
+      << "        Number of worker threads. Defaults to the number of\n"
+      << "        hardware threads.\n\n"
+      << "    --max_batch=<n>\n"
+      << "        Largest number of requests for one code answered as a\n"
+      << "        batch. Defaults to 64.\n\n"
+      << "    --shm=<name>\n"
+      << "        Also serve a shared-memory segment of this name, e.g.\n"
+      << "        /viterbi. See viterbi_shm.h.\n\n"
+      << "    --shm_channels=<n>\n"
+      << "        Number of producers the segment can serve at once.\n"
+      << "        Defaults to 4.\n\n"
+      << "    --shm_ring_size=<bytes>\n"
+      << "        Size of each request and response ring, a power of two.\n"
+      << "        Defaults to 16 MiB.\n";
+}
+
+void ParseFlags(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--help") == 0) {
+      Usage(argv[0]);
+      exit(1);
+    } else if (std::strncmp(argv[i], "--socket=", 9) == 0) {
+      FLAGS_socket = argv[i] + 9;
+    } else if (std::strncmp(argv[i], "--threads=", 10) == 0) {
+      FLAGS_threads = std::atoi(argv[i] + 10);
+    } else if (std::strncmp(argv[i], "--max_batch=", 12) == 0) {
+      FLAGS_max_batch = std::max(1, std::atoi(argv[i] + 12));
+    } else if (std::strncmp(argv[i], "--shm=", 6) == 0) {
+      FLAGS_shm = argv[i] + 6;
+    } else if (std::strncmp(argv[i], "--shm_channels=", 15) == 0) {
+      FLAGS_shm_channels = std::atoi(argv[i] + 15);
+    } else if (std::strncmp(argv[i], "--shm_ring_size=", 16) == 0) {
+      FLAGS_shm_ring_size = std::atoi(argv[i] + 16);
+    } else {
+      std::cout << "Unknown argument " << argv[i] << std::endl;
+      exit(1);
+    }
+  }
+}
+
+// A client connection. Responses are written by worker threads, so writes
+// are serialized.
+class Connection {
+ public:
+  explicit Connection(int fd) : fd_(fd) {}
+
+  ~Connection() { close(fd_); }
+
+  int fd() const { return fd_; }
+
+  // Writes serialized responses. Failures are ignored, as the reader thread
+  // notices a broken connection.
+  void Write(const std::string& data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    WriteFully(fd_, data.data(), data.size());
+  }
+
+ private:
+  const int fd_;
+  std::mutex mutex_;
+};
+
+struct PendingRequest {
+  std::shared_ptr<Connection> connection;
+  Request request;
+};
+
+// Queue of pending requests grouped by code. Codes are served round robin,
+// each time with a batch of its oldest requests.
+class BatchQueue {
+ public:
+  void Push(PendingRequest* pending) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Key key(pending->request.constraint, pending->request.polynomials);
+    std::deque<PendingRequest>& requests = pending_[key];
+    if (requests.empty()) {
+      order_.push_back(key);
+    }
+    requests.push_back(PendingRequest());
+    requests.back().connection.swap(pending->connection);
+    std::swap(requests.back().request, pending->request);
+    not_empty_.notify_one();
+  }
+
+  // Blocks until there are pending requests, then takes up to max_batch of
+  // them, all for the same code.
+  void Pop(size_t max_batch, std::vector<PendingRequest>* batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [&] { return !order_.empty(); });
+
+    const Key key = order_.front();
+    order_.pop_front();
+    std::deque<PendingRequest>& requests = pending_[key];
+    batch->clear();
+    while (!requests.empty() && batch->size() < max_batch) {
+      batch->push_back(PendingRequest());
+      batch->back().connection.swap(requests.front().connection);
+      std::swap(batch->back().request, requests.front().request);
+      requests.pop_front();
+    }
+    if (requests.empty()) {
+      pending_.erase(key);
+    } else {
+      order_.push_back(key);
+      not_empty_.notify_one();
+    }
+  }
+
+ private:
+  typedef std::pair<int, std::vector<int> > Key;
+
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::map<Key, std::deque<PendingRequest> > pending_;
+  // Codes with pending requests, in the order they will be served.
+  std::deque<Key> order_;
+};
+
+// Runs a valid request whose payload is at payload, returning its result as
+// a bit string. The buffer is reused between requests.
+std::string Run(const ViterbiCodec& codec,
+                int type,
+                const char* payload,
+                uint32_t num_symbols,
+                std::string* buffer) {
+  if (type == kEncode || type == kDecodeBits) {
+    buffer->resize(num_symbols);
+    UnpackBytes(reinterpret_cast<const unsigned char*>(payload), num_symbols,
+                &(*buffer)[0]);
+    return type == kEncode ? codec.Encode(*buffer) : codec.Decode(*buffer);
+  } else if (type == kDecodeInt8) {
+    return codec.Decode(reinterpret_cast<const int8_t*>(payload), num_symbols);
+  } else {
+    return codec.Decode(reinterpret_cast<const int16_t*>(payload),
+                        num_symbols);
+  }
+}
+
+// Answers a valid request. A request which fails anyway, e.g. as memory
+// runs out, is answered as invalid rather than taking the server down.
+void Process(const ViterbiCodec& codec,
+             const Request& request,
+             std::string* buffer,
+             Response* response) {
+  response->id = request.id;
+  std::string result;
+  try {
+    result = Run(codec, request.type, request.payload.data(),
+                 request.num_symbols, buffer);
+  } catch (const std::exception& e) {
+    response->status = kInvalidRequest;
+    response->num_bits = 0;
+    response->payload = std::string("Failed to process request: ") + e.what();
+    return;
+  }
+  response->status = kOk;
+  response->num_bits = result.size();
+  response->payload.resize((result.size() + 7) / 8);
+  PackBytes(result.data(), result.size(),
+            reinterpret_cast<unsigned char*>(&response->payload[0]));
+}
+
+void WorkerMain(BatchQueue* queue, ViterbiCodecCache* cache) {
+  std::vector<PendingRequest> batch;
+  std::string buffer;
+  Response response;
+  // Responses of a batch, per connection, so that each connection gets one
+  // write per batch.
+  std::map<Connection*, std::string> output;
+  while (true) {
+    queue->Pop(FLAGS_max_batch, &batch);
+    const Request& first = batch.front().request;
+    const ViterbiCodec& codec = cache->Get(first.constraint, first.polynomials);
+
+    for (int i = 0; i < batch.size(); i++) {
+      Process(codec, batch[i].request, &buffer, &response);
+      SerializeResponse(response, &output[batch[i].connection.get()]);
+    }
+    for (int i = 0; i < batch.size(); i++) {
+      std::string& data = output[batch[i].connection.get()];
+      if (!data.empty()) {
+        batch[i].connection->Write(data);
+        data.clear();
+      }
+    }
+    output.clear();
+    batch.clear();
+  }
+}
+
+// Reads requests from a connection until it is closed. Invalid requests are
+// answered right away; valid ones are queued for the workers.
+void ReaderMain(std::shared_ptr<Connection> connection, BatchQueue* queue) {
+  std::string body;
+  PendingRequest pending;
+  while (ReadMessage(connection->fd(), &body)) {
+    Response response;
+    std::string error;
+    if (!ParseRequest(body, &pending.request)) {
+      error = "Malformed request";
+    } else if (ValidateRequest(pending.request, &error)) {
+      pending.connection = connection;
+      queue->Push(&pending);
+      continue;
+    }
+
+    response.id = pending.request.id;
+    response.status = kInvalidRequest;
+    response.num_bits = 0;
+    response.payload = error;
+    std::string data;
+    SerializeResponse(response, &data);
+    connection->Write(data);
+  }
+}
+
+// Serves one channel of the shared-memory segment until it is closed.
+// Requests are read straight from the ring, and responses are written
+// straight into the other ring, which blocks while the producer lags behind.
+void ShmChannelMain(ShmSegment* segment,
+                    int channel,
+                    ViterbiCodecCache* cache) {
+  ShmRing* requests = segment->requests(channel);
+  ShmRing* responses = segment->responses(channel);
+  std::vector<int> polynomials;
+  std::string buffer;
+  std::string result;
+  std::string error;
+  size_t size;
+  const char* frame;
+  while ((frame = requests->BeginRead(&size)) != NULL) {
+    ShmFrameHeader header;
+    std::memcpy(&header, frame, std::min(size, sizeof(header)));
+    const char* payload = frame + sizeof(header);
+    const size_t payload_size = size - std::min(size, sizeof(header));
+
+    if (size < sizeof(header) || header.num_polynomials > kMaxShmPolynomials) {
+      error = "Malformed request";
+    } else {
+      polynomials.assign(header.polynomials,
+                         header.polynomials + header.num_polynomials);
+      if (ValidateRequest(header.type, header.constraint, polynomials,
+                          header.num_symbols, payload_size, &error)) {
+        try {
+          result = Run(cache->Get(header.constraint, polynomials),
+                       header.type, payload, header.num_symbols, &buffer);
+        } catch (const std::exception& e) {
+          error = std::string("Failed to process request: ") + e.what();
+        }
+      }
+    }
+    requests->EndRead();
+
+    // Every request gets a response, or its producer would wait forever.
+    // An encode outputs n times its input, which may not fit the ring.
+    if (error.empty() &&
+        sizeof(header) + (result.size() + 7) / 8 >
+            responses->max_record_size()) {
+      std::ostringstream os;
+      os << "Response of " << (result.size() + 7) / 8
+         << " bytes does not fit a ring of " << FLAGS_shm_ring_size
+         << " bytes";
+      error = os.str();
+    }
+    const std::string& data = error.empty() ? result : error;
+    const size_t data_size =
+        error.empty() ? (result.size() + 7) / 8 : error.size();
+    char* response = responses->BeginWrite(sizeof(header) + data_size);
+    if (response == NULL) {
+      // The segment is closed.
+      break;
+    }
+    header.type = error.empty() ? kOk : kInvalidRequest;
+    header.num_symbols = data.size();
+    std::memcpy(response, &header, sizeof(header));
+    if (error.empty()) {
+      PackBytes(result.data(), result.size(),
+                reinterpret_cast<unsigned char*>(response + sizeof(header)));
+    } else {
+      std::memcpy(response + sizeof(header), error.data(), error.size());
+    }
+    responses->CommitWrite();
+  }
+}
+
+void RemoveSocket(int signal) {
+  unlink(FLAGS_socket.c_str());
+  if (!FLAGS_shm.empty()) {
+    shm_unlink(FLAGS_shm.c_str());
+  }
+  _exit(0);
+}
+
+int main(int argc, char** argv) {
+  ParseFlags(argc, argv);
+
+  sockaddr_un address;
+  if (FLAGS_socket.size() >= sizeof(address.sun_path)) {
+    std::cout << "Socket path too long: " << FLAGS_socket << std::endl;
+    exit(1);
+  }
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::strcpy(address.sun_path, FLAGS_socket.c_str());
+
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(FLAGS_socket.c_str());
+  if (listener < 0 ||
+      bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) <
+          0 ||
+      listen(listener, SOMAXCONN) < 0) {
+    std::cout << "Failed to listen on " << FLAGS_socket << ": "
+              << std::strerror(errno) << std::endl;
+    exit(1);
+  }
+  signal(SIGINT, RemoveSocket);
+  signal(SIGTERM, RemoveSocket);
+  signal(SIGPIPE, SIG_IGN);
+
+  int num_threads = FLAGS_threads;
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  BatchQueue queue;
+  ViterbiCodecCache cache;
+  for (int i = 0; i < num_threads; i++) {
+    std::thread(WorkerMain, &queue, &cache).detach();
+  }
+  std::cout << "Listening on " << FLAGS_socket << " with " << num_threads
+            << " workers" << std::endl;
+
+  if (!FLAGS_shm.empty()) {
+    std::string error;
+    ShmSegment* segment = ShmSegment::Create(FLAGS_shm, FLAGS_shm_channels,
+                                             FLAGS_shm_ring_size, &error);
+    if (segment == NULL) {
+      std::cout << error << std::endl;
+      exit(1);
+    }
+    for (int i = 0; i < segment->num_channels(); i++) {
+      std::thread(ShmChannelMain, segment, i, &cache).detach();
+    }
+    std::cout << "Serving " << FLAGS_shm << " with "
+              << segment->num_channels() << " channels" << std::endl;
+  }
+
+  while (true) {
+    const int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      std::cout << "Failed to accept: " << std::strerror(errno) << std::endl;
+      exit(1);
+    }
+    std::shared_ptr<Connection> connection(new Connection(fd));
+    std::thread(ReaderMain, connection, &queue).detach();
+  }
+}
@@ -0,0 +1,492 @@
+// Implementation of ViterbiSessionManager.
+
+#include "viterbi_sessions.h"
+#include "viterbi_acs.h"
+#include "viterbi_snapshot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The block step is also built for AVX2, and picked at load time on CPUs
+// which support it.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VITERBI_SESSIONS_CLONES \
+  __attribute__((target_clones("avx2", "default")))
+#else
+#define VITERBI_SESSIONS_CLONES
+#endif
+
+// Vectors only pass between functions which are inlined into each other, so
+// their ABI does not matter.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace {
+
+// As in AcsState: 16-bit path metrics of unreachable states, and the best
+// metric above which the metrics of a session are renormalized.
+const int kUnreachableMetric16 = 1 << 13;
+const int kRenormalizeThreshold16 = 1 << 13;
+
+const int kLanes = ViterbiSessionManager::kLanes;
+
+// One 16-bit metric per session of a block.
+typedef int16_t Lanes __attribute__((vector_size(2 * kLanes)));
+
+// One trellis step for a block of sessions. All arrays hold kLanes values per
+// element, one per session.
+struct BlockStep {
+  int num_states;
+  int num_parity_bits;
+  int num_branch_outputs;
+  const int* branch_outputs;
+  const int* branch0;
+  const int* branch1;
+  // Scaled symbol costs, by parity bit.
+  const int16_t* cost0;
+  const int16_t* cost1;
+  // Added to the branch metrics of each session.
+  const int16_t* bias;
+  // All ones for sessions which take the step; the others keep their metrics.
+  const int16_t* active;
+  // Scratch space, by branch output.
+  int16_t* branch_metrics;
+  // The new metrics and the best of them, by state and session.
+  int16_t* new_metrics;
+  int16_t* best;
+  // By group of 16 states, bit i of lane l set if session l took the step and
+  // the survivor of state i of the group came from the odd predecessor.
+  int16_t* decisions;
+};
+
+inline __attribute__((always_inline)) Lanes Load(const int16_t* p) {
+  Lanes v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline __attribute__((always_inline)) void Store(int16_t* p, const Lanes& v) {
+  std::memcpy(p, &v, sizeof(v));
+}
+
+VITERBI_SESSIONS_CLONES
+void RunBlockStep(const BlockStep& step, const int16_t* metrics) {
+  const Lanes bias = Load(step.bias);
+  const Lanes active = Load(step.active);
+  const int n = step.num_parity_bits;
+  const int* output = step.branch_outputs;
+  for (int i = 0; i < step.num_branch_outputs; i++) {
+    Lanes metric = bias;
+    for (int j = 0; j < n; j++) {
+      metric += Load(output[j] ? step.cost1 + j * kLanes
+                               : step.cost0 + j * kLanes);
+    }
+    Store(step.branch_metrics + i * kLanes, metric);
+    output += n;
+  }
+
+  // Target states s and s + half share the predecessors 2s and 2s + 1.
+  const int num_states = step.num_states;
+  const int half = num_states >> 1;
+  const int* branch0 = step.branch0;
+  const int* branch1 = step.branch1;
+  const int16_t* branch_metrics = step.branch_metrics;
+  int16_t* new_metrics = step.new_metrics;
+  int16_t* lane_decisions = step.decisions;
+  Lanes best = Lanes() + (int16_t) 0x7fff;
+  Lanes decisions = Lanes();
+  for (int state = 0; state < num_states; state++) {
+    const int s = (state & (half - 1)) << 1;
+    const Lanes pm0 = Load(metrics + s * kLanes) +
+                      Load(branch_metrics + branch0[state] * kLanes);
+    const Lanes pm1 = Load(metrics + (s | 1) * kLanes) +
+                      Load(branch_metrics + branch1[state] * kLanes);
+    // Ties go to the even predecessor.
+    const Lanes odd = pm1 < pm0;
+    const Lanes selected = (pm1 & odd) | (pm0 & ~odd);
+    const Lanes metric = (selected & active) |
+                         (Load(metrics + state * kLanes) & ~active);
+    Store(new_metrics + state * kLanes, metric);
+    best = metric < best ? metric : best;
+    decisions |= (odd & active & 1) << (state & 15);
+    if ((state & 15) == 15 || state == num_states - 1) {
+      Store(lane_decisions + (state >> 4) * kLanes, decisions);
+      decisions = Lanes();
+    }
+  }
+  Store(step.best, best);
+}
+
+}  // namespace
+
+ViterbiSessionManager::ViterbiSessionManager(const ViterbiCodec& codec,
+                                             SymbolType symbol_type,
+                                             int traceback_depth,
+                                             int max_latency)
+    : codec_(codec),
+      traceback_depth_(traceback_depth > 0 ? traceback_depth
+                                           : codec.traceback_depth()),
+      window_(max_latency > 0
+                  ? max_latency
+                  : traceback_depth_ + std::max(traceback_depth_, 64)),
+      num_sessions_(0),
+      cost0_(codec.num_parity_bits() * kLanes),
+      cost1_(codec.num_parity_bits() * kLanes),
+      branch_metrics_(codec.num_branch_outputs_ * kLanes),
+      new_metrics_(codec.num_states() * kLanes),
+      lane_decisions_((codec.num_states() + 15) / 16 * kLanes) {
+  assert(traceback_depth_ >= codec_.constraint() - 1);
+  assert(window_ > traceback_depth_);
+
+  // As AcsState scales costs for 16-bit metrics.
+  const int max_symbol_cost = MaxSymbolCost(symbol_type);
+  max_cost_ = Max16BitCost(codec.constraint(), codec.num_parity_bits());
+  cost_shift_ = 0;
+  while ((max_symbol_cost >> cost_shift_) > max_cost_) {
+    cost_shift_++;
+  }
+  max_symbol_ = std::min(max_symbol_cost, 32767);
+}
+
+ViterbiSessionManager::Handle ViterbiSessionManager::Open() {
+  if (free_slots_.empty()) {
+    // Grow the arenas by a block.
+    const int first_slot = open_.size();
+    const int num_slots = first_slot + kLanes;
+    metrics_.resize((size_t) num_slots * codec_.num_states());
+    bias_.resize(num_slots);
+    decisions_.resize((size_t) num_slots * window_ * codec_.decision_words());
+    first_.resize(num_slots);
+    num_pending_steps_.resize(num_slots);
+    queued_.resize(num_slots);
+    decoded_.resize(num_slots);
+    generations_.resize(num_slots);
+    open_.resize(num_slots);
+    block_ready_.push_back(false);
+    for (int slot = num_slots - 1; slot >= first_slot; slot--) {
+      free_slots_.push_back(slot);
+    }
+  }
+
+  const int slot = free_slots_.back();
+  free_slots_.pop_back();
+  open_[slot] = true;
+  ResetSlot(slot);
+  num_sessions_++;
+  return (Handle) generations_[slot] << 32 | slot;
+}
+
+void ViterbiSessionManager::Close(Handle session) {
+  const int slot = Slot(session);
+  open_[slot] = false;
+  generations_[slot]++;
+  queued_[slot].clear();
+  decoded_[slot].clear();
+  free_slots_.push_back(slot);
+  num_sessions_--;
+}
+
+bool ViterbiSessionManager::IsOpen(Handle session) const {
+  const size_t slot = (uint32_t) session;
+  return slot < open_.size() && open_[slot] &&
+         generations_[slot] == (uint32_t) (session >> 32);
+}
+
+int ViterbiSessionManager::Slot(Handle session) const {
+  assert(IsOpen(session));
+  return (uint32_t) session;
+}
+
+void ViterbiSessionManager::ResetSlot(int slot) {
+  const int block = slot / kLanes;
+  const int lane = slot % kLanes;
+  int16_t* metrics = &metrics_[(size_t) block * codec_.num_states() * kLanes];
+  for (int state = 0; state < codec_.num_states(); state++) {
+    metrics[state * kLanes + lane] = state == 0 ? 0 : kUnreachableMetric16;
+  }
+  bias_[slot] = 0;
+  first_[slot] = 0;
+  num_pending_steps_[slot] = 0;
+  queued_[slot].clear();
+}
+
+void ViterbiSessionManager::Push(int slot, int symbol) {
+  std::vector<int16_t>& queued = queued_[slot];
+  queued.push_back(symbol);
+  const int block = slot / kLanes;
+  if (queued.size() >= codec_.num_parity_bits() && !block_ready_[block]) {
+    block_ready_[block] = true;
+    ready_blocks_.push_back(block);
+  }
+}
+
+void ViterbiSessionManager::Feed(Handle session, const std::string& bits) {
+  const int slot = Slot(session);
+  for (int i = 0; i < bits.size(); i++) {
+    assert(bits[i] == '0' || bits[i] == '1');
+    Push(slot, bits[i] == '0' ? max_symbol_ : -max_symbol_);
+  }
+}
+
+void ViterbiSessionManager::Feed(Handle session,
+                                 const int8_t* symbols,
+                                 size_t num_symbols) {
+  const int slot = Slot(session);
+  for (size_t i = 0; i < num_symbols; i++) {
+    Push(slot, symbols[i]);
+  }
+}
+
+void ViterbiSessionManager::Feed(Handle session,
+                                 const int16_t* symbols,
+                                 size_t num_symbols) {
+  const int slot = Slot(session);
+  for (size_t i = 0; i < num_symbols; i++) {
+    Push(slot, symbols[i]);
+  }
+}
+
+void ViterbiSessionManager::Process() {
+  for (int i = 0; i < ready_blocks_.size(); i++) {
+    ProcessBlock(ready_blocks_[i]);
+    block_ready_[ready_blocks_[i]] = false;
+  }
+  ready_blocks_.clear();
+}
+
+void ViterbiSessionManager::ProcessBlock(int block) {
+  const int n = codec_.num_parity_bits();
+  const int num_states = codec_.num_states();
+  const int num_groups = (num_states + 15) / 16;
+  const int first_slot = block * kLanes;
+  int16_t* metrics = &metrics_[(size_t) first_slot * num_states];
+
+  BlockStep step;
+  step.num_states = num_states;
+  step.num_parity_bits = n;
+  step.num_branch_outputs = codec_.num_branch_outputs_;
+  step.branch_outputs = codec_.branch_outputs_.data();
+  step.branch0 = codec_.branch0_.data();
+  step.branch1 = codec_.branch1_.data();
+  step.cost0 = cost0_.data();
+  step.cost1 = cost1_.data();
+  step.bias = &bias_[first_slot];
+  int16_t active[kLanes];
+  step.active = active;
+  step.branch_metrics = branch_metrics_.data();
+  step.new_metrics = new_metrics_.data();
+  int16_t best[kLanes];
+  step.best = best;
+  step.decisions = lane_decisions_.data();
+
+  size_t consumed[kLanes] = {0};
+  while (true) {
+    bool any_active = false;
+    for (int lane = 0; lane < kLanes; lane++) {
+      const int slot = first_slot + lane;
+      const std::vector<int16_t>& queued = queued_[slot];
+      active[lane] = open_[slot] && queued.size() - consumed[lane] >= n ? -1 : 0;
+      if (!active[lane]) {
+        continue;
+      }
+      any_active = true;
+      for (int j = 0; j < n; j++) {
+        const int x = queued[consumed[lane] + j];
+        cost0_[j * kLanes + lane] =
+            std::min((x < 0 ? -x : 0) >> cost_shift_, max_cost_);
+        cost1_[j * kLanes + lane] =
+            std::min((x > 0 ? x : 0) >> cost_shift_, max_cost_);
+      }
+      consumed[lane] += n;
+      if (num_pending_steps_[slot] == window_) {
+        Traceback(slot, window_ - traceback_depth_);
+      }
+    }
+    if (!any_active) {
+      break;
+    }
+
+    RunBlockStep(step, metrics);
+    std::memcpy(metrics, new_metrics_.data(),
+                new_metrics_.size() * sizeof(int16_t));
+
+    for (int lane = 0; lane < kLanes; lane++) {
+      if (!active[lane]) {
+        continue;
+      }
+      const int slot = first_slot + lane;
+      bias_[slot] = best[lane] >= kRenormalizeThreshold16 ? -best[lane] : 0;
+      uint64_t* words = decisions(slot, num_pending_steps_[slot]++);
+      std::fill_n(words, codec_.decision_words(), 0);
+      for (int group = 0; group < num_groups; group++) {
+        words[group >> 2] |=
+            (uint64_t) (uint16_t) lane_decisions_[group * kLanes + lane]
+            << ((group & 3) * 16);
+      }
+    }
+  }
+
+  for (int lane = 0; lane < kLanes; lane++) {
+    std::vector<int16_t>& queued = queued_[first_slot + lane];
+    queued.erase(queued.begin(), queued.begin() + consumed[lane]);
+  }
+}
+
+void ViterbiSessionManager::Traceback(int slot, int num_output) {
+  const int num_states = codec_.num_states();
+  const int lane = slot % kLanes;
+  const int16_t* metrics =
+      &metrics_[(size_t) (slot - lane) * num_states + lane];
+  int state = 0;
+  for (int s = 1; s < num_states; s++) {
+    if (metrics[s * kLanes] < metrics[state * kLanes]) {
+      state = s;
+    }
+  }
+
+  const int shift = codec_.constraint() - 2;
+  std::string& decoded = decoded_[slot];
+  const size_t begin = decoded.size();
+  decoded.resize(begin + num_output, '0');
+  for (int i = num_pending_steps_[slot] - 1; i >= 0; i--) {
+    if (i < num_output) {
+      decoded[begin + i] = state >> shift ? '1' : '0';
+    }
+    state = codec_.PreviousState(state, decisions(slot, i));
+  }
+
+  first_[slot] = (first_[slot] + num_output) % window_;
+  num_pending_steps_[slot] -= num_output;
+}
+
+void ViterbiSessionManager::Take(Handle session, std::string* decoded) {
+  const int slot = Slot(session);
+  decoded->append(decoded_[slot]);
+  decoded_[slot].clear();
+}
+
+void ViterbiSessionManager::Finish(Handle session, std::string* decoded) {
+  const int slot = Slot(session);
+  // Complete a partial trellis step with erasures.
+  while (queued_[slot].size() % codec_.num_parity_bits() != 0) {
+    Push(slot, 0);
+  }
+  ProcessBlock(slot / kLanes);
+
+  const int num_flushing_bits = codec_.constraint() - 1;
+  const int num_pending_steps = num_pending_steps_[slot];
+  Traceback(slot, num_pending_steps >= num_flushing_bits
+                      ? num_pending_steps - num_flushing_bits
+                      : num_pending_steps);
+  Take(session, decoded);
+  ResetSlot(slot);
+}
+
+int ViterbiSessionManager::pending_steps(Handle session) const {
+  return num_pending_steps_[Slot(session)];
+}
+
+void ViterbiSessionManager::Snapshot(Handle session, std::string* out) const {
+  const int slot = Slot(session);
+  const int num_states = codec_.num_states();
+  const int words = codec_.decision_words();
+  const int num_pending_steps = num_pending_steps_[slot];
+  AppendSnapshotHeader(kSessionSnapshot, codec_, out);
+  AppendSnapshot<uint8_t>(cost_shift_, out);
+  AppendSnapshot<uint8_t>(0, out);
+  AppendSnapshot<uint8_t>(0, out);
+  AppendSnapshot<uint8_t>(0, out);
+  AppendSnapshot<uint32_t>(num_pending_steps, out);
+  AppendSnapshot<uint32_t>(queued_[slot].size(), out);
+  AppendSnapshot<uint32_t>(decoded_[slot].size(), out);
+  AppendSnapshot<int16_t>(bias_[slot], out);
+  AppendSnapshot<int16_t>(0, out);
+  AppendSnapshot(queued_[slot].data(), queued_[slot].size(), out);
+  out->append(decoded_[slot]);
+
+  const int lane = slot % kLanes;
+  const int16_t* metrics =
+      &metrics_[(size_t) (slot - lane) * num_states + lane];
+  for (int state = 0; state < num_states; state++) {
+    AppendSnapshot(metrics[state * kLanes], out);
+  }
+
+  // The ring in at most two runs.
+  const int first_run = std::min(num_pending_steps, window_ - first_[slot]);
+  const uint64_t* ring = &decisions_[(size_t) slot * window_ * words];
+  AppendSnapshot(ring + (size_t) first_[slot] * words,
+                 (size_t) first_run * words, out);
+  AppendSnapshot(ring, (size_t) (num_pending_steps - first_run) * words, out);
+}
+
+bool ViterbiSessionManager::Restore(const char* data,
+                                    size_t size,
+                                    Handle* session) {
+  const Handle handle = Open();
+  if (!RestoreSlot(Slot(handle), data, size)) {
+    Close(handle);
+    return false;
+  }
+  *session = handle;
+  return true;
+}
+
+bool ViterbiSessionManager::RestoreSlot(int slot,
+                                        const char* data,
+                                        size_t size) {
+  const int num_states = codec_.num_states();
+  const int words = codec_.decision_words();
+  SnapshotReader reader(data, size);
+  uint8_t cost_shift;
+  uint8_t reserved8[3];
+  uint32_t num_pending_steps;
+  uint32_t num_queued;
+  uint32_t num_decoded;
+  int16_t bias;
+  int16_t reserved16;
+  if (!reader.ReadHeader(kSessionSnapshot, codec_) ||
+      !reader.Read(&cost_shift) || !reader.Read(reserved8, 3) ||
+      !reader.Read(&num_pending_steps) || !reader.Read(&num_queued) ||
+      !reader.Read(&num_decoded) || !reader.Read(&bias) ||
+      !reader.Read(&reserved16)) {
+    return false;
+  }
+  // Metrics scaled otherwise would not add up with this manager's costs.
+  if (cost_shift != cost_shift_ || num_pending_steps > window_ ||
+      num_queued > reader.remaining() / sizeof(int16_t) ||
+      num_decoded > reader.remaining()) {
+    return false;
+  }
+  std::vector<int16_t>& queued = queued_[slot];
+  queued.resize(num_queued);
+  decoded_[slot].resize(num_decoded);
+  if (!reader.Read(queued.data(), num_queued) ||
+      !reader.Read(&decoded_[slot][0], num_decoded)) {
+    return false;
+  }
+
+  const int lane = slot % kLanes;
+  int16_t* metrics = &metrics_[(size_t) (slot - lane) * num_states + lane];
+  for (int state = 0; state < num_states; state++) {
+    if (!reader.Read(&metrics[state * kLanes])) {
+      return false;
+    }
+  }
+  if (!reader.Read(&decisions_[(size_t) slot * window_ * words],
+                   (size_t) num_pending_steps * words) ||
+      reader.remaining() != 0) {
+    return false;
+  }
+  bias_[slot] = bias;
+  first_[slot] = 0;
+  num_pending_steps_[slot] = num_pending_steps;
+
+  const int block = slot / kLanes;
+  if (queued.size() >= codec_.num_parity_bits() && !block_ready_[block]) {
+    block_ready_[block] = true;
+    ready_blocks_.push_back(block);
+  }
+  return true;
+}
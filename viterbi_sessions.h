@@ -0,0 +1,164 @@
+// Decoding of many concurrent streams of one code, such as thousands of
+// low-rate channels.
+
+#ifndef VITERBI_SESSIONS_H_
+#define VITERBI_SESSIONS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "viterbi.h"
+
+// Streaming decoders for many sessions, like one ViterbiStreamDecoder each,
+// but with their state kept in shared arenas instead of separate objects.
+// Sessions are grouped in blocks of kLanes, whose path metrics are
+// interleaved state by state, so that one SIMD add-compare-select step
+// advances every session of a block with symbols pending. A session costs its
+// path metrics (16 bits per state), its decision ring and a few counters.
+//
+// Path metrics are 16-bit: symbol costs which do not fit them exactly are
+// scaled down, as by the 16-bit engines of ViterbiCodec. Not thread-safe.
+class ViterbiSessionManager {
+ public:
+  // Identifies a session. Handles of closed sessions are never reused.
+  typedef uint64_t Handle;
+
+  // Sessions per block.
+  static const int kLanes = 16;
+
+  // The codec must outlive the manager. Symbol costs are scaled for the
+  // given type. traceback_depth and max_latency are as for
+  // ViterbiStreamDecoder, and so is the output of each session as long as
+  // symbol costs need no scaling.
+  ViterbiSessionManager(const ViterbiCodec& codec,
+                        SymbolType symbol_type,
+                        int traceback_depth = 0,
+                        int max_latency = 0);
+
+  // Starts a new session in state 0.
+  Handle Open();
+
+  // Ends a session, discarding its state and undecoded symbols.
+  void Close(Handle session);
+
+  bool IsOpen(Handle session) const;
+
+  int num_sessions() const { return num_sessions_; }
+
+  // Queues received symbols of a session for the next Process(). Hard bits
+  // count as the most confident symbols of the manager's type.
+  void Feed(Handle session, const std::string& bits);
+  void Feed(Handle session, const int8_t* symbols, size_t num_symbols);
+  void Feed(Handle session, const int16_t* symbols, size_t num_symbols);
+
+  // Runs the trellis steps of all queued symbols of all sessions.
+  void Process();
+
+  // Moves the bits decoded so far for a session to *decoded.
+  void Take(Handle session, std::string* decoded);
+
+  // Ends the stream of a session like ViterbiStreamDecoder::Finish(),
+  // appending all its remaining bits to *decoded. The session stays open for
+  // a new stream.
+  void Finish(Handle session, std::string* decoded);
+
+  // Number of trellis steps of a session whose bits have not been output.
+  int pending_steps(Handle session) const;
+
+  int traceback_depth() const { return traceback_depth_; }
+
+  // Appends the state of a session to *out, see viterbi_snapshot.h: its path
+  // metrics, pending decisions, queued symbols and bits not taken yet. The
+  // body is:
+  //     uint8  cost_shift
+  //     uint8  reserved[3]
+  //     uint32 num_pending_steps
+  //     uint32 num_queued
+  //     uint32 num_decoded
+  //     int16  bias
+  //     int16  reserved
+  //     int16  queued[num_queued]
+  //     char   decoded[num_decoded]
+  //     int16  metrics[num_states]
+  //     uint64 decisions[num_pending_steps][decision_words], oldest first
+  void Snapshot(Handle session, std::string* out) const;
+
+  // Opens a session which continues the stream of a snapshot taken by a
+  // manager of the same code and symbol type, and sets *session to it. Its
+  // pending steps must fit the decision ring. Returns false, opening no
+  // session, if the snapshot does not fit or is malformed.
+  bool Restore(const char* data, size_t size, Handle* session);
+
+ private:
+  // Returns the slot of an open session.
+  int Slot(Handle session) const;
+
+  // Puts a slot in state 0 with nothing pending.
+  void ResetSlot(int slot);
+
+  // Queues one symbol, given as a log-likelihood ratio.
+  void Push(int slot, int symbol);
+
+  // Runs trellis steps for the block until none of its sessions has a full
+  // step of symbols queued.
+  void ProcessBlock(int block);
+
+  // Traces back the session in slot from its best state, and outputs the
+  // oldest num_output of its pending steps.
+  void Traceback(int slot, int num_output);
+
+  uint64_t* decisions(int slot, int step) {
+    int index = first_[slot] + step;
+    if (index >= window_) {
+      index -= window_;
+    }
+    return &decisions_[((size_t) slot * window_ + index) *
+                       codec_.decision_words()];
+  }
+
+  // Restores a snapshot into an open slot, see Restore().
+  bool RestoreSlot(int slot, const char* data, size_t size);
+
+  const ViterbiCodec& codec_;
+  const int traceback_depth_;
+  // Capacity of each decision ring, in trellis steps.
+  const int window_;
+
+  // Symbol costs are shifted right by cost_shift_ and clamped to max_cost_.
+  int cost_shift_;
+  int max_cost_;
+  // The most confident symbol, as which hard bits are queued.
+  int max_symbol_;
+
+  int num_sessions_;
+  std::vector<int> free_slots_;
+  std::vector<uint32_t> generations_;
+  std::vector<char> open_;
+
+  // Arenas, indexed by slot, or by block and then state and lane.
+  std::vector<int16_t> metrics_;
+  std::vector<int16_t> bias_;
+  std::vector<uint64_t> decisions_;
+  std::vector<int> first_;
+  std::vector<int> num_pending_steps_;
+  std::vector<std::vector<int16_t> > queued_;
+  std::vector<std::string> decoded_;
+
+  // Blocks with a session which has a full step of symbols queued.
+  std::vector<char> block_ready_;
+  std::vector<int> ready_blocks_;
+
+  // Scratch space of ProcessBlock(), by parity bit, branch output or state,
+  // and then lane.
+  std::vector<int16_t> cost0_;
+  std::vector<int16_t> cost1_;
+  std::vector<int16_t> branch_metrics_;
+  std::vector<int16_t> new_metrics_;
+  // Decision bits of 16 states per lane, by group of 16 states.
+  std::vector<int16_t> lane_decisions_;
+};
+
+#endif  // VITERBI_SESSIONS_H_
@@ -0,0 +1,214 @@
+// Implementation of ViterbiShadowVerifier.
+
+#include "viterbi_shadow.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "viterbi.h"
+
+namespace {
+
+// The reference decodes every frame with a full search in the scalar engine,
+// traced back in one pass.
+ViterbiOptions ReferenceOptions() {
+  ViterbiOptions reference;
+  reference.engine = kScalarEngine;
+  reference.metric_bits = 32;
+  reference.segmented_traceback = false;
+  reference.codeword_fast_path = false;
+  return reference;
+}
+
+const char* FormatName(SymbolType type) {
+  switch (type) {
+    case kInt8Symbols:
+      return "int8";
+    case kInt16Symbols:
+      return "int16";
+    default:
+      return "text";
+  }
+}
+
+}  // namespace
+
+ViterbiShadowVerifier::ViterbiShadowVerifier(const ViterbiCodec& codec,
+                                             double fraction,
+                                             const std::string& log_dir,
+                                             size_t max_pending)
+    : codec_(codec),
+      reference_(codec.code(), ReferenceOptions()),
+      fraction_(fraction),
+      log_dir_(log_dir),
+      max_pending_(max_pending),
+      num_frames_(0),
+      verifying_(false),
+      stop_(false),
+      thread_(&ViterbiShadowVerifier::Run, this) {}
+
+ViterbiShadowVerifier::~ViterbiShadowVerifier() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  pending_cv_.notify_one();
+  thread_.join();
+}
+
+std::string ViterbiShadowVerifier::Decode(const std::string& bits) {
+  const uint64_t id = num_frames_.fetch_add(1);
+  std::string decoded = codec_.Decode(bits);
+  Sample(id, kHardSymbols, bits.data(), bits.size(), decoded);
+  return decoded;
+}
+
+std::string ViterbiShadowVerifier::Decode(const int8_t* symbols,
+                                          size_t num_symbols) {
+  const uint64_t id = num_frames_.fetch_add(1);
+  std::string decoded = codec_.Decode(symbols, num_symbols);
+  Sample(id, kInt8Symbols, symbols, num_symbols, decoded);
+  return decoded;
+}
+
+std::string ViterbiShadowVerifier::Decode(const int16_t* symbols,
+                                          size_t num_symbols) {
+  const uint64_t id = num_frames_.fetch_add(1);
+  std::string decoded = codec_.Decode(symbols, num_symbols);
+  Sample(id, kInt16Symbols, symbols, num_symbols * 2, decoded);
+  return decoded;
+}
+
+void ViterbiShadowVerifier::Sample(uint64_t id,
+                                   SymbolType type,
+                                   const void* input,
+                                   size_t input_bytes,
+                                   const std::string& decoded) {
+  // Frame id is sampled if it takes the running count of samples to the
+  // next integer, which spreads the samples evenly.
+  if (std::floor((id + 1) * fraction_) == std::floor(id * fraction_)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.num_sampled++;
+    if (pending_.size() >= max_pending_) {
+      stats_.num_dropped++;
+      return;
+    }
+    pending_.push_back(Frame());
+    Frame& frame = pending_.back();
+    frame.id = id;
+    frame.type = type;
+    frame.input.assign(static_cast<const char*>(input), input_bytes);
+    frame.decoded = decoded;
+  }
+  pending_cv_.notify_one();
+}
+
+void ViterbiShadowVerifier::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this] { return pending_.empty() && !verifying_; });
+}
+
+ViterbiShadowStats ViterbiShadowVerifier::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ViterbiShadowStats stats = stats_;
+  stats.num_frames = num_frames_.load();
+  return stats;
+}
+
+void ViterbiShadowVerifier::Run() {
+  // Run only when a CPU would otherwise idle, or else at the lowest nice
+  // level, which Linux sets per thread.
+  sched_param param = {};
+  if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0 &&
+      setpriority(PRIO_PROCESS, 0, 19) != 0) {
+    std::cerr << "ViterbiShadowVerifier: cannot lower the priority of the "
+                 "reference thread: "
+              << std::strerror(errno) << std::endl;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    pending_cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+    if (pending_.empty()) {
+      return;
+    }
+    const Frame frame = std::move(pending_.front());
+    pending_.pop_front();
+    verifying_ = true;
+    lock.unlock();
+    Verify(frame);
+    lock.lock();
+    verifying_ = false;
+    if (pending_.empty()) {
+      idle_cv_.notify_all();
+    }
+  }
+}
+
+void ViterbiShadowVerifier::Verify(const Frame& frame) {
+  std::string expected;
+  switch (frame.type) {
+    case kInt8Symbols:
+      expected = reference_.Decode(
+          reinterpret_cast<const int8_t*>(frame.input.data()),
+          frame.input.size());
+      break;
+    case kInt16Symbols:
+      expected = reference_.Decode(
+          reinterpret_cast<const int16_t*>(frame.input.data()),
+          frame.input.size() / 2);
+      break;
+    default:
+      expected = reference_.Decode(frame.input);
+      break;
+  }
+  const bool mismatch = expected != frame.decoded;
+  if (mismatch && !log_dir_.empty()) {
+    LogMismatch(frame, expected);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.num_verified++;
+  stats_.num_mismatches += mismatch;
+}
+
+void ViterbiShadowVerifier::LogMismatch(const Frame& frame,
+                                        const std::string& expected) {
+  std::ostringstream name;
+  name << "shadow-" << getpid() << "-" << frame.id << "."
+       << FormatName(frame.type);
+  std::ofstream input((log_dir_ + "/" + name.str()).c_str(),
+                      std::ios::binary);
+  input.write(frame.input.data(), frame.input.size());
+
+  int num_differing = 0;
+  int first_differing = -1;
+  for (int i = 0; i < expected.size(); i++) {
+    if (i >= frame.decoded.size() || frame.decoded[i] != expected[i]) {
+      num_differing++;
+      if (first_differing < 0) {
+        first_differing = i;
+      }
+    }
+  }
+  std::ofstream log((log_dir_ + "/shadow-mismatches.log").c_str(),
+                    std::ios::app);
+  log << name.str() << ": " << codec_ << ": " << num_differing << " of "
+      << expected.size() << " bits differ, the first at " << first_differing
+      << std::endl;
+}
@@ -0,0 +1,123 @@
+// Shadow verification of a fast decoder against the reference one.
+
+#ifndef VITERBI_SHADOW_H_
+#define VITERBI_SHADOW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "viterbi.h"
+
+// Counters of a ViterbiShadowVerifier since it started.
+struct ViterbiShadowStats {
+  ViterbiShadowStats()
+      : num_frames(0),
+        num_sampled(0),
+        num_dropped(0),
+        num_verified(0),
+        num_mismatches(0) {}
+
+  // Frames decoded, and those sampled for verification.
+  uint64_t num_frames;
+  uint64_t num_sampled;
+  // Sampled frames dropped because too many were waiting.
+  uint64_t num_dropped;
+  // Sampled frames the reference decoded, and those it decoded otherwise.
+  uint64_t num_verified;
+  uint64_t num_mismatches;
+};
+
+// Decodes frames with a codec configured for speed, such as one with SIMD
+// engines or reduced-state search, and decodes a fraction of them again with
+// the reference: a codec of the same code with the scalar engine, 32-bit
+// metrics, the full search of every frame and a traceback over the whole
+// frame in one pass. The reference runs on a background thread at idle
+// priority, so the callers only pay for copying the sampled frames; if more
+// than max_pending frames wait for it, further samples are dropped rather
+// than queued.
+//
+// Each mismatch is counted and, if log_dir is not empty, its input frame is
+// written to log_dir/shadow-<pid>-<n>.<format>, where format is "text",
+// "int8" or "int16" as for viterbi_main's --input_format, and a line naming
+// the file and where the outputs differ is appended to
+// log_dir/shadow-mismatches.log. Thread-safe.
+class ViterbiShadowVerifier {
+ public:
+  // The codec must outlive the verifier. A fraction of 0 verifies nothing,
+  // 1 every frame.
+  ViterbiShadowVerifier(const ViterbiCodec& codec,
+                        double fraction,
+                        const std::string& log_dir = std::string(),
+                        size_t max_pending = 64);
+
+  // Verifies the pending frames, then stops.
+  ~ViterbiShadowVerifier();
+
+  ViterbiShadowVerifier(const ViterbiShadowVerifier&) = delete;
+  ViterbiShadowVerifier& operator=(const ViterbiShadowVerifier&) = delete;
+
+  // As the codec's Decode().
+  std::string Decode(const std::string& bits);
+  std::string Decode(const int8_t* symbols, size_t num_symbols);
+  std::string Decode(const int16_t* symbols, size_t num_symbols);
+
+  // Waits until every sampled frame so far is verified.
+  void Flush();
+
+  ViterbiShadowStats stats() const;
+
+  const ViterbiCodec& codec() const { return codec_; }
+
+  const ViterbiCodec& reference() const { return reference_; }
+
+ private:
+  // A sampled frame: its input as the bytes of its symbols, and what the
+  // codec decoded.
+  struct Frame {
+    uint64_t id;
+    SymbolType type;
+    std::string input;
+    std::string decoded;
+  };
+
+  // Queues frame id for verification if it is sampled.
+  void Sample(uint64_t id,
+              SymbolType type,
+              const void* input,
+              size_t input_bytes,
+              const std::string& decoded);
+
+  void Run();
+
+  // Decodes a frame with the reference, and logs it if it differs.
+  void Verify(const Frame& frame);
+
+  void LogMismatch(const Frame& frame, const std::string& expected);
+
+  const ViterbiCodec& codec_;
+  const ViterbiCodec reference_;
+  const double fraction_;
+  const std::string log_dir_;
+  const size_t max_pending_;
+
+  std::atomic<uint64_t> num_frames_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable pending_cv_;
+  std::condition_variable idle_cv_;
+  std::deque<Frame> pending_;
+  bool verifying_;
+  bool stop_;
+  ViterbiShadowStats stats_;
+
+  std::thread thread_;
+};
+
+#endif  // VITERBI_SHADOW_H_
@@ -0,0 +1,387 @@
+// Implementation of the shared-memory transport.
+
+#include "viterbi_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "shared-memory atomics must be lock free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "shared-memory atomics must be lock free");
+
+const uint32_t kSegmentMagic = 0x56534d31;  // "VSM1"
+const uint32_t kSegmentVersion = 2;
+
+// Every record starts with its payload size, or kPaddingRecord for the
+// filler that skips to the end of the ring.
+const size_t kRecordHeaderSize = 16;
+const size_t kRecordAlignment = 64;
+const uint64_t kPaddingRecord = ~(uint64_t) 0;
+
+// Number of polls before sleeping on a futex. Spinning only pays off if the
+// other side runs on another CPU.
+int SpinCount() {
+  static const int spin_count =
+      std::thread::hardware_concurrency() > 1 ? 2000 : 0;
+  return spin_count;
+}
+
+struct ShmSegmentHeader {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint32_t num_channels;
+  uint32_t reserved;
+  uint64_t ring_size;
+};
+
+struct ShmChannel {
+  // Process id of the producer holding the channel, or 0.
+  alignas(64) std::atomic<uint32_t> claimed;
+  ShmRingControl requests;
+  ShmRingControl responses;
+};
+
+size_t RoundUp(size_t x, size_t alignment) {
+  return (x + alignment - 1) / alignment * alignment;
+}
+
+void Futex(std::atomic<uint32_t>* address, int op, uint32_t value) {
+  // Not FUTEX_PRIVATE_FLAG: the waiters are in different processes.
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), op, value, NULL,
+          NULL, 0);
+}
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+// Offsets of the parts of a segment.
+size_t ChannelsOffset() { return RoundUp(sizeof(ShmSegmentHeader), 64); }
+
+size_t RingsOffset(int num_channels) {
+  return RoundUp(ChannelsOffset() + num_channels * sizeof(ShmChannel),
+                 sysconf(_SC_PAGESIZE));
+}
+
+size_t SegmentSize(int num_channels, size_t ring_size) {
+  return RingsOffset(num_channels) + 2 * num_channels * ring_size;
+}
+
+}  // namespace
+
+ShmRing::ShmRing(ShmRingControl* control, char* data, size_t capacity)
+    : control_(control),
+      data_(data),
+      capacity_(capacity),
+      pending_write_(0),
+      pending_read_(0) {}
+
+size_t ShmRing::max_record_size() const {
+  return capacity_ - kRecordHeaderSize;
+}
+
+bool ShmRing::closed() const {
+  return control_->closed.load(std::memory_order_acquire) != 0;
+}
+
+uint64_t ShmRing::num_written() const {
+  return control_->num_written.load(std::memory_order_acquire);
+}
+
+uint64_t ShmRing::num_read() const {
+  return control_->num_read.load(std::memory_order_acquire);
+}
+
+template <typename Done>
+bool ShmRing::Wait(std::atomic<uint32_t>* seq,
+                   std::atomic<uint32_t>* waiting,
+                   Done done) {
+  for (int i = 0; i < SpinCount(); i++) {
+    if (done()) {
+      return true;
+    }
+    if (closed()) {
+      return false;
+    }
+    CpuRelax();
+  }
+  while (true) {
+    const uint32_t value = seq->load(std::memory_order_seq_cst);
+    waiting->store(1, std::memory_order_seq_cst);
+    if (done()) {
+      waiting->store(0, std::memory_order_relaxed);
+      return true;
+    }
+    if (closed()) {
+      waiting->store(0, std::memory_order_relaxed);
+      return false;
+    }
+    Futex(seq, FUTEX_WAIT, value);
+    waiting->store(0, std::memory_order_relaxed);
+  }
+}
+
+void ShmRing::Notify(std::atomic<uint32_t>* seq,
+                     std::atomic<uint32_t>* waiting) {
+  seq->fetch_add(1, std::memory_order_seq_cst);
+  if (waiting->load(std::memory_order_seq_cst)) {
+    Futex(seq, FUTEX_WAKE, INT_MAX);
+  }
+}
+
+char* ShmRing::BeginWrite(size_t size) {
+  if (size > max_record_size() || closed()) {
+    return NULL;
+  }
+  const size_t total = RoundUp(kRecordHeaderSize + size, kRecordAlignment);
+  const uint64_t write_pos =
+      control_->write_pos.load(std::memory_order_relaxed);
+  const size_t offset = write_pos % capacity_;
+
+  // A record does not wrap around. If it does not fit before the end of the
+  // ring, fill the rest with padding and start over at the beginning.
+  if (offset + total > capacity_) {
+    const size_t padding = capacity_ - offset;
+    if (!Wait(&control_->read_seq, &control_->producer_waiting, [&] {
+          return write_pos + padding - control_->read_pos.load() <=
+                 capacity_;
+        })) {
+      return NULL;
+    }
+    memcpy(data_ + offset, &kPaddingRecord, sizeof(kPaddingRecord));
+    control_->write_pos.store(write_pos + padding, std::memory_order_release);
+    Notify(&control_->write_seq, &control_->consumer_waiting);
+    return BeginWrite(size);
+  }
+
+  if (!Wait(&control_->read_seq, &control_->producer_waiting, [&] {
+        return write_pos + total - control_->read_pos.load() <= capacity_;
+      })) {
+    return NULL;
+  }
+  const uint64_t record_size = size;
+  memcpy(data_ + offset, &record_size, sizeof(record_size));
+  pending_write_ = total;
+  return data_ + offset + kRecordHeaderSize;
+}
+
+void ShmRing::CommitWrite() {
+  control_->num_written.fetch_add(1, std::memory_order_release);
+  control_->write_pos.fetch_add(pending_write_, std::memory_order_release);
+  pending_write_ = 0;
+  Notify(&control_->write_seq, &control_->consumer_waiting);
+}
+
+const char* ShmRing::BeginRead(size_t* size) {
+  while (true) {
+    const uint64_t read_pos =
+        control_->read_pos.load(std::memory_order_relaxed);
+    if (!Wait(&control_->write_seq, &control_->consumer_waiting,
+              [&] { return control_->write_pos.load() != read_pos; })) {
+      // Drain what was written before the ring was closed.
+      if (control_->write_pos.load() == read_pos) {
+        return NULL;
+      }
+    }
+
+    const size_t offset = read_pos % capacity_;
+    uint64_t record_size;
+    memcpy(&record_size, data_ + offset, sizeof(record_size));
+    if (record_size == kPaddingRecord) {
+      control_->read_pos.store(read_pos + capacity_ - offset,
+                               std::memory_order_release);
+      Notify(&control_->read_seq, &control_->producer_waiting);
+      continue;
+    }
+    *size = record_size;
+    pending_read_ = RoundUp(kRecordHeaderSize + record_size, kRecordAlignment);
+    return data_ + offset + kRecordHeaderSize;
+  }
+}
+
+void ShmRing::EndRead() {
+  control_->num_read.fetch_add(1, std::memory_order_release);
+  control_->read_pos.fetch_add(pending_read_, std::memory_order_release);
+  pending_read_ = 0;
+  Notify(&control_->read_seq, &control_->producer_waiting);
+}
+
+void ShmRing::Close() {
+  control_->closed.store(1, std::memory_order_release);
+  Notify(&control_->write_seq, &control_->consumer_waiting);
+  Notify(&control_->read_seq, &control_->producer_waiting);
+}
+
+ShmSegment::ShmSegment(const std::string& name,
+                       bool owner,
+                       void* address,
+                       size_t size)
+    : name_(name), owner_(owner), address_(address), size_(size) {
+  ShmSegmentHeader* header = static_cast<ShmSegmentHeader*>(address_);
+  num_channels_ = header->num_channels;
+  char* base = static_cast<char*>(address_);
+  ShmChannel* channels =
+      reinterpret_cast<ShmChannel*>(base + ChannelsOffset());
+  char* rings = base + RingsOffset(num_channels_);
+  const size_t ring_size = header->ring_size;
+  for (int i = 0; i < num_channels_; i++) {
+    requests_.push_back(ShmRing(&channels[i].requests,
+                                rings + 2 * i * ring_size, ring_size));
+    responses_.push_back(ShmRing(&channels[i].responses,
+                                 rings + (2 * i + 1) * ring_size, ring_size));
+  }
+}
+
+ShmSegment::~ShmSegment() {
+  munmap(address_, size_);
+  if (owner_) {
+    shm_unlink(name_.c_str());
+  }
+}
+
+ShmSegment* ShmSegment::Create(const std::string& name,
+                               int num_channels,
+                               size_t ring_size,
+                               std::string* error) {
+  if (num_channels <= 0 || ring_size < 4096 ||
+      (ring_size & (ring_size - 1)) != 0) {
+    *error = "Expected a positive number of channels and a power-of-two "
+             "ring size of at least 4096";
+    return NULL;
+  }
+
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  const size_t size = SegmentSize(num_channels, ring_size);
+  if (fd < 0 || ftruncate(fd, size) < 0) {
+    *error = "Failed to create " + name + ": " + strerror(errno);
+    if (fd >= 0) {
+      close(fd);
+      shm_unlink(name.c_str());
+    }
+    return NULL;
+  }
+  void* address =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    *error = "Failed to map " + name + ": " + strerror(errno);
+    shm_unlink(name.c_str());
+    return NULL;
+  }
+
+  // ftruncate() zero-fills, so only the atomics need constructing.
+  char* base = static_cast<char*>(address);
+  ShmSegmentHeader* header = new (base) ShmSegmentHeader();
+  header->version = kSegmentVersion;
+  header->num_channels = num_channels;
+  header->ring_size = ring_size;
+  for (int i = 0; i < num_channels; i++) {
+    new (base + ChannelsOffset() + i * sizeof(ShmChannel)) ShmChannel();
+  }
+  // Publish the segment last, so that Open() never sees it half built.
+  header->magic.store(kSegmentMagic, std::memory_order_release);
+  return new ShmSegment(name, true, address, size);
+}
+
+ShmSegment* ShmSegment::Open(const std::string& name, std::string* error) {
+  const int fd = shm_open(name.c_str(), O_RDWR, 0);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    *error = "Failed to open " + name + ": " + strerror(errno);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+  const size_t size = st.st_size;
+  void* address = size < sizeof(ShmSegmentHeader)
+                      ? MAP_FAILED
+                      : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                             fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    *error = "Failed to map " + name;
+    return NULL;
+  }
+
+  const ShmSegmentHeader* header =
+      static_cast<const ShmSegmentHeader*>(address);
+  if (header->magic.load(std::memory_order_acquire) != kSegmentMagic ||
+      header->version != kSegmentVersion ||
+      SegmentSize(header->num_channels, header->ring_size) != size) {
+    *error = name + " is not a decoder segment of this version";
+    munmap(address, size);
+    return NULL;
+  }
+  return new ShmSegment(name, false, address, size);
+}
+
+int ShmSegment::ClaimChannel() {
+  ShmChannel* channels = reinterpret_cast<ShmChannel*>(
+      static_cast<char*>(address_) + ChannelsOffset());
+  const uint32_t pid = getpid();
+  for (int i = 0; i < num_channels_; i++) {
+    uint32_t owner = 0;
+    if (channels[i].claimed.compare_exchange_strong(owner, pid)) {
+      return i;
+    }
+    // Take over the channel of a dead producer. Its process id may have been
+    // reused, which only delays the takeover until that process exits.
+    if (kill(owner, 0) < 0 && errno == ESRCH &&
+        channels[i].claimed.compare_exchange_strong(owner, pid)) {
+      if (DrainChannel(i)) {
+        return i;
+      }
+      channels[i].claimed.store(0, std::memory_order_release);
+    }
+  }
+  return -1;
+}
+
+bool ShmSegment::DrainChannel(int channel) {
+  // The service answers every request it reads, so the dead producer is owed
+  // as many responses as it wrote requests.
+  const uint64_t num_requests = requests_[channel].num_written();
+  ShmRing* responses = &responses_[channel];
+  while (responses->num_read() < num_requests) {
+    size_t size;
+    if (responses->BeginRead(&size) == NULL) {
+      return false;
+    }
+    responses->EndRead();
+  }
+  return true;
+}
+
+void ShmSegment::ReleaseChannel(int channel) {
+  ShmChannel* channels = reinterpret_cast<ShmChannel*>(
+      static_cast<char*>(address_) + ChannelsOffset());
+  channels[channel].claimed.store(0, std::memory_order_release);
+}
+
+void ShmSegment::Close() {
+  for (int i = 0; i < num_channels_; i++) {
+    requests_[i].Close();
+    responses_[i].Close();
+  }
+}
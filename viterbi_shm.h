@@ -0,0 +1,160 @@
+// Shared-memory transport for decode requests.
+//
+// A segment, created by the decoder service with shm_open(), holds a number
+// of channels. A producer process claims a channel and gets a pair of rings
+// with it: it writes request frames into one, in place, and the service
+// decodes them straight from shared memory and writes response frames into
+// the other. Each ring has a single producer and a single consumer; many
+// producers are served by giving each its own channel.
+//
+// Waiting on an empty or full ring sleeps on a futex in the segment after a
+// short spin, so an idle channel costs no CPU and a full ring applies
+// backpressure to its producer.
+
+#ifndef VITERBI_SHM_H_
+#define VITERBI_SHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Control block of a ring. It lives in shared memory, so it must only contain
+// address-free lock-free atomics.
+struct ShmRingControl {
+  // Total bytes and records ever written, and a futex the consumer sleeps on
+  // until they grow. The ring offset is write_pos % capacity.
+  alignas(64) std::atomic<uint64_t> write_pos;
+  std::atomic<uint64_t> num_written;
+  std::atomic<uint32_t> write_seq;
+  std::atomic<uint32_t> consumer_waiting;
+  // Total bytes and records ever read, and a futex the producer sleeps on
+  // until they grow.
+  alignas(64) std::atomic<uint64_t> read_pos;
+  std::atomic<uint64_t> num_read;
+  std::atomic<uint32_t> read_seq;
+  std::atomic<uint32_t> producer_waiting;
+  alignas(64) std::atomic<uint32_t> closed;
+};
+
+// A single-producer single-consumer ring of variable-size records. Records
+// are contiguous in memory and 16-byte aligned, so the consumer can work on
+// them in place.
+class ShmRing {
+ public:
+  ShmRing(ShmRingControl* control, char* data, size_t capacity);
+
+  // Largest record size that fits the ring.
+  size_t max_record_size() const;
+
+  // Producer side. BeginWrite() waits until size bytes are free and returns
+  // where to write them; CommitWrite() then publishes the record. Returns NULL
+  // if the ring is closed or size exceeds max_record_size().
+  char* BeginWrite(size_t size);
+  void CommitWrite();
+
+  // Consumer side. BeginRead() waits for a record and returns it and its
+  // size; EndRead() then releases its space. Returns NULL once the ring is
+  // closed and empty.
+  const char* BeginRead(size_t* size);
+  void EndRead();
+
+  // Wakes all waiters; both sides fail from then on, except that the
+  // consumer may drain records already written.
+  void Close();
+
+  bool closed() const;
+
+  // Records committed and released over the life of the ring.
+  uint64_t num_written() const;
+  uint64_t num_read() const;
+
+ private:
+  // Waits until done() holds, spinning briefly and then sleeping on seq.
+  template <typename Done>
+  bool Wait(std::atomic<uint32_t>* seq,
+            std::atomic<uint32_t>* waiting,
+            Done done);
+
+  // Advances seq and wakes its waiter, if any.
+  void Notify(std::atomic<uint32_t>* seq, std::atomic<uint32_t>* waiting);
+
+  ShmRingControl* const control_;
+  char* const data_;
+  const size_t capacity_;
+
+  // Bytes taken by the record being written or read, including padding.
+  size_t pending_write_;
+  size_t pending_read_;
+};
+
+const int kMaxShmPolynomials = 8;
+
+// Header of request and response frames in the rings. The payload follows
+// it, as described in viterbi_protocol.h.
+struct ShmFrameHeader {
+  uint64_t id;
+  // Request: a RequestType from viterbi_protocol.h. Response: a
+  // ResponseStatus.
+  uint32_t type;
+  // Request: number of bits or symbols in the payload. Response: number of
+  // decoded bits, packed most significant bit first, or of error message
+  // characters.
+  uint32_t num_symbols;
+  uint32_t constraint;
+  uint32_t num_polynomials;
+  uint32_t polynomials[kMaxShmPolynomials];
+};
+
+class ShmSegment {
+ public:
+  // Creates a segment named name (see shm_open()) with num_channels channels
+  // of two rings of ring_size bytes each. ring_size must be a power of two.
+  // The segment is removed when the returned object is destroyed. Returns
+  // NULL and sets *error on failure.
+  static ShmSegment* Create(const std::string& name,
+                            int num_channels,
+                            size_t ring_size,
+                            std::string* error);
+
+  // Opens a segment created by another process.
+  static ShmSegment* Open(const std::string& name, std::string* error);
+
+  ~ShmSegment();
+
+  int num_channels() const { return num_channels_; }
+
+  ShmRing* requests(int channel) { return &requests_[channel]; }
+  ShmRing* responses(int channel) { return &responses_[channel]; }
+
+  // Claims a free channel for a producer. Returns -1 if all are taken. A
+  // channel whose producer process died without releasing it is claimed
+  // again, once the responses to its requests are read and discarded, so
+  // this may wait for the service to answer them.
+  int ClaimChannel();
+
+  // Releases a claimed channel once both of its rings are drained.
+  void ReleaseChannel(int channel);
+
+  // Closes all rings, waking the service and all producers.
+  void Close();
+
+ private:
+  ShmSegment(const std::string& name, bool owner, void* address, size_t size);
+
+  // Discards the responses to every request written to a channel. Returns
+  // false if its rings are closed first.
+  bool DrainChannel(int channel);
+
+  const std::string name_;
+  const bool owner_;
+  void* const address_;
+  const size_t size_;
+  int num_channels_;
+  std::vector<ShmRing> requests_;
+  std::vector<ShmRing> responses_;
+};
+
+#endif  // VITERBI_SHM_H_
@@ -0,0 +1,199 @@
+// Test producer and benchmark for the shared-memory transport of
+// viterbi_server. Claims a channel, writes soft-symbol frames into the
+// request ring in place, and checks and times the responses.
+
+#include "viterbi.h"
+#include "viterbi_bits.h"
+#include "viterbi_protocol.h"
+#include "viterbi_shm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Name of the segment served by viterbi_server --shm.
+static std::string FLAGS_shm = "/viterbi";
+
+// Number of frames to send.
+static int FLAGS_frames = 10000;
+
+// Number of message bits per frame.
+static int FLAGS_bits = 1000;
+
+// Soft symbol type: int8 or int16.
+static std::string FLAGS_type = "int8";
+
+typedef std::chrono::steady_clock Clock;
+
+void Usage(const std::string& exec) {
+  std::cout
+      << "Usage:\n"
+      << "    " << exec << " [--shm=<name>] [--frames=<n>] [--bits=<n>]"
+      << " [--type=<int8|int16>] [<constraint> <polynomial>...]\n\n"
+      << "Sends random frames through a shared-memory channel of\n"
+      << "viterbi_server and reports throughput and latency percentiles.\n"
+      << "The code defaults to 7 91 117 121.\n";
+}
+
+std::vector<std::string> ParseFlags(int argc, char** argv) {
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--help") == 0) {
+      Usage(argv[0]);
+      exit(1);
+    } else if (std::strncmp(argv[i], "--shm=", 6) == 0) {
+      FLAGS_shm = argv[i] + 6;
+    } else if (std::strncmp(argv[i], "--frames=", 9) == 0) {
+      FLAGS_frames = std::max(1, std::atoi(argv[i] + 9));
+    } else if (std::strncmp(argv[i], "--bits=", 7) == 0) {
+      FLAGS_bits = std::max(1, std::atoi(argv[i] + 7));
+    } else if (std::strncmp(argv[i], "--type=", 7) == 0) {
+      FLAGS_type = argv[i] + 7;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  return args;
+}
+
+// Writes the symbols of encoded into a ring record, as a demodulator would.
+template <typename T>
+void WriteSymbols(const std::string& encoded, int magnitude, char* payload) {
+  T* symbols = reinterpret_cast<T*>(payload);
+  for (int i = 0; i < encoded.size(); i++) {
+    symbols[i] = encoded[i] == '0' ? magnitude : -magnitude;
+  }
+}
+
+double Percentile(const std::vector<double>& sorted, double p) {
+  return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> args = ParseFlags(argc, argv);
+  int constraint = 7;
+  std::vector<int> polynomials;
+  if (args.empty()) {
+    polynomials.push_back(91);
+    polynomials.push_back(117);
+    polynomials.push_back(121);
+  } else if (args.size() < 3) {
+    std::cout << "Insufficient number of arguments." << std::endl;
+    exit(1);
+  } else {
+    constraint = std::atoi(args[0].c_str());
+    for (int i = 1; i < args.size(); i++) {
+      polynomials.push_back(std::atoi(args[i].c_str()));
+    }
+  }
+  if (polynomials.size() > kMaxShmPolynomials) {
+    std::cout << "At most " << kMaxShmPolynomials << " polynomials"
+              << std::endl;
+    exit(1);
+  }
+  ViterbiCodec codec(constraint, polynomials);
+
+  std::string error;
+  std::unique_ptr<ShmSegment> segment(ShmSegment::Open(FLAGS_shm, &error));
+  if (!segment) {
+    std::cout << error << std::endl;
+    exit(1);
+  }
+  const int channel = segment->ClaimChannel();
+  if (channel < 0) {
+    std::cout << "All channels of " << FLAGS_shm << " are taken" << std::endl;
+    exit(1);
+  }
+  ShmRing* requests = segment->requests(channel);
+  ShmRing* responses = segment->responses(channel);
+
+  std::string message;
+  for (int i = 0; i < FLAGS_bits; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const std::string encoded = codec.Encode(message);
+  const bool wide = FLAGS_type == "int16";
+
+  ShmFrameHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.type = wide ? kDecodeInt16 : kDecodeInt8;
+  header.num_symbols = encoded.size();
+  header.constraint = constraint;
+  header.num_polynomials = polynomials.size();
+  std::copy(polynomials.begin(), polynomials.end(), header.polynomials);
+  const size_t frame_size =
+      sizeof(header) + PayloadSize(header.type, header.num_symbols);
+
+  // The producer runs on its own thread, so that a full request ring and a
+  // full response ring cannot block each other.
+  std::vector<Clock::time_point> sent(FLAGS_frames);
+  const Clock::time_point start = Clock::now();
+  std::thread producer([&] {
+    for (int i = 0; i < FLAGS_frames; i++) {
+      char* frame = requests->BeginWrite(frame_size);
+      if (frame == NULL) {
+        std::cout << "Frame of " << frame_size << " bytes does not fit"
+                  << std::endl;
+        exit(1);
+      }
+      header.id = i;
+      std::memcpy(frame, &header, sizeof(header));
+      if (wide) {
+        WriteSymbols<int16_t>(encoded, 1000, frame + sizeof(header));
+      } else {
+        WriteSymbols<int8_t>(encoded, 100, frame + sizeof(header));
+      }
+      sent[i] = Clock::now();
+      requests->CommitWrite();
+    }
+  });
+
+  std::vector<double> latencies;
+  std::string decoded;
+  int errors = 0;
+  for (int i = 0; i < FLAGS_frames; i++) {
+    size_t size;
+    const char* frame = responses->BeginRead(&size);
+    if (frame == NULL) {
+      std::cout << "Server closed " << FLAGS_shm << std::endl;
+      exit(1);
+    }
+    ShmFrameHeader response;
+    std::memcpy(&response, frame, sizeof(response));
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                            Clock::now() - sent[response.id])
+                            .count());
+    decoded.assign(response.num_symbols, '0');
+    UnpackBytes(
+        reinterpret_cast<const unsigned char*>(frame + sizeof(response)),
+        response.num_symbols, &decoded[0]);
+    if (response.type != kOk || decoded != message) {
+      errors++;
+    }
+    responses->EndRead();
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  producer.join();
+  segment->ReleaseChannel(channel);
+
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << codec << ", " << FLAGS_type << ", " << FLAGS_bits
+            << " bits per frame, channel " << channel << "\n"
+            << "frames:     " << latencies.size() << " in " << seconds
+            << " s, " << errors << " errors\n"
+            << "throughput: " << latencies.size() / seconds << " frames/s, "
+            << latencies.size() * (double) FLAGS_bits / seconds / 1e6
+            << " Mbit/s\n"
+            << "latency:    p50 " << Percentile(latencies, 0.5) << " us, p99 "
+            << Percentile(latencies, 0.99) << " us, p99.9 "
+            << Percentile(latencies, 0.999) << " us, max "
+            << latencies.back() << " us" << std::endl;
+  return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+// Binary snapshots of streaming encoder and decoder state, so that a stream
+// can move to another thread or process and carry on where it left off.
+//
+// A snapshot is a header followed by the state of one encoder, decoder or
+// session. All integers are in host byte order: snapshots move between
+// processes on machines of the same architecture.
+//
+// Header:
+//     uint32 magic            kSnapshotMagic
+//     uint16 version          kSnapshotVersion
+//     uint8  kind             a SnapshotKind
+//     uint8  constraint
+//     uint32 num_polynomials
+//     uint32 polynomials[num_polynomials]
+//
+// The body of each kind is laid out by the Snapshot() method of its class.
+// A snapshot restores only into an object of the same kind and code, and of
+// the same version.
+
+#ifndef VITERBI_SNAPSHOT_H_
+#define VITERBI_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "viterbi.h"
+
+const uint32_t kSnapshotMagic = 0x53425456;  // "VTBS"
+const int kSnapshotVersion = 1;
+
+enum SnapshotKind {
+  kStreamEncoderSnapshot = 0,
+  kStreamDecoderSnapshot = 1,
+  kSessionSnapshot = 2,
+};
+
+template <typename T>
+inline void AppendSnapshot(const T& value, std::string* out) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+inline void AppendSnapshot(const T* values, size_t count, std::string* out) {
+  out->append(reinterpret_cast<const char*>(values), count * sizeof(T));
+}
+
+inline void AppendSnapshotHeader(SnapshotKind kind,
+                                 const ViterbiCodec& codec,
+                                 std::string* out) {
+  AppendSnapshot<uint32_t>(kSnapshotMagic, out);
+  AppendSnapshot<uint16_t>(kSnapshotVersion, out);
+  AppendSnapshot<uint8_t>(kind, out);
+  AppendSnapshot<uint8_t>(codec.constraint(), out);
+  AppendSnapshot<uint32_t>(codec.polynomials().size(), out);
+  for (int i = 0; i < codec.polynomials().size(); i++) {
+    AppendSnapshot<uint32_t>(codec.polynomials()[i], out);
+  }
+}
+
+// Reads a snapshot in place. Every read fails once the data runs out.
+class SnapshotReader {
+ public:
+  SnapshotReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+  template <typename T>
+  bool Read(T* value) {
+    return Read(value, 1);
+  }
+
+  template <typename T>
+  bool Read(T* values, size_t count) {
+    if (count > size_ / sizeof(T)) {
+      return false;
+    }
+    std::memcpy(values, data_, count * sizeof(T));
+    data_ += count * sizeof(T);
+    size_ -= count * sizeof(T);
+    return true;
+  }
+
+  // Steps over count values without reading them.
+  template <typename T>
+  bool Skip(size_t count) {
+    if (count > size_ / sizeof(T)) {
+      return false;
+    }
+    data_ += count * sizeof(T);
+    size_ -= count * sizeof(T);
+    return true;
+  }
+
+  // Reads the header. Returns false unless it is of this version and of the
+  // given kind and code.
+  bool ReadHeader(SnapshotKind kind, const ViterbiCodec& codec) {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t snapshot_kind;
+    uint8_t constraint;
+    uint32_t num_polynomials;
+    if (!Read(&magic) || !Read(&version) || !Read(&snapshot_kind) ||
+        !Read(&constraint) || !Read(&num_polynomials)) {
+      return false;
+    }
+    if (magic != kSnapshotMagic || version != kSnapshotVersion ||
+        snapshot_kind != kind || constraint != codec.constraint() ||
+        num_polynomials != codec.polynomials().size()) {
+      return false;
+    }
+    for (int i = 0; i < num_polynomials; i++) {
+      uint32_t polynomial;
+      if (!Read(&polynomial) || polynomial != codec.polynomials()[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  size_t remaining() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+#endif  // VITERBI_SNAPSHOT_H_
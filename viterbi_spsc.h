@@ -0,0 +1,100 @@
+// Lock-free queue between two threads of one process.
+
+#ifndef VITERBI_SPSC_H_
+#define VITERBI_SPSC_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Waits for another thread by spinning, then yielding, then sleeping, so a
+// busy pipeline reacts within nanoseconds and an idle one costs little CPU.
+class SpinWait {
+ public:
+  SpinWait() : rounds_(0) {}
+
+  void Wait() {
+    if (rounds_ < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    } else if (rounds_ < 1024) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    rounds_++;
+  }
+
+ private:
+  int rounds_;
+};
+
+// A bounded single-producer single-consumer queue of preallocated slots,
+// which are filled and drained in place, so elements holding buffers are
+// reused without allocating.
+template <typename T>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity) : slots_(capacity), head_(0), tail_(0) {}
+
+  // Producer side. TryBeginPush() returns the slot to fill next, or NULL if
+  // the ring is full; EndPush() then publishes it. BeginPush() waits for a
+  // free slot.
+  T* TryBeginPush() {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+      return NULL;
+    }
+    return &slots_[tail % slots_.size()];
+  }
+
+  T* BeginPush() {
+    SpinWait wait;
+    T* slot;
+    while ((slot = TryBeginPush()) == NULL) {
+      wait.Wait();
+    }
+    return slot;
+  }
+
+  void EndPush() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  // Consumer side. TryFront() returns the oldest published slot, or NULL if
+  // there is none; Pop() then releases it. Front() waits for a slot.
+  T* TryFront() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (tail_.load(std::memory_order_acquire) == head) {
+      return NULL;
+    }
+    return &slots_[head % slots_.size()];
+  }
+
+  T* Front() {
+    SpinWait wait;
+    T* slot;
+    while ((slot = TryFront()) == NULL) {
+      wait.Wait();
+    }
+    return slot;
+  }
+
+  void Pop() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+ private:
+  std::vector<T> slots_;
+  // Slots ever popped and pushed, on separate cache lines.
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+};
+
+#endif  // VITERBI_SPSC_H_
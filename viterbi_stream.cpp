@@ -0,0 +1,383 @@
+// Implementation of ViterbiStreamDecoder and ViterbiStreamEncoder.
+
+#include "viterbi_stream.h"
+#include "viterbi_snapshot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+double ViterbiMergeStats::mean_depth() const {
+  return num_merges > 0 ? (double) total_depth / num_merges : 0;
+}
+
+int ViterbiMergeStats::Percentile(double fraction) const {
+  uint64_t count = 0;
+  for (int depth = 0; depth < histogram.size(); depth++) {
+    count += histogram[depth];
+    if (count >= fraction * num_merges) {
+      return depth;
+    }
+  }
+  return max_depth;
+}
+
+ViterbiStreamDecoder::ViterbiStreamDecoder(const ViterbiCodec& codec,
+                                           int traceback_depth,
+                                           int max_latency)
+    : codec_(codec),
+      traceback_depth_(traceback_depth > 0 ? traceback_depth
+                                           : codec.traceback_depth()),
+      window_(max_latency > 0
+                  ? max_latency
+                  : traceback_depth_ + std::max(traceback_depth_, 64)),
+      decisions_((size_t) window_ * codec.decision_words()),
+      acs_(codec, codec.ChooseEngine(kHardSymbols, SIZE_MAX), kHardSymbols),
+      cost0_(codec.num_parity_bits()),
+      cost1_(codec.num_parity_bits()),
+      commit_on_merge_(false) {
+  assert(traceback_depth_ >= codec_.constraint() - 1);
+  assert(window_ > traceback_depth_);
+  traceback_.reserve(window_);
+  Reset();
+}
+
+void ViterbiStreamDecoder::Reset() {
+  acs_.Reset();
+  mid_stream_ = false;
+  first_ = 0;
+  num_pending_steps_ = 0;
+  num_costs_ = 0;
+  anchor_ = 0;
+}
+
+void ViterbiStreamDecoder::JoinMidStream() {
+  Reset();
+  acs_.ResetMidFrame();
+  mid_stream_ = true;
+}
+
+void ViterbiStreamDecoder::set_commit_on_merge(bool commit_on_merge) {
+  commit_on_merge_ = commit_on_merge;
+  roots_.resize(commit_on_merge ? codec_.num_states() : 0);
+  next_roots_.resize(roots_.size());
+  anchor_ = 0;
+}
+
+void ViterbiStreamDecoder::Push(int cost0, int cost1, std::string* decoded) {
+  cost0_[num_costs_] = cost0;
+  cost1_[num_costs_] = cost1;
+  if (++num_costs_ == codec_.num_parity_bits()) {
+    num_costs_ = 0;
+    Step(decoded);
+  }
+}
+
+void ViterbiStreamDecoder::Step(std::string* decoded) {
+  if (num_pending_steps_ == window_) {
+    Traceback(window_ - traceback_depth_, decoded);
+  }
+
+  acs_.Step(cost0_.data(), cost1_.data(), decisions(num_pending_steps_));
+  num_pending_steps_++;
+  if (commit_on_merge_) {
+    TrackMerges(decoded);
+  }
+}
+
+void ViterbiStreamDecoder::TrackMerges(std::string* decoded) {
+  if (anchor_ == 0) {
+    Reanchor();
+    return;
+  }
+
+  // States j and j + num_states / 2 both come from state 2j or 2j + 1, see
+  // ViterbiCodec::PreviousState(). Decisions are taken a word at a time.
+  const uint64_t* step_decisions = decisions(num_pending_steps_ - 1);
+  const int half = codec_.num_states() / 2;
+  const int num_bits = std::min(half, 64);
+  const int* roots = roots_.data();
+  int* next_roots = next_roots_.data();
+  for (int first = 0; first < half; first += 64) {
+    const int k = first + half;
+    const uint64_t low = step_decisions[first >> 6] >> (first & 63);
+    const uint64_t high = step_decisions[k >> 6] >> (k & 63);
+    for (int i = 0; i < num_bits; i++) {
+      const int j = first + i;
+      const int even = roots[2 * j];
+      const int odd = roots[2 * j + 1];
+      next_roots[j] = (low >> i) & 1 ? odd : even;
+      next_roots[j + half] = (high >> i) & 1 ? odd : even;
+    }
+  }
+  roots_.swap(next_roots_);
+
+  const int root = roots_[0];
+  for (int state = 1; state < roots_.size(); state++) {
+    if (roots_[state] != root) {
+      return;
+    }
+  }
+  // One state reaches at most 2^d states in d steps, so merges are at least
+  // (constraint - 1) steps deep, and the flushing bits at the end of the
+  // stream are never output here.
+  AddMerge(num_pending_steps_ - anchor_);
+  Traceback(root, anchor_, anchor_, decoded);
+  Reanchor();
+}
+
+void ViterbiStreamDecoder::Reanchor() {
+  for (int state = 0; state < roots_.size(); state++) {
+    roots_[state] = state;
+  }
+  anchor_ = num_pending_steps_;
+}
+
+void ViterbiStreamDecoder::AddMerge(int depth) {
+  merge_stats_.num_merges++;
+  merge_stats_.total_depth += depth;
+  merge_stats_.max_depth = std::max(merge_stats_.max_depth, depth);
+  if (depth >= merge_stats_.histogram.size()) {
+    merge_stats_.histogram.resize(depth + 1);
+  }
+  merge_stats_.histogram[depth]++;
+}
+
+void ViterbiStreamDecoder::Traceback(int num_output, std::string* decoded) {
+  Traceback(acs_.BestState(), num_pending_steps_, num_output, decoded);
+}
+
+void ViterbiStreamDecoder::Traceback(int state,
+                                     int num_steps,
+                                     int num_output,
+                                     std::string* decoded) {
+  const int shift = codec_.constraint() - 2;
+  traceback_.assign(num_output, '0');
+  for (int i = num_steps - 1; i >= 0; i--) {
+    if (i < num_output) {
+      traceback_[i] = state >> shift ? '1' : '0';
+    }
+    state = codec_.PreviousState(state, decisions(i));
+  }
+  decoded->append(traceback_);
+
+  first_ = (first_ + num_output) % window_;
+  num_pending_steps_ -= num_output;
+  // The anchor is placed anew if it was output.
+  anchor_ = std::max(0, anchor_ - num_output);
+}
+
+void ViterbiStreamDecoder::Prepare(SymbolType type) {
+  if (num_pending_steps_ == 0 && num_costs_ == 0) {
+    acs_.Reset(codec_.ChooseEngine(type, SIZE_MAX), type);
+    if (mid_stream_) {
+      acs_.ResetMidFrame();
+    }
+  } else if (MaxSymbolCost(type) > MaxSymbolCost(acs_.symbol_type())) {
+    acs_.Widen(type);
+  }
+}
+
+void ViterbiStreamDecoder::Feed(const std::string& bits,
+                                std::string* decoded) {
+  Prepare(kHardSymbols);
+  for (int i = 0; i < bits.size(); i++) {
+    assert(bits[i] == '0' || bits[i] == '1');
+    const int bit = bits[i] - '0';
+    Push(bit, 1 - bit, decoded);
+  }
+}
+
+template <typename T>
+void ViterbiStreamDecoder::FeedSoft(const T* symbols,
+                                    size_t num_symbols,
+                                    std::string* decoded) {
+  for (size_t i = 0; i < num_symbols; i++) {
+    const int x = symbols[i];
+    Push(x < 0 ? -x : 0, x > 0 ? x : 0, decoded);
+  }
+}
+
+void ViterbiStreamDecoder::Feed(const int8_t* symbols,
+                                size_t num_symbols,
+                                std::string* decoded) {
+  Prepare(kInt8Symbols);
+  FeedSoft(symbols, num_symbols, decoded);
+}
+
+void ViterbiStreamDecoder::Feed(const int16_t* symbols,
+                                size_t num_symbols,
+                                std::string* decoded) {
+  Prepare(kInt16Symbols);
+  FeedSoft(symbols, num_symbols, decoded);
+}
+
+void ViterbiStreamDecoder::FeedPacked(const unsigned char* data,
+                                      size_t num_bits,
+                                      std::string* decoded) {
+  Prepare(kHardSymbols);
+  for (size_t i = 0; i < num_bits; i++) {
+    const int bit = (data[i >> 3] >> (7 - (i & 7))) & 1;
+    Push(bit, 1 - bit, decoded);
+  }
+}
+
+void ViterbiStreamDecoder::Finish(std::string* decoded) {
+  // Complete a partial trellis step with erasures.
+  while (num_costs_ > 0) {
+    Push(0, 0, decoded);
+  }
+
+  const int num_flushing_bits = codec_.constraint() - 1;
+  if (num_pending_steps_ >= num_flushing_bits) {
+    Traceback(num_pending_steps_ - num_flushing_bits, decoded);
+  } else {
+    Traceback(num_pending_steps_, decoded);
+  }
+  Reset();
+}
+
+void ViterbiStreamDecoder::Snapshot(std::string* out) const {
+  AppendSnapshotHeader(kStreamDecoderSnapshot, codec_, out);
+  AppendSnapshot<uint32_t>(num_pending_steps_, out);
+  AppendSnapshot<uint32_t>(num_costs_, out);
+  AppendSnapshot<uint8_t>(commit_on_merge_, out);
+  AppendSnapshot<uint8_t>(mid_stream_, out);
+  AppendSnapshot<uint8_t>(0, out);
+  AppendSnapshot<uint8_t>(0, out);
+  AppendSnapshot<uint32_t>(anchor_, out);
+  AppendSnapshot(cost0_.data(), num_costs_, out);
+  AppendSnapshot(cost1_.data(), num_costs_, out);
+  acs_.Snapshot(out);
+
+  // The ring in at most two runs.
+  const int words = codec_.decision_words();
+  const int first_run = std::min(num_pending_steps_, window_ - first_);
+  AppendSnapshot(&decisions_[(size_t) first_ * words],
+                 (size_t) first_run * words, out);
+  AppendSnapshot(decisions_.data(),
+                 (size_t) (num_pending_steps_ - first_run) * words, out);
+  if (commit_on_merge_) {
+    AppendSnapshot(roots_.data(), roots_.size(), out);
+  }
+}
+
+bool ViterbiStreamDecoder::Restore(const char* data, size_t size) {
+  if (RestoreState(data, size)) {
+    return true;
+  }
+  Reset();
+  acs_.Reset(codec_.ChooseEngine(kHardSymbols, SIZE_MAX), kHardSymbols);
+  return false;
+}
+
+bool ViterbiStreamDecoder::RestoreState(const char* data, size_t size) {
+  SnapshotReader reader(data, size);
+  uint32_t num_pending_steps;
+  uint32_t num_costs;
+  uint8_t commit_on_merge;
+  uint8_t mid_stream;
+  uint8_t reserved[2];
+  uint32_t anchor;
+  if (!reader.ReadHeader(kStreamDecoderSnapshot, codec_) ||
+      !reader.Read(&num_pending_steps) || !reader.Read(&num_costs) ||
+      !reader.Read(&commit_on_merge) || !reader.Read(&mid_stream) ||
+      !reader.Read(reserved, 2) || !reader.Read(&anchor)) {
+    return false;
+  }
+  if (num_pending_steps > window_ || num_costs >= cost0_.size() ||
+      mid_stream > 1 || anchor > num_pending_steps) {
+    return false;
+  }
+
+  // Everything is read into temporaries, or stepped over, until the whole
+  // snapshot is known to be valid. AcsState cannot be assigned, so its part
+  // is read twice: into a copy, then into acs_.
+  std::vector<int> cost0(num_costs);
+  std::vector<int> cost1(num_costs);
+  if (!reader.Read(cost0.data(), num_costs) ||
+      !reader.Read(cost1.data(), num_costs)) {
+    return false;
+  }
+  SnapshotReader acs_reader = reader;
+  AcsState acs(acs_);
+  if (!acs.Restore(&reader)) {
+    return false;
+  }
+  SnapshotReader decisions_reader = reader;
+  const size_t num_decision_words =
+      (size_t) num_pending_steps * codec_.decision_words();
+  if (!reader.Skip<uint64_t>(num_decision_words)) {
+    return false;
+  }
+  std::vector<int> roots(commit_on_merge ? codec_.num_states() : 0);
+  if (!reader.Read(roots.data(), roots.size()) || reader.remaining() != 0) {
+    return false;
+  }
+  for (int i = 0; i < roots.size(); i++) {
+    if (roots[i] < 0 || roots[i] >= codec_.num_states()) {
+      return false;
+    }
+  }
+
+  const bool valid = acs_.Restore(&acs_reader) &&
+                     decisions_reader.Read(decisions_.data(),
+                                           num_decision_words);
+  assert(valid);
+  std::copy(cost0.begin(), cost0.end(), cost0_.begin());
+  std::copy(cost1.begin(), cost1.end(), cost1_.begin());
+  set_commit_on_merge(commit_on_merge);
+  roots_.swap(roots);
+  mid_stream_ = mid_stream;
+  first_ = 0;
+  num_pending_steps_ = num_pending_steps;
+  num_costs_ = num_costs;
+  anchor_ = anchor;
+  return true;
+}
+
+ViterbiStreamEncoder::ViterbiStreamEncoder(const ViterbiCodec& codec)
+    : codec_(codec), state_(0) {}
+
+void ViterbiStreamEncoder::Push(int input, std::string* encoded) {
+  const int n = codec_.num_parity_bits();
+  const size_t index = state_ | (input << (codec_.constraint() - 1));
+  encoded->append(&codec_.outputs_[index * n], n);
+  state_ = codec_.NextState(state_, input);
+}
+
+void ViterbiStreamEncoder::Feed(const std::string& bits,
+                                std::string* encoded) {
+  for (int i = 0; i < bits.size(); i++) {
+    assert(bits[i] == '0' || bits[i] == '1');
+    Push(bits[i] - '0', encoded);
+  }
+}
+
+void ViterbiStreamEncoder::Finish(std::string* encoded) {
+  for (int i = 0; i < codec_.constraint() - 1; i++) {
+    Push(0, encoded);
+  }
+  Reset();
+}
+
+void ViterbiStreamEncoder::Snapshot(std::string* out) const {
+  AppendSnapshotHeader(kStreamEncoderSnapshot, codec_, out);
+  AppendSnapshot<uint32_t>(state_, out);
+}
+
+bool ViterbiStreamEncoder::Restore(const char* data, size_t size) {
+  SnapshotReader reader(data, size);
+  uint32_t state;
+  if (!reader.ReadHeader(kStreamEncoderSnapshot, codec_) ||
+      !reader.Read(&state) || state >= codec_.num_states() ||
+      reader.remaining() != 0) {
+    Reset();
+    return false;
+  }
+  state_ = state;
+  return true;
+}
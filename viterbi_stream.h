@@ -0,0 +1,239 @@
+// Streaming Viterbi decoder.
+
+#ifndef VITERBI_STREAM_H_
+#define VITERBI_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "viterbi.h"
+#include "viterbi_acs.h"
+
+// Depths, in trellis steps, within which the survivor paths of a
+// ViterbiStreamDecoder were seen to merge.
+struct ViterbiMergeStats {
+  ViterbiMergeStats() : num_merges(0), total_depth(0), max_depth(0) {}
+
+  // Mean merge depth, 0 if none was seen.
+  double mean_depth() const;
+
+  // Smallest depth within which at least the given fraction of merges
+  // happened, e.g. 0.999 to size a traceback depth from.
+  int Percentile(double fraction) const;
+
+  uint64_t num_merges;
+  uint64_t total_depth;
+  int max_depth;
+  // histogram[d] counts the merges at depth d.
+  std::vector<uint64_t> histogram;
+};
+
+// Decodes an unbounded stream of received symbols in bounded memory. A bit is
+// output once traceback_depth() further trellis steps have been received, by
+// which time all survivor paths have almost surely merged. A depth of about 5
+// times the constraint length is customary.
+//
+// With set_commit_on_merge(), the decoder also tracks, for every state, the
+// state its survivor path passes through at an anchor step. Once they all
+// agree, every survivor shares the path up to the anchor, so its bits are
+// final and are output at once, usually long before traceback_depth() steps.
+// The anchor then moves to the newest step. The traceback depth remains the
+// bound for channels so noisy that the paths do not merge within it.
+//
+// Symbols may be fed in chunks of any size; they need not be aligned to
+// num_parity_bits(). Decoded bits are appended to *decoded as '0' and '1'.
+class ViterbiStreamDecoder {
+ public:
+  // The codec must outlive the decoder. A traceback_depth of 0 takes the
+  // codec's. If max_latency is positive, every bit is output at most
+  // max_latency trellis steps after it is received, at the cost of more
+  // frequent tracebacks; it must exceed traceback_depth.
+  ViterbiStreamDecoder(const ViterbiCodec& codec,
+                       int traceback_depth,
+                       int max_latency = 0);
+
+  // Feeds hard bits, '0' or '1'.
+  void Feed(const std::string& bits, std::string* decoded);
+
+  // Feeds soft symbols, see ViterbiCodec::Decode() for their meaning.
+  void Feed(const int8_t* symbols, size_t num_symbols, std::string* decoded);
+  void Feed(const int16_t* symbols, size_t num_symbols, std::string* decoded);
+
+  // Feeds packed hard bits, most significant bit of each byte first.
+  void FeedPacked(const unsigned char* data,
+                  size_t num_bits,
+                  std::string* decoded);
+
+  // Ends the stream and outputs all remaining bits. Like
+  // ViterbiCodec::Decode(), the stream is assumed to end with
+  // (constraint - 1) flushing bits, which are removed; missing trailing
+  // symbols are treated as erasures. The decoder is then ready for a new
+  // stream.
+  void Finish(std::string* decoded);
+
+  // Discards all state and starts a new stream.
+  void Reset();
+
+  // Discards all state and joins a stream at an unknown point, with every
+  // encoder state equally likely, as after losing sync. The first bits output
+  // are less reliable until about traceback_depth() steps are received.
+  void JoinMidStream();
+
+  const ViterbiCodec& codec() const { return codec_; }
+
+  // Smallest path metric of the stream, see AcsState::BestMetric(). How fast
+  // it grows per symbol tells how well the symbols fit the code.
+  int64_t path_metric() const { return acs_.BestMetric(); }
+
+  int traceback_depth() const { return traceback_depth_; }
+
+  int max_latency() const { return window_; }
+
+  // Number of received trellis steps whose bits have not been output yet.
+  int pending_steps() const { return num_pending_steps_; }
+
+  // Whether to output bits as soon as all survivor paths have merged. The
+  // tracking costs about half as much per step as the scalar
+  // add-compare-select.
+  void set_commit_on_merge(bool commit_on_merge);
+
+  bool commit_on_merge() const { return commit_on_merge_; }
+
+  // Depths of the merges seen since construction, over all streams.
+  const ViterbiMergeStats& merge_stats() const { return merge_stats_; }
+
+  // Appends the state of the stream to *out, see viterbi_snapshot.h: path
+  // metrics, pending decisions and symbols of a partial step. The body is:
+  //     uint32 num_pending_steps
+  //     uint32 num_costs
+  //     uint8  commit_on_merge
+  //     uint8  mid_stream          joined by JoinMidStream()
+  //     uint8  reserved[2]
+  //     uint32 anchor
+  //     int32  cost0[num_costs], cost1[num_costs]
+  //     uint8  engine, metric_bits, symbol_type, reserved
+  //     int32  bias, num_steps
+  //     int16 or int32 metrics[num_states]
+  //     uint64 decisions[num_pending_steps][decision_words], oldest first
+  //     int32  roots[num_states]    if commit_on_merge
+  void Snapshot(std::string* out) const;
+
+  // Continues the stream of a snapshot of a decoder of the same code, which
+  // then outputs exactly what that decoder would have. Its pending steps
+  // must fit max_latency(). Returns false if the snapshot does not fit or is
+  // malformed, and then resets the decoder, keeping its commit_on_merge().
+  bool Restore(const char* data, size_t size);
+
+ private:
+  // Adds the cost of one received symbol to the current trellis step, and
+  // runs the step once it is complete.
+  void Push(int cost0, int cost1, std::string* decoded);
+
+  // Runs one trellis step over cost0_ and cost1_.
+  void Step(std::string* decoded);
+
+  // Traces back from the best state over all pending steps, and outputs the
+  // oldest num_output of them.
+  void Traceback(int num_output, std::string* decoded);
+
+  // Traces back from state after the first num_steps pending steps, and
+  // outputs the oldest num_output of them.
+  void Traceback(int state, int num_steps, int num_output,
+                 std::string* decoded);
+
+  // Follows the survivors through the newest step, and outputs the steps up
+  // to the anchor if they have merged there.
+  void TrackMerges(std::string* decoded);
+
+  // Moves the anchor to the newest step.
+  void Reanchor();
+
+  // Records a merge of depth steps.
+  void AddMerge(int depth);
+
+  // Chooses the engine for the symbol type of the first feed of a stream.
+  // Later feeds of a type with larger costs switch to 32-bit metrics.
+  void Prepare(SymbolType type);
+
+  template <typename T>
+  void FeedSoft(const T* symbols, size_t num_symbols, std::string* decoded);
+
+  uint64_t* decisions(int step) {
+    return &decisions_[(size_t) ((first_ + step) % window_) *
+                       codec_.decision_words()];
+  }
+
+  // Restore() without the reset on failure.
+  bool RestoreState(const char* data, size_t size);
+
+  const ViterbiCodec& codec_;
+  const int traceback_depth_;
+
+  // Capacity of the decision ring, in trellis steps. When it is full, all but
+  // the newest traceback_depth_ steps are output at once, which amortizes the
+  // cost of the traceback.
+  const int window_;
+
+  std::vector<uint64_t> decisions_;
+  // Whether the stream was joined by JoinMidStream().
+  bool mid_stream_;
+  int first_;
+  int num_pending_steps_;
+
+  AcsState acs_;
+
+  // Costs of the symbols received so far for the current trellis step.
+  std::vector<int> cost0_;
+  std::vector<int> cost1_;
+  int num_costs_;
+
+  std::string traceback_;
+
+  bool commit_on_merge_;
+
+  // For each state, the state its survivor path passes through after the
+  // first anchor_ pending steps. An anchor_ of 0 is yet to be placed.
+  int anchor_;
+  std::vector<int> roots_;
+  std::vector<int> next_roots_;
+
+  ViterbiMergeStats merge_stats_;
+};
+
+// Encodes an unbounded stream of bits, in chunks of any size.
+class ViterbiStreamEncoder {
+ public:
+  // The codec must outlive the encoder.
+  explicit ViterbiStreamEncoder(const ViterbiCodec& codec);
+
+  // Encodes bits, '0' or '1', appending the parity bits to *encoded.
+  void Feed(const std::string& bits, std::string* encoded);
+
+  // Ends the stream with (constraint - 1) flushing bits, like
+  // ViterbiCodec::Encode(). The encoder is then ready for a new stream.
+  void Finish(std::string* encoded);
+
+  // Discards all state and starts a new stream.
+  void Reset() { state_ = 0; }
+
+  const ViterbiCodec& codec() const { return codec_; }
+
+  // Appends the state of the stream to *out, see viterbi_snapshot.h. The
+  // body is a uint32 encoder state.
+  void Snapshot(std::string* out) const;
+
+  // Continues the stream of a snapshot of an encoder of the same code.
+  // Returns false if the snapshot is malformed, and then resets the encoder.
+  bool Restore(const char* data, size_t size);
+
+ private:
+  void Push(int input, std::string* encoded);
+
+  const ViterbiCodec& codec_;
+  int state_;
+};
+
+#endif  // VITERBI_STREAM_H_
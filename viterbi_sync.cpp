@@ -0,0 +1,233 @@
+// Implementation of ViterbiFrameSync.
+
+#include "viterbi_sync.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "viterbi.h"
+#include "viterbi_stream.h"
+
+namespace {
+
+void FeedDecoder(ViterbiStreamDecoder* decoder,
+                 const char* bits,
+                 size_t num_bits,
+                 std::string* decoded) {
+  decoder->Feed(std::string(bits, num_bits), decoded);
+}
+
+template <typename T>
+void FeedDecoder(ViterbiStreamDecoder* decoder,
+                 const T* symbols,
+                 size_t num_symbols,
+                 std::string* decoded) {
+  decoder->Feed(symbols, num_symbols, decoded);
+}
+
+// The cost of receiving a symbol as the parity bit it is furthest from.
+int Magnitude(char bit) { return 1; }
+
+template <typename T>
+int Magnitude(T symbol) {
+  return abs(symbol);
+}
+
+char Invert(char bit) { return bit == '0' ? '1' : '0'; }
+
+template <typename T>
+T Invert(T symbol) {
+  // The most negative symbol has no negation: clamp it.
+  return symbol == std::numeric_limits<T>::min()
+             ? std::numeric_limits<T>::max()
+             : -symbol;
+}
+
+}  // namespace
+
+const double ViterbiFrameSync::kLockRatio = 0.5;
+
+ViterbiFrameSync::ViterbiFrameSync(const ViterbiCodec& codec,
+                                   int window_steps,
+                                   int traceback_depth)
+    : codec_(codec),
+      window_steps_(window_steps > 0 ? window_steps
+                                     : 8 * codec.constraint()),
+      traceback_depth_(traceback_depth) {
+  Reset();
+}
+
+void ViterbiFrameSync::Reset() {
+  const int num_polarities = codec_.transparent() ? 1 : 2;
+  hypotheses_.resize(codec_.num_parity_bits() * num_polarities);
+  for (int i = 0; i < hypotheses_.size(); i++) {
+    Hypothesis& hypothesis = hypotheses_[i];
+    hypothesis.phase = i / num_polarities;
+    hypothesis.inverted = i % num_polarities == 1;
+    if (!hypothesis.decoder) {
+      hypothesis.decoder.reset(
+          new ViterbiStreamDecoder(codec_, traceback_depth_));
+    }
+    hypothesis.decoder->JoinMidStream();
+    hypothesis.skip = hypothesis.phase;
+    hypothesis.decoded.clear();
+    hypothesis.window_start = 0;
+    hypothesis.growth = -1;
+  }
+  winner_ = -1;
+  window_fed_ = 0;
+  window_magnitude_ = 0;
+  num_windows_ = 0;
+}
+
+int ViterbiFrameSync::phase() const {
+  return locked() ? hypotheses_[winner_].phase : -1;
+}
+
+bool ViterbiFrameSync::inverted() const {
+  return locked() && hypotheses_[winner_].inverted;
+}
+
+double ViterbiFrameSync::growth(int phase, bool inverted) const {
+  for (int i = 0; i < hypotheses_.size(); i++) {
+    const Hypothesis& hypothesis = hypotheses_[i];
+    if (hypothesis.phase == phase && hypothesis.inverted == inverted &&
+        hypothesis.decoder) {
+      return hypothesis.growth;
+    }
+  }
+  return -1;
+}
+
+ViterbiStreamDecoder* ViterbiFrameSync::decoder() {
+  return locked() ? hypotheses_[winner_].decoder.get() : NULL;
+}
+
+void ViterbiFrameSync::Feed(const std::string& bits, std::string* decoded) {
+  FeedSymbols(bits.data(), bits.size(), decoded);
+}
+
+void ViterbiFrameSync::Feed(const int8_t* symbols,
+                            size_t num_symbols,
+                            std::string* decoded) {
+  FeedSymbols(symbols, num_symbols, decoded);
+}
+
+void ViterbiFrameSync::Feed(const int16_t* symbols,
+                            size_t num_symbols,
+                            std::string* decoded) {
+  FeedSymbols(symbols, num_symbols, decoded);
+}
+
+template <typename T>
+void ViterbiFrameSync::FeedSymbols(const T* symbols,
+                                   size_t num_symbols,
+                                   std::string* decoded) {
+  const size_t window_symbols =
+      (size_t) window_steps_ * codec_.num_parity_bits();
+  size_t i = 0;
+  while (i < num_symbols && !locked()) {
+    const size_t chunk =
+        std::min(num_symbols - i, window_symbols - window_fed_);
+    for (size_t j = i; j < i + chunk; j++) {
+      window_magnitude_ += Magnitude(symbols[j]);
+    }
+    for (int h = 0; h < hypotheses_.size(); h++) {
+      FeedHypothesis(&hypotheses_[h], symbols + i, chunk,
+                     &hypotheses_[h].decoded);
+    }
+    i += chunk;
+    window_fed_ += chunk;
+    if (window_fed_ == window_symbols) {
+      EndWindow(decoded);
+    }
+  }
+  if (i < num_symbols) {
+    FeedHypothesis(&hypotheses_[winner_], symbols + i, num_symbols - i,
+                   decoded);
+  }
+}
+
+template <typename T>
+void ViterbiFrameSync::FeedHypothesis(Hypothesis* hypothesis,
+                                      const T* symbols,
+                                      size_t num_symbols,
+                                      std::string* decoded) {
+  const size_t skip = std::min((size_t) hypothesis->skip, num_symbols);
+  hypothesis->skip -= skip;
+  symbols += skip;
+  num_symbols -= skip;
+  if (num_symbols == 0) {
+    return;
+  }
+  if (hypothesis->inverted) {
+    inverted_.resize((num_symbols * sizeof(T) + 1) / 2);
+    T* inverted = reinterpret_cast<T*>(inverted_.data());
+    for (size_t i = 0; i < num_symbols; i++) {
+      inverted[i] = Invert(symbols[i]);
+    }
+    symbols = inverted;
+  }
+  FeedDecoder(hypothesis->decoder.get(), symbols, num_symbols, decoded);
+}
+
+void ViterbiFrameSync::EndWindow(std::string* decoded) {
+  int best = -1;
+  int second = -1;
+  for (int i = 0; i < hypotheses_.size(); i++) {
+    Hypothesis& hypothesis = hypotheses_[i];
+    const int64_t metric = hypothesis.decoder->path_metric();
+    hypothesis.growth =
+        window_magnitude_ > 0
+            ? (double) (metric - hypothesis.window_start) / window_magnitude_
+            : 0;
+    hypothesis.window_start = metric;
+    if (best < 0 || hypothesis.growth < hypotheses_[best].growth) {
+      second = best;
+      best = i;
+    } else if (second < 0 ||
+               hypothesis.growth < hypotheses_[second].growth) {
+      second = i;
+    }
+  }
+  window_fed_ = 0;
+  window_magnitude_ = 0;
+  num_windows_++;
+
+  if (second < 0 ||
+      hypotheses_[best].growth < kLockRatio * hypotheses_[second].growth) {
+    Lock(best, decoded);
+  }
+}
+
+void ViterbiFrameSync::Lock(int winner, std::string* decoded) {
+  winner_ = winner;
+  decoded->append(hypotheses_[winner].decoded);
+  for (int i = 0; i < hypotheses_.size(); i++) {
+    hypotheses_[i].decoded.clear();
+    if (i != winner) {
+      hypotheses_[i].decoder.reset();
+    }
+  }
+}
+
+void ViterbiFrameSync::Finish(std::string* decoded) {
+  if (!locked()) {
+    int best = 0;
+    for (int i = 1; i < hypotheses_.size(); i++) {
+      if (hypotheses_[i].growth >= 0 &&
+          hypotheses_[i].growth < hypotheses_[best].growth) {
+        best = i;
+      }
+    }
+    Lock(best, decoded);
+  }
+  hypotheses_[winner_].decoder->Finish(decoded);
+  Reset();
+}
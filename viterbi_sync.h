@@ -0,0 +1,132 @@
+// Code-phase and polarity acquisition for streams joined mid-flight.
+
+#ifndef VITERBI_SYNC_H_
+#define VITERBI_SYNC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "viterbi.h"
+#include "viterbi_stream.h"
+
+// Decodes a stream of a rate 1/n code received from an unknown point, such
+// as a receiver tuned in mid-transmission: which of its symbols starts a
+// trellis step (the code phase) and whether a demodulator inverted them (the
+// polarity) are found from the symbols themselves.
+//
+// Every hypothesis, n phases times 2 polarities, runs its own
+// ViterbiStreamDecoder joined mid-stream over the same symbols. Over each
+// window of window_steps() trellis steps, the path metric of the right one
+// grows only by the noise, while the wrong ones find no codeword close to
+// the symbols. Once the least growth is under kLockRatio of the next least,
+// the sync locks: the bits its decoder has output so far are output, the
+// other decoders are dropped and the stream carries on in the winning one,
+// so no symbol is decoded twice. Until then, nothing is output.
+//
+// A transparent code (see ViterbiCodec::transparent()) decodes inverted
+// symbols as well as the others, so its polarity cannot be told: only the
+// phases are tried, and the bits output are complemented if the symbols
+// were.
+class ViterbiFrameSync {
+ public:
+  static const double kLockRatio;
+
+  // The codec must outlive the sync. A window_steps of 0 takes 8 times the
+  // constraint length; a traceback_depth of 0 takes the codec's.
+  explicit ViterbiFrameSync(const ViterbiCodec& codec,
+                            int window_steps = 0,
+                            int traceback_depth = 0);
+
+  // Feed symbols and output decoded bits like ViterbiStreamDecoder, once
+  // locked.
+  void Feed(const std::string& bits, std::string* decoded);
+  void Feed(const int8_t* symbols, size_t num_symbols, std::string* decoded);
+  void Feed(const int16_t* symbols, size_t num_symbols, std::string* decoded);
+
+  // Ends the stream like ViterbiStreamDecoder::Finish(). If the sync has not
+  // locked, it settles for the hypothesis which grew least in the last
+  // window, or the first one. It is then ready for a new stream.
+  void Finish(std::string* decoded);
+
+  // Discards all state and starts acquiring a new stream.
+  void Reset();
+
+  const ViterbiCodec& codec() const { return codec_; }
+
+  int window_steps() const { return window_steps_; }
+
+  bool locked() const { return winner_ >= 0; }
+
+  // Symbols the stream started with before the first whole trellis step, or
+  // -1 until locked.
+  int phase() const;
+
+  // Whether the symbols are inverted. Always false for a transparent code.
+  bool inverted() const;
+
+  // Windows compared so far.
+  int num_windows() const { return num_windows_; }
+
+  // Growth of the path metric of a hypothesis over the last window, over the
+  // summed magnitude of its symbols: about the fraction of the symbols the
+  // likeliest path disagrees with. -1 if it is not tried or was dropped.
+  double growth(int phase, bool inverted) const;
+
+  // The decoder of the stream once locked, else NULL. It may be configured,
+  // e.g. with set_commit_on_merge(), but only fed through the sync, which
+  // inverts the symbols if needed.
+  ViterbiStreamDecoder* decoder();
+
+ private:
+  struct Hypothesis {
+    int phase;
+    bool inverted;
+    std::unique_ptr<ViterbiStreamDecoder> decoder;
+    // Symbols yet to drop from the start of the stream.
+    int skip;
+    // Bits output while acquiring.
+    std::string decoded;
+    // Path metric at the start of the window.
+    int64_t window_start;
+    double growth;
+  };
+
+  template <typename T>
+  void FeedSymbols(const T* symbols, size_t num_symbols, std::string* decoded);
+
+  // Feeds symbols of the stream to one hypothesis.
+  template <typename T>
+  void FeedHypothesis(Hypothesis* hypothesis,
+                      const T* symbols,
+                      size_t num_symbols,
+                      std::string* decoded);
+
+  // Compares the hypotheses over the window just ended, and locks if one
+  // stands out.
+  void EndWindow(std::string* decoded);
+
+  // Carries on in the given hypothesis, outputting what it decoded so far.
+  void Lock(int winner, std::string* decoded);
+
+  const ViterbiCodec& codec_;
+  const int window_steps_;
+  const int traceback_depth_;
+
+  std::vector<Hypothesis> hypotheses_;
+  // Index of the locked hypothesis, or -1.
+  int winner_;
+
+  // Symbols fed in the current window, and their summed magnitude.
+  size_t window_fed_;
+  int64_t window_magnitude_;
+  int num_windows_;
+
+  // Inverted symbols of any type.
+  std::vector<int16_t> inverted_;
+};
+
+#endif  // VITERBI_SYNC_H_
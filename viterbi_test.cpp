@@ -4,13 +4,39 @@
 // Date: 01/30/2015
 
 #include "viterbi.h"
+#include "viterbi_acs.h"
+#include "viterbi_async.h"
+#include "viterbi_batch.h"
+#include "viterbi_bits.h"
+#include "viterbi_harq.h"
+#include "viterbi_memory.h"
+#include "viterbi_pipeline.h"
+#include "viterbi_sessions.h"
+#include "viterbi_shadow.h"
+#include "viterbi_shm.h"
+#include "viterbi_stream.h"
+#include "viterbi_sync.h"
+#include "viterbi_tuner.h"
+#include "viterbi_tuning.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <cassert>
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 void TestViterbiDecoding(const ViterbiCodec& codec,
@@ -88,6 +114,1702 @@ void TestViterbiDecodingSamples() {
   }
 }
 
+// Constraint 2, a two-state trellis, is the smallest code. Constraint 1 is
+// refused at construction rather than crashing the decoder.
+void TestConstraintBounds() {
+  std::vector<int> polynomials;
+  polynomials.push_back(3);
+  polynomials.push_back(1);
+  const ViterbiCodec smallest(2, polynomials);
+  std::string encoded = smallest.Encode("1011001");
+  assert(smallest.Decode(encoded) == "1011001");
+  encoded[4] = encoded[4] == '0' ? '1' : '0';
+  assert(smallest.Decode(encoded).size() == 7);
+
+  const pid_t child = fork();
+  if (child == 0) {
+    std::freopen("/dev/null", "w", stderr);
+    const ViterbiCodec single_state(1, std::vector<int>(2, 1));
+    single_state.Decode("0101");
+    _exit(0);
+  }
+  int status;
+  assert(waitpid(child, &status, 0) == child);
+  assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+}
+
+// Round-trips random bit strings of every length up to a few vector widths
+// through PackBits(), UnpackBits(), PackBytes() and UnpackBytes(), and checks that invalid
+// characters are found.
+void TestBitConversion() {
+  std::cout << std::string(60, '=') << std::endl
+            << "Bit conversion (" << BitsInstructionSet() << ")" << std::endl
+            << std::endl;
+  for (int size = 0; size <= 200; size++) {
+    std::string text;
+    for (int i = 0; i < size; i++) {
+      text += (std::rand() & 1) + '0';
+    }
+
+    std::vector<uint64_t> words(NumBitWords(size));
+    assert(PackBits(text.data(), size, words.data()));
+    for (int i = 0; i < size; i++) {
+      assert(GetBit(words.data(), i) == text[i] - '0');
+    }
+    std::string unpacked(size, ' ');
+    UnpackBits(words.data(), size, &unpacked[0]);
+    assert(unpacked == text);
+
+    std::vector<unsigned char> bytes((size + 7) / 8);
+    assert(PackBytes(text.data(), size, bytes.data()));
+    for (int i = 0; i < size; i++) {
+      assert(((bytes[i / 8] >> (7 - i % 8)) & 1) == text[i] - '0');
+    }
+    unpacked.assign(size, ' ');
+    UnpackBytes(bytes.data(), size, &unpacked[0]);
+    assert(unpacked == text);
+
+    assert(FindNonBit(text.data(), size) == size);
+    if (size > 0) {
+      const int i = std::rand() % size;
+      text[i] = '2';
+      assert(FindNonBit(text.data(), size) == i);
+      assert(!PackBits(text.data(), size, words.data()));
+    }
+  }
+}
+
+// Pushes records of varying sizes through a small shared-memory ring, so that
+// it wraps around and the producer waits for space, and checks that they
+// arrive intact and in order.
+void TestShmRing() {
+  std::cout << std::string(60, '=') << std::endl
+            << "Shared-memory ring" << std::endl
+            << std::endl;
+  std::ostringstream name;
+  name << "/viterbi_test_" << getpid();
+  std::string error;
+  std::unique_ptr<ShmSegment> segment(
+      ShmSegment::Create(name.str(), 2, 4096, &error));
+  assert(segment);
+
+  std::unique_ptr<ShmSegment> client(ShmSegment::Open(name.str(), &error));
+  assert(client);
+  assert(client->ClaimChannel() == 0);
+  assert(client->ClaimChannel() == 1);
+  assert(client->ClaimChannel() == -1);
+  client->ReleaseChannel(1);
+
+  ShmRing* producer_ring = client->requests(1);
+  ShmRing* consumer_ring = segment->requests(1);
+  assert(producer_ring->BeginWrite(producer_ring->max_record_size() + 1) ==
+         NULL);
+
+  const int kNumRecords = 2000;
+  std::thread producer([&] {
+    for (int i = 0; i < kNumRecords; i++) {
+      const size_t size = 1 + i * 37 % 1500;
+      char* record = producer_ring->BeginWrite(size);
+      assert(record != NULL);
+      for (size_t j = 0; j < size; j++) {
+        record[j] = (char) (i + j);
+      }
+      producer_ring->CommitWrite();
+    }
+    producer_ring->Close();
+  });
+
+  for (int i = 0; i < kNumRecords; i++) {
+    size_t size;
+    const char* record = consumer_ring->BeginRead(&size);
+    assert(record != NULL);
+    assert(size == 1 + i * 37 % 1500);
+    for (size_t j = 0; j < size; j++) {
+      assert(record[j] == (char) (i + j));
+    }
+    consumer_ring->EndRead();
+  }
+  size_t size;
+  assert(consumer_ring->BeginRead(&size) == NULL);
+  producer.join();
+
+  // The channel of a producer which died is claimed again once the responses
+  // to its requests are discarded.
+  client->ReleaseChannel(0);
+  const pid_t child = fork();
+  if (child == 0) {
+    std::unique_ptr<ShmSegment> dying(ShmSegment::Open(name.str(), &error));
+    if (!dying || dying->ClaimChannel() != 0) {
+      _exit(1);
+    }
+    for (int i = 0; i < 3; i++) {
+      dying->requests(0)->BeginWrite(8);
+      dying->requests(0)->CommitWrite();
+    }
+    _exit(0);
+  }
+  int status;
+  assert(waitpid(child, &status, 0) == child);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  const auto respond = [&](char value) {
+    size_t size;
+    assert(segment->requests(0)->BeginRead(&size) != NULL);
+    segment->requests(0)->EndRead();
+    char* response = segment->responses(0)->BeginWrite(1);
+    *response = value;
+    segment->responses(0)->CommitWrite();
+  };
+  std::thread service([&] {
+    for (int i = 0; i < 3; i++) {
+      respond('0');
+    }
+  });
+  assert(client->ClaimChannel() == 0);
+  service.join();
+  assert(client->requests(0)->BeginWrite(8) != NULL);
+  client->requests(0)->CommitWrite();
+  respond('1');
+  assert(*client->responses(0)->BeginRead(&size) == '1');
+  client->responses(0)->EndRead();
+}
+
+// Hard bits as soft symbols of the given magnitude.
+template <typename T>
+std::vector<T> ToSymbols(const std::string& bits, int magnitude) {
+  std::vector<T> symbols(bits.size());
+  for (int i = 0; i < bits.size(); i++) {
+    symbols[i] = bits[i] == '0' ? magnitude : -magnitude;
+  }
+  return symbols;
+}
+
+// Soft-decision decoding of hard symbols must match hard-decision decoding,
+// and weakly received wrong bits must not matter.
+void TestSoftDecoding(const ViterbiCodec& codec,
+                      const std::string& encoded,
+                      const std::string& message) {
+  std::vector<int8_t> hard = ToSymbols<int8_t>(encoded, 1);
+  assert(codec.Decode(hard.data(), hard.size()) == codec.Decode(encoded));
+
+  std::vector<int16_t> soft = ToSymbols<int16_t>(encoded, 1000);
+  for (int i = 0; i < soft.size(); i += 3) {
+    soft[i] = soft[i] > 0 ? -1 : 1;
+  }
+  assert(codec.Decode(soft.data(), soft.size()) == message);
+}
+
+// Feeds the message to a streaming encoder, and the encoded bits to a
+// streaming decoder, in random chunks.
+void TestStreamDecoding(const ViterbiCodec& codec,
+                        const std::string& encoded,
+                        const std::string& message) {
+  ViterbiStreamEncoder encoder(codec);
+  std::string stream_encoded;
+  for (int i = 0; i < message.size();) {
+    int chunk = std::rand() % 8;
+    encoder.Feed(message.substr(i, chunk), &stream_encoded);
+    i += chunk;
+  }
+  encoder.Finish(&stream_encoded);
+  assert(stream_encoded == encoded);
+
+  ViterbiStreamDecoder decoder(codec, 5 * codec.constraint());
+  std::string decoded;
+  for (int i = 0; i < encoded.size();) {
+    int chunk = std::rand() % 8;
+    decoder.Feed(encoded.substr(i, chunk), &decoded);
+    i += chunk;
+  }
+  decoder.Finish(&decoded);
+  assert(decoded == message);
+  assert(decoder.pending_steps() == 0);
+}
+
+// Decodes a message much longer than the traceback window of a streaming
+// decoder, with sparse bit errors.
+void TestStreamDecodingLong(const ViterbiCodec& codec) {
+  std::string message;
+  for (int i = 0; i < 5000; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  std::string encoded = codec.Encode(message);
+  for (int i = 100; i < encoded.size(); i += 100) {
+    encoded[i] = encoded[i] == '0' ? '1' : '0';
+  }
+
+  ViterbiStreamDecoder decoder(codec, 5 * codec.constraint());
+  std::string decoded;
+  for (int i = 0; i < encoded.size(); i += 1000) {
+    decoder.Feed(encoded.substr(i, 1000), &decoded);
+    assert(decoder.pending_steps() <= 2 * decoder.traceback_depth() + 64);
+  }
+  decoder.Finish(&decoded);
+  assert(decoded == message);
+  assert(codec.Decode(encoded) == message);
+
+  // Bound the latency of every decoded bit.
+  const int max_latency = 5 * codec.constraint() + 8;
+  ViterbiStreamDecoder low_latency_decoder(codec, 5 * codec.constraint(),
+                                           max_latency);
+  decoded.clear();
+  for (int i = 0; i < encoded.size(); i += codec.num_parity_bits()) {
+    low_latency_decoder.Feed(encoded.substr(i, codec.num_parity_bits()),
+                             &decoded);
+    assert(low_latency_decoder.pending_steps() <= max_latency);
+  }
+  low_latency_decoder.Finish(&decoded);
+  assert(decoded == message);
+}
+
+// Bits output as soon as the survivor paths merge are the bits of the whole
+// frame's best path, however long the stream and wherever the chunks end.
+void TestCommitOnMerge(const ViterbiCodec& codec) {
+  std::string message;
+  for (int i = 0; i < 20000; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const std::string encoded = codec.Encode(message);
+  std::vector<int8_t> symbols(encoded.size());
+  for (size_t i = 0; i < encoded.size(); i++) {
+    symbols[i] = (encoded[i] == '0' ? 40 : -40) + std::rand() % 101 - 50;
+  }
+  const std::string expected = codec.Decode(symbols.data(), symbols.size());
+
+  // Deep enough that the ring never fills, so every bit but the last few is
+  // output on a merge.
+  ViterbiStreamDecoder decoder(codec, 2000);
+  decoder.set_commit_on_merge(true);
+  int max_pending = 0;
+  for (int stream = 0; stream < 2; stream++) {
+    std::string decoded;
+    for (size_t i = 0; i < symbols.size();) {
+      const size_t chunk =
+          std::min<size_t>(std::rand() % 64, symbols.size() - i);
+      decoder.Feed(symbols.data() + i, chunk, &decoded);
+      max_pending = std::max(max_pending, decoder.pending_steps());
+      i += chunk;
+    }
+    decoder.Finish(&decoded);
+    assert(decoded == expected);
+  }
+
+  const ViterbiMergeStats& stats = decoder.merge_stats();
+  assert(stats.num_merges > 0);
+  assert(stats.max_depth >= codec.constraint() - 1);
+  assert(stats.max_depth < max_pending);
+  assert(max_pending < decoder.traceback_depth());
+  assert(stats.Percentile(1.0) == stats.max_depth);
+  std::cout << "merge depth: mean " << stats.mean_depth() << ", median "
+            << stats.Percentile(0.5) << ", max " << stats.max_depth
+            << std::endl;
+
+  // On a clean channel the paths merge within a few constraint lengths.
+  ViterbiStreamDecoder clean(codec, 0);
+  clean.set_commit_on_merge(true);
+  std::string decoded;
+  for (int i = 0; i < encoded.size(); i += codec.num_parity_bits()) {
+    clean.Feed(encoded.substr(i, codec.num_parity_bits()), &decoded);
+    assert(clean.pending_steps() <= 2 * clean.traceback_depth());
+  }
+  clean.Finish(&decoded);
+  assert(decoded == message);
+  assert(clean.merge_stats().max_depth <= clean.traceback_depth());
+}
+
+// A stream moved to another decoder, encoder or session manager through a
+// snapshot carries on exactly as if it had stayed.
+void TestSnapshot(const ViterbiCodec& codec) {
+  std::string message;
+  for (int i = 0; i < 5000; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+
+  // The encoder moves every few hundred bits.
+  std::string encoded;
+  {
+    ViterbiStreamEncoder encoder(codec);
+    for (int i = 0; i < message.size(); i += 300) {
+      ViterbiStreamEncoder moved(codec);
+      std::string snapshot;
+      encoder.Snapshot(&snapshot);
+      assert(moved.Restore(snapshot.data(), snapshot.size()));
+      moved.Feed(message.substr(i, 300), &encoded);
+      encoder.Reset();
+      snapshot.clear();
+      moved.Snapshot(&snapshot);
+      snapshot.resize(snapshot.size() - 1);
+      assert(!encoder.Restore(snapshot.data(), snapshot.size()));
+      snapshot.clear();
+      moved.Snapshot(&snapshot);
+      assert(encoder.Restore(snapshot.data(), snapshot.size()));
+    }
+    encoder.Finish(&encoded);
+  }
+  assert(encoded == codec.Encode(message));
+
+  std::vector<int8_t> symbols(encoded.size());
+  for (size_t i = 0; i < encoded.size(); i++) {
+    symbols[i] = (encoded[i] == '0' ? 40 : -40) + std::rand() % 101 - 50;
+  }
+  const std::string expected = codec.Decode(symbols.data(), symbols.size());
+
+  // The decoder moves after chunks of any size, also in the middle of a
+  // trellis step, between two decoders of alternating merge tracking.
+  for (int commit_on_merge = 0; commit_on_merge < 2; commit_on_merge++) {
+    std::unique_ptr<ViterbiStreamDecoder> decoder(
+        new ViterbiStreamDecoder(codec, 0));
+    decoder->set_commit_on_merge(commit_on_merge);
+    std::string decoded;
+    for (size_t i = 0; i < symbols.size();) {
+      const size_t chunk =
+          std::min<size_t>(std::rand() % 200, symbols.size() - i);
+      decoder->Feed(symbols.data() + i, chunk, &decoded);
+      i += chunk;
+      std::string snapshot;
+      decoder->Snapshot(&snapshot);
+      decoder.reset(new ViterbiStreamDecoder(codec, 0));
+      decoder->set_commit_on_merge(!commit_on_merge);
+      assert(decoder->Restore(snapshot.data(), snapshot.size()));
+      assert(decoder->commit_on_merge() == commit_on_merge);
+    }
+    decoder->Finish(&decoded);
+    assert(decoded == expected);
+  }
+
+  // A decoder which joined mid-stream moves before its first symbol, and
+  // still starts with every state equally likely.
+  for (size_t join = 41; join < 100; join += 11) {
+    ViterbiStreamDecoder joined(codec, 0);
+    joined.JoinMidStream();
+    std::string snapshot;
+    joined.Snapshot(&snapshot);
+    ViterbiStreamDecoder moved(codec, 0);
+    assert(moved.Restore(snapshot.data(), snapshot.size()));
+    std::string joined_decoded;
+    joined.Feed(symbols.data() + join, symbols.size() - join,
+                &joined_decoded);
+    joined.Finish(&joined_decoded);
+    std::string moved_decoded;
+    moved.Feed(symbols.data() + join, symbols.size() - join, &moved_decoded);
+    moved.Finish(&moved_decoded);
+    assert(moved_decoded == joined_decoded);
+  }
+
+  // Snapshots of other codes, kinds or versions, truncated ones and ones
+  // with trailing data are refused, and leave a fresh decoder.
+  {
+    ViterbiStreamDecoder decoder(codec, 0);
+    std::string decoded;
+    decoder.Feed(symbols.data(), 1001, &decoded);
+    std::string snapshot;
+    decoder.Snapshot(&snapshot);
+    std::vector<int> polynomials = codec.polynomials();
+    polynomials[0] ^= 2;
+    ViterbiCodec other_codec(codec.constraint(), polynomials);
+    ViterbiStreamDecoder other(other_codec, 0);
+    assert(!other.Restore(snapshot.data(), snapshot.size()));
+    assert(other.pending_steps() == 0);
+    ViterbiStreamEncoder encoder(codec);
+    assert(!encoder.Restore(snapshot.data(), snapshot.size()));
+    std::string bad = snapshot;
+    bad[4]++;
+    assert(!decoder.Restore(bad.data(), bad.size()));
+    assert(decoder.pending_steps() == 0);
+    assert(!decoder.Restore(snapshot.data(), snapshot.size() - 1));
+    bad = snapshot + '0';
+    assert(!decoder.Restore(bad.data(), bad.size()));
+    // Pending steps must fit the ring.
+    ViterbiStreamDecoder shallow(codec, codec.constraint(),
+                                 codec.constraint() + 1);
+    assert(!shallow.Restore(snapshot.data(), snapshot.size()));
+    assert(decoder.Restore(snapshot.data(), snapshot.size()));
+    decoder.Feed(symbols.data() + 1001, symbols.size() - 1001, &decoded);
+    decoder.Finish(&decoded);
+    assert(decoded == expected);
+
+    // So are roots beyond the states, which leave the decoder's merge
+    // tracking as it was.
+    ViterbiStreamDecoder tracking(codec, 0);
+    tracking.set_commit_on_merge(true);
+    tracking.Feed(symbols.data(), 1001, &decoded);
+    snapshot.clear();
+    tracking.Snapshot(&snapshot);
+    bad = snapshot;
+    const int32_t root = codec.num_states();
+    std::memcpy(&bad[bad.size() - sizeof(root)], &root, sizeof(root));
+    assert(!decoder.Restore(bad.data(), bad.size()));
+    assert(!decoder.commit_on_merge());
+    assert(decoder.pending_steps() == 0);
+    assert(decoder.Restore(snapshot.data(), snapshot.size()));
+    assert(decoder.commit_on_merge());
+  }
+
+  // A session moves between managers, with queued symbols and bits not
+  // taken yet, and into a stream decoder's place it is refused.
+  {
+    ViterbiSessionManager manager(codec, kInt8Symbols);
+    ViterbiSessionManager::Handle session = manager.Open();
+    std::string decoded;
+    for (size_t i = 0; i < symbols.size();) {
+      const size_t chunk =
+          std::min<size_t>(std::rand() % 200, symbols.size() - i);
+      manager.Feed(session, symbols.data() + i, chunk);
+      i += chunk;
+      if (std::rand() % 2) {
+        manager.Process();
+      }
+      std::string snapshot;
+      manager.Snapshot(session, &snapshot);
+      ViterbiStreamDecoder decoder(codec, 0);
+      assert(!decoder.Restore(snapshot.data(), snapshot.size()));
+      manager.Close(session);
+      assert(manager.Restore(snapshot.data(), snapshot.size(), &session));
+      assert(manager.num_sessions() == 1);
+      if (std::rand() % 2) {
+        manager.Take(session, &decoded);
+      }
+    }
+    manager.Finish(session, &decoded);
+    assert(decoded == expected);
+
+    std::string snapshot;
+    manager.Snapshot(session, &snapshot);
+    ViterbiSessionManager hard(codec, kHardSymbols);
+    ViterbiSessionManager::Handle other;
+    // int8 metrics are scaled unlike hard ones for most codes.
+    if (Max16BitCost(codec.constraint(), codec.num_parity_bits()) <
+        MaxSymbolCost(kInt8Symbols)) {
+      assert(!hard.Restore(snapshot.data(), snapshot.size(), &other));
+      assert(hard.num_sessions() == 0);
+    }
+  }
+}
+
+// Frames decode alike whichever resource their buffers come from, and the
+// resources reuse their memory from frame to frame.
+void TestMemoryResources(const ViterbiCodec& codec) {
+  std::string message;
+  for (int i = 0; i < 70000; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const std::string encoded = codec.Encode(message);
+  std::vector<int8_t> symbols(encoded.size());
+  for (size_t i = 0; i < encoded.size(); i++) {
+    symbols[i] = (encoded[i] == '0' ? 40 : -40) + std::rand() % 81 - 40;
+  }
+  const std::string expected = codec.Decode(symbols.data(), symbols.size());
+
+  HugePageResource huge_pages;
+  BumpArena arena(&huge_pages);
+  std::pmr::memory_resource* resources[] = {&huge_pages, &arena,
+                                            ThreadArenaMemory()};
+  for (int i = 0; i < 3; i++) {
+    ViterbiOptions options = codec.options();
+    options.memory_resource = resources[i];
+    ViterbiCodec codec_with_resource(codec.constraint(), codec.polynomials(),
+                                     options);
+    assert(codec_with_resource.memory_resource() == resources[i]);
+    for (int repeat = 0; repeat < 3; repeat++) {
+      assert(codec_with_resource.Decode(symbols.data(), symbols.size()) ==
+             expected);
+    }
+    std::vector<std::vector<int8_t> > frames(3, symbols);
+    std::vector<std::string> decoded;
+    codec_with_resource.DecodeBatch(frames, &decoded);
+    assert(decoded == std::vector<std::string>(3, expected));
+  }
+  // The frame's decisions took one mapping, reused since, and the arena's
+  // blocks were coalesced into one.
+  assert(huge_pages.num_mappings() <= 3);
+  const size_t capacity = arena.capacity();
+  {
+    ViterbiOptions options = codec.options();
+    options.memory_resource = &arena;
+    ViterbiCodec codec_with_resource(codec.constraint(), codec.polynomials(),
+                                     options);
+    codec_with_resource.Decode(symbols.data(), symbols.size());
+  }
+  assert(arena.capacity() == capacity);
+
+  ViterbiBatchDecoder batch(codec, 2, 0, &huge_pages);
+  std::vector<std::vector<int8_t> > frames(1, symbols);
+  std::vector<std::string> decoded;
+  batch.Decode(frames, &decoded);
+  assert(decoded[0] == expected);
+}
+
+// A stream joined at a random step, phase and polarity, with noise: the sync
+// must lock onto them and then output what a decoder which knew them would.
+void TestFrameSync(const ViterbiCodec& codec) {
+  std::string message;
+  for (int i = 0; i < 3000; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const std::string encoded = codec.Encode(message);
+  const int n = codec.num_parity_bits();
+  for (int trial = 0; trial < 2 * n; trial++) {
+    const int join_step = 100 + std::rand() % 100;
+    const int phase = trial % n;
+    const bool inverted = trial / n == 1;
+    const int start = join_step * n - phase;
+    std::vector<int8_t> symbols(encoded.size() - start);
+    for (size_t i = 0; i < symbols.size(); i++) {
+      const int magnitude = i % 50 == 49 ? -20 : 64;
+      symbols[i] = (encoded[start + i] == '0' ? magnitude : -magnitude) +
+                   std::rand() % 121 - 60;
+    }
+
+    // The symbols from the first whole step, as sent.
+    std::vector<int8_t> aligned(symbols.begin() + phase, symbols.end());
+    if (inverted) {
+      for (size_t i = 0; i < symbols.size(); i++) {
+        symbols[i] = -symbols[i];
+      }
+    }
+    ViterbiStreamDecoder reference(codec, 0);
+    reference.JoinMidStream();
+    std::string expected;
+    reference.Feed(aligned.data(), aligned.size(), &expected);
+    reference.Finish(&expected);
+    // Bits of a transparent code come out complemented when inverted.
+    if (inverted && codec.transparent()) {
+      for (int i = 0; i < expected.size(); i++) {
+        expected[i] = expected[i] == '0' ? '1' : '0';
+      }
+    }
+
+    ViterbiFrameSync sync(codec);
+    std::string decoded;
+    for (size_t i = 0; i < symbols.size();) {
+      const size_t chunk = std::min(symbols.size() - i,
+                                    (size_t) (std::rand() % 100));
+      sync.Feed(symbols.data() + i, chunk, &decoded);
+      i += chunk;
+      assert(sync.locked() || decoded.empty());
+    }
+    assert(sync.locked());
+    assert(sync.num_windows() <= 2);
+    assert(sync.phase() == phase);
+    assert(sync.inverted() == (inverted && !codec.transparent()));
+    assert(sync.growth(phase, sync.inverted()) >= 0);
+    assert(sync.decoder() != NULL);
+    sync.Finish(&decoded);
+    assert(!sync.locked());
+    assert(decoded == expected);
+    // All but the first bits after joining are right.
+    const int settled = 5 * codec.constraint();
+    assert(decoded.size() == message.size() - join_step);
+    if (!inverted || !codec.transparent()) {
+      assert(decoded.substr(settled) == message.substr(join_step + settled));
+    }
+  }
+
+  // Hard bits, of a stream which ends before the sync locks.
+  ViterbiFrameSync sync(codec);
+  std::string decoded;
+  sync.Feed(encoded.substr(n * 3000 - 1), &decoded);
+  assert(!sync.locked() && decoded.empty());
+  sync.Finish(&decoded);
+  assert(sync.phase() == -1);
+}
+
+// Frames of a transparent code received in either polarity, with errors,
+// decode to the bits sent in one pass, which also tells the polarity.
+void TestEitherPolarity(const ViterbiCodec& codec) {
+  assert(codec.transparent());
+  for (int trial = 0; trial < 8; trial++) {
+    std::string message;
+    for (int i = 0; i < 500 + std::rand() % 500; i++) {
+      message += (std::rand() & 1) + '0';
+    }
+    const bool inverted = trial % 2 == 1;
+    std::string encoded = codec.Encode(message);
+    for (int i = 0; i < encoded.size(); i++) {
+      if (inverted) {
+        encoded[i] = encoded[i] == '0' ? '1' : '0';
+      }
+      if (i % 40 == 17) {
+        encoded[i] = encoded[i] == '0' ? '1' : '0';
+      }
+    }
+    bool found_inverted = !inverted;
+    assert(codec.DecodeEitherPolarity(encoded, &found_inverted) == message);
+    assert(found_inverted == inverted);
+
+    std::vector<int16_t> soft = ToSymbols<int16_t>(encoded, 1000);
+    found_inverted = !inverted;
+    assert(codec.DecodeEitherPolarity(soft.data(), soft.size(),
+                                      &found_inverted) == message);
+    assert(found_inverted == inverted);
+  }
+
+  // Codes with an even number of taps in a polynomial are refused.
+  std::vector<int> polynomials = codec.polynomials();
+  polynomials[0] ^= 1 << (codec.constraint() - 1);
+  const ViterbiCodec opaque(codec.constraint(), polynomials);
+  assert(!opaque.transparent());
+  const std::string encoded = opaque.Encode("1101");
+  bool inverted = true;
+  assert(opaque.DecodeEitherPolarity(encoded, &inverted).empty());
+  assert(!inverted);
+}
+
+// Known bits and a-priori LLRs correct errors no decoder without them could,
+// and change nothing where the symbols suffice.
+void TestPriors(const ViterbiCodec& codec) {
+  std::string message;
+  for (int i = 0; i < 600; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const int n = codec.num_parity_bits();
+  std::string encoded = codec.Encode(message);
+  for (int i = 50; i < encoded.size(); i += 50) {
+    encoded[i] = encoded[i] == '0' ? '1' : '0';
+  }
+  ViterbiPriors priors;
+  assert(codec.DecodeWithPriors(encoded, priors) == message);
+
+  // A header of 100 known bits and a pilot every 16 bits, over a burst of
+  // errors which Decode() cannot correct.
+  priors.known.assign(message.size(), '?');
+  for (int i = 0; i < message.size(); i++) {
+    if (i < 100 || i % 16 == 0) {
+      priors.known[i] = message[i];
+    }
+  }
+  std::string burst = encoded;
+  for (int i = 40 * n; i < 80 * n; i += 2) {
+    burst[i] = burst[i] == '0' ? '1' : '0';
+  }
+  assert(codec.Decode(burst) != message);
+  assert(codec.DecodeWithPriors(burst, priors) == message);
+
+  // Known bits hold even where the symbols say otherwise.
+  std::vector<int16_t> soft = ToSymbols<int16_t>(burst, 100);
+  const std::string decoded =
+      codec.DecodeWithPriors(soft.data(), soft.size(), priors);
+  assert(decoded.size() == message.size());
+  for (int i = 0; i < message.size(); i++) {
+    assert(priors.known[i] == '?' || decoded[i] == message[i]);
+  }
+
+  // Strong priors over a burst in the middle of the frame.
+  std::string middle_burst = encoded;
+  for (int i = 300 * n; i < 330 * n; i += 2) {
+    middle_burst[i] = middle_burst[i] == '0' ? '1' : '0';
+  }
+  std::vector<int8_t> symbols = ToSymbols<int8_t>(middle_burst, 10);
+  assert(codec.Decode(symbols.data(), symbols.size()) != message);
+  ViterbiPriors llrs;
+  llrs.llrs.resize(message.size());
+  for (int i = 290; i < 340; i++) {
+    llrs.llrs[i] = (message[i] == '0' ? 20 : -20) * n;
+  }
+  assert(codec.DecodeWithPriors(symbols.data(), symbols.size(), llrs) ==
+         message);
+}
+
+// Every Decode() of a HARQ buffer matches a whole-frame decode of the summed
+// transmissions, and searches only from the checkpoint before the first
+// changed step.
+void TestHarq(const ViterbiCodec& codec) {
+  std::string message;
+  for (int i = 0; i < 2000; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const std::string encoded = codec.Encode(message);
+  const int n = codec.num_parity_bits();
+  const int num_steps = encoded.size() / n;
+  const auto transmit = [&](size_t first, size_t size) {
+    std::vector<int8_t> symbols(size);
+    for (size_t i = 0; i < size; i++) {
+      symbols[i] = (encoded[first + i] == '0' ? 20 : -20) +
+                   std::rand() % 61 - 30;
+    }
+    return symbols;
+  };
+  const auto expect = [&](ViterbiHarqBuffer* harq) {
+    const std::vector<int16_t>& sum = harq->symbols();
+    assert(harq->Decode() == codec.Decode(sum.data(), sum.size()));
+  };
+
+  // Chase combining.
+  ViterbiHarqBuffer harq(codec, encoded.size(), 50);
+  for (int transmission = 0; transmission < 3; transmission++) {
+    const std::vector<int8_t> symbols = transmit(0, encoded.size());
+    harq.Combine(symbols.data(), symbols.size());
+    expect(&harq);
+    assert(harq.searched_steps() == num_steps);
+  }
+  assert(harq.Decode() == harq.Decode());
+  assert(harq.searched_steps() == 0);
+
+  // A retransmission of the end of the frame is searched from there.
+  const size_t first = 1500 * n + 3;
+  const std::vector<int8_t> tail = transmit(first, encoded.size() - first);
+  harq.Combine(tail.data(), tail.size(), first);
+  expect(&harq);
+  assert(harq.searched_steps() == num_steps - 1500);
+  const std::vector<int8_t> middle = transmit(1234 * n, 10 * n);
+  harq.Combine(middle.data(), middle.size(), 1234 * n);
+  expect(&harq);
+  assert(harq.searched_steps() == num_steps - 1200);
+  assert(harq.Decode() == message);
+
+  // Incremental redundancy: two halves of the mother code, punctured.
+  harq.Reset();
+  const std::string patterns[] = {"1100", "0010"};
+  for (int i = 0; i < 2; i++) {
+    std::vector<int8_t> symbols;
+    const std::vector<int8_t> all = transmit(0, encoded.size());
+    for (size_t j = 0; j < all.size(); j++) {
+      if (patterns[i][j % 4] == '1') {
+        symbols.push_back(all[j]);
+      }
+    }
+    harq.Combine(symbols.data(), symbols.size(), 0, patterns[i]);
+    expect(&harq);
+  }
+  for (size_t j = 3; j < encoded.size(); j += 4) {
+    assert(harq.symbols()[j] == 0);
+  }
+}
+
+// The verifier must return what its codec decodes, and log exactly the frames
+// the reference decodes otherwise.
+void TestShadow(const ViterbiCodec& codec) {
+  ViterbiOptions options;
+  options.reduced_states = 4;
+  options.max_reduced_error_rate = 1.0;
+  const ViterbiCodec reduced(codec.constraint(), codec.polynomials(),
+                             options);
+  const auto frame = [&]() {
+    std::string message;
+    for (int i = 0; i < 500; i++) {
+      message += (std::rand() & 1) + '0';
+    }
+    const std::string encoded = codec.Encode(message);
+    std::vector<int8_t> soft(encoded.size());
+    for (size_t i = 0; i < encoded.size(); i++) {
+      soft[i] = (encoded[i] == '0' ? 40 : -40) + std::rand() % 121 - 60;
+    }
+    return soft;
+  };
+
+  char dir[] = "/tmp/viterbi_test_shadow.XXXXXX";
+  assert(mkdtemp(dir) != NULL);
+  {
+    ViterbiShadowVerifier shadow(reduced, 1.0, dir, 1000);
+    for (int i = 0; i < 20; i++) {
+      const std::vector<int8_t> soft = frame();
+      assert(shadow.Decode(soft.data(), soft.size()) ==
+             reduced.Decode(soft.data(), soft.size()));
+    }
+    shadow.Flush();
+    const ViterbiShadowStats stats = shadow.stats();
+    assert(stats.num_frames == 20);
+    assert(stats.num_sampled == 20);
+    assert(stats.num_dropped == 0);
+    assert(stats.num_verified == 20);
+    assert(stats.num_mismatches > 0);
+
+    // Each mismatch names its input, which the reference decodes otherwise.
+    const std::string log_path = std::string(dir) + "/shadow-mismatches.log";
+    std::ifstream log(log_path.c_str());
+    std::string line;
+    int num_lines = 0;
+    while (std::getline(log, line)) {
+      const std::string path =
+          std::string(dir) + "/" + line.substr(0, line.find(':'));
+      std::ifstream in(path.c_str(), std::ios::binary);
+      std::ostringstream contents;
+      contents << in.rdbuf();
+      const std::string input = contents.str();
+      const int8_t* soft = reinterpret_cast<const int8_t*>(input.data());
+      assert(!input.empty());
+      assert(shadow.reference().Decode(soft, input.size()) !=
+             reduced.Decode(soft, input.size()));
+      unlink(path.c_str());
+      num_lines++;
+    }
+    assert(num_lines == stats.num_mismatches);
+    unlink(log_path.c_str());
+  }
+  rmdir(dir);
+
+  // The full search matches its reference, and a fraction samples evenly.
+  ViterbiShadowVerifier shadow(codec, 0.25);
+  for (int i = 0; i < 40; i++) {
+    const std::vector<int8_t> soft = frame();
+    shadow.Decode(soft.data(), soft.size());
+  }
+  shadow.Flush();
+  const ViterbiShadowStats stats = shadow.stats();
+  assert(stats.num_sampled == 10);
+  assert(stats.num_verified == stats.num_sampled - stats.num_dropped);
+  assert(stats.num_mismatches == 0);
+}
+
+// The pipelined decoder must output exactly what the streaming decoder does,
+// whatever the symbol types and feed sizes, over several streams.
+void TestPipelineDecoding(const ViterbiCodec& codec, int max_latency) {
+  ViterbiStreamDecoder decoder(codec, 0, max_latency);
+  ViterbiPipelineDecoder pipeline(codec, 0, max_latency);
+  for (int stream = 0; stream < 3; stream++) {
+    std::string message;
+    for (int i = 0; i < 10000; i++) {
+      message += (std::rand() & 1) + '0';
+    }
+    const std::string encoded = codec.Encode(message);
+    std::string expected;
+    std::string decoded;
+    for (size_t i = 0; i < encoded.size();) {
+      const size_t size =
+          std::min<size_t>(std::rand() % 9000, encoded.size() - i);
+      std::string hard(size, '0');
+      std::vector<int8_t> int8(size);
+      std::vector<int16_t> int16(size);
+      for (size_t j = 0; j < size; j++) {
+        const int x =
+            (encoded[i + j] == '0' ? 40 : -40) + std::rand() % 161 - 80;
+        hard[j] = x < 0 ? '1' : '0';
+        int8[j] = x;
+        int16[j] = x * 200;
+      }
+      switch (std::rand() % 3) {
+        case 0:
+          decoder.Feed(hard, &expected);
+          pipeline.Feed(hard, &decoded);
+          break;
+        case 1:
+          decoder.Feed(int8.data(), size, &expected);
+          pipeline.Feed(int8.data(), size, &decoded);
+          break;
+        default:
+          decoder.Feed(int16.data(), size, &expected);
+          pipeline.Feed(int16.data(), size, &decoded);
+          break;
+      }
+      assert(decoded.size() <= expected.size());
+      i += size;
+    }
+    decoder.Finish(&expected);
+    pipeline.Finish(&decoded);
+    assert(decoded == expected);
+  }
+
+  // A pipeline destroyed mid-stream, with its output rings full, stops.
+  std::string decoded;
+  {
+    ViterbiPipelineDecoder unfinished(codec, 0, max_latency);
+    unfinished.Feed(std::string(3 * ViterbiPipelineDecoder::kBlockSteps * 20,
+                                '0'),
+                    &decoded);
+  }
+}
+
+#if defined(__cpp_impl_coroutine)
+
+// A coroutine which runs until its first suspension when called, and is
+// destroyed when it returns.
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() { return DetachedTask(); }
+    std::suspend_never initial_suspend() { return std::suspend_never(); }
+    std::suspend_never final_suspend() noexcept {
+      return std::suspend_never();
+    }
+    void return_void() {}
+    void unhandled_exception() { std::abort(); }
+  };
+};
+
+DetachedTask AwaitRoundTrip(const ViterbiCodec& codec,
+                            std::string message,
+                            ViterbiExecutor* executor,
+                            std::promise<std::string>* decoded) {
+  const std::string encoded = co_await AwaitEncode(codec, message, executor);
+  decoded->set_value(co_await AwaitDecode(codec, encoded, executor));
+}
+
+#endif  // defined(__cpp_impl_coroutine)
+
+// The asynchronous entry points must return what the synchronous ones do, and
+// a small frame must not wait for a huge one submitted before it.
+void TestAsync(const ViterbiCodec& codec) {
+  ViterbiExecutor executor(1);
+  const int n = codec.num_parity_bits();
+
+  std::string huge_message;
+  for (int i = 0; i < 20 * kDecodeSliceStates / codec.num_states(); i++) {
+    huge_message += (std::rand() & 1) + '0';
+  }
+  const std::string huge_encoded = codec.Encode(huge_message);
+  std::vector<int8_t> huge_symbols(huge_encoded.size());
+  for (size_t i = 0; i < huge_encoded.size(); i++) {
+    huge_symbols[i] =
+        (huge_encoded[i] == '0' ? 40 : -40) + std::rand() % 161 - 80;
+  }
+
+  std::mutex mutex;
+  std::vector<std::string> finished;
+  std::promise<void> huge_done;
+  StartDecode(codec, huge_symbols,
+              [&](std::string decoded) {
+                assert(decoded ==
+                       codec.Decode(huge_symbols.data(), huge_symbols.size()));
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back("huge");
+                huge_done.set_value();
+              },
+              &executor);
+  std::future<std::string> small = DecodeAsync(
+      codec, huge_encoded.substr(0, 100 * n), &executor);
+  assert(small.get() == codec.Decode(huge_encoded.substr(0, 100 * n)));
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(finished.empty());
+  }
+
+  assert(EncodeAsync(codec, huge_message, &executor).get() == huge_encoded);
+  assert(DecodeAsync(codec, huge_encoded).get() == huge_message);
+  // Odd lengths: missing hard bits are "0", missing soft symbols erasures.
+  const std::string odd = huge_encoded.substr(0, 1001);
+  assert(DecodeAsync(codec, odd, &executor).get() == codec.Decode(odd));
+  std::vector<int16_t> int16(1001);
+  for (int i = 0; i < int16.size(); i++) {
+    int16[i] = huge_symbols[i] * 100;
+  }
+  assert(DecodeAsync(codec, int16, &executor).get() ==
+         codec.Decode(int16.data(), int16.size()));
+  assert(DecodeAsync(codec, std::string(), &executor).get() ==
+         codec.Decode(std::string()));
+
+#if defined(__cpp_impl_coroutine)
+  std::promise<std::string> decoded;
+  std::future<std::string> result = decoded.get_future();
+  AwaitRoundTrip(codec, huge_message.substr(0, 5000), &executor, &decoded);
+  assert(result.get() == huge_message.substr(0, 5000));
+#endif
+
+  huge_done.get_future().wait();
+  std::lock_guard<std::mutex> lock(mutex);
+  assert(finished.size() == 1);
+}
+
+// The executor must run jobs earliest deadline first, then highest priority,
+// and count the deadlines missed.
+void TestSchedule(const ViterbiCodec& codec) {
+  typedef ViterbiSchedule::Clock Clock;
+  ViterbiExecutor executor(1);
+
+  // Hold the only thread while jobs queue up.
+  std::promise<void> gate;
+  std::promise<void> held;
+  std::shared_future<void> opened = gate.get_future().share();
+  executor.Submit([opened, &held]() {
+    held.set_value();
+    opened.wait();
+    return true;
+  });
+  held.get_future().wait();
+
+  std::mutex mutex;
+  std::vector<int> finished;
+  const Clock::time_point now = Clock::now();
+  const int deadlines[] = {3, 1, 2, -1, -1, 1};
+  const int priorities[] = {0, 0, 0, 0, 5, 7};
+  for (int i = 0; i < 6; i++) {
+    ViterbiSchedule schedule;
+    schedule.priority = priorities[i];
+    if (deadlines[i] >= 0) {
+      schedule.deadline = now + std::chrono::hours(deadlines[i]);
+    }
+    StartDecode(codec, codec.Encode("1101"),
+                [&, i](std::string decoded) {
+                  assert(decoded == "1101");
+                  std::lock_guard<std::mutex> lock(mutex);
+                  finished.push_back(i);
+                },
+                &executor, schedule);
+  }
+  gate.set_value();
+
+  // Bulk work is preempted at slice boundaries by urgent work. It takes
+  // enough slices to still run when the urgent work is submitted, with an
+  // error so that it is searched rather than taken as a codeword.
+  std::string bulk_message;
+  for (int i = 0; i < 100 * kDecodeSliceStates / codec.num_states(); i++) {
+    bulk_message += (std::rand() & 1) + '0';
+  }
+  std::string bulk_encoded = codec.Encode(bulk_message);
+  bulk_encoded[0] = bulk_encoded[0] == '0' ? '1' : '0';
+  std::future<std::string> bulk = DecodeAsync(codec, bulk_encoded, &executor);
+  std::future<std::vector<std::string> > urgent = DecodeBatchAsync(
+      codec, std::vector<std::string>(3, codec.Encode("0110")), &executor,
+      ViterbiSchedule::Within(std::chrono::seconds(10)));
+  assert(urgent.get() == std::vector<std::string>(3, "0110"));
+  assert(bulk.wait_for(std::chrono::seconds(0)) != std::future_status::ready);
+  assert(bulk.get() == bulk_message);
+
+  // Already late.
+  ViterbiSchedule late;
+  late.deadline = now;
+  assert(DecodeAsync(codec, codec.Encode("1"), &executor, late).get() == "1");
+
+  const int expected[] = {5, 1, 2, 0, 4, 3};
+  std::lock_guard<std::mutex> lock(mutex);
+  assert(finished == std::vector<int>(expected, expected + 6));
+  // The stats are updated after the callbacks run.
+  ViterbiExecutorStats stats;
+  for (int i = 0; i < 1000 && stats.num_jobs < 12; i++) {
+    stats = executor.stats();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  assert(stats.num_jobs == 12);
+  assert(stats.num_slices > stats.num_jobs);
+  assert(stats.num_deadline_jobs == 8);
+  assert(stats.num_deadline_misses == 1);
+  assert(stats.max_lateness > Clock::duration(0));
+}
+
+// A batch of small and huge frames must decode as ViterbiCodec::Decode(): the
+// small ones exactly, and the huge ones, which are split, on a channel clean
+// enough for the overlap to hide the splits.
+void TestBatchDecoding(const ViterbiCodec& codec) {
+  // Split frames decode as whole ones once survivor paths merge within the
+  // overlap. A fixed seed keeps the noise of this test, which flips symbols,
+  // the same from run to run.
+  std::mt19937 rng(61);
+  ViterbiBatchDecoder batch(codec, 3, 4 * codec.traceback_overlap());
+  for (int round = 0; round < 2; round++) {
+    std::vector<std::vector<int8_t> > frames;
+    std::vector<int> message_sizes;
+    for (int i = 0; i < 100; i++) {
+      message_sizes.push_back(rng() % 60);
+    }
+    message_sizes.insert(message_sizes.begin() + 10,
+                         3 * ViterbiBatchDecoder::kSegmentSteps + 123);
+    message_sizes.push_back(ViterbiBatchDecoder::kSegmentSteps + 1);
+    for (int i = 0; i < message_sizes.size(); i++) {
+      std::string message;
+      for (int j = 0; j < message_sizes[i]; j++) {
+        message += (rng() & 1) + '0';
+      }
+      const std::string encoded = codec.Encode(message);
+      std::vector<int8_t> symbols(encoded.size());
+      for (size_t j = 0; j < encoded.size(); j++) {
+        symbols[j] = (encoded[j] == '0' ? 40 : -40) + (int) (rng() % 101) - 50;
+      }
+      // Some frames end mid trellis step.
+      if (!symbols.empty() && rng() % 4 == 0) {
+        symbols.pop_back();
+      }
+      frames.push_back(symbols);
+    }
+
+    std::vector<std::string> decoded;
+    batch.Decode(frames, &decoded);
+    assert(decoded.size() == frames.size());
+    for (int i = 0; i < frames.size(); i++) {
+      assert(decoded[i] == codec.Decode(frames[i].data(), frames[i].size()));
+    }
+  }
+
+  std::vector<std::string> hard_frames;
+  hard_frames.push_back(codec.Encode("1011"));
+  hard_frames.push_back("");
+  hard_frames.push_back("011");
+  std::vector<std::string> decoded;
+  batch.Decode(hard_frames, &decoded);
+  for (int i = 0; i < hard_frames.size(); i++) {
+    assert(decoded[i] == codec.Decode(hard_frames[i]));
+  }
+  batch.Decode(std::vector<std::string>(), &decoded);
+  assert(decoded.empty());
+}
+
+// Long frames are traced back in overlapping segments, which must output
+// what a single traceback over the whole frame does on any channel the code
+// can correct, where survivor paths merge quickly.
+void TestSegmentedTraceback(const ViterbiCodec& codec) {
+  std::string message;
+  for (int i = 0; i < 100000; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const std::string encoded = codec.Encode(message);
+  std::vector<int8_t> symbols(encoded.size());
+  for (size_t i = 0; i < encoded.size(); i++) {
+    symbols[i] = (encoded[i] == '0' ? 40 : -40) + std::rand() % 101 - 50;
+  }
+
+  // A stream decoder deeper than the frame traces it back in one go.
+  ViterbiStreamDecoder whole(codec, message.size() + codec.constraint());
+  std::string expected;
+  whole.Feed(symbols.data(), symbols.size(), &expected);
+  whole.Finish(&expected);
+  assert(codec.Decode(symbols.data(), symbols.size()) == expected);
+
+  // Without overlap the segments' ends are guessed, and DecodeBatch() must
+  // guess them as Decode() does.
+  ViterbiOptions options;
+  options.traceback_overlap = 1;
+  const ViterbiCodec short_overlap(codec.constraint(), codec.polynomials(),
+                                   options);
+  const std::string guessed =
+      short_overlap.Decode(symbols.data(), symbols.size());
+  assert(guessed != expected);
+  std::vector<std::string> decoded;
+  short_overlap.DecodeBatch(
+      std::vector<std::vector<int8_t> >(2, symbols), &decoded);
+  assert(decoded == std::vector<std::string>(2, guessed));
+
+  // Without segments the ends need no guessing, so the shadow verifier's
+  // reference catches the guesses.
+  options.segmented_traceback = false;
+  const ViterbiCodec unsegmented(codec.constraint(), codec.polynomials(),
+                                 options);
+  assert(unsegmented.Decode(symbols.data(), symbols.size()) == expected);
+  unsegmented.DecodeBatch(
+      std::vector<std::vector<int8_t> >(2, symbols), &decoded);
+  assert(decoded == std::vector<std::string>(2, expected));
+  ViterbiShadowVerifier shadow(short_overlap, 1.0);
+  assert(shadow.Decode(symbols.data(), symbols.size()) == guessed);
+  shadow.Flush();
+  assert(shadow.stats().num_mismatches == 1);
+}
+
+// Interleaved batch decoding must decode every frame as Decode() does.
+void TestDecodeBatch(const ViterbiCodec& codec) {
+  std::vector<std::string> hard;
+  std::vector<std::vector<int8_t> > int8;
+  std::vector<std::vector<int16_t> > int16;
+  for (int i = 0; i < 20; i++) {
+    std::string message;
+    const int max_size = std::min(3000, (1 << 20) / codec.num_states());
+    const int size = i == 3 ? 0 : std::rand() % max_size;
+    for (int j = 0; j < size; j++) {
+      message += (std::rand() & 1) + '0';
+    }
+    std::string encoded = codec.Encode(message);
+    if (!encoded.empty() && std::rand() % 3 == 0) {
+      encoded.erase(encoded.size() - 1);
+    }
+    std::vector<int8_t> symbols(encoded.size());
+    std::vector<int16_t> wide(encoded.size());
+    for (size_t j = 0; j < encoded.size(); j++) {
+      const int x =
+          (encoded[j] == '0' ? 40 : -40) + std::rand() % 161 - 80;
+      encoded[j] = x < 0 ? '1' : '0';
+      symbols[j] = x;
+      wide[j] = x * 200;
+    }
+    hard.push_back(encoded);
+    int8.push_back(symbols);
+    int16.push_back(wide);
+  }
+
+  std::vector<std::string> decoded;
+  codec.DecodeBatch(hard, &decoded);
+  assert(decoded.size() == hard.size());
+  for (int i = 0; i < hard.size(); i++) {
+    assert(decoded[i] == codec.Decode(hard[i]));
+  }
+  codec.DecodeBatch(int8, &decoded);
+  for (int i = 0; i < int8.size(); i++) {
+    assert(decoded[i] == codec.Decode(int8[i].data(), int8[i].size()));
+  }
+  codec.DecodeBatch(int16, &decoded);
+  for (int i = 0; i < int16.size(); i++) {
+    assert(decoded[i] == codec.Decode(int16[i].data(), int16[i].size()));
+  }
+  codec.DecodeBatch(std::vector<std::string>(), &decoded);
+  assert(decoded.empty());
+}
+
+// Frames whose hard decisions form a codeword decode without a search to the
+// same bits, and the syndrome tells clean channels from noisy ones.
+void TestCodewordFastPath(const ViterbiCodec& codec) {
+  ViterbiOptions options;
+  options.codeword_fast_path = false;
+  const ViterbiCodec searching(codec.constraint(), codec.polynomials(),
+                               options);
+  for (int errors = 0; errors < 3; errors++) {
+    std::string message;
+    for (int i = 0; i < 500; i++) {
+      message += (std::rand() & 1) + '0';
+    }
+    std::string encoded = codec.Encode(message);
+    for (int i = 0; i < errors; i++) {
+      const int j = std::rand() % encoded.size();
+      encoded[j] = encoded[j] == '0' ? '1' : '0';
+    }
+    assert(codec.Decode(encoded) == searching.Decode(encoded));
+    std::vector<int8_t> soft(encoded.size());
+    for (size_t i = 0; i < encoded.size(); i++) {
+      soft[i] = (encoded[i] == '0' ? 1 : -1) * (1 + std::rand() % 127);
+    }
+    assert(codec.Decode(soft.data(), soft.size()) ==
+           searching.Decode(soft.data(), soft.size()));
+    // An erasure leaves other codewords as likely.
+    soft[std::rand() % soft.size()] = 0;
+    assert(codec.Decode(soft.data(), soft.size()) ==
+           searching.Decode(soft.data(), soft.size()));
+    if (errors == 0) {
+      assert(codec.EstimateErrorRate(encoded) == 0);
+    }
+  }
+
+  if (codec.num_parity_bits() >= 2) {
+    std::string message;
+    for (int i = 0; i < 20000; i++) {
+      message += (std::rand() & 1) + '0';
+    }
+    std::string encoded = codec.Encode(message);
+    for (size_t i = 0; i < encoded.size(); i++) {
+      if (std::rand() % 100 == 0) {
+        encoded[i] = encoded[i] == '0' ? '1' : '0';
+      }
+    }
+    const double rate = codec.EstimateErrorRate(encoded);
+    assert(rate > 0.005 && rate < 0.02);
+  }
+}
+
+// The reduced-state search decodes frames within the error rate guardrail,
+// and frames beyond it are searched in full.
+void TestReducedStates(const ViterbiCodec& codec) {
+  ViterbiOptions options;
+  options.reduced_states = codec.num_states() / 2;
+  options.max_reduced_error_rate = 0.02;
+  const ViterbiCodec reduced(codec.constraint(), codec.polynomials(),
+                             options);
+  for (int noisy = 0; noisy < 2; noisy++) {
+    std::string message;
+    for (int i = 0; i < 2000; i++) {
+      message += (std::rand() & 1) + '0';
+    }
+    const std::string encoded = codec.Encode(message);
+    std::vector<int8_t> soft(encoded.size());
+    for (size_t i = 0; i < encoded.size(); i++) {
+      const int noise = noisy ? std::rand() % 101 - 50 : std::rand() % 61 - 30;
+      soft[i] = (encoded[i] == '0' ? 40 : -40) + noise;
+      if (!noisy && std::rand() % 500 == 0) {
+        soft[i] = -soft[i];
+      }
+    }
+    const double rate = reduced.EstimateErrorRate(soft.data(), soft.size());
+    assert(noisy ? rate > 0.02 : rate > 0 && rate <= 0.02);
+    if (noisy) {
+      assert(reduced.Decode(soft.data(), soft.size()) ==
+             codec.Decode(soft.data(), soft.size()));
+    } else {
+      assert(reduced.Decode(soft.data(), soft.size()) == message);
+    }
+  }
+
+  // Sparse hard errors stay within the guardrail.
+  std::string message;
+  for (int i = 0; i < 2000; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  std::string encoded = codec.Encode(message);
+  for (int i = 50; i < encoded.size(); i += 200) {
+    encoded[i] = encoded[i] == '0' ? '1' : '0';
+  }
+  assert(reduced.EstimateErrorRate(encoded) <= 0.02);
+  assert(reduced.Decode(encoded) == message);
+
+  // The batch and asynchronous decoders take the same shortcut. Keeping a
+  // single state on a noisy channel loses the most likely path, so they
+  // cannot match Decode() by searching in full instead.
+  options.reduced_states = 1;
+  options.max_reduced_error_rate = 1;
+  const ViterbiCodec greedy(codec.constraint(), codec.polynomials(), options);
+  std::vector<std::vector<int8_t> > frames(3);
+  for (int i = 0; i < frames.size(); i++) {
+    const std::string encoded = codec.Encode(message.substr(i * 500, 500));
+    for (size_t j = 0; j < encoded.size(); j++) {
+      frames[i].push_back((encoded[j] == '0' ? 40 : -40) +
+                          std::rand() % 101 - 50);
+    }
+  }
+  std::vector<std::string> batch_decoded;
+  greedy.DecodeBatch(frames, &batch_decoded);
+  std::vector<std::string> pool_decoded;
+  ViterbiBatchDecoder(greedy, 2).Decode(frames, &pool_decoded);
+  for (int i = 0; i < frames.size(); i++) {
+    const std::string expected =
+        greedy.Decode(frames[i].data(), frames[i].size());
+    assert(expected != codec.Decode(frames[i].data(), frames[i].size()));
+    assert(batch_decoded[i] == expected);
+    assert(pool_decoded[i] == expected);
+    assert(DecodeAsync(greedy, frames[i]).get() == expected);
+  }
+  // Except for frames beyond one slice, which are searched in full.
+  std::string long_message;
+  for (int i = 0; i < kDecodeSliceStates / codec.num_states(); i++) {
+    long_message += (std::rand() & 1) + '0';
+  }
+  const std::string long_encoded = codec.Encode(long_message);
+  std::vector<int8_t> long_frame(long_encoded.size());
+  for (size_t i = 0; i < long_encoded.size(); i++) {
+    long_frame[i] =
+        (long_encoded[i] == '0' ? 40 : -40) + std::rand() % 101 - 50;
+  }
+  const std::string searched =
+      codec.Decode(long_frame.data(), long_frame.size());
+  assert(searched != greedy.Decode(long_frame.data(), long_frame.size()));
+  assert(DecodeAsync(greedy, long_frame).get() == searched);
+}
+
+// Every engine this CPU supports must decide exactly like the scalar engine
+// on noisy frames, unless 16-bit metrics have to scale the symbols down.
+void TestEngines(const ViterbiCodec& codec) {
+  std::string message;
+  for (int i = 0; i < 300; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const std::string encoded = codec.Encode(message);
+  std::string hard(encoded.size(), '0');
+  std::vector<int8_t> int8(encoded.size());
+  std::vector<int16_t> int16(encoded.size());
+  for (int i = 0; i < encoded.size(); i++) {
+    const int x = (encoded[i] == '0' ? 40 : -40) + std::rand() % 121 - 60;
+    hard[i] = x < 0 ? '1' : '0';
+    int8[i] = x;
+    int16[i] = x * 200;
+  }
+  const size_t half = encoded.size() / 2;
+
+  ViterbiOptions scalar_options;
+  scalar_options.engine = kScalarEngine;
+  const ViterbiCodec scalar(codec.constraint(), codec.polynomials(),
+                            scalar_options);
+  const std::string hard_decoded = scalar.Decode(hard);
+  const std::string int8_decoded = scalar.Decode(int8.data(), int8.size());
+  const std::string int16_decoded = scalar.Decode(int16.data(), int16.size());
+  ViterbiStreamDecoder scalar_decoder(scalar, 0);
+  std::string stream_decoded;
+  scalar_decoder.Feed(hard.substr(0, half), &stream_decoded);
+  scalar_decoder.Feed(int16.data() + half, int16.size() - half,
+                      &stream_decoded);
+  scalar_decoder.Finish(&stream_decoded);
+
+  const ViterbiEngine kEngines[] = {kSse2Engine, kAvx2Engine};
+  for (int i = 0; i < 2; i++) {
+    for (int metric_bits = 16; metric_bits <= 32; metric_bits += 16) {
+      const AcsConfig config = {kEngines[i], metric_bits};
+      if (!codec.SupportsEngine(config)) {
+        continue;
+      }
+      ViterbiOptions options;
+      options.engine = config.engine;
+      options.metric_bits = config.metric_bits;
+      const ViterbiCodec engine_codec(codec.constraint(), codec.polynomials(),
+                                      options);
+      assert(engine_codec.ChooseEngine(kInt16Symbols, 0).engine ==
+             config.engine);
+
+      assert(engine_codec.Decode(hard) == hard_decoded);
+      if (metric_bits == 32 ||
+          MaxSymbolCost(kInt8Symbols) <=
+              Max16BitCost(codec.constraint(), codec.num_parity_bits())) {
+        assert(engine_codec.Decode(int8.data(), int8.size()) == int8_decoded);
+      }
+      const std::string decoded =
+          engine_codec.Decode(int16.data(), int16.size());
+      assert(metric_bits == 16 ? decoded.size() == message.size()
+                               : decoded == int16_decoded);
+
+      // Switching from hard to soft symbols mid-stream widens the metrics.
+      ViterbiStreamDecoder decoder(engine_codec, 0);
+      std::string engine_stream_decoded;
+      decoder.Feed(hard.substr(0, half), &engine_stream_decoded);
+      decoder.Feed(int16.data() + half, int16.size() - half,
+                   &engine_stream_decoded);
+      decoder.Finish(&engine_stream_decoded);
+      assert(engine_stream_decoded == stream_decoded);
+    }
+  }
+}
+
+// Sessions of a ViterbiSessionManager must decode exactly like separate
+// stream decoders, however their symbols arrive.
+void TestSessions(const ViterbiCodec& codec) {
+  const bool soft = MaxSymbolCost(kInt8Symbols) <=
+                    Max16BitCost(codec.constraint(), codec.num_parity_bits());
+  ViterbiSessionManager manager(codec, soft ? kInt8Symbols : kHardSymbols);
+  const int num_sessions = ViterbiSessionManager::kLanes + 5;
+  std::vector<ViterbiSessionManager::Handle> handles;
+  std::vector<std::vector<int8_t> > received(num_sessions);
+  std::vector<std::string> expected(num_sessions);
+  for (int i = 0; i < num_sessions; i++) {
+    handles.push_back(manager.Open());
+    std::string message;
+    for (int j = std::rand() % 300; j > 0; j--) {
+      message += (std::rand() & 1) + '0';
+    }
+    const std::string encoded = codec.Encode(message);
+    ViterbiStreamDecoder decoder(codec, 0);
+    std::string hard(encoded.size(), '0');
+    for (int j = 0; j < encoded.size(); j++) {
+      const int x = (encoded[j] == '0' ? 40 : -40) + std::rand() % 121 - 60;
+      hard[j] = x < 0 ? '1' : '0';
+      received[i].push_back(x);
+    }
+    if (soft) {
+      decoder.Feed(received[i].data(), received[i].size(), &expected[i]);
+    } else {
+      decoder.Feed(hard, &expected[i]);
+    }
+    decoder.Finish(&expected[i]);
+  }
+  assert(manager.num_sessions() == num_sessions);
+
+  // Feed each session in chunks of random sizes, a few sessions at a time.
+  std::vector<size_t> fed(num_sessions);
+  std::vector<std::string> decoded(num_sessions);
+  bool done = false;
+  while (!done) {
+    done = true;
+    for (int i = 0; i < num_sessions; i++) {
+      const size_t size = std::min<size_t>(std::rand() % 40,
+                                           received[i].size() - fed[i]);
+      if (std::rand() % 3 == 0 || size == 0) {
+        done = done && fed[i] == received[i].size();
+        continue;
+      }
+      done = false;
+      if (soft) {
+        manager.Feed(handles[i], received[i].data() + fed[i], size);
+      } else {
+        std::string hard;
+        for (size_t j = fed[i]; j < fed[i] + size; j++) {
+          hard += received[i][j] < 0 ? '1' : '0';
+        }
+        manager.Feed(handles[i], hard);
+      }
+      fed[i] += size;
+    }
+    manager.Process();
+    const int i = std::rand() % num_sessions;
+    manager.Take(handles[i], &decoded[i]);
+    assert(manager.pending_steps(handles[i]) <=
+           manager.traceback_depth() + std::max(manager.traceback_depth(), 64));
+  }
+  for (int i = 0; i < num_sessions; i++) {
+    manager.Finish(handles[i], &decoded[i]);
+    assert(decoded[i] == expected[i]);
+  }
+
+  // Handles of closed sessions stay invalid when their slots are reused.
+  manager.Close(handles[3]);
+  assert(!manager.IsOpen(handles[3]));
+  const ViterbiSessionManager::Handle reopened = manager.Open();
+  assert(reopened != handles[3] && manager.IsOpen(reopened));
+  assert(manager.num_sessions() == num_sessions);
+}
+
+// Tuning file entries must round-trip, and steer the codecs they are for.
+// Codecs of one code share its tables whatever their options, and decode
+// alike from several threads at once.
+void TestSharedCode() {
+  std::vector<int> polynomials;
+  polynomials.push_back(91);
+  polynomials.push_back(121);
+  std::weak_ptr<const ConvolutionalCode> weak;
+  {
+    ViterbiOptions options;
+    options.engine = kScalarEngine;
+    const ViterbiCodec codec(7, polynomials);
+    const ViterbiCodec scalar(7, polynomials, options);
+    const ViterbiCodec from_code(codec.code(), options);
+    assert(codec.code() == scalar.code());
+    assert(codec.code() == from_code.code());
+    assert(codec.code() == ConvolutionalCode::Get(7, polynomials));
+    const std::vector<int> other_polynomials(1, 91);
+    assert(codec.code() != ConvolutionalCode::Get(7, other_polynomials));
+    assert(codec.code()->num_states() == 64);
+    assert(codec.code()->table_bytes() > 0);
+    weak = codec.code();
+
+    std::string message;
+    for (int i = 0; i < 2000; i++) {
+      message += (std::rand() & 1) + '0';
+    }
+    std::string encoded = codec.Encode(message);
+    for (int i = 0; i < encoded.size(); i += 50) {
+      encoded[i] = encoded[i] == '0' ? '1' : '0';
+    }
+    const std::string expected = codec.Decode(encoded);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+      threads.push_back(std::thread([&, i]() {
+        const ViterbiCodec& shared = i % 2 ? scalar : from_code;
+        for (int repeat = 0; repeat < 10; repeat++) {
+          assert(shared.Decode(encoded) == expected);
+        }
+      }));
+    }
+    for (int i = 0; i < threads.size(); i++) {
+      threads[i].join();
+    }
+  }
+  // The tables go with the last codec.
+  assert(weak.expired());
+}
+
+// Codes are mapped from the table files which the first process to use them
+// saves, and damaged or foreign table files are ignored.
+void TestTableCache() {
+  char dir[] = "/tmp/viterbi_test_tables.XXXXXX";
+  assert(mkdtemp(dir) != NULL);
+  setenv("VITERBI_TABLE_CACHE", dir, 1);
+  std::vector<int> polynomials;
+  polynomials.push_back(91);
+  polynomials.push_back(121);
+  polynomials.push_back(117);
+  const std::string path = std::string(dir) + "/" +
+                           ConvolutionalCode::TableFileName(7, polynomials);
+
+  std::string message;
+  for (int i = 0; i < 1000; i++) {
+    message += (std::rand() & 1) + '0';
+  }
+  const ViterbiCodec built(
+      std::make_shared<ConvolutionalCode>(7, polynomials));
+  std::string encoded = built.Encode(message);
+  for (int i = 0; i < encoded.size(); i += 40) {
+    encoded[i] = encoded[i] == '0' ? '1' : '0';
+  }
+  {
+    const ViterbiCodec codec(7, polynomials);
+    assert(!codec.code()->mapped());
+    assert(std::ifstream(path.c_str()).good());
+  }
+  {
+    const ViterbiCodec codec(7, polynomials);
+    assert(codec.code()->mapped());
+    assert(codec.code()->table_bytes() == built.code()->table_bytes());
+    assert(codec.Encode(message) == built.Encode(message));
+    assert(codec.Decode(encoded) == built.Decode(encoded));
+    assert(codec.Decode(encoded) == message);
+  }
+  unsetenv("VITERBI_TABLE_CACHE");
+
+  std::string file;
+  {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    file = contents.str();
+  }
+  const std::string damaged_path = path + ".damaged";
+  std::string damaged = file;
+  damaged[damaged.size() - 100] ^= 1;
+  std::ofstream(damaged_path.c_str(), std::ios::binary) << damaged;
+  assert(ConvolutionalCode::Load(damaged_path, 7, polynomials) == NULL);
+  std::ofstream(damaged_path.c_str(), std::ios::binary)
+      << file.substr(0, file.size() - 8);
+  assert(ConvolutionalCode::Load(damaged_path, 7, polynomials) == NULL);
+  polynomials[2] = 79;
+  assert(ConvolutionalCode::Load(path, 7, polynomials) == NULL);
+  assert(ConvolutionalCode::Load(damaged_path + ".missing", 7, polynomials) ==
+         NULL);
+  unlink(damaged_path.c_str());
+  unlink(path.c_str());
+  rmdir(dir);
+}
+
+void TestTuning() {
+  char path[] = "/tmp/viterbi_test_tuning.XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+
+  std::vector<int> polynomials;
+  polynomials.push_back(109);
+  polynomials.push_back(79);
+
+  ViterbiTuning entry;
+  entry.cpu = TuningCpuName();
+  entry.constraint = 7;
+  entry.polynomials = polynomials;
+  entry.symbol_type = kInt8Symbols;
+  entry.max_frame_bits = 1000;
+  entry.acs.engine = kScalarEngine;
+  entry.acs.metric_bits = 32;
+  entry.traceback_depth = 20;
+  entry.num_threads = 3;
+  std::vector<ViterbiTuning> entries;
+  MergeTuning(entry, &entries);
+  entry.max_frame_bits = 100000;
+  entry.acs.engine = kSse2Engine;
+  entry.traceback_depth = 25;
+  MergeTuning(entry, &entries);
+  entry.cpu = "another_cpu";
+  entry.traceback_depth = 50;
+  MergeTuning(entry, &entries);
+  entry.cpu = TuningCpuName();
+  entry.traceback_depth = 25;
+  entry.num_threads = 2;
+  MergeTuning(entry, &entries);
+  entry.symbol_type = kHardSymbols;
+  entry.max_frame_bits = 1000;
+  entry.traceback_depth = 40;
+  MergeTuning(entry, &entries);
+  assert(entries.size() == 4);
+
+  std::string error;
+  assert(WriteTuningFile(path, entries, &error));
+  std::vector<ViterbiTuning> read;
+  assert(ReadTuningFile(path, &read, &error));
+  assert(read.size() == 4);
+  assert(read[1].acs.engine == kSse2Engine && read[1].num_threads == 2);
+  assert(FindTuning(read, kInt8Symbols, 10)->max_frame_bits == 1000);
+  assert(FindTuning(read, kInt8Symbols, 5000)->max_frame_bits == 100000);
+  assert(FindTuning(read, kInt8Symbols, 1 << 20)->max_frame_bits == 100000);
+  assert(FindTuning(read, kInt16Symbols, 10) == NULL);
+  assert(LoadTuningFile(path) == LoadTuningFile(path));
+  assert(LoadTuningFile(path)->size() == 4);
+
+  ViterbiOptions options;
+  options.tuning_file = path;
+  const ViterbiCodec codec(7, polynomials, options);
+  assert(codec.tuning().size() == 3);
+  assert(codec.traceback_depth() == 25);
+  assert(codec.traceback_depth(kInt8Symbols) == 25);
+  assert(codec.traceback_depth(kHardSymbols) == 40);
+  assert(codec.traceback_depth(kInt16Symbols) == 35);
+  assert(codec.num_threads() == 3);
+  assert(codec.ChooseEngine(kInt8Symbols, 500).engine == kScalarEngine);
+  const AcsConfig sse2 = {kSse2Engine, 32};
+  if (codec.SupportsEngine(sse2)) {
+    assert(codec.ChooseEngine(kInt8Symbols, 5000).engine == kSse2Engine);
+  }
+  options.traceback_depth = 30;
+  assert(ViterbiCodec(7, polynomials, options).traceback_depth() == 30);
+
+  std::ofstream(path) << "garbage\n";
+  assert(!ReadTuningFile(path, &read, &error));
+  assert(LoadTuningFile(path) == NULL);
+  assert(ViterbiCodec(7, polynomials, options).tuning().empty());
+  unlink(path);
+
+  TunerOptions tuner_options;
+  tuner_options.frame_bits.push_back(256);
+  tuner_options.min_seconds = 0.001;
+  tuner_options.max_threads = 1;
+  tuner_options.message_bits = 2000;
+  const std::vector<ViterbiTuning> tuned =
+      TuneCode(7, polynomials, tuner_options, NULL);
+  assert(tuned.size() == 1);
+  assert(tuned[0].max_frame_bits == 256);
+  assert(codec.SupportsEngine(tuned[0].acs));
+  assert(tuned[0].traceback_depth >= 14 && tuned[0].num_threads == 1);
+}
+
 // Test the given ViterbiCodec by randomly generating 10 input sequences of
 // length 8, 16, 32 respectively, encode and decode them, then test if the
 // decoded string is the same as the original input.
@@ -106,12 +1828,25 @@ void TestViterbiCodecAutomatic(const ViterbiCodec& codec) {
       std::cout << "encoded = " << encoded << std::endl
                 << "decoded = " << decoded << std::endl << std::endl;
       assert(decoded == message);
+
+      TestSoftDecoding(codec, encoded, message);
+      TestStreamDecoding(codec, encoded, message);
     }
   }
+  TestEngines(codec);
+  TestCodewordFastPath(codec);
+  TestSessions(codec);
+  TestDecodeBatch(codec);
 }
 
 int main(int argc, char** argv) {
   TestViterbiDecodingSamples();
+  TestConstraintBounds();
+  TestBitConversion();
+  TestShmRing();
+  TestTuning();
+  TestSharedCode();
+  TestTableCache();
 
   std::srand(std::time(NULL));
 
@@ -169,6 +1904,8 @@ int main(int argc, char** argv) {
     ViterbiCodec codec(9, polynomials);
 
     TestViterbiCodecAutomatic(codec);
+    TestFrameSync(codec);
+    TestPriors(codec);
   }
 
   {
@@ -187,6 +1924,29 @@ int main(int argc, char** argv) {
     TestViterbiCodecAutomatic(codec);
   }
 
+  {
+    std::vector<int> polynomials;
+    polynomials.push_back(109);
+    polynomials.push_back(79);
+
+    TestStreamDecodingLong(ViterbiCodec(7, polynomials));
+    TestCommitOnMerge(ViterbiCodec(7, polynomials));
+    TestSnapshot(ViterbiCodec(7, polynomials));
+    TestMemoryResources(ViterbiCodec(7, polynomials));
+    TestFrameSync(ViterbiCodec(7, polynomials));
+    TestEitherPolarity(ViterbiCodec(7, polynomials));
+    TestPriors(ViterbiCodec(7, polynomials));
+    TestHarq(ViterbiCodec(7, polynomials));
+    TestShadow(ViterbiCodec(7, polynomials));
+    TestReducedStates(ViterbiCodec(7, polynomials));
+    TestSegmentedTraceback(ViterbiCodec(7, polynomials));
+    TestPipelineDecoding(ViterbiCodec(7, polynomials), 0);
+    TestPipelineDecoding(ViterbiCodec(7, polynomials), 40);
+    TestAsync(ViterbiCodec(7, polynomials));
+    TestSchedule(ViterbiCodec(7, polynomials));
+    TestBatchDecoding(ViterbiCodec(7, polynomials));
+  }
+
   std::cout << "PASS" << std::endl;
 }
 
@@ -0,0 +1,173 @@
+// Tunes the decoder for a code on this machine, and records the result in a
+// tuning file which ViterbiCodec loads at construction.
+
+#include "viterbi.h"
+#include "viterbi_tuner.h"
+#include "viterbi_tuning.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Tuning file to update.
+static std::string FLAGS_tuning_file = DefaultTuningFile();
+
+// Type of the received symbols to tune for: bits, int8 or int16.
+static std::string FLAGS_input_format = "int8";
+
+// Received symbols per frame to tune for, comma separated.
+static std::string FLAGS_frame_bits = "256,4096,65536";
+
+// Signal to noise ratio per message bit of the simulated channel, in dB.
+static double FLAGS_ebn0 = 3.0;
+
+// Largest allowed relative increase in bit errors over the scalar engine.
+static double FLAGS_tolerance = 0.05;
+
+// Seconds to measure each candidate for.
+static double FLAGS_seconds = 0.2;
+
+// Most threads to try; 0 for all hardware threads.
+static int FLAGS_threads = 0;
+
+// Reverse polynomials.
+static bool FLAGS_reverse_polynomials = false;
+
+void Usage(const std::string& exec) {
+  std::cout
+      << "Usage:\n"
+      << "    " << exec << " [--tuning_file=<path>]"
+      << " [--input_format=<bits|int8|int16>] [--frame_bits=<n>,...]"
+      << " [--ebn0=<dB>] [--tolerance=<fraction>] [--seconds=<s>]"
+      << " [--threads=<n>] [--reverse_polynomials]"
+      << " <constraint> <polynomial>...\n\n"
+      << "Measures the decoder engines, metric widths, thread counts and\n"
+      << "stream traceback depths for the code on this machine, on simulated\n"
+      << "noisy frames, and records the fastest configuration whose bit\n"
+      << "errors stay within the tolerance of the scalar engine in the\n"
+      << "tuning file, which defaults to $VITERBI_TUNING_FILE. Entries for\n"
+      << "other codes, symbol types, frame sizes and CPUs are kept.\n";
+}
+
+std::vector<std::string> ParseFlags(int argc, char** argv) {
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--help") == 0) {
+      Usage(argv[0]);
+      exit(1);
+    } else if (std::strncmp(argv[i], "--tuning_file=", 14) == 0) {
+      FLAGS_tuning_file = argv[i] + 14;
+    } else if (std::strncmp(argv[i], "--input_format=", 15) == 0) {
+      FLAGS_input_format = argv[i] + 15;
+    } else if (std::strncmp(argv[i], "--frame_bits=", 13) == 0) {
+      FLAGS_frame_bits = argv[i] + 13;
+    } else if (std::strncmp(argv[i], "--ebn0=", 7) == 0) {
+      FLAGS_ebn0 = std::atof(argv[i] + 7);
+    } else if (std::strncmp(argv[i], "--tolerance=", 12) == 0) {
+      FLAGS_tolerance = std::max(0.0, std::atof(argv[i] + 12));
+    } else if (std::strncmp(argv[i], "--seconds=", 10) == 0) {
+      FLAGS_seconds = std::atof(argv[i] + 10);
+    } else if (std::strncmp(argv[i], "--threads=", 10) == 0) {
+      FLAGS_threads = std::max(0, std::atoi(argv[i] + 10));
+    } else if (std::strcmp(argv[i], "--reverse_polynomials") == 0) {
+      FLAGS_reverse_polynomials = true;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  return args;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> args = ParseFlags(argc, argv);
+  if (args.size() < 2) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  TunerOptions options;
+  if (!ParseSymbolType(FLAGS_input_format, &options.symbol_type)) {
+    std::cout << "Unknown input format: " << FLAGS_input_format << std::endl;
+    return 1;
+  }
+  std::istringstream frame_bits(FLAGS_frame_bits);
+  std::string item;
+  while (std::getline(frame_bits, item, ',')) {
+    const long bits = std::atol(item.c_str());
+    if (bits <= 0) {
+      std::cout << "Expected frame sizes, found " << FLAGS_frame_bits
+                << std::endl;
+      return 1;
+    }
+    options.frame_bits.push_back(bits);
+  }
+  options.ebn0_db = FLAGS_ebn0;
+  options.tolerance = FLAGS_tolerance;
+  options.min_seconds = FLAGS_seconds;
+  options.max_threads = FLAGS_threads;
+  if (FLAGS_tuning_file.empty()) {
+    std::cout << "No tuning file: set --tuning_file or VITERBI_TUNING_FILE"
+              << std::endl;
+    return 1;
+  }
+
+  const int constraint = std::atoi(args[0].c_str());
+  std::vector<int> polynomials;
+  for (int i = 1; i < args.size(); i++) {
+    polynomials.push_back(std::atoi(args[i].c_str()));
+  }
+  if (constraint < 3 || constraint > 16) {
+    std::cout << "Constraint should be between 3 and 16, found " << constraint
+              << std::endl;
+    return 1;
+  }
+  for (int i = 0; i < polynomials.size(); i++) {
+    if (polynomials[i] <= 0 || polynomials[i] >= (1 << constraint)) {
+      std::cout << "Polynomial should be between 1 and "
+                << (1 << constraint) - 1 << ", found " << polynomials[i]
+                << std::endl;
+      return 1;
+    }
+    if (FLAGS_reverse_polynomials) {
+      polynomials[i] = ReverseBits(constraint, polynomials[i]);
+    }
+  }
+
+  // Keep the other entries of an existing file.
+  std::vector<ViterbiTuning> entries;
+  std::string error;
+  if (!ReadTuningFile(FLAGS_tuning_file, &entries, &error)) {
+    if (std::ifstream(FLAGS_tuning_file.c_str())) {
+      std::cout << error << std::endl;
+      return 1;
+    }
+    entries.clear();
+  }
+
+  std::cout << "Tuning " << ViterbiCodec(constraint, polynomials) << " on "
+            << TuningCpuName() << std::endl;
+  const std::vector<ViterbiTuning> tuned =
+      TuneCode(constraint, polynomials, options, &std::cout);
+
+  for (int i = 0; i < tuned.size(); i++) {
+    const ViterbiTuning& entry = tuned[i];
+    std::cout << "Up to " << entry.max_frame_bits << " "
+              << SymbolTypeName(entry.symbol_type)
+              << " symbols: " << EngineName(entry.acs.engine) << "/"
+              << entry.acs.metric_bits << ", " << entry.num_threads
+              << " threads, traceback depth " << entry.traceback_depth
+              << std::endl;
+    MergeTuning(entry, &entries);
+  }
+  if (!WriteTuningFile(FLAGS_tuning_file, entries, &error)) {
+    std::cout << error << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << FLAGS_tuning_file << std::endl;
+  return 0;
+}
@@ -0,0 +1,302 @@
+// Implementation of TuneCode().
+
+#include "viterbi_tuner.h"
+#include "viterbi.h"
+#include "viterbi_stream.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Simulated received frames: random messages, encoded, sent as BPSK over an
+// additive white Gaussian noise channel and quantized to the symbol type.
+class Frames {
+ public:
+  Frames(const ViterbiCodec& codec,
+         SymbolType type,
+         int num_frames,
+         int message_bits,
+         double ebn0_db,
+         std::mt19937* rng)
+      : type_(type), total_message_bits_(0) {
+    std::bernoulli_distribution coin;
+    for (int i = 0; i < num_frames; i++) {
+      std::string message(message_bits, '0');
+      for (int j = 0; j < message_bits; j++) {
+        message[j] = coin(*rng) ? '1' : '0';
+      }
+      const std::string encoded = codec.Encode(message);
+
+      const double rate = (double) message.size() / encoded.size();
+      const double sigma =
+          std::sqrt(1 / (2 * rate * std::pow(10.0, ebn0_db / 10)));
+      std::normal_distribution<double> noise(0, sigma);
+      std::string hard(encoded.size(), '0');
+      std::vector<int8_t> int8(encoded.size());
+      std::vector<int16_t> int16(encoded.size());
+      for (int j = 0; j < encoded.size(); j++) {
+        const double y = (encoded[j] == '0' ? 1 : -1) + noise(*rng);
+        hard[j] = y < 0 ? '1' : '0';
+        int8[j] = std::max(-127L, std::min(127L, std::lround(y * 32)));
+        int16[j] = std::max(-32767L, std::min(32767L, std::lround(y * 4096)));
+      }
+
+      messages_.push_back(message);
+      total_message_bits_ += message.size();
+      if (type == kHardSymbols) {
+        hard_.push_back(hard);
+      } else if (type == kInt8Symbols) {
+        int8_.push_back(int8);
+      } else {
+        int16_.push_back(int16);
+      }
+    }
+  }
+
+  int size() const { return messages_.size(); }
+
+  const std::string& message(int i) const { return messages_[i]; }
+
+  long total_message_bits() const { return total_message_bits_; }
+
+  std::string Decode(const ViterbiCodec& codec, int i) const {
+    if (type_ == kHardSymbols) {
+      return codec.Decode(hard_[i]);
+    } else if (type_ == kInt8Symbols) {
+      return codec.Decode(int8_[i].data(), int8_[i].size());
+    }
+    return codec.Decode(int16_[i].data(), int16_[i].size());
+  }
+
+  void Feed(int i, ViterbiStreamDecoder* decoder, std::string* decoded) const {
+    if (type_ == kHardSymbols) {
+      decoder->Feed(hard_[i], decoded);
+    } else if (type_ == kInt8Symbols) {
+      decoder->Feed(int8_[i].data(), int8_[i].size(), decoded);
+    } else {
+      decoder->Feed(int16_[i].data(), int16_[i].size(), decoded);
+    }
+  }
+
+  long CountErrors(const ViterbiCodec& codec) const {
+    long errors = 0;
+    for (int i = 0; i < size(); i++) {
+      errors += CountBitErrors(Decode(codec, i), messages_[i]);
+    }
+    return errors;
+  }
+
+  static long CountBitErrors(const std::string& decoded,
+                             const std::string& message) {
+    long errors = std::max(decoded.size(), message.size()) -
+                  std::min(decoded.size(), message.size());
+    for (size_t i = 0; i < std::min(decoded.size(), message.size()); i++) {
+      errors += decoded[i] != message[i];
+    }
+    return errors;
+  }
+
+ private:
+  const SymbolType type_;
+  std::vector<std::string> messages_;
+  std::vector<std::string> hard_;
+  std::vector<std::vector<int8_t> > int8_;
+  std::vector<std::vector<int16_t> > int16_;
+  long total_message_bits_;
+};
+
+ViterbiOptions ForcedOptions(const AcsConfig& config) {
+  ViterbiOptions options;
+  options.engine = config.engine;
+  options.metric_bits = config.metric_bits;
+  return options;
+}
+
+// Decodes all frames repeatedly, on num_threads threads, for at least
+// min_seconds. Returns decoded message bits per second.
+double MeasureThroughput(const ViterbiCodec& codec,
+                         const Frames& frames,
+                         int num_threads,
+                         double min_seconds) {
+  const Clock::time_point start = Clock::now();
+  long decoded_bits = 0;
+  double elapsed;
+  do {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.push_back(std::thread([&codec, &frames, num_threads, t]() {
+        for (int i = t; i < frames.size(); i += num_threads) {
+          frames.Decode(codec, i);
+        }
+      }));
+    }
+    for (int t = 0; t < num_threads; t++) {
+      threads[t].join();
+    }
+    decoded_bits += frames.total_message_bits();
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  } while (elapsed < min_seconds);
+  return decoded_bits / elapsed;
+}
+
+long AllowedErrors(long reference_errors, double tolerance) {
+  return reference_errors + (long) (reference_errors * tolerance);
+}
+
+// Returns the shallowest traceback depth, in multiples of the constraint, at
+// which a ViterbiStreamDecoder with config decodes a simulated stream within
+// the tolerance of whole-frame decoding.
+int TuneTracebackDepth(const ViterbiCodec& reference,
+                       const AcsConfig& config,
+                       const TunerOptions& options,
+                       std::mt19937* rng,
+                       std::ostream* log) {
+  const int constraint = reference.constraint();
+  const Frames stream(reference, options.symbol_type, 1, options.message_bits,
+                      options.ebn0_db, rng);
+  const long allowed =
+      AllowedErrors(stream.CountErrors(reference), options.tolerance);
+  const ViterbiCodec codec(constraint, reference.polynomials(),
+                           ForcedOptions(config));
+  const int max_depth = 10 * constraint;
+  for (int depth = 2 * constraint; depth < max_depth; depth += constraint) {
+    ViterbiStreamDecoder decoder(codec, depth);
+    std::string decoded;
+    stream.Feed(0, &decoder, &decoded);
+    decoder.Finish(&decoded);
+    const long errors = Frames::CountBitErrors(decoded, stream.message(0));
+    if (log) {
+      *log << "traceback depth " << depth << ": " << errors
+           << " bit errors, at most " << allowed << " allowed" << std::endl;
+    }
+    if (errors <= allowed) {
+      return depth;
+    }
+  }
+  return max_depth;
+}
+
+}  // namespace
+
+std::vector<ViterbiTuning> TuneCode(int constraint,
+                                    const std::vector<int>& polynomials,
+                                    const TunerOptions& options,
+                                    std::ostream* log) {
+  std::mt19937 rng(options.seed);
+  const AcsConfig scalar = {kScalarEngine, 32};
+  const ViterbiCodec reference(constraint, polynomials, ForcedOptions(scalar));
+
+  static const ViterbiEngine kEngines[] = {kScalarEngine, kSse2Engine,
+                                           kAvx2Engine};
+  std::vector<AcsConfig> candidates;
+  for (int i = 0; i < 3; i++) {
+    for (int metric_bits = 16; metric_bits <= 32; metric_bits += 16) {
+      const AcsConfig config = {kEngines[i], metric_bits};
+      if (reference.SupportsEngine(config)) {
+        candidates.push_back(config);
+      }
+    }
+  }
+  const int max_threads =
+      options.max_threads > 0
+          ? options.max_threads
+          : std::max(1, (int) std::thread::hardware_concurrency());
+
+  std::vector<ViterbiTuning> entries;
+  for (int f = 0; f < options.frame_bits.size(); f++) {
+    const size_t frame_bits = options.frame_bits[f];
+    const int message_bits =
+        std::max(1, (int) (frame_bits / polynomials.size()) - constraint + 1);
+    const int num_frames = std::max(1, options.message_bits / message_bits);
+    const Frames frames(reference, options.symbol_type, num_frames,
+                        message_bits, options.ebn0_db, &rng);
+    const long allowed =
+        AllowedErrors(frames.CountErrors(reference), options.tolerance);
+
+    AcsConfig best = scalar;
+    double best_rate = 0;
+    for (int i = 0; i < candidates.size(); i++) {
+      const ViterbiCodec codec(constraint, polynomials,
+                               ForcedOptions(candidates[i]));
+      const long errors = frames.CountErrors(codec);
+      if (log) {
+        *log << frame_bits << " " << SymbolTypeName(options.symbol_type)
+             << " symbols, " << EngineName(candidates[i].engine) << "/"
+             << candidates[i].metric_bits << ": " << errors << " bit errors";
+      }
+      if (errors > allowed) {
+        if (log) {
+          *log << ", more than " << allowed << " allowed" << std::endl;
+        }
+        continue;
+      }
+      const double rate =
+          MeasureThroughput(codec, frames, 1, options.min_seconds);
+      if (log) {
+        *log << ", " << rate / 1e6 << " Mbit/s" << std::endl;
+      }
+      if (rate > best_rate) {
+        best = candidates[i];
+        best_rate = rate;
+      }
+    }
+
+    int best_threads = 1;
+    if (max_threads > 1) {
+      const ViterbiCodec codec(constraint, polynomials, ForcedOptions(best));
+      std::vector<double> rates(max_threads + 1);
+      for (int threads = 1; threads <= max_threads; threads++) {
+        rates[threads] =
+            MeasureThroughput(codec, frames, threads, options.min_seconds);
+        if (log) {
+          *log << frame_bits << " " << SymbolTypeName(options.symbol_type)
+               << " symbols, " << threads << " threads: "
+               << rates[threads] / 1e6 << " Mbit/s" << std::endl;
+        }
+      }
+      const double fastest = *std::max_element(rates.begin(), rates.end());
+      while (rates[best_threads] < 0.95 * fastest) {
+        best_threads++;
+      }
+    }
+
+    ViterbiTuning entry;
+    entry.cpu = TuningCpuName();
+    entry.constraint = constraint;
+    entry.polynomials = polynomials;
+    entry.symbol_type = options.symbol_type;
+    entry.max_frame_bits = frame_bits;
+    entry.acs = best;
+    entry.traceback_depth = 0;
+    entry.num_threads = best_threads;
+    entries.push_back(entry);
+  }
+
+  // Streams are decoded like the largest frames.
+  if (!entries.empty()) {
+    AcsConfig stream_config = entries.front().acs;
+    size_t largest = 0;
+    for (int i = 0; i < entries.size(); i++) {
+      if (entries[i].max_frame_bits >= largest) {
+        largest = entries[i].max_frame_bits;
+        stream_config = entries[i].acs;
+      }
+    }
+    const int depth =
+        TuneTracebackDepth(reference, stream_config, options, &rng, log);
+    for (int i = 0; i < entries.size(); i++) {
+      entries[i].traceback_depth = depth;
+    }
+  }
+  return entries;
+}
@@ -0,0 +1,51 @@
+// Auto-tuning: measures which decoder configuration is fastest for a code on
+// this machine, among those which decode simulated noisy frames about as well
+// as the scalar engine.
+
+#ifndef VITERBI_TUNER_H_
+#define VITERBI_TUNER_H_
+
+#include <stddef.h>
+
+#include <ostream>
+#include <vector>
+
+#include "viterbi_tuning.h"
+
+struct TunerOptions {
+  TunerOptions()
+      : symbol_type(kInt8Symbols),
+        ebn0_db(3.0),
+        tolerance(0.05),
+        min_seconds(0.2),
+        max_threads(0),
+        message_bits(1 << 16),
+        seed(1) {}
+
+  SymbolType symbol_type;
+  // Received symbols per frame to tune for. One tuning entry is made for each.
+  std::vector<size_t> frame_bits;
+  // Signal to noise ratio per message bit of the simulated channel, in dB.
+  double ebn0_db;
+  // Largest allowed relative increase in bit errors over the scalar engine.
+  double tolerance;
+  // Time to measure each candidate for.
+  double min_seconds;
+  // Most threads to try. 0 for all hardware threads.
+  int max_threads;
+  // Message bits to simulate for each frame size.
+  int message_bits;
+  unsigned int seed;
+};
+
+// Tunes the code for each frame size of options: picks the fastest engine and
+// metric width whose bit errors stay within the tolerance, the fewest threads
+// within 5% of the best throughput, and the shallowest traceback depth of
+// ViterbiStreamDecoder within the tolerance. Reports each measurement to *log
+// if it is not NULL.
+std::vector<ViterbiTuning> TuneCode(int constraint,
+                                    const std::vector<int>& polynomials,
+                                    const TunerOptions& options,
+                                    std::ostream* log);
+
+#endif  // VITERBI_TUNER_H_
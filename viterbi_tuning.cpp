@@ -0,0 +1,264 @@
+// Implementation of the tuning file.
+
+#include "viterbi_tuning.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define VITERBI_TUNING_CPUID
+#endif
+
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char* const kEngineNames[] = {"auto", "scalar", "sse2", "avx2"};
+const char* const kSymbolTypeNames[] = {"bits", "int8", "int16"};
+
+const char kTuningFileHeader[] =
+    "# Viterbi decoder tuning, written by viterbi_tune.\n"
+    "# cpu constraint polynomials symbols max_frame_bits engine metric_bits"
+    " traceback_depth threads\n";
+
+bool ParsePolynomials(const std::string& text, std::vector<int>* polynomials) {
+  std::istringstream in(text);
+  std::string item;
+  polynomials->clear();
+  while (std::getline(in, item, ',')) {
+    char* end;
+    const long polynomial = std::strtol(item.c_str(), &end, 10);
+    if (item.empty() || *end != '\0' || polynomial <= 0) {
+      return false;
+    }
+    polynomials->push_back(polynomial);
+  }
+  return !polynomials->empty();
+}
+
+bool ParseEntry(const std::string& line, ViterbiTuning* entry) {
+  std::istringstream in(line);
+  std::string polynomials;
+  std::string symbol_type;
+  std::string engine;
+  if (!(in >> entry->cpu >> entry->constraint >> polynomials >> symbol_type >>
+        entry->max_frame_bits >> engine >> entry->acs.metric_bits >>
+        entry->traceback_depth >> entry->num_threads)) {
+    return false;
+  }
+  std::string rest;
+  return !(in >> rest) && ParsePolynomials(polynomials, &entry->polynomials) &&
+         ParseSymbolType(symbol_type, &entry->symbol_type) &&
+         ParseEngine(engine, &entry->acs.engine) &&
+         entry->acs.engine != kAutoEngine &&
+         (entry->acs.metric_bits == 16 || entry->acs.metric_bits == 32) &&
+         entry->traceback_depth >= entry->constraint - 1 &&
+         entry->num_threads > 0;
+}
+
+bool SameKey(const ViterbiTuning& a, const ViterbiTuning& b) {
+  return a.cpu == b.cpu && a.constraint == b.constraint &&
+         a.polynomials == b.polynomials && a.symbol_type == b.symbol_type &&
+         a.max_frame_bits == b.max_frame_bits;
+}
+
+}  // namespace
+
+const char* EngineName(ViterbiEngine engine) {
+  return kEngineNames[engine];
+}
+
+bool ParseEngine(const std::string& name, ViterbiEngine* engine) {
+  for (int i = 0; i < 4; i++) {
+    if (name == kEngineNames[i]) {
+      *engine = static_cast<ViterbiEngine>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* SymbolTypeName(SymbolType type) {
+  return kSymbolTypeNames[type];
+}
+
+bool ParseSymbolType(const std::string& name, SymbolType* type) {
+  for (int i = 0; i < 3; i++) {
+    if (name == kSymbolTypeNames[i]) {
+      *type = static_cast<SymbolType>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+int MaxSymbolCost(SymbolType type) {
+  switch (type) {
+    case kHardSymbols:
+      return 1;
+    case kInt8Symbols:
+      return 128;
+    case kInt16Symbols:
+      return 32768;
+  }
+  return 32768;
+}
+
+std::string TuningCpuName() {
+  std::string name;
+#ifdef VITERBI_TUNING_CPUID
+  unsigned int regs[12];
+  if (__get_cpuid(0x80000000, &regs[0], &regs[1], &regs[2], &regs[3]) &&
+      regs[0] >= 0x80000004) {
+    for (unsigned int leaf = 0; leaf < 3; leaf++) {
+      __get_cpuid(0x80000002 + leaf, &regs[4 * leaf], &regs[4 * leaf + 1],
+                  &regs[4 * leaf + 2], &regs[4 * leaf + 3]);
+    }
+    name.assign(reinterpret_cast<const char*>(regs),
+                strnlen(reinterpret_cast<const char*>(regs), sizeof(regs)));
+  }
+#endif
+
+  // Trim, and join words with '_' so the name is one field of the file.
+  std::istringstream in(name);
+  std::string word;
+  std::string cpu;
+  while (in >> word) {
+    if (!cpu.empty()) {
+      cpu += '_';
+    }
+    cpu += word;
+  }
+  return cpu.empty() ? "unknown" : cpu;
+}
+
+std::string DefaultTuningFile() {
+  const char* path = std::getenv("VITERBI_TUNING_FILE");
+  return path ? path : "";
+}
+
+bool ReadTuningFile(const std::string& path,
+                    std::vector<ViterbiTuning>* entries,
+                    std::string* error) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    *error = "cannot open " + path;
+    return false;
+  }
+  entries->clear();
+  std::string line;
+  for (int line_number = 1; std::getline(in, line); line_number++) {
+    const size_t begin = line.find_first_not_of(" \t");
+    if (begin == std::string::npos || line[begin] == '#') {
+      continue;
+    }
+    ViterbiTuning entry;
+    if (!ParseEntry(line, &entry)) {
+      std::ostringstream message;
+      message << path << ":" << line_number << ": malformed tuning entry";
+      *error = message.str();
+      return false;
+    }
+    entries->push_back(entry);
+  }
+  return true;
+}
+
+std::shared_ptr<const std::vector<ViterbiTuning> > LoadTuningFile(
+    const std::string& path) {
+  // A file rewritten by viterbi_tune changes size or modification time.
+  struct CachedFile {
+    int64_t size;
+    int64_t mtime_ns;
+    std::shared_ptr<const std::vector<ViterbiTuning> > entries;
+  };
+  static std::mutex mutex;
+  static std::map<std::string, CachedFile> cache;
+
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return NULL;
+  }
+  const int64_t mtime_ns =
+      (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  std::lock_guard<std::mutex> lock(mutex);
+  CachedFile& cached = cache[path];
+  if (!cached.entries || cached.size != st.st_size ||
+      cached.mtime_ns != mtime_ns) {
+    std::shared_ptr<std::vector<ViterbiTuning> > entries(
+        new std::vector<ViterbiTuning>());
+    std::string error;
+    if (!ReadTuningFile(path, entries.get(), &error)) {
+      cache.erase(path);
+      return NULL;
+    }
+    cached.size = st.st_size;
+    cached.mtime_ns = mtime_ns;
+    cached.entries = entries;
+  }
+  return cached.entries;
+}
+
+bool WriteTuningFile(const std::string& path,
+                     const std::vector<ViterbiTuning>& entries,
+                     std::string* error) {
+  std::ofstream out(path.c_str());
+  out << kTuningFileHeader;
+  for (int i = 0; i < entries.size(); i++) {
+    const ViterbiTuning& entry = entries[i];
+    out << entry.cpu << " " << entry.constraint << " ";
+    for (int j = 0; j < entry.polynomials.size(); j++) {
+      out << (j > 0 ? "," : "") << entry.polynomials[j];
+    }
+    out << " " << SymbolTypeName(entry.symbol_type) << " "
+        << entry.max_frame_bits << " " << EngineName(entry.acs.engine) << " "
+        << entry.acs.metric_bits << " " << entry.traceback_depth << " "
+        << entry.num_threads << "\n";
+  }
+  out.close();
+  if (!out) {
+    *error = "cannot write " + path;
+    return false;
+  }
+  return true;
+}
+
+void MergeTuning(const ViterbiTuning& entry,
+                 std::vector<ViterbiTuning>* entries) {
+  for (int i = 0; i < entries->size(); i++) {
+    if (SameKey((*entries)[i], entry)) {
+      (*entries)[i] = entry;
+      return;
+    }
+  }
+  entries->push_back(entry);
+}
+
+const ViterbiTuning* FindTuning(const std::vector<ViterbiTuning>& entries,
+                                SymbolType type,
+                                size_t num_symbols) {
+  const ViterbiTuning* covering = NULL;
+  const ViterbiTuning* largest = NULL;
+  for (int i = 0; i < entries.size(); i++) {
+    const ViterbiTuning& entry = entries[i];
+    if (entry.symbol_type != type) {
+      continue;
+    }
+    if (entry.max_frame_bits >= num_symbols &&
+        (covering == NULL || entry.max_frame_bits < covering->max_frame_bits)) {
+      covering = &entry;
+    }
+    if (largest == NULL || entry.max_frame_bits > largest->max_frame_bits) {
+      largest = &entry;
+    }
+  }
+  return covering ? covering : largest;
+}
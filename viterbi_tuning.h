@@ -0,0 +1,105 @@
+// Decoder engines and the tuning file which chooses between them.
+//
+// viterbi_tune measures which engine is fastest on this machine for a code,
+// symbol type and frame size, and records the winners in a tuning file. A
+// ViterbiCodec loads the entries for its code and CPU at construction, from
+// the file named by $VITERBI_TUNING_FILE unless told otherwise.
+
+#ifndef VITERBI_TUNING_H_
+#define VITERBI_TUNING_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Implementations of the add-compare-select step, the inner loop of the
+// decoder. They all decide exactly like kScalarEngine, except that 16-bit
+// path metrics may have to coarsen large soft symbols, see
+// ViterbiCodec::ChooseEngine().
+enum ViterbiEngine {
+  kAutoEngine,    // Chosen by the codec for each frame.
+  kScalarEngine,  // One state at a time. 32-bit metrics only.
+  kSse2Engine,    // 8 states per instruction with 16-bit metrics, 4 with 32.
+  kAvx2Engine,    // 16 states per instruction with 16-bit metrics, 8 with 32.
+};
+
+// Kinds of received symbols. They bound the cost of a symbol, which is what
+// metric width they need.
+enum SymbolType {
+  kHardSymbols,   // '0' and '1'.
+  kInt8Symbols,   // int8_t log-likelihood ratios.
+  kInt16Symbols,  // int16_t log-likelihood ratios.
+};
+
+// How to run the add-compare-select step.
+struct AcsConfig {
+  ViterbiEngine engine;
+  int metric_bits;  // 16 or 32.
+};
+
+// The tuned configuration of one code on one CPU, for frames of one symbol
+// type and up to max_frame_bits received symbols.
+struct ViterbiTuning {
+  std::string cpu;
+  int constraint;
+  std::vector<int> polynomials;
+  SymbolType symbol_type;
+  size_t max_frame_bits;
+  AcsConfig acs;
+  // For ViterbiStreamDecoder.
+  int traceback_depth;
+  // Threads worth decoding frames of this code with.
+  int num_threads;
+};
+
+// "auto", "scalar", "sse2" or "avx2".
+const char* EngineName(ViterbiEngine engine);
+bool ParseEngine(const std::string& name, ViterbiEngine* engine);
+
+// "bits", "int8" or "int16", like the --input_format flag of viterbi_main.
+const char* SymbolTypeName(SymbolType type);
+bool ParseSymbolType(const std::string& name, SymbolType* type);
+
+// Largest cost of one received symbol of the given type.
+int MaxSymbolCost(SymbolType type);
+
+// Identifies this machine's CPU in tuning files: its model name with blanks
+// replaced by '_'.
+std::string TuningCpuName();
+
+// $VITERBI_TUNING_FILE, or empty if unset.
+std::string DefaultTuningFile();
+
+// Reads all entries of a tuning file. Returns false and sets *error if it
+// cannot be read or is malformed.
+bool ReadTuningFile(const std::string& path,
+                    std::vector<ViterbiTuning>* entries,
+                    std::string* error);
+
+// Same as ReadTuningFile(), but each version of a file is parsed once per
+// process and shared, as every ViterbiCodec loads it. Returns NULL if the
+// file cannot be read or is malformed.
+std::shared_ptr<const std::vector<ViterbiTuning> > LoadTuningFile(
+    const std::string& path);
+
+// Writes entries to a tuning file, replacing its contents.
+bool WriteTuningFile(const std::string& path,
+                     const std::vector<ViterbiTuning>& entries,
+                     std::string* error);
+
+// Adds entry to entries, replacing any entry for the same CPU, code, symbol
+// type and frame size.
+void MergeTuning(const ViterbiTuning& entry,
+                 std::vector<ViterbiTuning>* entries);
+
+// Returns the entry of the given symbol type which covers frames of
+// num_symbols received symbols: the one with the smallest max_frame_bits not
+// below num_symbols, else the one with the largest. Returns NULL if there is
+// no entry of that type.
+const ViterbiTuning* FindTuning(const std::vector<ViterbiTuning>& entries,
+                                SymbolType type,
+                                size_t num_symbols);
+
+#endif  // VITERBI_TUNING_H_